@@ -0,0 +1,74 @@
+# Time [$shp coordinates read] with and without worker threads on a synthetic
+# arc shapefile of SIZE/8 megabytes. (Coordinate lists take several times more
+# memory than the coordinates they are decoded from.)
+# Usage: coordinates.bench.tcl ?SIZE? ?DIRECTORY?
+
+package require Tcl 8.5
+lappend auto_path [file join [file dirname [info script]] ..]
+package require shapetcl
+
+set size [expr {[llength $argv] > 0 ? [lindex $argv 0] : 256}]
+set dir [expr {[llength $argv] > 1 ? [lindex $argv 1] : [file join [file dirname [info script]] tmp]}]
+file mkdir $dir
+set base [file join $dir coordinates]
+set size [expr {max(1, $size / 8)}]
+
+# Each record is a single-part arc with this many vertices.
+set vertexCount 500
+set contentLength [expr {44 + 4 + 16 * $vertexCount}]
+set recordCount [expr {max(1, ($size * 1048576) / (8 + $contentLength))}]
+
+# Write the .shp file. Records differ only in their record numbers.
+set vertices {}
+for {set i 0} {$i < $vertexCount} {incr i} {
+	lappend vertices [expr {$i * 0.001}] [expr {sin($i * 0.01)}]
+}
+set content [binary format iq4iiia*q* 3 {0.0 -1.0 0.499 1.0} 1 $vertexCount 0 {} $vertices]
+set shpLength [expr {100 + $recordCount * (8 + $contentLength)}]
+set bounds [binary format q8 {0.0 -1.0 0.499 1.0 0.0 0.0 0.0 0.0}]
+set header [binary format IIIIIIIii 9994 0 0 0 0 0 [expr {$shpLength / 2}] 1000 3]$bounds
+
+set f [open $base.shp wb]
+puts -nonewline $f $header
+for {set i 1} {$i <= $recordCount} {incr i} {
+	puts -nonewline $f [binary format II $i [expr {$contentLength / 2}]]$content
+}
+close $f
+
+# Write the .dbf file, with one integer field per record.
+set f [open $base.dbf wb]
+puts -nonewline $f [binary format ccccisSa20 3 113 1 1 $recordCount 65 11 {}]
+puts -nonewline $f [binary format a11aa4cca14 ID N {} 10 0 {}]
+puts -nonewline $f \r
+set record [format " %10d" 0]
+for {set i 0} {$i < $recordCount} {incr i} {
+	puts -nonewline $f $record
+}
+puts -nonewline $f \x1a
+close $f
+
+proc report {label microseconds bytes} {
+	set seconds [expr {$microseconds / 1e6}]
+	puts [format "%-32s %10.3f s %10.1f MB/s" $label $seconds \
+			[expr {$seconds > 0 ? $bytes / 1048576.0 / $seconds : 0}]]
+}
+
+puts [format "%d records, %.1f MB .shp" $recordCount [expr {$shpLength / 1048576.0}]]
+
+::shapetcl::rebuildIndex $base
+set shp [::shapetcl::shapefile $base readonly]
+
+# read once first so every timed read finds the file in the page cache
+$shp coordinates read -threads 1
+
+set t [lindex [time {$shp coordinates read}] 0]
+report "coordinates read" $t $shpLength
+
+foreach threads {1 2 4 8 16} {
+	set t [lindex [time {$shp coordinates read -threads $threads}] 0]
+	report "coordinates read -threads $threads" $t $shpLength
+}
+
+$shp close
+file delete $base.shp $base.shx $base.dbf
+catch {file delete $dir}
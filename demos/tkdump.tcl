@@ -11,15 +11,8 @@ if {$argc != 1} {
 	exit 1
 }
 
-# transform presumed global geographic coords to window coords
-proc Reproject {x y} {
-	set px [expr {($x + 180) * 3.0}]
-	set py [expr {(90 - $y) * 3.0}]
-	# Mollweide Projection
-	#set px [expr {540 + (180 * (2.0 * sqrt(2.0) * ($x * 0.01745329251) * cos($y * 0.01745329251)) / 3.14159265359)}]
-	#set py [expr {270 - (180 * sqrt(2.0) * sin($y * 0.01745329251))}]
-	return [list $px $py]
-}
+# map presumed global geographic coords to window coords
+set viewport {-180 -90 180 90 1080 540}
 
 # list attribute values for a given feature
 proc Report {shp id} {
@@ -47,15 +40,12 @@ set fcount [$shp info count]
 # add each feature to the canvas
 $shp config getOnlyXyCoordinates 1
 for {set fid 0} {$fid < $fcount} {incr fid} {
-	set feature [$shp coordinates read $fid]
-	foreach part $feature {		
+	set feature [$shp coordinates read $fid -viewport $viewport]
+	foreach coords $feature {
 		
-		# convert part to screen coordinates
-		set coords {}
-		foreach {x y} $part {
-			lassign [Reproject $x $y] mapx mapy
-			lappend coords $mapx $mapy
-			if {$basetype eq "multipoint"} {
+		# parts are already in screen coordinates
+		if {$basetype eq "multipoint"} {
+			foreach {mapx mapy} $coords {
 				.f.c create oval \
 						[expr {$mapx - 3}] [expr {$mapy - 3}] \
 						[expr {$mapx + 3}] [expr {$mapy + 3}] \
@@ -64,7 +54,9 @@ for {set fid 0} {$fid < $fcount} {incr fid} {
 		}
 		
 		# plot this part on canvas (points as circles)
+		# (parts that collapse to a single pixel are too small to draw)
 		if {$basetype eq "polygon"} {
+			if {[llength $coords] < 6} continue
 			.f.c create poly $coords -tags f$fid -fill black -outline {}
 		} elseif {$basetype eq "point"} {
 			.f.c create oval \
@@ -72,6 +64,7 @@ for {set fid 0} {$fid < $fcount} {incr fid} {
 					[expr {[lindex $coords 0] + 3}] [expr {[lindex $coords 1] + 3}] \
 					-tags f$fid -fill black -outline {}
 		} elseif {$basetype eq "arc"} {
+			if {[llength $coords] < 4} continue
 			.f.c create line $coords -tags f$fid -fill black -width 4
 		}
 	}
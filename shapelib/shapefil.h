@@ -278,11 +278,11 @@ typedef	struct
 
     int		nShapeType;				/* SHPT_* */
     
-    unsigned int 	nFileSize;				/* SHP file */
+    SAOffset 	nFileSize;				/* SHP file */
 
     int         nRecords;
     int		nMaxRecords;
-    unsigned int		*panRecOffset;
+    SAOffset		*panRecOffset;
     unsigned int		*panRecSize;
 
     double	adBoundsMin[4];
@@ -292,6 +292,8 @@ typedef	struct
 
     unsigned char *pabyRec;
     int         nBufSize;
+
+    int		bLargeFile;	/* allow .shp files of 4 GB or more */
 } SHPInfo;
 
 typedef SHPInfo * SHPHandle;
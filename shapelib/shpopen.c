@@ -370,7 +370,7 @@ void SHPAPI_CALL SHPWriteHeader( SHPHandle psSHP )
     abyHeader[2] = 0x27;				/* magic cookie */
     abyHeader[3] = 0x0a;
 
-    i32 = psSHP->nFileSize/2;				/* file size */
+    i32 = (int32)(psSHP->nFileSize/2);			/* file size */
     ByteCopy( &i32, abyHeader+24, 4 );
     if( !bBigEndian ) SwapWord( 4, abyHeader+24 );
     
@@ -445,7 +445,7 @@ void SHPAPI_CALL SHPWriteHeader( SHPHandle psSHP )
 
     for( i = 0; i < psSHP->nRecords; i++ )
     {
-        panSHX[i*2  ] = psSHP->panRecOffset[i]/2;
+        panSHX[i*2  ] = (int32)(psSHP->panRecOffset[i]/2);
         panSHX[i*2+1] = psSHP->panRecSize[i]/2;
         if( !bBigEndian ) SwapWord( 4, panSHX+i*2 );
         if( !bBigEndian ) SwapWord( 4, panSHX+i*2+1 );
@@ -689,8 +689,8 @@ SHPOpenLL( const char * pszLayer, const char * pszAccess, SAHooks *psHooks )
 /* -------------------------------------------------------------------- */
     psSHP->nMaxRecords = psSHP->nRecords;
 
-    psSHP->panRecOffset = (unsigned int *)
-        malloc(sizeof(unsigned int) * MAX(1,psSHP->nMaxRecords) );
+    psSHP->panRecOffset = (SAOffset *)
+        malloc(sizeof(SAOffset) * MAX(1,psSHP->nMaxRecords) );
     psSHP->panRecSize = (unsigned int *)
         malloc(sizeof(unsigned int) * MAX(1,psSHP->nMaxRecords) );
     pabyBuf = (uchar *) malloc(8 * MAX(1,psSHP->nRecords) );
@@ -753,7 +753,7 @@ SHPOpenLL( const char * pszLayer, const char * pszAccess, SAHooks *psHooks )
         memcpy( &nLength, pabyBuf + i * 8 + 4, 4 );
         if( !bBigEndian ) SwapWord( 4, &nLength );
 
-        psSHP->panRecOffset[i] = nOffset*2;
+        psSHP->panRecOffset[i] = (SAOffset)(unsigned int)nOffset * 2;
         psSHP->panRecSize[i] = nLength*2;
     }
     free( pabyBuf );
@@ -1182,7 +1182,8 @@ int SHPAPI_CALL
 SHPWriteObject(SHPHandle psSHP, int nShapeId, SHPObject * psObject )
 		      
 {
-    unsigned int	       	nRecordOffset, nRecordSize=0;
+    SAOffset	       	nRecordOffset;
+    unsigned int		nRecordSize=0;
     int i;
     uchar	*pabyRec;
     int32	i32;
@@ -1214,8 +1215,8 @@ SHPWriteObject(SHPHandle psSHP, int nShapeId, SHPObject * psObject )
     {
         psSHP->nMaxRecords =(int) ( psSHP->nMaxRecords * 1.3 + 100);
 
-        psSHP->panRecOffset = (unsigned int *) 
-            SfRealloc(psSHP->panRecOffset,sizeof(unsigned int) * psSHP->nMaxRecords );
+        psSHP->panRecOffset = (SAOffset *) 
+            SfRealloc(psSHP->panRecOffset,sizeof(SAOffset) * psSHP->nMaxRecords );
         psSHP->panRecSize = (unsigned int *) 
             SfRealloc(psSHP->panRecSize,sizeof(unsigned int) * psSHP->nMaxRecords );
     }
@@ -1467,13 +1468,13 @@ SHPWriteObject(SHPHandle psSHP, int nShapeId, SHPObject * psObject )
 /* -------------------------------------------------------------------- */
     if( nShapeId == -1 || psSHP->panRecSize[nShapeId] < nRecordSize-8 )
     {
-        unsigned int nExpectedSize = psSHP->nFileSize + nRecordSize;
-        if( nExpectedSize < psSHP->nFileSize ) // due to unsigned int overflow
+        SAOffset nExpectedSize = psSHP->nFileSize + nRecordSize;
+        if( !psSHP->bLargeFile && nExpectedSize > 0xFFFFFFFFU ) // 32-bit offsets
         {
             char str[128];
             sprintf( str, "Failed to write shape object. "
-                     "File size cannot reach %u + %u.",
-                     psSHP->nFileSize, nRecordSize );
+                     "File size cannot reach %lu + %u.",
+                     (unsigned long) psSHP->nFileSize, nRecordSize );
             psSHP->sHooks.Error( str );
             free( pabyRec );
             return -1;
@@ -1627,8 +1628,8 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
          */
         char str[128];
         sprintf( str,
-                 "Error in fseek() reading object from .shp file at offset %u",
-                 psSHP->panRecOffset[hEntity]);
+                 "Error in fseek() reading object from .shp file at offset %lu",
+                 (unsigned long) psSHP->panRecOffset[hEntity]);
 
         psSHP->sHooks.Error( str );
         return NULL;
@@ -1642,8 +1643,8 @@ SHPReadObject( SHPHandle psSHP, int hEntity )
          */
         char str[128];
         sprintf( str,
-                 "Error in fread() reading object of size %u at offset %u from .shp file",
-                 nEntitySize, psSHP->panRecOffset[hEntity] );
+                 "Error in fread() reading object of size %u at offset %lu from .shp file",
+                 nEntitySize, (unsigned long) psSHP->panRecOffset[hEntity] );
 
         psSHP->sHooks.Error( str );
         return NULL;
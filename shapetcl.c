@@ -1,7 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "shapefil.h"
 #include <tcl.h>
+#ifdef USE_PROJ
+#include <proj.h>
+#endif
 
 enum {
 	BASE_POINT,
@@ -27,6 +36,17 @@ struct shapefile_data {
 	SHPHandle shp;
 	DBFHandle dbf;
 	
+	/* Shared index of shp, if opened with -shared; otherwise NULL */
+	struct shapefile_sharedIndex *shared;
+	
+	/* True while shp holds only the .shp header, if opened with -lazy; the
+	   index is loaded when features are first accessed (see
+	   shapefile_lazyLoad) */
+	int lazy;
+	
+	/* Unfinished [coordinates read -async] jobs, most recent first */
+	struct shapefile_asyncRead *asyncReads;
+	
 	/* Metadata: */
 	
 	/* True if shapefile is readonly; set by [shapefile] on open/create. */
@@ -75,9 +95,80 @@ struct shapefile_data {
 	   allowTruncation and allowAlternateNotation are true, alternate notation
 	   will be attempted before truncating large double values. */
 	int allowTruncation;
+	
+	/* Treat records flagged as deleted in the attribute table as empty. Read
+	   actions return {} for deleted records without decoding them, and search
+	   actions omit them. False by default. */
+	int skipDeleted;
+	
+	/* Approximate number of bytes of decoded features and attribute records
+	   to keep for repeated reads (see shapefile_cacheLookup). 0 (no cache) by
+	   default. */
+	int cacheSize;
+	
+	/* Cache state: bytes used, hit and miss counts, entries by key, and
+	   entries ordered from most to least recently used */
+	int cacheUsed;
+	Tcl_WideInt cacheHits;
+	Tcl_WideInt cacheMisses;
+	Tcl_HashTable cacheTable;
+	struct shapefile_cacheEntry *cacheFirst;
+	struct shapefile_cacheEntry *cacheLast;
+	
+	/* Packed R-tree of feature bounding boxes, built by the first [$shp
+	   spatial] query and discarded when geometry changes; otherwise NULL */
+	struct shapefile_spatialIndex *spatialIndex;
 };
 typedef struct shapefile_data * ShapefilePtr;
 
+/*
+ * ShapefileSharedIndexPtr
+ *
+ * Read-only .shx offset table shared by all handles opened with -shared for
+ * the same shapefile, in any thread. Entries are identified by normalized
+ * .shp path and the sizes and modification times of the .shp and .shx, so a
+ * shapefile that changes on disk gets a new entry. Entries for an index
+ * rewritten by [rebuildIndex] are also unlisted by shapefile_sharedForget,
+ * since modification times may not change. Protected by
+ * SHARED_INDEXES_MUTEX.
+ */
+struct shapefile_sharedIndex {
+	char *key;
+	Tcl_WideInt size;
+	long mtime;
+	Tcl_WideInt shxSize;
+	long shxMtime;
+	int refCount;
+	
+	/* Header values and offset table copied to each handle; files unset */
+	SHPInfo info;
+	
+	struct shapefile_sharedIndex *next;
+};
+typedef struct shapefile_sharedIndex * ShapefileSharedIndexPtr;
+
+/*
+ * ShapefileCacheEntryPtr
+ *
+ * A decoded feature or formatted attribute record held in a shapefile's
+ * cache. Features and records are keyed separately by index; size is the
+ * approximate memory used by the entry.
+ */
+struct shapefile_cacheEntry {
+	Tcl_HashEntry *hashEntry;
+	int size;
+	
+	/* Exactly one of shape (feature entries) or record is set */
+	SHPObject *shape;
+	Tcl_Obj *record;
+	
+	struct shapefile_cacheEntry *prev;
+	struct shapefile_cacheEntry *next;
+};
+typedef struct shapefile_cacheEntry * ShapefileCacheEntryPtr;
+static ShapefileSharedIndexPtr SHARED_INDEXES = NULL;
+TCL_DECLARE_MUTEX(SHARED_INDEXES_MUTEX);
+
 /* 
  * Counter used to generate unique names for the ensemble command identifiers
  * generated by the [shapefile] command. Incremented by [shapefile] after open.
@@ -91,9 +182,534 @@ TCL_DECLARE_MUTEX(COMMAND_COUNT_MUTEX);
  */
 #define NUMERIC_BUFFER_SIZE 64
 
+/*
+ * Size of the buffers used to stream raw records between shapefiles (see
+ * shapefile_rewrite). Large buffers keep reads and writes sequential.
+ */
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * ShapefileBufferPtr
+ *
+ * Buffered access to one shapefile component file (.shp, .shx, or .dbf)
+ * through Shapelib's SAHooks. Output buffers accumulate data until full.
+ * Input buffers read ahead only when requests are sequential, so random
+ * access costs no more than an unbuffered read.
+ */
+struct shapefile_buffer {
+	SAHooks *hooks;
+	SAFile file;
+	unsigned char *data;
+
+	/* Number of valid bytes in data */
+	int length;
+
+	/* Input only: file offset of data, and offset following last request */
+	SAOffset start;
+	SAOffset next;
+};
+typedef struct shapefile_buffer * ShapefileBufferPtr;
+
+/*
+ * Read-ahead parameters of the stream hooks (see shapefile_streamRead). Once
+ * READ_AHEAD_RUN consecutive reads have each started at or shortly after the
+ * end of the previous one, reads are served from READ_AHEAD_SIZE blocks
+ * aligned to READ_AHEAD_ALIGN bytes.
+ */
+#define READ_AHEAD_SIZE (256 * 1024)
+#define READ_AHEAD_ALIGN 4096
+#define READ_AHEAD_RUN 4
+
+/*
+ * ShapefileMemoryFilePtr
+ *
+ * A shapefile component file held in memory, for paths that begin with
+ * MEMORY_PREFIX. Files are registered in MEMORY_FILES by full name and may be
+ * opened by any number of streams, in any thread. A file remains until it is
+ * removed or replaced, or until the last shapefile command using it closes
+ * (see shapefile_memoryRetain); its data is freed once no stream has it open.
+ * Protected by MEMORY_FILES_MUTEX.
+ */
+struct shapefile_memoryFile {
+	/* Registry entry, or NULL once the file is removed or replaced */
+	Tcl_HashEntry *hashEntry;
+	
+	/* File contents: valid and allocated bytes */
+	unsigned char *data;
+	SAOffset size;
+	SAOffset capacity;
+	
+	/* Number of shapefile commands using the file, and of open streams */
+	int refCount;
+	int openCount;
+};
+typedef struct shapefile_memoryFile * ShapefileMemoryFilePtr;
+static Tcl_HashTable MEMORY_FILES;
+static int MEMORY_FILES_INITIALIZED = 0;
+TCL_DECLARE_MUTEX(MEMORY_FILES_MUTEX);
+
+/*
+ * Path prefix of shapefiles held in memory, as in [shapefile mem://roads
+ * arc {...}]. The rest of the path is a name and need not exist on disk.
+ */
+#define MEMORY_PREFIX "mem://"
+
+/*
+ * ShapefileStreamPtr
+ *
+ * File handle of the SAHooks used to open shapefiles (see
+ * shapefile_streamHooks). Shapelib seeks and reads once per record, which
+ * stdio serves with small reads; streams detect sequential scans and read
+ * ahead in large blocks instead. Random access is passed through unchanged.
+ * Streams of memory files (paths beginning with MEMORY_PREFIX) have no file
+ * and copy directly to and from the file's data. Paths outside the native
+ * filesystem, such as files in starkits or other Tcl virtual filesystems,
+ * are opened as Tcl channels instead, and all their reads are served from
+ * read-ahead blocks so that small reads do not each cost a channel call.
+ * Exactly one of file, channel, or memory is set.
+ */
+struct shapefile_stream {
+	FILE *file;
+	Tcl_Channel channel;
+	ShapefileMemoryFilePtr memory;
+	
+	/* Logical position of the next read or write */
+	SAOffset position;
+	
+	/* Read-ahead block: file offset of data, and number of valid bytes */
+	unsigned char *data;
+	SAOffset start;
+	int length;
+	
+	/* Offset following the last read, and length of the current forward run */
+	SAOffset next;
+	int run;
+	
+	/* True once the operating system has been told access is sequential */
+	int advised;
+};
+typedef struct shapefile_stream * ShapefileStreamPtr;
+
+/*
+ * ShapefileOutputPtr
+ *
+ * State of a shapefile being written record by record from raw records of
+ * one or more source shapefiles. Records are copied without being decoded;
+ * only record numbers, index offsets, header bounds, and counts are updated.
+ */
+struct shapefile_output {
+	SAHooks hooks;
+	struct shapefile_buffer shp, shx, dbf;
+	
+	/* Path of the output shapefile, used to remove it if not committed */
+	Tcl_Obj *path;
+
+	/* Read buffers for the current source .shp and .dbf */
+	struct shapefile_buffer shpInput, dbfInput;
+
+	/* Scratch buffer holding the current raw shape record */
+	unsigned char *record;
+	int recordSize;
+
+	int shapeType;
+	int recordCount;
+
+	/* Bytes written to the .shp so far, including the 100 byte header */
+	SAOffset shpSize;
+
+	/* Accumulated XYZM bounds of non-null records */
+	int hasBounds;
+	double min[4], max[4];
+};
+typedef struct shapefile_output * ShapefileOutputPtr;
+
+/*
+ * Number of bits per axis of the grid on which record bounding box centers
+ * are located to compute Hilbert and Morton sort keys (see cmd_sort).
+ */
+#define SORT_GRID_ORDER 16
+
+/*
+ * ShapefileSortKeyPtr
+ *
+ * Sort key of one record, used by [$shp sort]. Only keys are held in memory;
+ * records are copied from the source shapefile in key order afterward.
+ */
+struct shapefile_sortKey {
+	int featureId;
+
+	/* True for null shapes and null attribute values, which sort last */
+	int isNull;
+
+	/* Hilbert or Morton grid index, numeric value, or fixed-width string */
+	unsigned int code;
+	double number;
+	const char *string;
+};
+typedef struct shapefile_sortKey * ShapefileSortKeyPtr;
+
+/*
+ * Number of children of each node of a spatial index (see
+ * shapefile_spatialBuild).
+ */
+#define SPATIAL_NODE_SIZE 16
+
+/*
+ * Upper bound on the number of levels of a spatial index; enough for any
+ * feature count at SPATIAL_NODE_SIZE children per node.
+ */
+#define SPATIAL_MAX_LEVELS 16
+
+/*
+ * ShapefileSpatialIndexPtr
+ *
+ * Packed R-tree of the bounding boxes of a shapefile's non-null features,
+ * used by [$shp spatial]. Leaves are stored first, in Hilbert order of their
+ * box centers, followed by each level of parent nodes; the last node is the
+ * root. Read only once built, so it may be searched from several threads.
+ */
+struct shapefile_spatialIndex {
+	int leafCount;
+	int nodeCount;
+	
+	/* Xmin, Ymin, Xmax, Ymax of each node */
+	double *boxes;
+	
+	/* Feature index of each leaf, or index of the first child of each parent;
+	   a parent's children run to the next parent's first child or the end
+	   of the level below */
+	int *children;
+	
+	/* Index of the first node of each level, leaves first, and of the node
+	   following the root */
+	int levelCount;
+	int levelStart[SPATIAL_MAX_LEVELS + 1];
+};
+typedef struct shapefile_spatialIndex * ShapefileSpatialIndexPtr;
+
+/*
+ * Number of decoded features [$shp spatial locate] keeps between points
+ * before they are discarded.
+ */
+#define SPATIAL_LOCATE_SHAPES 1024
+
+/*
+ * Entry in the queue of a nearest feature search (see cmd_spatial_nearest):
+ * an index node at the distance to its box, or, if node is -1, a feature at
+ * its exact distance.
+ */
+struct shapefile_spatialEntry {
+	double distance;
+	int node;
+	int featureId;
+};
+
+/*
+ * ShapefileJoinRangePtr
+ *
+ * A contiguous range of point features joined to polygons by one worker
+ * thread of [spatialjoin], with its own handles for both shapefiles. The
+ * spatial index and deleted feature flags are shared and read only.
+ */
+struct shapefile_joinRange {
+	SHPHandle points;
+	SHPHandle polygons;
+	ShapefileSpatialIndexPtr index;
+	int within;
+	const char *skipPoints;
+	const char *skipPolygons;
+	int start;
+	int stop;
+	
+	/* Point and polygon index of each pair found */
+	int *pairs;
+	int pairCount;
+	int pairCapacity;
+	
+	/* Feature that could not be read, or -1, and whether it is a polygon */
+	int failedId;
+	int failedPolygon;
+	
+	Tcl_ThreadId threadId;
+	int threaded;
+};
+typedef struct shapefile_joinRange * ShapefileJoinRangePtr;
+
+/*
+ * Built-in projections of [coordinates read|write -project]. Projected
+ * coordinates are in meters on a sphere with the WGS84 semi-major radius.
+ */
+#define PROJECTION_LONLAT 0
+#define PROJECTION_WEBMERCATOR 1
+#define PROJECTION_EQUIRECTANGULAR 2
+#define PROJECTION_MOLLWEIDE 3
+#define PROJECTION_RADIUS 6378137.0
+
+/*
+ * ShapefileProjectionPtr
+ *
+ * A conversion between two projections, named by a {from to} list. Pairs of
+ * built-in projections are converted by shapefile_projectCoords through
+ * longitude and latitude; if Shapetcl is built with USE_PROJ, other pairs
+ * are converted by a PROJ transformation object. Names point into the list
+ * from which the projection was parsed.
+ */
+struct shapefile_projection {
+	const char *fromName;
+	const char *toName;
+	int from;
+	int to;
+#ifdef USE_PROJ
+	PJ *transform;
+#endif
+};
+typedef struct shapefile_projection * ShapefileProjectionPtr;
+
+/*
+ * ShapefileClipOutputPtr
+ *
+ * Growable vertex and part arrays for [coordinates read -clip]. Each vertex
+ * is stored as four consecutive x, y, z, and m values, so that intersection
+ * points can interpolate all of them at once.
+ */
+struct shapefile_clipOutput {
+	double *vertices;
+	int vertexCount;
+	int vertexCapacity;
+	int *partStarts;
+	int partCount;
+	int partCapacity;
+};
+typedef struct shapefile_clipOutput * ShapefileClipOutputPtr;
+
+/*
+ * Issues reported by [$shp geometry validate], as bits of the mask returned
+ * by shapefile_validateShape. The order matches the issue names listed by
+ * cmd_geometry.
+ */
+#define ISSUE_NAN 1
+#define ISSUE_DEGENERATE 2
+#define ISSUE_UNCLOSED 4
+#define ISSUE_WINDING 8
+#define ISSUE_INTERSECTION 16
+
+/*
+ * A segment of the edges tested for intersection by shapefile_partsIntersect.
+ * (x1, y1) is the lesser endpoint in x, then y. Segments are numbered by
+ * index within their part so that edges sharing a vertex can be recognized;
+ * closed parts also join their first and last segment. Segments crossed by
+ * the sweep line are kept in a treap ordered from bottom to top.
+ */
+struct shapefile_sweepSegment {
+	double x1, y1, x2, y2;
+	int part;
+	int index;
+	int partSegments;
+	int closed;
+	int left, right, parent;
+	unsigned int priority;
+};
+
+/*
+ * An endpoint of a sweep segment, where it enters or leaves the sweep line.
+ */
+struct shapefile_sweepEvent {
+	double x, y;
+	int segment;
+	int leave;
+};
+
+/*
+ * ShapefileSweepPtr
+ *
+ * State of the sweep line of shapefile_partsIntersect: the segments, the
+ * root of the treap of segments crossing the sweep line, and the event point
+ * at which the sweep line currently stands.
+ */
+struct shapefile_sweep {
+	struct shapefile_sweepSegment *segments;
+	int root;
+	double x, y;
+};
+typedef struct shapefile_sweep * ShapefileSweepPtr;
+
+/*
+ * GeoJSON text is written to the channel of [$shp export geojson] whenever
+ * GEOJSON_FLUSH_SIZE bytes have accumulated, and read by [import geojson]
+ * in blocks of GEOJSON_CHUNK_SIZE characters. Coordinates may be rounded to
+ * at most GEOJSON_MAX_PRECISION decimal places; values whose scaled
+ * magnitude is below GEOJSON_EXACT_LIMIT (2^53) are formatted with integer
+ * arithmetic. Only the first GEOJSON_KEY_SIZE - 1 characters of top-level
+ * member names are kept, to find the features member, and imported text
+ * may nest GEOJSON_MAX_DEPTH deep.
+ */
+#define GEOJSON_FLUSH_SIZE 65536
+#define GEOJSON_CHUNK_SIZE 65536
+#define GEOJSON_MAX_PRECISION 15
+#define GEOJSON_EXACT_LIMIT 9007199254740992.0
+#define GEOJSON_KEY_SIZE 16
+#define GEOJSON_MAX_DEPTH 256
+
+/*
+ * ShapefileJsonPtr
+ *
+ * State of [$shp export geojson]: the output channel, the text not yet
+ * written to it, and the number of decimal places to which coordinates are
+ * rounded, or -1 to write them exactly.
+ */
+struct shapefile_json {
+	Tcl_Channel channel;
+	Tcl_DString text;
+	int precision;
+};
+typedef struct shapefile_json * ShapefileJsonPtr;
+
+/*
+ * ShapefileDecodeRangePtr
+ *
+ * A contiguous range of features decoded by one worker thread of [$shp
+ * coordinates read -threads N]. Each range has its own .shp handle, so
+ * workers never share a file position or record buffer. Decoded shapes are
+ * stored in the shared shapes array by feature index; skipped features are
+ * left NULL. No Tcl objects are touched by worker threads.
+ */
+struct shapefile_decodeRange {
+	SHPHandle shp;
+	SHPObject **shapes;
+	const char *skip;
+	int start;
+	int stop;
+	Tcl_ThreadId threadId;
+	int threaded;
+};
+typedef struct shapefile_decodeRange * ShapefileDecodeRangePtr;
+
+/*
+ * Default number of features passed to each [coordinates read -async]
+ * callback. Smaller chunks reach the callback sooner; larger chunks reduce
+ * per-event overhead.
+ */
+#define ASYNC_CHUNK_SIZE 256
+
+/*
+ * ShapefileAsyncReadPtr
+ *
+ * A [$shp coordinates read -async] job. A background thread reads features
+ * with its own .shp handle and copy of the offset table, and queues chunks
+ * of decoded shapes to the thread that started the job. Owned by that
+ * thread; released with Tcl_EventuallyFree, since a callback may close the
+ * shapefile while its own job is being serviced.
+ */
+struct shapefile_asyncRead {
+	Tcl_Interp *interp;
+	struct shapefile_data *shapefile;
+	Tcl_Obj *command;
+	Tcl_ThreadId owner;
+	Tcl_ThreadId threadId;
+	SHPHandle shp;
+	int featureCount;
+	char *skip;
+	int chunkSize;
+	
+	/* Optional XY bounding box; features that do not intersect it are omitted */
+	int useBounds;
+	double min[2];
+	double max[2];
+	
+	/* Set by the owner to stop the worker; protected by mutex */
+	int cancelled;
+	Tcl_Mutex mutex;
+	
+	struct shapefile_asyncRead *next;
+};
+typedef struct shapefile_asyncRead * ShapefileAsyncReadPtr;
+
+/*
+ * ShapefileAsyncEventPtr
+ *
+ * A chunk of decoded shapes queued from an async read worker to its owner.
+ * The final event of a job is queued after the worker's last read; if a
+ * feature could not be read, failedId is its index (otherwise -1).
+ */
+struct shapefile_asyncEvent {
+	Tcl_Event header;
+	ShapefileAsyncReadPtr job;
+	int count;
+	int *featureIds;
+	SHPObject **shapes;
+	int final;
+	int failedId;
+};
+typedef struct shapefile_asyncEvent * ShapefileAsyncEventPtr;
+
+/*
+ * Default maximum number of shards of a [layer] held open at once (see
+ * shapefile_layerShard). Each open shard uses three file descriptors.
+ */
+#define LAYER_MAX_OPEN 64
+
+/*
+ * ShapefileShardPtr
+ *
+ * One shapefile of a layer opened with [layer open]. Feature count, shape
+ * type, and header bounds are read when the layer is opened; the shapefile
+ * itself is opened only when a feature or record of the shard is accessed.
+ * Open shards are linked from most to least recently used.
+ */
+struct shapefile_shard {
+	char *path;
+	
+	/* Global index of the shard's first feature, and its feature count */
+	int base;
+	int count;
+	
+	/* XYZM bounds from the .shp header */
+	double min[4], max[4];
+	
+	/* Open shapefile, or NULL if the shard is closed */
+	struct shapefile_data *shapefile;
+	struct shapefile_shard *prev;
+	struct shapefile_shard *next;
+};
+typedef struct shapefile_shard * ShapefileShardPtr;
+
+/*
+ * ShapefileLayerPtr
+ *
+ * A set of shapefiles with the same shape type and attribute fields, read
+ * as a single layer. Global feature indices number the features of each
+ * shard in turn. Allocated by [layer open] and passed to layer command
+ * handlers as ClientData.
+ */
+struct shapefile_layer {
+	int shardCount;
+	struct shapefile_shard *shards;
+	int featureCount;
+	int shapeType;
+	int dimType;
+	
+	/* Union of the header bounds of shards that have features */
+	double min[4], max[4];
+	
+	/* Limit and number of open shards, and open shards by recent use */
+	int maxOpen;
+	int openCount;
+	struct shapefile_shard *openFirst;
+	struct shapefile_shard *openLast;
+};
+typedef struct shapefile_layer * ShapefileLayerPtr;
+
 int Shapetcl_Init(Tcl_Interp *interp);
 int shapefile_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 int shapefile_typeSupported(int shpType);
+ShapefilePtr shapefile_new(const char *path, SHPHandle shp, DBFHandle dbf, int readonly, ShapefileSharedIndexPtr sharedIndex);
+SHPHandle shapefile_sharedOpen(const char *path, ShapefileSharedIndexPtr *sharedPtr);
+void shapefile_sharedClose(SHPHandle shp, ShapefileSharedIndexPtr shared);
+void shapefile_sharedForget(const char *path);
+SHPHandle shapefile_cloneHandle(const char *path, const SHPInfo *info);
+SHPHandle shapefile_lazyOpen(const char *path, const char *access);
+int shapefile_largeOffsets(Tcl_Interp *interp, SHPHandle shp, const char *path);
+int shapefile_lazyLoad(Tcl_Interp *interp, ShapefilePtr shapefile);
 int shapefile_typeCode(const char *shpTypeName);
 int shapefile_typeBase(int shpType);
 int shapefile_typeDimension(int shpType);
@@ -109,6 +725,7 @@ int cmd_info(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST
 int cmd_info_count(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 int cmd_info_type(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 int cmd_info_bounds(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_info_deleted(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 
 int cmd_fields(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 int cmd_fields_add(Tcl_Interp *interp, DBFHandle dbf, int validate, Tcl_Obj *definitions, Tcl_Obj *attrList, ShapefilePtr shapefile);
@@ -119,10 +736,88 @@ int cmd_fields_description(Tcl_Interp *interp, ShapefilePtr shapefile, int field
 int cmd_fields_index(Tcl_Interp *interp, ShapefilePtr shapefile, const char *fieldName);
 
 int cmd_coordinates(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
-int cmd_coordinates_write(Tcl_Interp *interp, ShapefilePtr shapefile, int featureId, Tcl_Obj *coordParts);
+int cmd_coordinates_write(Tcl_Interp *interp, ShapefilePtr shapefile, int featureId, Tcl_Obj *coordParts, ShapefileProjectionPtr projection);
 int cmd_coordinates_writeNull(Tcl_Interp *interp, ShapefilePtr shapefile, int featureId);
 int cmd_coordinates_readAll(Tcl_Interp *interp, ShapefilePtr shapefile);
+int cmd_coordinates_readThreads(Tcl_Interp *interp, ShapefilePtr shapefile, int threadCount);
+Tcl_ThreadCreateType cmd_coordinates_decodeRange(ClientData clientData);
+int cmd_coordinates_readAsync(Tcl_Interp *interp, ShapefilePtr shapefile, int objc, Tcl_Obj *CONST objv[]);
+Tcl_ThreadCreateType cmd_coordinates_asyncWorker(ClientData clientData);
+void cmd_coordinates_asyncPost(ShapefileAsyncReadPtr job, int count, int *featureIds, SHPObject **shapes, int final, int failedId);
+int cmd_coordinates_asyncEvent(Tcl_Event *evPtr, int flags);
+int cmd_coordinates_asyncCallback(ShapefileAsyncReadPtr job, Tcl_Obj *featureIds, Tcl_Obj *features);
+int cmd_coordinates_asyncDiscard(Tcl_Event *evPtr, ClientData clientData);
+void cmd_coordinates_asyncFinish(ShapefileAsyncReadPtr job);
+void cmd_coordinates_asyncFree(char *clientData);
+void cmd_coordinates_asyncCancel(ShapefilePtr shapefile);
 int cmd_coordinates_read(Tcl_Interp *interp, ShapefilePtr shapefile, int featureId);
+int cmd_coordinates_shape(Tcl_Interp *interp, ShapefilePtr shapefile, SHPObject *shape);
+int shapefile_isConvertOption(Tcl_Obj *obj);
+int cmd_coordinates_readConverted(Tcl_Interp *interp, ShapefilePtr shapefile, int objc, Tcl_Obj *CONST objv[]);
+void shapefile_transformCoords(double *x, double *y, int count, const double *matrix);
+void shapefile_quantizeShape(SHPObject *shape);
+SHPObject *shapefile_copyShape(const SHPObject *shape);
+int shapefile_projectionParse(Tcl_Interp *interp, Tcl_Obj *spec, ShapefileProjectionPtr projection);
+void shapefile_projectionFree(ShapefileProjectionPtr projection);
+int shapefile_projectCoords(Tcl_Interp *interp, ShapefileProjectionPtr projection, double *x, double *y, int count);
+int shapefile_projectInverse(int from, double *x, double *y, int count);
+int shapefile_projectForward(int to, double *x, double *y, int count);
+SHPObject *shapefile_clipShape(const SHPObject *shape, const double *window);
+void shapefile_clipRing(ShapefileClipOutputPtr output, ShapefileClipOutputPtr ring, ShapefileClipOutputPtr scratch, const double *window);
+void shapefile_clipArc(ShapefileClipOutputPtr output, const double *vertices, int count, const double *window);
+int shapefile_clipOutcode(const double *vertex, const double *window);
+void shapefile_clipIntersect(const double *a, const double *b, int edge, const double *window, double *vertex);
+void shapefile_clipAppend(ShapefileClipOutputPtr output, const double *vertex);
+void shapefile_clipPart(ShapefileClipOutputPtr output);
+void shapefile_clipFree(ShapefileClipOutputPtr output);
+SHPObject *shapefile_simplifyShape(const SHPObject *shape, double tolerance, int method);
+void shapefile_simplifyDp(const double *x, const double *y, int count, double *rank);
+void shapefile_simplifyVw(const double *x, const double *y, int count, double *rank);
+void shapefile_simplifySift(int *heap, int *position, const double *area, int count, int i);
+double shapefile_triangleArea(const double *x, const double *y, int a, int b, int c);
+
+SHPObject *shapefile_readShape(Tcl_Interp *interp, ShapefilePtr shapefile, int featureId, int *release);
+
+int cmd_geometry(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_geometry_repair(Tcl_Interp *interp, ShapefilePtr shapefile, int objc, Tcl_Obj *CONST objv[]);
+double shapefile_shapeArea(const SHPObject *shape);
+double shapefile_shapeLength(const SHPObject *shape);
+int shapefile_shapeCentroid(const SHPObject *shape, double *x, double *y);
+double shapefile_ringArea(const double *x, const double *y, int count, double x0, double y0, double *cx, double *cy);
+double shapefile_pathLength(const double *x, const double *y, int count, double x0, double y0, double *cx, double *cy);
+int shapefile_validateShape(const SHPObject *shape, int checkIntersections);
+int shapefile_ringIsHole(const SHPObject *shape, int part);
+SHPObject *shapefile_repairShape(const SHPObject *shape);
+int shapefile_partsIntersect(const SHPObject *shape, int firstPart, int partCount);
+int shapefile_compareSweepEvent(const void *a, const void *b);
+double shapefile_sweepY(ShapefileSweepPtr sweep, int segment);
+int shapefile_sweepCompare(ShapefileSweepPtr sweep, int a, int b);
+void shapefile_sweepRotate(ShapefileSweepPtr sweep, int node);
+void shapefile_sweepInsert(ShapefileSweepPtr sweep, int segment);
+void shapefile_sweepRemove(ShapefileSweepPtr sweep, int segment);
+int shapefile_sweepNeighbor(ShapefileSweepPtr sweep, int segment, int above);
+int shapefile_sweepIntersect(ShapefileSweepPtr sweep, int a, int b);
+int shapefile_onSegment(const struct shapefile_sweepSegment *segment, double x, double y);
+
+int cmd_spatial(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_spatial_contains(Tcl_Interp *interp, ShapefilePtr shapefile, int objc, Tcl_Obj *CONST objv[]);
+int cmd_spatial_locate(Tcl_Interp *interp, ShapefilePtr shapefile, Tcl_Obj *points);
+SHPObject *shapefile_shapeTableRead(Tcl_HashTable *shapes, SHPHandle shp, int featureId);
+void shapefile_shapeTableClear(Tcl_HashTable *shapes);
+int cmd_spatial_nearest(Tcl_Interp *interp, ShapefilePtr shapefile, int objc, Tcl_Obj *CONST objv[]);
+void shapefile_spatialPush(struct shapefile_spatialEntry **queue, int *count, int *capacity, const struct shapefile_spatialEntry *entry);
+void shapefile_spatialPop(struct shapefile_spatialEntry *queue, int *count, struct shapefile_spatialEntry *entry);
+int shapefile_spatialBefore(const struct shapefile_spatialEntry *a, const struct shapefile_spatialEntry *b);
+double shapefile_boxDistance(const double *box, double x, double y);
+double shapefile_shapeDistance(const SHPObject *shape, double x, double y);
+double shapefile_partsDistance(const SHPObject *shape, double x, double y);
+double shapefile_segmentDistance(double x1, double y1, double x2, double y2, double x, double y);
+ShapefileSpatialIndexPtr shapefile_spatialBuild(Tcl_Interp *interp, ShapefilePtr shapefile);
+void shapefile_spatialFree(ShapefileSpatialIndexPtr index);
+void shapefile_spatialInvalidate(ShapefilePtr shapefile);
+int shapefile_spatialSearch(ShapefileSpatialIndexPtr index, double xmin, double ymin, double xmax, double ymax, int **featureIds, int *capacity);
+int shapefile_pointInShape(const SHPObject *shape, double x, double y);
+int shapefile_compareId(const void *a, const void *b);
 
 int cmd_attributes(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 int cmd_attributes_write(Tcl_Interp *interp, ShapefilePtr shapefile, int recordId, int validate, Tcl_Obj *attrList);
@@ -137,14 +832,128 @@ int cmd_attributes_search(Tcl_Interp *interp, ShapefilePtr shapefile, int fieldI
 
 int cmd_write(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
 
+int cmd_export(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int shapefile_jsonFlush(ShapefileJsonPtr json);
+void shapefile_jsonNumber(ShapefileJsonPtr json, double value, int precision);
+void shapefile_jsonString(ShapefileJsonPtr json, const char *string);
+void shapefile_jsonPosition(ShapefileJsonPtr json, const SHPObject *shape, int vertex, int hasZ);
+void shapefile_jsonPositions(ShapefileJsonPtr json, const SHPObject *shape, int start, int count, int hasZ, int reverse);
+void shapefile_jsonGeometry(ShapefileJsonPtr json, const SHPObject *shape, int hasZ);
+void shapefile_jsonPolygons(ShapefileJsonPtr json, const SHPObject *shape, int hasZ);
+int cmd_save(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_save_component(Tcl_Interp *interp, ShapefilePtr shapefile, const char *extension, const char *outputPath, Tcl_Obj *contents);
+
+int cmd_compact(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_delete(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_sort(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_sort_spatialKeys(Tcl_Interp *interp, ShapefilePtr shapefile, ShapefileSortKeyPtr keys, int featureCount, int hilbert, double *bounds);
+int cmd_sort_fieldKeys(Tcl_Interp *interp, ShapefilePtr shapefile, ShapefileSortKeyPtr keys, int featureCount, int fieldId, char *strings);
+unsigned int shapefile_hilbertCode(unsigned int x, unsigned int y);
+unsigned int shapefile_mortonCode(unsigned int x, unsigned int y);
+int shapefile_compareCode(const void *a, const void *b);
+int shapefile_compareNumber(const void *a, const void *b);
+int shapefile_compareString(const void *a, const void *b);
+int cmd_undelete(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_delete_mark(Tcl_Interp *interp, ShapefilePtr shapefile, Tcl_Obj *featureIdList, int deleted);
+
+ShapefileCacheEntryPtr shapefile_cacheLookup(ShapefilePtr shapefile, int index, int isRecord);
+int shapefile_cacheInsert(ShapefilePtr shapefile, int index, SHPObject *shape, Tcl_Obj *record);
+void shapefile_cacheInvalidate(ShapefilePtr shapefile, int index, int isRecord);
+void shapefile_cacheRemove(ShapefilePtr shapefile, ShapefileCacheEntryPtr entry);
+void shapefile_cacheTrim(ShapefilePtr shapefile, int size);
+
+unsigned int shapefile_getBigInt(const unsigned char *bytes);
+void shapefile_putBigInt(unsigned char *bytes, unsigned int value);
+int shapefile_getLittleInt(const unsigned char *bytes);
+void shapefile_putLittleInt(unsigned char *bytes, int value);
+double shapefile_getLittleDouble(const unsigned char *bytes);
+void shapefile_putLittleDouble(unsigned char *bytes, double value);
+int shapefile_encodeShape(const SHPObject *shape, unsigned char *content);
+int shapefile_recordBounds(const unsigned char *content, int contentLength, double *min, double *max);
+void shapefile_header(unsigned char *header, SAOffset fileSize, int shapeType, const double *min, const double *max);
+Tcl_Obj *shapefile_componentPath(const char *path, const char *extension);
+int shapefile_bufferRead(ShapefileBufferPtr buffer, SAOffset offset, void *data, int size);
+int shapefile_bufferWrite(ShapefileBufferPtr buffer, const void *data, int size);
+int shapefile_bufferFlush(ShapefileBufferPtr buffer);
+void shapefile_bufferRelease(ShapefileBufferPtr buffer);
+void shapefile_streamHooks(SAHooks *hooks);
+SAFile shapefile_streamOpen(const char *filename, const char *access);
+SAOffset shapefile_streamRead(void *p, SAOffset size, SAOffset nmemb, SAFile file);
+int shapefile_streamFill(ShapefileStreamPtr stream, SAOffset offset);
+SAOffset shapefile_streamReadAt(ShapefileStreamPtr stream, SAOffset offset, void *p, SAOffset size);
+SAOffset shapefile_streamWrite(void *p, SAOffset size, SAOffset nmemb, SAFile file);
+SAOffset shapefile_streamSeek(SAFile file, SAOffset offset, int whence);
+SAOffset shapefile_streamTell(SAFile file);
+int shapefile_streamFlush(SAFile file);
+int shapefile_streamClose(SAFile file);
+int shapefile_streamRemove(const char *filename);
+int shapefile_channelPath(const char *path);
+int shapefile_memoryPath(const char *path);
+ShapefileMemoryFilePtr shapefile_memoryOpen(const char *name, const char *access);
+SAOffset shapefile_memoryRead(ShapefileMemoryFilePtr memory, SAOffset offset, void *p, SAOffset size);
+SAOffset shapefile_memoryWrite(ShapefileMemoryFilePtr memory, SAOffset offset, const void *p, SAOffset size);
+SAOffset shapefile_memorySize(ShapefileMemoryFilePtr memory);
+void shapefile_memoryClose(ShapefileMemoryFilePtr memory);
+void shapefile_memoryDetach(ShapefileMemoryFilePtr memory);
+int shapefile_memoryRemove(const char *name);
+int shapefile_memoryRename(const char *source, const char *target);
+void shapefile_memoryRetain(const char *path, int delta);
+ShapefileOutputPtr shapefile_outputOpen(Tcl_Interp *interp, const char *path, int shapeType, DBFHandle dbf);
+void shapefile_outputSource(ShapefileOutputPtr output, SHPHandle shp, DBFHandle dbf);
+int shapefile_outputRecord(Tcl_Interp *interp, ShapefileOutputPtr output, SHPHandle shp, DBFHandle dbf, int featureId);
+int shapefile_outputShape(Tcl_Interp *interp, ShapefileOutputPtr output, DBFHandle dbf, int featureId, const SHPObject *shape);
+int shapefile_outputAppend(Tcl_Interp *interp, ShapefileOutputPtr output, DBFHandle dbf, int featureId, int size);
+int shapefile_outputClose(Tcl_Interp *interp, ShapefileOutputPtr output, int commit);
+int shapefile_rewrite(Tcl_Interp *interp, ShapefilePtr shapefile, const int *featureIds, int featureCount, const char *outputPath, int *repairCount);
+int shapefile_moveFiles(const char *sourceBase, const char *targetBase, int count);
+void shapefile_deleteFiles(const char *base);
+int shapefile_reopen(Tcl_Interp *interp, ShapefilePtr shapefile, int largeFile);
+int shapefile_rebuildIndex_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int shapefile_rebuildIndex(Tcl_Interp *interp, const char *path, int *recordCount);
+int shapefile_concatShapefiles_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int shapefile_schemaMatch(Tcl_Interp *interp, DBFHandle dbf, DBFHandle otherDbf, const char *otherPath);
+int shapefile_samePath(const char *path, const char *otherPath);
+void shapefile_copySidecars(const char *sourcePath, const char *targetPath);
+int shapefile_spatialjoin_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+Tcl_ThreadCreateType shapefile_joinRange(ClientData clientData);
+ShapefilePtr shapefile_command(Tcl_Interp *interp, Tcl_Obj *name);
+int shapefile_import_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int shapefile_jsonParse(const char **cursor, const char *end, int depth, Tcl_Obj **value, const char **error);
+const char *shapefile_jsonSpace(const char *c, const char *end);
+int shapefile_jsonMember(Tcl_Interp *interp, Tcl_Obj *object, const char *name, Tcl_Obj **value);
+int shapefile_importFeature(Tcl_Interp *interp, ShapefilePtr shapefile, Tcl_Obj *name, Tcl_Obj *feature);
+int shapefile_importPositions(Tcl_Interp *interp, ShapefilePtr shapefile, Tcl_Obj *parts, Tcl_Obj **positions, int count);
+
+int shapefile_layer_cmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int shapefile_layerHeader(Tcl_Interp *interp, ShapefileShardPtr shard, int *shapeType);
+ShapefilePtr shapefile_layerShard(Tcl_Interp *interp, ShapefileLayerPtr layer, int shardId);
+void shapefile_layerRelease(ShapefileLayerPtr layer, ShapefileShardPtr shard);
+int shapefile_layerLocate(ShapefileLayerPtr layer, int featureId, int *localId);
+int shapefile_layerAppend(Tcl_Interp *interp, Tcl_Obj *list, int base);
+int cmd_layer_dispatcher(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_layer_close(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+void layer_exit_handler(ClientData clientData);
+void layer_delete_handler(ClientData clientData);
+int cmd_layer_info(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_layer_coordinates(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_layer_attributes(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_layer_locate(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+int cmd_layer_query(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *CONST objv[]);
+
 /*
  * Shapetcl_Init
  * 
  * Invoked by Tcl when the Shapetcl extension is loaded.
  * 
  * Result:
- *   Registers the [shapefile] command used to open or create shapefiles.
- *   (Note: the [shapefile] command is created in the ::shapetcl namespace.)
+ *   Registers the [shapefile] command used to open or create shapefiles, the
+ *   [rebuildIndex] command used to repair shapefile indexes, the
+ *   [concatShapefiles] command used to merge shapefiles, the [layer] command
+ *   used to read many shapefiles as one, the [spatialjoin] command used to
+ *   pair points with the polygons that contain them, and the [import]
+ *   command used to add features read from GeoJSON. (Note: these commands
+ *   are created in the ::shapetcl namespace, and none has the name of a
+ *   builtin command, so all may be imported.)
  */
 int Shapetcl_Init(Tcl_Interp *interp) {
 	
@@ -159,8 +968,18 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 	}
 	
 	(void)Tcl_CreateObjCommand(interp, "::shapetcl::shapefile", (Tcl_ObjCmdProc *)shapefile_cmd, NULL, NULL);
+	(void)Tcl_CreateObjCommand(interp, "::shapetcl::rebuildIndex", (Tcl_ObjCmdProc *)shapefile_rebuildIndex_cmd, NULL, NULL);
+	(void)Tcl_CreateObjCommand(interp, "::shapetcl::concatShapefiles", (Tcl_ObjCmdProc *)shapefile_concatShapefiles_cmd, NULL, NULL);
+	(void)Tcl_CreateObjCommand(interp, "::shapetcl::layer", (Tcl_ObjCmdProc *)shapefile_layer_cmd, NULL, NULL);
+	(void)Tcl_CreateObjCommand(interp, "::shapetcl::spatialjoin", (Tcl_ObjCmdProc *)shapefile_spatialjoin_cmd, NULL, NULL);
+	(void)Tcl_CreateObjCommand(interp, "::shapetcl::import", (Tcl_ObjCmdProc *)shapefile_import_cmd, NULL, NULL);
 	shapetclNamespace = Tcl_FindNamespace(interp, "shapetcl", NULL, TCL_GLOBAL_ONLY);
 	Tcl_Export(interp, shapetclNamespace, "shapefile", 0);
+	Tcl_Export(interp, shapetclNamespace, "rebuildIndex", 0);
+	Tcl_Export(interp, shapetclNamespace, "concatShapefiles", 0);
+	Tcl_Export(interp, shapetclNamespace, "layer", 0);
+	Tcl_Export(interp, shapetclNamespace, "spatialjoin", 0);
+	Tcl_Export(interp, shapetclNamespace, "import", 0);
 	
 	return TCL_OK;
 }
@@ -177,6 +996,31 @@ int Shapetcl_Init(Tcl_Interp *interp) {
  *     Create a shapefile at PATH. TYPE defines feature geometry type. FIELDS
  *     defines initial attribute table format. At least one field is required.
  *     See the [fields] command for details on FIELDSDEFINITION format. 
+ *   A PATH beginning with mem:// names a shapefile held in memory (see
+ *   ShapefileMemoryFilePtr), which lasts while any command has it open.
+ * 
+ * Options:
+ *   Options may follow the arguments when an existing shapefile is opened.
+ *   -shared
+ *     Share one copy of the .shx offset table among all handles opened with
+ *     -shared for the same unmodified shapefile, in any thread. Each handle
+ *     has its own file descriptor and read buffers, so handles in different
+ *     threads can read concurrently. Shared shapefiles must be readonly.
+ *   -lazy
+ *     Read only the .shp header when the shapefile is opened, and load the
+ *     .shx index when features are first accessed. Metadata queries such as
+ *     [info count] and [info bounds] then cost a single small read. May not
+ *     be combined with -shared.
+ *   -largeFile
+ *     Support .shp files of 4 GB or more. The record offsets read from the
+ *     .shx index are replaced by 64-bit offsets recovered by scanning the
+ *     .shp record headers (see shapefile_largeOffsets), and writes may extend
+ *     the .shp past 4 GB. May not be combined with -lazy or -shared.
+ *   -rebuildIndex never|auto|always
+ *     If auto, the .shx index is rebuilt (see [rebuildIndex]) if it is
+ *     missing or cannot be read, or if its record count does not match the
+ *     attribute table. If always, the index is rebuilt before opening. The
+ *     default is never.
  * 
  * Result:
  *   Name of an ensemble command for subsequent operations on the shapefile.
@@ -195,13 +1039,84 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 	int shpType;
 	Tcl_Obj *cmdNameObj;
 	Tcl_Namespace *ns;
+	Tcl_Obj *args[4];
+	int argc, i, optionIndex;
+	int rebuildIndex = 0;
+	int shared = 0, lazy = 0, largeFile = 0;
+	ShapefileSharedIndexPtr sharedIndex = NULL;
+	static const char *optionNames[] = {"-largeFile", "-lazy", "-rebuildIndex", "-shared", NULL};
+	static const char *rebuildNames[] = {"never", "auto", "always", NULL};
+	
+	/* options follow the positional arguments, none of which begin with - */
+	for (argc = 2; argc < objc && Tcl_GetString(objv[argc])[0] != '-'; argc++) {}
+	if (objc < 2 || argc > 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path ?mode?|?type fieldDefinitions? ?-option ...?");
+		return TCL_ERROR;
+	}
+	for (i = 0; i < argc; i++) {
+		args[i] = objv[i];
+	}
 	
-	if (objc < 2 || objc > 4) {
-		Tcl_WrongNumArgs(interp, 1, objv, "path ?mode?|?type fieldDefinitions?");
+	for (i = argc; i < objc; i++) {
+		if (Tcl_GetIndexFromObj(interp, objv[i], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		switch (optionIndex) {
+			case 0: /* -largeFile */
+				largeFile = 1;
+				break;
+			case 1: /* -lazy */
+				lazy = 1;
+				break;
+			case 2: /* -rebuildIndex */
+				if (++i >= objc) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing value for -rebuildIndex option"));
+					return TCL_ERROR;
+				}
+				if (Tcl_GetIndexFromObj(interp, objv[i], rebuildNames, "-rebuildIndex value", TCL_EXACT, &rebuildIndex) != TCL_OK) {
+					return TCL_ERROR;
+				}
+				break;
+			case 3: /* -shared */
+				shared = 1;
+				break;
+		}
+	}
+	if (argc == 4 && objc > argc) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("options are only valid when opening an existing shapefile"));
 		return TCL_ERROR;
 	}
+	objc = argc;
+	objv = args;
 
 	path = Tcl_GetString(objv[1]);
+	
+	if (shared && objc == 3 && strcmp(Tcl_GetString(objv[2]), "readonly") != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("shared shapefiles must be readonly"));
+		return TCL_ERROR;
+	}
+	
+	if (shared && lazy) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("-lazy and -shared options cannot be combined"));
+		return TCL_ERROR;
+	}
+	
+	if (largeFile && (shared || lazy)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("-largeFile option cannot be combined with -lazy or -shared"));
+		return TCL_ERROR;
+	}
+	
+	/* offsets past 4 GB need a 64-bit SAOffset, which is unsigned long and
+	   so only 32 bits on some platforms, such as 64-bit Windows */
+	if (largeFile && sizeof(SAOffset) < 8) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("-largeFile option is not supported on this platform"));
+		return TCL_ERROR;
+	}
+	
+	if ((shared || lazy) && shapefile_memoryPath(path)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("-lazy and -shared options are not supported for memory shapefiles"));
+		return TCL_ERROR;
+	}
 
 	if (objc == 3) {
 		/* opening an existing file, and an access mode is explicitly set */
@@ -218,6 +1133,7 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 	
 	if (objc == 4) {
 		/* create a new file; access must be readwrite. */
+		SAHooks hooks;
 		readonly = 0;
 		
 		if ((shpType = shapefile_typeCode(Tcl_GetString(objv[2]))) == -1) {
@@ -235,7 +1151,8 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 			return TCL_ERROR;
 		}
 		
-		if ((dbf = DBFCreate(path)) == NULL) {
+		shapefile_streamHooks(&hooks);
+		if ((dbf = DBFCreateLL(path, "LDID/87", &hooks)) == NULL) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create attribute table for \"%s\"", path));
 			return TCL_ERROR;
 		}
@@ -246,7 +1163,7 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 			return TCL_ERROR;
 		}
 				
-		if ((shp = SHPCreate(path, shpType)) == NULL) {
+		if ((shp = SHPCreateLL(path, shpType, &hooks)) == NULL) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create shapefile for \"%s\"", path));
 			DBFClose(dbf);
 			return TCL_ERROR;
@@ -256,8 +1173,10 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 		
 		/* open an existing shapefile */
 		int shpCount, dbfCount;
+		SAHooks hooks;
 		
-		if ((dbf = DBFOpen(path, readonly ? "rb" : "rb+")) == NULL) {
+		shapefile_streamHooks(&hooks);
+		if ((dbf = DBFOpenLL(path, readonly ? "rb" : "rb+", &hooks)) == NULL) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open attribute table for \"%s\"", path));
 			return TCL_ERROR;
 		}
@@ -268,18 +1187,55 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 			return TCL_ERROR;
 		}
 		
-		if ((shp = SHPOpen(path, readonly ? "rb" : "rb+")) == NULL) {
+		/* rebuild the index first if requested unconditionally */
+		if (rebuildIndex == 2 && shapefile_rebuildIndex(interp, path, NULL) != TCL_OK) {
+			DBFClose(dbf);
+			return TCL_ERROR;
+		}
+		
+		if (shared) {
+			shp = shapefile_sharedOpen(path, &sharedIndex);
+		} else if (lazy) {
+			shp = shapefile_lazyOpen(path, readonly ? "rb" : "rb+");
+		} else {
+			shp = SHPOpenLL(path, readonly ? "rb" : "rb+", &hooks);
+		}
+		
+		/* rebuild the index if it is missing, unreadable, or out of step */
+		if (rebuildIndex == 1 && (shp == NULL || shp->nRecords != DBFGetRecordCount(dbf))) {
+			shapefile_sharedClose(shp, sharedIndex);
+			sharedIndex = NULL;
+			if (shapefile_rebuildIndex(interp, path, NULL) != TCL_OK) {
+				DBFClose(dbf);
+				return TCL_ERROR;
+			}
+			if (shared) {
+				shp = shapefile_sharedOpen(path, &sharedIndex);
+			} else if (lazy) {
+				shp = shapefile_lazyOpen(path, readonly ? "rb" : "rb+");
+			} else {
+				shp = SHPOpenLL(path, readonly ? "rb" : "rb+", &hooks);
+			}
+		}
+		
+		if (shp == NULL) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", path));
 			DBFClose(dbf);
 			return TCL_ERROR;
 		}
 		
+		if (largeFile && shapefile_largeOffsets(interp, shp, path) != TCL_OK) {
+			DBFClose(dbf);
+			SHPClose(shp);
+			return TCL_ERROR;
+		}
+		
 		/* Only types we don't handle are SHPT_NULL and SHPT_MULTIPATCH */
 		SHPGetInfo(shp, &shpCount, &shpType, NULL, NULL);
 		if (!shapefile_typeSupported(shpType)) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("unsupported shape type \"%d\"", shpType));
 			DBFClose(dbf);
-			SHPClose(shp);
+			shapefile_sharedClose(shp, sharedIndex);
 			return TCL_ERROR;
 		}
 		
@@ -288,33 +1244,18 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 		if (dbfCount != shpCount) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("shapefile feature count (%d) does not match attribute record count (%d)", shpCount, dbfCount));
 			DBFClose(dbf);
-			SHPClose(shp);
+			shapefile_sharedClose(shp, sharedIndex);
 			return TCL_ERROR;
 		}
 	}
 	
-	if ((shapefile = (ShapefilePtr)ckalloc((unsigned int)sizeof(struct shapefile_data))) == NULL) {
+	if ((shapefile = shapefile_new(path, shp, dbf, readonly, sharedIndex)) == NULL) {
 		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate shapefile command data"));;
 		DBFClose(dbf);
-		SHPClose(shp);
+		shapefile_sharedClose(shp, sharedIndex);
 		return TCL_ERROR;
 	}
-	shapefile->shp = shp;
-	shapefile->dbf = dbf;	
-	shapefile->readonly = readonly;
-	shapefile->allowAlternateNotation = 0;
-	shapefile->getAllCoords = 0;
-	shapefile->getOnlyXyCoords = 0;
-	shapefile->readRawStrings = 0;
-	shapefile->autoClosePolygons = 0;
-	shapefile->allowTruncation = 0;
-	shapefile->shapeType = shpType;
-	shapefile->baseType = shapefile_typeBase(shpType);
-	shapefile->dimType = shapefile_typeDimension(shpType);
-	
-	/* save the path of the shapefile */
-	shapefile->path = (char *)ckalloc((unsigned int)(strlen(path) + 1));
-    strcpy(shapefile->path, path);
+	shapefile->lazy = lazy;
 	
 	ns = Tcl_GetCurrentNamespace(interp);
 	Tcl_MutexLock(&COMMAND_COUNT_MUTEX);
@@ -328,7 +1269,7 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 	if (Tcl_CreateObjCommand(interp, Tcl_GetString(cmdNameObj), (Tcl_ObjCmdProc *)cmd_dispatcher, (ClientData)shapefile, (Tcl_CmdDeleteProc *)shapefile_delete_handler) == NULL) {
 		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create command for %s", Tcl_GetString(cmdNameObj)));
 		DBFClose(dbf);
-		SHPClose(shp);
+		shapefile_sharedClose(shp, sharedIndex);
 		ckfree((char *)shapefile);
 		return TCL_ERROR;
 	}
@@ -338,6 +1279,428 @@ int Shapetcl_Init(Tcl_Interp *interp) {
 	return TCL_OK;
 }
 
+/*
+ * shapefile_new
+ * 
+ * Allocate the ShapefilePtr structure for an open shapefile and its default
+ * config options. The shapefile owns shp (and its shared index, if any) and
+ * dbf from then on; they are closed by shapefile_exit_handler.
+ * 
+ * Result:
+ *   New ShapefilePtr, or NULL if it could not be allocated.
+ */
+ShapefilePtr shapefile_new(
+		const char *path,
+		SHPHandle shp,
+		DBFHandle dbf,
+		int readonly,
+		ShapefileSharedIndexPtr sharedIndex) {
+	
+	ShapefilePtr shapefile;
+	int shpType;
+	
+	if ((shapefile = (ShapefilePtr)ckalloc((unsigned int)sizeof(struct shapefile_data))) == NULL) {
+		return NULL;
+	}
+	SHPGetInfo(shp, NULL, &shpType, NULL, NULL);
+	shapefile->shp = shp;
+	shapefile->dbf = dbf;	
+	shapefile->readonly = readonly;
+	shapefile->shared = sharedIndex;
+	shapefile->lazy = 0;
+	shapefile->asyncReads = NULL;
+	shapefile->allowAlternateNotation = 0;
+	shapefile->getAllCoords = 0;
+	shapefile->getOnlyXyCoords = 0;
+	shapefile->readRawStrings = 0;
+	shapefile->autoClosePolygons = 0;
+	shapefile->allowTruncation = 0;
+	shapefile->skipDeleted = 0;
+	shapefile->cacheSize = 0;
+	shapefile->cacheUsed = 0;
+	shapefile->cacheHits = 0;
+	shapefile->cacheMisses = 0;
+	Tcl_InitHashTable(&shapefile->cacheTable, TCL_ONE_WORD_KEYS);
+	shapefile->cacheFirst = NULL;
+	shapefile->cacheLast = NULL;
+	shapefile->spatialIndex = NULL;
+	shapefile->shapeType = shpType;
+	shapefile->baseType = shapefile_typeBase(shpType);
+	shapefile->dimType = shapefile_typeDimension(shpType);
+	
+	/* save the path of the shapefile */
+	shapefile->path = (char *)ckalloc((unsigned int)(strlen(path) + 1));
+	strcpy(shapefile->path, path);
+	
+	/* memory shapefiles last as long as a command uses them */
+	if (shapefile_memoryPath(path)) {
+		shapefile_memoryRetain(path, 1);
+	}
+	
+	return shapefile;
+}
+
+/*
+ * shapefile_sharedOpen
+ * 
+ * Open the shapefile at path readonly using a shared index. The first handle
+ * opened for a shapefile reads the .shx with SHPOpen and registers its offset
+ * table; later handles copy the registered header values and offset table
+ * pointers and open only the .shp file. *sharedPtr is set to the index entry,
+ * which must be released with shapefile_sharedClose.
+ * 
+ * Result:
+ *   Shapefile handle, or NULL if the shapefile could not be opened.
+ */
+SHPHandle shapefile_sharedOpen(
+		const char *path,
+		ShapefileSharedIndexPtr *sharedPtr) {
+	
+	ShapefileSharedIndexPtr shared;
+	SHPHandle shp = NULL;
+	Tcl_Obj *shpPath, *shxPath, *normalPath;
+	Tcl_StatBuf statBuf, shxStatBuf;
+	const char *key;
+	SAHooks hooks;
+	
+	*sharedPtr = NULL;
+	shapefile_streamHooks(&hooks);
+	
+	shpPath = shapefile_componentPath(path, "shp");
+	shxPath = shapefile_componentPath(path, "shx");
+	Tcl_IncrRefCount(shpPath);
+	Tcl_IncrRefCount(shxPath);
+	if ((normalPath = Tcl_FSGetNormalizedPath(NULL, shpPath)) == NULL
+			|| Tcl_FSStat(shpPath, &statBuf) != 0
+			|| Tcl_FSStat(shxPath, &shxStatBuf) != 0) {
+		Tcl_DecrRefCount(shpPath);
+		Tcl_DecrRefCount(shxPath);
+		return NULL;
+	}
+	Tcl_DecrRefCount(shxPath);
+	key = Tcl_GetString(normalPath);
+	
+	Tcl_MutexLock(&SHARED_INDEXES_MUTEX);
+	
+	for (shared = SHARED_INDEXES; shared != NULL; shared = shared->next) {
+		if (strcmp(shared->key, key) == 0 && shared->size == (Tcl_WideInt)statBuf.st_size
+				&& shared->mtime == (long)statBuf.st_mtime
+				&& shared->shxSize == (Tcl_WideInt)shxStatBuf.st_size
+				&& shared->shxMtime == (long)shxStatBuf.st_mtime) {
+			break;
+		}
+	}
+	
+	if (shared != NULL) {
+		if ((shp = shapefile_cloneHandle(path, &shared->info)) != NULL) {
+			shared->refCount++;
+		}
+	} else if ((shp = SHPOpenLL(path, "rb", &hooks)) != NULL) {
+		shared = (ShapefileSharedIndexPtr)ckalloc((unsigned int)sizeof(struct shapefile_sharedIndex));
+		shared->key = ckalloc((unsigned int)(strlen(key) + 1));
+		strcpy(shared->key, key);
+		shared->size = (Tcl_WideInt)statBuf.st_size;
+		shared->mtime = (long)statBuf.st_mtime;
+		shared->shxSize = (Tcl_WideInt)shxStatBuf.st_size;
+		shared->shxMtime = (long)shxStatBuf.st_mtime;
+		shared->refCount = 1;
+		memcpy(&shared->info, shp, sizeof(SHPInfo));
+		shared->info.fpSHP = NULL;
+		shared->info.fpSHX = NULL;
+		shared->info.pabyRec = NULL;
+		shared->info.nBufSize = 0;
+		shared->next = SHARED_INDEXES;
+		SHARED_INDEXES = shared;
+	}
+	
+	Tcl_MutexUnlock(&SHARED_INDEXES_MUTEX);
+	Tcl_DecrRefCount(shpPath);
+	
+	if (shp != NULL) {
+		*sharedPtr = shared;
+	}
+	return shp;
+}
+
+/*
+ * shapefile_sharedClose
+ * 
+ * Close a shapefile handle. If shared is not NULL, the handle's offset table
+ * belongs to the shared index entry, which is released and freed along with
+ * the table when no other handle refers to it.
+ */
+void shapefile_sharedClose(
+		SHPHandle shp,
+		ShapefileSharedIndexPtr shared) {
+	
+	ShapefileSharedIndexPtr *link;
+	
+	if (shp == NULL) {
+		return;
+	}
+	
+	if (shared == NULL) {
+		SHPClose(shp);
+		return;
+	}
+	
+	/* SHPClose must not free the shared offset table */
+	shp->panRecOffset = NULL;
+	shp->panRecSize = NULL;
+	SHPClose(shp);
+	
+	Tcl_MutexLock(&SHARED_INDEXES_MUTEX);
+	if (--shared->refCount == 0) {
+		for (link = &SHARED_INDEXES; *link != NULL; link = &(*link)->next) {
+			if (*link == shared) {
+				*link = shared->next;
+				break;
+			}
+		}
+		/* the offset table was allocated by Shapelib */
+		free(shared->info.panRecOffset);
+		free(shared->info.panRecSize);
+		ckfree(shared->key);
+		ckfree((char *)shared);
+	}
+	Tcl_MutexUnlock(&SHARED_INDEXES_MUTEX);
+}
+
+/*
+ * shapefile_sharedForget
+ * 
+ * Unlist the shared index entries of the shapefile at path, as when its
+ * .shx file is rewritten, so that later -shared opens read the new index.
+ * Handles using the entries keep them until they are closed.
+ */
+void shapefile_sharedForget(const char *path) {
+	ShapefileSharedIndexPtr *link;
+	Tcl_Obj *shpPath, *normalPath;
+	
+	shpPath = shapefile_componentPath(path, "shp");
+	Tcl_IncrRefCount(shpPath);
+	if ((normalPath = Tcl_FSGetNormalizedPath(NULL, shpPath)) != NULL) {
+		Tcl_MutexLock(&SHARED_INDEXES_MUTEX);
+		for (link = &SHARED_INDEXES; *link != NULL; ) {
+			if (strcmp((*link)->key, Tcl_GetString(normalPath)) == 0) {
+				*link = (*link)->next;
+			} else {
+				link = &(*link)->next;
+			}
+		}
+		Tcl_MutexUnlock(&SHARED_INDEXES_MUTEX);
+	}
+	Tcl_DecrRefCount(shpPath);
+}
+
+/*
+ * shapefile_cloneHandle
+ * 
+ * Create a readonly handle for the shapefile at path from the header values
+ * and offset table in info, without reading the .shx file. The new handle
+ * has its own .shp file and record buffer but shares info's offset table.
+ * 
+ * Result:
+ *   Shapefile handle, or NULL if the .shp file could not be opened.
+ */
+SHPHandle shapefile_cloneHandle(
+		const char *path,
+		const SHPInfo *info) {
+	
+	SHPHandle shp;
+	Tcl_Obj *shpPath;
+	
+	/* allocated like Shapelib handles, since SHPClose frees it */
+	if ((shp = (SHPHandle)calloc(sizeof(SHPInfo), 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(shp, info, sizeof(SHPInfo));
+	
+	/* try the same extensions SHPOpen does */
+	shpPath = shapefile_componentPath(path, "shp");
+	Tcl_IncrRefCount(shpPath);
+	shp->fpSHP = shp->sHooks.FOpen(Tcl_GetString(shpPath), "rb");
+	Tcl_DecrRefCount(shpPath);
+	if (shp->fpSHP == NULL) {
+		shpPath = shapefile_componentPath(path, "SHP");
+		Tcl_IncrRefCount(shpPath);
+		shp->fpSHP = shp->sHooks.FOpen(Tcl_GetString(shpPath), "rb");
+		Tcl_DecrRefCount(shpPath);
+	}
+	if (shp->fpSHP == NULL) {
+		free(shp);
+		return NULL;
+	}
+	
+	return shp;
+}
+
+/*
+ * shapefile_lazyOpen
+ * 
+ * Open the shapefile at path with the given access mode without reading its
+ * index. Only the 100 byte .shp header is read; the record count is derived
+ * from the size of the .shx file. The handle has no offset table, so it may
+ * be used only with SHPGetInfo and SHPClose until replaced by
+ * shapefile_lazyLoad.
+ * 
+ * Result:
+ *   Shapefile handle, or NULL if the .shp header could not be read or the
+ *   .shx file is missing or malformed.
+ */
+SHPHandle shapefile_lazyOpen(
+		const char *path,
+		const char *access) {
+	
+	SHPHandle shp;
+	unsigned char header[100];
+	Tcl_Obj *shpPath, *shxPath;
+	Tcl_StatBuf statBuf;
+	Tcl_WideInt shxSize = -1;
+	int count = 0;
+	
+	if ((shp = (SHPHandle)calloc(1, sizeof(SHPInfo))) == NULL) {
+		return NULL;
+	}
+	shapefile_streamHooks(&shp->sHooks);
+	
+	shpPath = shapefile_componentPath(path, "shp");
+	shxPath = shapefile_componentPath(path, "shx");
+	Tcl_IncrRefCount(shpPath);
+	Tcl_IncrRefCount(shxPath);
+	if ((shp->fpSHP = shp->sHooks.FOpen(Tcl_GetString(shpPath), access)) != NULL) {
+		count = (int)shp->sHooks.FRead(header, sizeof(header), 1, shp->fpSHP);
+	}
+	if (Tcl_FSStat(shxPath, &statBuf) == 0) {
+		shxSize = (Tcl_WideInt)statBuf.st_size;
+	}
+	Tcl_DecrRefCount(shpPath);
+	Tcl_DecrRefCount(shxPath);
+	
+	if (shp->fpSHP == NULL) {
+		free(shp);
+		return NULL;
+	}
+	if (count != 1 || shapefile_getBigInt(header) != 9994
+			|| shxSize < 100 || (shxSize - 100) % 8 != 0) {
+		SHPClose(shp);
+		return NULL;
+	}
+	
+	shp->nFileSize = (SAOffset)shapefile_getBigInt(header + 24) * 2;
+	shp->nShapeType = shapefile_getLittleInt(header + 32);
+	shp->nRecords = (int)((shxSize - 100) / 8);
+	shp->nMaxRecords = shp->nRecords;
+	shp->adBoundsMin[0] = shapefile_getLittleDouble(header + 36);
+	shp->adBoundsMin[1] = shapefile_getLittleDouble(header + 44);
+	shp->adBoundsMax[0] = shapefile_getLittleDouble(header + 52);
+	shp->adBoundsMax[1] = shapefile_getLittleDouble(header + 60);
+	shp->adBoundsMin[2] = shapefile_getLittleDouble(header + 68);
+	shp->adBoundsMax[2] = shapefile_getLittleDouble(header + 76);
+	shp->adBoundsMin[3] = shapefile_getLittleDouble(header + 84);
+	shp->adBoundsMax[3] = shapefile_getLittleDouble(header + 92);
+	
+	return shp;
+}
+
+/*
+ * shapefile_lazyLoad
+ * 
+ * Replace the header-only handle of a shapefile opened with -lazy by a
+ * complete handle, reading the .shx index. Has no effect on other shapefiles.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_lazyLoad(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile) {
+	
+	SHPHandle shp;
+	SAHooks hooks;
+	
+	if (!shapefile->lazy) {
+		return TCL_OK;
+	}
+	
+	shapefile_streamHooks(&hooks);
+	if ((shp = SHPOpenLL(shapefile->path, shapefile->readonly ? "rb" : "rb+", &hooks)) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", shapefile->path));
+		return TCL_ERROR;
+	}
+	if (shp->nRecords != shapefile->shp->nRecords) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("shapefile index of \"%s\" has changed since it was opened", shapefile->path));
+		SHPClose(shp);
+		return TCL_ERROR;
+	}
+	
+	SHPClose(shapefile->shp);
+	shapefile->shp = shp;
+	shapefile->lazy = 0;
+	return TCL_OK;
+}
+
+/*
+ * shapefile_largeOffsets
+ * 
+ * Replace the record offsets of shp, which are read from 32-bit word offsets
+ * in the .shx index and so wrap for .shp files of 4 GB or more, by offsets
+ * recovered by scanning the .shp record headers in sequence, and allow shp
+ * to grow past 4 GB. Only the 8 byte header and shape type of each record
+ * are read. The index must still contain one entry per record. Used by the
+ * -largeFile open option.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_largeOffsets(
+		Tcl_Interp *interp,
+		SHPHandle shp,
+		const char *path) {
+	
+	struct shapefile_buffer input;
+	unsigned char record[12];
+	SAOffset fileSize, offset = 100;
+	unsigned int contentLength;
+	int featureId, recordType;
+	
+	memset(&input, 0, sizeof(struct shapefile_buffer));
+	input.hooks = &shp->sHooks;
+	input.file = shp->fpSHP;
+	
+	/* the actual file size bounds the scan; the header size may have wrapped */
+	if (shp->sHooks.FSeek(shp->fpSHP, 0, SEEK_END) != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read shapefile for \"%s\"", path));
+		return TCL_ERROR;
+	}
+	fileSize = shp->sHooks.FTell(shp->fpSHP);
+	
+	for (featureId = 0; featureId < shp->nRecords; featureId++) {
+		if (offset + 12 > fileSize || !shapefile_bufferRead(&input, offset, record, 12)) {
+			break;
+		}
+		contentLength = shapefile_getBigInt(record + 4) * 2;
+		recordType = shapefile_getLittleInt(record + 8);
+		if (contentLength < 4 || contentLength > fileSize - offset - 8
+				|| (recordType != SHPT_NULL && recordType != shp->nShapeType)) {
+			break;
+		}
+		shp->panRecOffset[featureId] = offset;
+		shp->panRecSize[featureId] = contentLength;
+		offset += 8 + contentLength;
+	}
+	shapefile_bufferRelease(&input);
+	
+	if (featureId < shp->nRecords) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to recover offset of feature %d of \"%s\"", featureId, path));
+		return TCL_ERROR;
+	}
+	
+	shp->nFileSize = offset;
+	shp->bLargeFile = 1;
+	return TCL_OK;
+}
+
 /*
  * shapefile_typeSupported
  * 
@@ -477,7 +1840,7 @@ int shapefile_typeDimension(int shpType) {
  * by shapefile_cmd. The clientData is a ShapefilePtr associated with identifier.
  * 
  * Command Syntax:
- *   [$shp attributes|close|configure|coordinates|fields|info|mode|write ?args?]
+ *   [$shp attributes|close|compact|configure|coordinates|delete|export|fields|geometry|info|file|save|sort|spatial|undelete|write ?args?]
  *     Invokes the function handler associated with selected subcommand.
  *     Unambiguous abbreviations such as [$shp attr] or [$shp coord] are valid.
  * 
@@ -490,19 +1853,35 @@ int cmd_dispatcher(
 		int objc,
 		Tcl_Obj *CONST objv[]) {
 
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
 	int subcommandIndex;
-	static const char *subcommandNames[] = {
-			"attributes",
-			"close",
-			"configure",
-			"coordinates",
-			"fields",
-			"info",
-			"file",
-			"write",
-			NULL
+	
+	/* each subcommand's handler, and whether it reads or writes features
+	   through the .shx index, which must then be loaded for a -lazy
+	   shapefile; [$shp info] loads it itself for the bounds of one feature */
+	static const struct {
+		const char *name;
+		Tcl_ObjCmdProc *proc;
+		int indexed;
+	} subcommands[] = {
+			{"attributes",  (Tcl_ObjCmdProc *)cmd_attributes,  0},
+			{"close",       (Tcl_ObjCmdProc *)cmd_close,       0},
+			{"compact",     (Tcl_ObjCmdProc *)cmd_compact,     1},
+			{"configure",   (Tcl_ObjCmdProc *)cmd_config,      0},
+			{"coordinates", (Tcl_ObjCmdProc *)cmd_coordinates, 1},
+			{"delete",      (Tcl_ObjCmdProc *)cmd_delete,      0},
+			{"export",      (Tcl_ObjCmdProc *)cmd_export,      1},
+			{"fields",      (Tcl_ObjCmdProc *)cmd_fields,      0},
+			{"geometry",    (Tcl_ObjCmdProc *)cmd_geometry,    1},
+			{"info",        (Tcl_ObjCmdProc *)cmd_info,        0},
+			{"file",        (Tcl_ObjCmdProc *)cmd_file,        0},
+			{"save",        (Tcl_ObjCmdProc *)cmd_save,        1},
+			{"sort",        (Tcl_ObjCmdProc *)cmd_sort,        1},
+			{"spatial",     (Tcl_ObjCmdProc *)cmd_spatial,     1},
+			{"undelete",    (Tcl_ObjCmdProc *)cmd_undelete,    0},
+			{"write",       (Tcl_ObjCmdProc *)cmd_write,       1},
+			{NULL, NULL, 0}
 	};
-	int result;
 	
 	if (objc < 2) {
 		Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?args?");
@@ -510,27 +1889,24 @@ int cmd_dispatcher(
 	}
 	
 	/* identify subcommand, or set result to error message w/valid cmd list */
-	if (Tcl_GetIndexFromObj(interp, objv[1], subcommandNames, "subcommand",
+	if (Tcl_GetIndexFromObjStruct(interp, objv[1], subcommands, sizeof(subcommands[0]), "subcommand",
 			0 /* not TCL_EXACT */, &subcommandIndex) != TCL_OK) {
 		return TCL_ERROR;
 	}
 	
-	switch (subcommandIndex) {
-		case 0: result = cmd_attributes (clientData, interp, objc, objv); break;
-		case 1: result = cmd_close      (clientData, interp, objc, objv); break;
-		case 2: result = cmd_config     (clientData, interp, objc, objv); break;
-		case 3: result = cmd_coordinates(clientData, interp, objc, objv); break;
-		case 4: result = cmd_fields     (clientData, interp, objc, objv); break;
-		case 5: result = cmd_info       (clientData, interp, objc, objv); break;
-		case 6: result = cmd_file       (clientData, interp, objc, objv); break;
-		case 7: result = cmd_write      (clientData, interp, objc, objv); break;
-		default:
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid subcommand index (%d)", subcommandIndex));
-			result = TCL_ERROR;
-			break;
+	/* a shapefile left without handles by a failed rewrite can only be closed */
+	if ((shapefile->shp == NULL || shapefile->dbf == NULL)
+			&& subcommands[subcommandIndex].proc != (Tcl_ObjCmdProc *)cmd_close) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("shapefile \"%s\" could not be reopened and must be closed", shapefile->path));
+		return TCL_ERROR;
 	}
 	
-	return result;
+	if (shapefile->lazy && subcommands[subcommandIndex].indexed
+			&& shapefile_lazyLoad(interp, shapefile) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	return subcommands[subcommandIndex].proc(clientData, interp, objc, objv);
 }
 
 /*
@@ -573,10 +1949,18 @@ int cmd_close(
  */
 void shapefile_exit_handler(ClientData clientData) {
 	ShapefilePtr shapefile = (ShapefilePtr)clientData;
-	SHPClose(shapefile->shp);
+	cmd_coordinates_asyncCancel(shapefile);
+	shapefile_cacheTrim(shapefile, 0);
+	Tcl_DeleteHashTable(&shapefile->cacheTable);
+	shapefile_spatialInvalidate(shapefile);
+	shapefile_sharedClose(shapefile->shp, shapefile->shared);
 	shapefile->shp = NULL;
+	shapefile->shared = NULL;
 	DBFClose(shapefile->dbf);
 	shapefile->dbf = NULL;
+	if (shapefile_memoryPath(shapefile->path)) {
+		shapefile_memoryRetain(shapefile->path, -1);
+	}
 	ckfree((void *)shapefile->path);
 	shapefile->path = NULL;
 }
@@ -589,6 +1973,7 @@ void shapefile_exit_handler(ClientData clientData) {
  */
 void shapefile_delete_handler(ClientData clientData) {
 	Tcl_DeleteExitHandler((Tcl_ExitProc *)shapefile_exit_handler, clientData);
+	cmd_coordinates_asyncCancel((ShapefilePtr)clientData);
 	ckfree((char *)clientData);
 }
 
@@ -602,6 +1987,8 @@ void shapefile_delete_handler(ClientData clientData) {
  *     Get the current value of the specified option. Option may be abbreviated.
  *   [$shp config option 0|1]
  *     Set the value of the specified option to 0 or 1 (boolean options only).
+ *   [$shp config cacheSize bytes]
+ *     Set the cache size. Least recently used entries are discarded to fit.
  *     Some options are incompatible, in which case setting one to true has the
  *     side effect of setting the other to false (see get*Coordinates options).
  *
@@ -612,10 +1999,12 @@ void shapefile_delete_handler(ClientData clientData) {
  *   readRawStrings (0)
  *   autoClosePolygons (0)
  *   allowTruncation (0)
+ *   skipDeleted (0)
+ *   cacheSize (0)
  *   (See notes in ShapefilePtr struct definition for option details.)
  *
  * Result:
- *   Returns boolean value of specified option.
+ *   Returns value of specified option.
  */
 int cmd_config(
 		ClientData clientData,
@@ -633,11 +2022,13 @@ int cmd_config(
 			"readRawStrings",
 			"autoClosePolygons",
 			"allowTruncation",
+			"skipDeleted",
+			"cacheSize",
 			NULL
 	};
 	
 	if (objc < 3 || objc > 4) {
-		Tcl_WrongNumArgs(interp, 2, objv, "option ?booleanValue?");
+		Tcl_WrongNumArgs(interp, 2, objv, "option ?value?");
 		return TCL_ERROR;
 	}
 	
@@ -645,8 +2036,15 @@ int cmd_config(
 		return TCL_ERROR;
 	}
 	
-	if (objc == 4) {
-		/* all options expected to be boolean */
+	if (objc == 4 && optionIndex == 7) {
+		/* cacheSize is a byte count */
+		if ((Tcl_GetIntFromObj(interp, objv[3], &optionValue) != TCL_OK)
+				|| optionValue < 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid cache size \"%s\" (should be a non-negative integer)", Tcl_GetString(objv[3])));
+			return TCL_ERROR;
+		}
+	} else if (objc == 4) {
+		/* all other options expected to be boolean */
 		if ((Tcl_GetIntFromObj(interp, objv[3], &optionValue) != TCL_OK)
 				|| (optionValue != 0 && optionValue != 1)) {
 			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid option value \"%s\" (should be 0 or 1)", Tcl_GetString(objv[3])));
@@ -681,6 +2079,10 @@ int cmd_config(
 			break;
 		case 3: /* readRawStrings */
 			if (objc == 4) {
+				/* cached records were formatted with the previous setting */
+				if (shapefile->readRawStrings != optionValue) {
+					shapefile_cacheTrim(shapefile, 0);
+				}
 				shapefile->readRawStrings = optionValue;
 			}
 			Tcl_SetObjResult(interp, Tcl_NewIntObj(shapefile->readRawStrings));
@@ -697,6 +2099,19 @@ int cmd_config(
 			}
 			Tcl_SetObjResult(interp, Tcl_NewIntObj(shapefile->allowTruncation));
 			break;
+		case 6: /* skipDeleted */
+			if (objc == 4) {
+				shapefile->skipDeleted = optionValue;
+			}
+			Tcl_SetObjResult(interp, Tcl_NewIntObj(shapefile->skipDeleted));
+			break;
+		case 7: /* cacheSize */
+			if (objc == 4) {
+				shapefile->cacheSize = optionValue;
+				shapefile_cacheTrim(shapefile, optionValue);
+			}
+			Tcl_SetObjResult(interp, Tcl_NewIntObj(shapefile->cacheSize));
+			break;
 	}
 	
 	return TCL_OK;
@@ -709,10 +2124,20 @@ int cmd_config(
  * the shapefile itself. See cmd_info for queries about the shapefile content.
  *
  * Command Syntax:
+ *   [$shp file cache]
+ *     Get a dictionary of feature and attribute record cache statistics: size
+ *     (configured capacity in bytes; see cacheSize config option), used
+ *     (approximate bytes in use), entries, hits, and misses. Lookups are only
+ *     counted while the cache is enabled.
+ *   [$shp file indexed]
+ *     Get 0 if the shapefile was opened with -lazy and its .shx index has not
+ *     been loaded yet, or 1 otherwise.
  *   [$shp file mode]
  *     Get shapefile access mode. Result is one of readonly or readwrite.
  *   [$shp file path]
  *     Get shapefile path. Not normalized; returned as initially provided.
+ *   [$shp file shared]
+ *     Get 1 if the shapefile was opened with -shared, or 0 if not.
  *
  * Result:
  *   As described under Command Syntax.
@@ -724,8 +2149,9 @@ int cmd_file(
 		Tcl_Obj *CONST objv[]) {
 	
 	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	Tcl_Obj *stats;
 	int actionIndex;
-	static const char *actionNames[] = {"mode", "path",	NULL};
+	static const char *actionNames[] = {"cache", "indexed", "mode", "path", "shared", NULL};
 	
 	if (objc != 3) {
 		Tcl_WrongNumArgs(interp, 2, objv, "option");
@@ -738,16 +2164,36 @@ int cmd_file(
 	}
 	
 	switch (actionIndex) {
-		case 0: /* mode */
+		case 0: /* cache */
+			stats = Tcl_NewListObj(0, NULL);
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewStringObj("size", -1));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewIntObj(shapefile->cacheSize));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewStringObj("used", -1));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewIntObj(shapefile->cacheUsed));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewStringObj("entries", -1));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewIntObj(shapefile->cacheTable.numEntries));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewStringObj("hits", -1));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewWideIntObj(shapefile->cacheHits));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewStringObj("misses", -1));
+			Tcl_ListObjAppendElement(interp, stats, Tcl_NewWideIntObj(shapefile->cacheMisses));
+			Tcl_SetObjResult(interp, stats);
+			break;
+		case 1: /* indexed */
+			Tcl_SetObjResult(interp, Tcl_NewIntObj(!shapefile->lazy));
+			break;
+		case 2: /* mode */
 			if (shapefile->readonly) {
 				Tcl_SetObjResult(interp, Tcl_ObjPrintf("readonly"));
 			} else {
 				Tcl_SetObjResult(interp, Tcl_ObjPrintf("readwrite"));
 			}
 			break;
-		case 1: /* path */
+		case 3: /* path */
 			Tcl_SetObjResult(interp, Tcl_NewStringObj(shapefile->path, -1));
 			break;
+		case 4: /* shared */
+			Tcl_SetObjResult(interp, Tcl_NewIntObj(shapefile->shared != NULL));
+			break;
 	}
 	
 	return TCL_OK;
@@ -764,6 +2210,8 @@ int cmd_file(
  *     See cmd_info_bounds for details.
  *   [$shp info count]
  *     See cmd_info_count for details.
+ *   [$shp info deleted]
+ *     See cmd_info_deleted for details.
  *   [$shp info type]
  *     See cmd_info_type for details.
  *
@@ -778,7 +2226,7 @@ int cmd_info(
 
 	int result = TCL_OK;
 	int optionIndex;
-	static const char *optionNames[] = {"bounds", "count", "type", NULL};
+	static const char *optionNames[] = {"bounds", "count", "deleted", "type", NULL};
 
 	if (objc < 3) {
 		Tcl_WrongNumArgs(interp, 2, objv, "option ?args?");
@@ -797,7 +2245,10 @@ int cmd_info(
 		case 1: /* count */
 			result = cmd_info_count(clientData, interp, objc, objv);
 			break;
-		case 2: /* type */
+		case 2: /* deleted */
+			result = cmd_info_deleted(clientData, interp, objc, objv);
+			break;
+		case 3: /* type */
 			result = cmd_info_type(clientData, interp, objc, objv);
 			break;
 	}
@@ -843,6 +2294,63 @@ int cmd_info_count(
 	return TCL_OK;
 }
 
+/*
+ * cmd_info_deleted
+ * 
+ * Implements the [$shp info deleted] action used to query record deletion
+ * flags. Deletion flags are stored in the attribute table; see [$shp delete].
+ * 
+ * Command Syntax:
+ *   [$shp info deleted]
+ *     Get a list of the indices of all deleted records.
+ *   [$shp info deleted FEATURE]
+ *     Get 1 if the specified record is deleted or 0 if not.
+ * 
+ * Result:
+ *   As described under Command Syntax above.
+ */
+int cmd_info_deleted(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	Tcl_Obj *deletedList;
+	int dbfCount, recordId;
+	
+	if (objc != 3 && objc != 4) {
+		Tcl_WrongNumArgs(interp, 3, objv, "?index?");
+		return TCL_ERROR;
+	}
+	
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	
+	if (objc == 4) {
+		if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (recordId < 0 || recordId >= dbfCount) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+			return TCL_ERROR;
+		}
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(DBFIsRecordDeleted(shapefile->dbf, recordId) ? 1 : 0));
+		return TCL_OK;
+	}
+	
+	deletedList = Tcl_NewListObj(0, NULL);
+	for (recordId = 0; recordId < dbfCount; recordId++) {
+		if (DBFIsRecordDeleted(shapefile->dbf, recordId)) {
+			if (Tcl_ListObjAppendElement(interp, deletedList, Tcl_NewIntObj(recordId)) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		}
+	}
+	
+	Tcl_SetObjResult(interp, deletedList);
+	return TCL_OK;
+}
+
 /*
  * cmd_info_type
  * 
@@ -1018,33 +2526,46 @@ int cmd_info_bounds(
 	SHPGetInfo(shapefile->shp, &shpCount, NULL, min, max);
 	
 	if (objc == 4) {
-		int featureId;
+		int featureId, isNull;
 		SHPObject *obj;
+		ShapefileCacheEntryPtr entry = NULL;
 		
 		if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
 			return TCL_ERROR;
 		}
 		
-		if (featureId < 0 || featureId >= shpCount) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+		/* features are read through the index, which -lazy has not read */
+		if (shapefile->lazy && shapefile_lazyLoad(interp, shapefile) != TCL_OK) {
 			return TCL_ERROR;
 		}
 		
-		if ((obj = SHPReadObject(shapefile->shp, featureId)) == NULL) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+		if (featureId < 0 || featureId >= shpCount) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
 			return TCL_ERROR;
 		}
 		
-		if (obj->nSHPType == SHPT_NULL) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("no bounds for null feature"));
-			SHPDestroyObject(obj);
+		if ((entry = shapefile_cacheLookup(shapefile, featureId, 0)) != NULL) {
+			obj = entry->shape;
+		} else if ((obj = SHPReadObject(shapefile->shp, featureId)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
 			return TCL_ERROR;
+		} else if (shapefile_cacheInsert(shapefile, featureId, obj, NULL)) {
+			entry = shapefile->cacheFirst;
 		}
 		
 		min[0] = obj->dfXMin; min[1] = obj->dfYMin; min[2] = obj->dfZMin; min[3] = obj->dfMMin;
 		max[0] = obj->dfXMax; max[1] = obj->dfYMax; max[2] = obj->dfZMax; max[3] = obj->dfMMax;
+		isNull = obj->nSHPType == SHPT_NULL;
+		
+		/* shapes are owned by the cache once inserted */
+		if (entry == NULL) {
+			SHPDestroyObject(obj);
+		}
 		
-		SHPDestroyObject(obj);
+		if (isNull) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("no bounds for null feature"));
+			return TCL_ERROR;
+		}
 	}
 	
 	bounds = Tcl_NewListObj(0, NULL);
@@ -1607,8 +3128,31 @@ int cmd_fields_index(
  *     Get the coordinates of one feature.
  *   [$shp coordinates read]
  *     Get the coordinates of all features.
+ *   [$shp coordinates read ?FEATURE? -clip {XMIN YMIN XMAX YMAX}]
+ *     Get the coordinates of one or all features, clipped to a rectangle.
+ *     Features outside the rectangle are empty.
+ *   [$shp coordinates read ?FEATURE? -simplify TOLERANCE ?-method dp|vw?]
+ *     Get the coordinates of one or all features, with arcs and polygon
+ *     rings simplified by the Douglas-Peucker (default) or Visvalingam-
+ *     Whyatt algorithm. Ring closure and minimum vertex counts are kept.
+ *   [$shp coordinates read ?FEATURE? -project {FROM TO}]
+ *     Get the coordinates of one or all features, converted from projection
+ *     FROM to projection TO. May be combined with -clip, -simplify,
+ *     -transform, and -viewport.
+ *   [$shp coordinates read ?FEATURE? ?-transform MATRIX? ?-viewport VIEWPORT?]
+ *     Get the coordinates of one or all features, mapped through the affine
+ *     MATRIX {a b c d e f} and/or onto the pixel grid of VIEWPORT {xmin ymin
+ *     xmax ymax width height}. May be combined with -simplify.
+ *   [$shp coordinates read -threads COUNT]
+ *     Get the coordinates of all features, decoded by COUNT worker threads.
+ *   [$shp coordinates read -async -command CALLBACK ?-bbox BOUNDS? ?-chunk N?]
+ *     Read the coordinates of all features (or those intersecting BOUNDS) in
+ *     the background, passing them to CALLBACK from the event loop.
  *   [$shp coordinates write FEATURE COORDINATES]
  *     Set the coordinates of one feature.
+ *   [$shp coordinates write ?FEATURE? COORDINATES -project {FROM TO}]
+ *     Set the coordinates of one or a new feature, converted from projection
+ *     FROM to projection TO.
  *   [$shp coordinates write COORDINATES]
  *     Set the coordinates of a new feature. The feature is appended to the
  *     shapefile. A new attribute record is also created, populated with NULLs.
@@ -1669,32 +3213,71 @@ int cmd_coordinates(
 			if (cmd_coordinates_readAll(interp, shapefile) != TCL_OK) {
 				return TCL_ERROR;
 			}
-		} else if (objc == 4) {
-		
-			/* get feature index to read */			
-			if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
+		} else if (objc >= 4 && strcmp(Tcl_GetString(objv[3]), "-async") == 0) {
+			
+			/* return immediately; coords are passed to a callback in chunks */
+			if (cmd_coordinates_readAsync(interp, shapefile, objc - 4, objv + 4) != TCL_OK) {
 				return TCL_ERROR;
 			}
+		} else if (objc >= 5 && (shapefile_isConvertOption(objv[3])
+				|| shapefile_isConvertOption(objv[4]))) {
 			
-			/* return coords of specified feature index */
-			if (cmd_coordinates_read(interp, shapefile, featureId) != TCL_OK) {
+			/* return coords of one or all features, simplified or transformed */
+			if (cmd_coordinates_readConverted(interp, shapefile, objc, objv) != TCL_OK) {
 				return TCL_ERROR;
 			}
+		} else if (objc == 5 && strcmp(Tcl_GetString(objv[3]), "-threads") == 0) {
+			int threadCount;
 			
-		} else {
-			Tcl_WrongNumArgs(interp, 3, objv, "?index?");
-			return TCL_ERROR;
+			/* return coords of all features, decoded by worker threads */
+			if (Tcl_GetIntFromObj(interp, objv[4], &threadCount) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (threadCount < 1) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid thread count %d", threadCount));
+				return TCL_ERROR;
+			}
+			if (cmd_coordinates_readThreads(interp, shapefile, threadCount) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		} else if (objc == 4) {
+		
+			/* get feature index to read */			
+			if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			/* return coords of specified feature index */
+			if (cmd_coordinates_read(interp, shapefile, featureId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+		} else {
+			Tcl_WrongNumArgs(interp, 3, objv, "?index? ?-project {from to}? ?-clip window? ?-simplify tolerance ?-method dp|vw?? ?-transform matrix? ?-viewport viewport?|-threads count|-async -command callback ?-bbox bounds? ?-chunk count??");
+			return TCL_ERROR;
 		}
 	} else if (subcommandIndex == 1) {
 		/* write coords */
+		struct shapefile_projection projection;
+		ShapefileProjectionPtr projectionPtr = NULL;
+		int returnValue = TCL_ERROR;
+		
+		/* a trailing -project option converts coords before they're written */
+		if ((objc == 6 || objc == 7) && strcmp(Tcl_GetString(objv[objc - 2]), "-project") == 0) {
+			if (shapefile_projectionParse(interp, objv[objc - 1], &projection) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			projectionPtr = &projection;
+			objc -= 2;
+		}
 		
 		if (objc == 4) {
 			/* write coords to a new feature; create complementary blank attribute record */
 			int recordId;
 			
 			/* write coords to a new feature */
-			if (cmd_coordinates_write(interp, shapefile, -1, objv[3]) != TCL_OK) {
-				return TCL_ERROR;
+			if (cmd_coordinates_write(interp, shapefile, -1, objv[3], projectionPtr) != TCL_OK) {
+				goto writeCleanup;
 			}
 			
 			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &featureId);
@@ -1702,13 +3285,13 @@ int cmd_coordinates(
 			
 			/* interp result is new feature id; create a null attribute record to match */
 			if (cmd_attributes_write(interp, shapefile, -1, 0, NULL) != TCL_OK) {
-				return TCL_ERROR;
+				goto writeCleanup;
 			}
 			
 			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &recordId);
 			if (featureId != recordId) {
 				Tcl_SetObjResult(interp, Tcl_ObjPrintf("new feature index (%d) does not match new empty attribute record index (%d)", featureId, recordId));
-				return TCL_ERROR;
+				goto writeCleanup;
 			}
 				
 		} else if (objc == 5) {
@@ -1716,22 +3299,29 @@ int cmd_coordinates(
 			
 			/* get feature index to overwrite */
 			if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
-				return TCL_ERROR;
+				goto writeCleanup;
 			}
 
 			if (featureId == -1) {
 				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d (use write command)", featureId));
-				return TCL_ERROR;
+				goto writeCleanup;
 			}
 			
 			/* if shape output is successful, interp result is set to output feature id */
-			if (cmd_coordinates_write(interp, shapefile, featureId, objv[4]) != TCL_OK) {
-				return TCL_ERROR;
+			if (cmd_coordinates_write(interp, shapefile, featureId, objv[4], projectionPtr) != TCL_OK) {
+				goto writeCleanup;
 			}
 		} else {
-			Tcl_WrongNumArgs(interp, 3, objv, "?index? coordinates");
-			return TCL_ERROR;
+			Tcl_WrongNumArgs(interp, 3, objv, "?index? coordinates ?-project {from to}?");
+			goto writeCleanup;
+		}
+		returnValue = TCL_OK;
+
+	   writeCleanup:
+		if (projectionPtr != NULL) {
+			shapefile_projectionFree(projectionPtr);
 		}
+		return returnValue;
 	}
 		
 	return TCL_OK;
@@ -1742,7 +3332,8 @@ int cmd_coordinates(
  * 
  * Implements the [$shp coordinates write ?FEATURE? COORDINATELIST] actions of
  * the [$shp coordinates] command, used to set the coordinates of a new feature
- * or to overwrite the coordinates of an existing feature.
+ * or to overwrite the coordinates of an existing feature. If projection is not
+ * NULL, the x and y coordinates are converted by it before they're written.
  * 
  * Result:
  *   Index number of the feature that was written.
@@ -1751,7 +3342,8 @@ int cmd_coordinates_write(
 		Tcl_Interp *interp,
 		ShapefilePtr shapefile,
 		int featureId,
-		Tcl_Obj *coordParts) {
+		Tcl_Obj *coordParts,
+		ShapefileProjectionPtr projection) {
 	
 	int featureCount;
 	int outputFeatureId;
@@ -1770,12 +3362,20 @@ int cmd_coordinates_write(
 		return TCL_ERROR;
 	}
 	
+	/* background readers expect records to stay where the index says */
+	if (shapefile->asyncReads != NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write coordinates during asynchronous read"));
+		return TCL_ERROR;
+	}
+	
 	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
 	if (featureId < -1 || featureId >= featureCount) {
 		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
 		return TCL_ERROR;
 	}
 	/* a featureId of -1 indicates a new feature should be output */
+	shapefile_cacheInvalidate(shapefile, featureId, 0);
+	shapefile_spatialInvalidate(shapefile);
 	
 	/* write a null feature if the coordinate list is a NULL pointer */
 	if (coordParts == NULL) {
@@ -2002,6 +3602,14 @@ int cmd_coordinates_write(
 		}
 	}
 	
+	/* convert the whole feature at once; rings stay closed, since each
+	   vertex is converted the same way */
+	if (projection != NULL && shapefile_projectCoords(interp, projection,
+			xCoords, yCoords, vertexCount) != TCL_OK) {
+		returnValue = TCL_ERROR;
+		goto cwRelease;
+	}
+	
 	/* assemble the coordinate lists into a new shape (z & m may be NULL) */
 	if ((shape = SHPCreateObject(shapefile->shapeType, featureId, partCount,
 			partStarts, NULL, vertexCount, xCoords, yCoords, zCoords, mCoords)) == NULL) {
@@ -2103,923 +3711,10160 @@ int cmd_coordinates_readAll(
 }
 
 /*
- * cmd_coordinates_read
+ * cmd_coordinates_readThreads
  * 
- * Implements the [$shp coordinates read FEATURE] action of the [$shp
- * coordinates] command, used to get coordinate list of the specified featured.
- * Also used by the [$shp coordinates read] action to get each feature's coords.
+ * Implements the [$shp coordinates read -threads COUNT] action of the [$shp
+ * coordinates] command. Features are divided into COUNT contiguous ranges,
+ * each read and decoded by a worker thread with its own .shp handle (see
+ * shapefile_cloneHandle); the coordinate lists are then built in feature
+ * order by the calling thread. If threads are unavailable, or the shapefile
+ * is read through Tcl channels (which belong to the thread that opened
+ * them), ranges are decoded by the calling thread instead.
  * 
  * Result:
- *   Coordinate list for the specified feature.
+ *   List containing a coordinate list for each feature in shapefile, the same
+ *   as [$shp coordinates read].
  */
-int cmd_coordinates_read(
+int cmd_coordinates_readThreads(
 		Tcl_Interp *interp,
 		ShapefilePtr shapefile,
-		int featureId) {
+		int threadCount) {
 	
-	SHPObject *shape;
-	Tcl_Obj *coordParts;
-	int featureCount, part, partCount, vertex, vertexStart, vertexStop;
+	ShapefileDecodeRangePtr ranges;
+	SHPObject **shapes;
+	char *skip = NULL;
+	SHPInfo info;
+	Tcl_Obj *featureList;
+	int featureCount, featureId, rangeIndex, threadResult;
 	int returnValue = TCL_OK;
+	int channel = shapefile_channelPath(shapefile->path);
 	
 	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
-	if (featureId < 0 || featureId >= featureCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
-		return TCL_ERROR;
+	if (featureCount == 0) {
+		Tcl_SetObjResult(interp, Tcl_NewObj());
+		return TCL_OK;
 	}
-	
-	if ((shape = SHPReadObject(shapefile->shp, featureId)) == NULL) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
-		return TCL_ERROR;
+	if (threadCount > featureCount) {
+		threadCount = featureCount;
 	}
 	
-	/* If this is a NULL shape, return empty list {} explicitly (just leaving
-	   coordParts empty would return a list containing an empty list). */
-	if (shape->nSHPType == SHPT_NULL) {
-		Tcl_SetObjResult(interp, Tcl_NewObj());
-		return TCL_OK;
+	/* workers read from their own descriptors, so pending writes must reach
+	   the .shp file first; the offset table is current in memory */
+	if (shapefile->shp->fpSHX != NULL) {
+		shapefile->shp->sHooks.FFlush(shapefile->shp->fpSHP);
 	}
 	
-	/* prepare a list of coordinate lists; each member list represents one part
-	   (a "ring") of the feature. Some features only have one part. */
-	coordParts = Tcl_NewListObj(0, NULL);
+	/* the attribute table is not safe to read from workers, so deleted
+	   features to skip are determined in advance */
+	if (shapefile->skipDeleted) {
+		skip = ckalloc((unsigned int)featureCount);
+		for (featureId = 0; featureId < featureCount; featureId++) {
+			skip[featureId] = (char)DBFIsRecordDeleted(shapefile->dbf, featureId);
+		}
+	}
 	
-	/* initialize vertex indices. if there's only one part, add all vertices;
-	   if there are multiple parts, stop adding vertices at 1st part boundary */
-	part = 0;
-	vertexStart = 0;
-	if (shape->nParts < 2) {
-		partCount = 1;
-		vertexStop = shape->nVertices;
-	} else {
-		partCount = shape->nParts;
-		vertexStop = shape->panPartStart[1];
+	shapes = (SHPObject **)ckalloc((unsigned int)(sizeof(SHPObject *) * featureCount));
+	memset(shapes, 0, sizeof(SHPObject *) * featureCount);
+	ranges = (ShapefileDecodeRangePtr)ckalloc((unsigned int)(sizeof(struct shapefile_decodeRange) * threadCount));
+	memset(ranges, 0, sizeof(struct shapefile_decodeRange) * threadCount);
+	
+	/* clones share this handle's offset table but none of its files */
+	memcpy(&info, shapefile->shp, sizeof(SHPInfo));
+	info.fpSHP = NULL;
+	info.fpSHX = NULL;
+	info.pabyRec = NULL;
+	info.nBufSize = 0;
+	info.bUpdated = 0;
+	
+	for (rangeIndex = 0; rangeIndex < threadCount; rangeIndex++) {
+		ShapefileDecodeRangePtr range = &ranges[rangeIndex];
+		
+		range->shapes = shapes;
+		range->skip = skip;
+		range->start = (int)(((Tcl_WideInt)featureCount * rangeIndex) / threadCount);
+		range->stop = (int)(((Tcl_WideInt)featureCount * (rangeIndex + 1)) / threadCount);
+		
+		if ((range->shp = shapefile_cloneHandle(shapefile->path, &info)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", shapefile->path));
+			returnValue = TCL_ERROR;
+			break;
+		}
+		
+		range->threaded = !channel && Tcl_CreateThread(&range->threadId, cmd_coordinates_decodeRange,
+				(ClientData)range, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) == TCL_OK;
 	}
 	
-	while (part < partCount) {
+	/* decode any ranges that could not be given a thread here, then wait for
+	   the others; every range with a handle must finish before cleanup */
+	for (rangeIndex = 0; rangeIndex < threadCount; rangeIndex++) {
+		ShapefileDecodeRangePtr range = &ranges[rangeIndex];
 		
-		/* prepare a coordinate list for this part */
-		Tcl_Obj *coords = Tcl_NewListObj(0, NULL);
+		if (range->shp == NULL) {
+			continue;
+		}
+		if (range->threaded) {
+			(void)Tcl_JoinThread(range->threadId, &threadResult);
+		} else if (returnValue == TCL_OK) {
+			cmd_coordinates_decodeRange((ClientData)range);
+		}
 		
-		/* get the vertex coordinates for this part */
-		for (vertex = vertexStart; vertex < vertexStop; vertex++) {
-			if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfX[vertex])) != TCL_OK) {
-				returnValue = TCL_ERROR;
-				goto crRelease;
-			}
-			if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfY[vertex])) != TCL_OK) {
-				returnValue = TCL_ERROR;
-				goto crRelease;
-			}
-			
-			/* don't bother considering Z or M coords if only xy is requested */
-			if (shapefile->getOnlyXyCoords) {
-				continue;
-			}
-			
-			/* for Z type features, append Z coordinate before Measure */
-			if (shapefile->getAllCoords
-					|| shapefile->dimType == DIM_XYZM) {
-				
-				if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfZ[vertex])) != TCL_OK) {
-					returnValue = TCL_ERROR;
-					goto crRelease;
-				}
-			}
-			
-			/* for M and Z type features, append Measure (if used) last */
-			if (shapefile->getAllCoords
-					|| shapefile->dimType == DIM_XYZM
-					|| shapefile->dimType == DIM_XYM) {
-				
-				/* append M coordinate, or 0.0 if unused despite type */
-				if (Tcl_ListObjAppendElement(interp, coords,
-						Tcl_NewDoubleObj(shape->bMeasureIsUsed ? shape->padfM[vertex] : 0.0)) != TCL_OK) {
-					returnValue = TCL_ERROR;
-					goto crRelease;
-				}
-			}			
+		/* SHPClose must not free the borrowed offset table */
+		range->shp->panRecOffset = NULL;
+		range->shp->panRecSize = NULL;
+		SHPClose(range->shp);
+	}
+	
+	if (returnValue != TCL_OK) {
+		goto crtRelease;
+	}
+	
+	featureList = Tcl_NewListObj(0, NULL);
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		
+		/* deleted features are read as empty, as by cmd_coordinates_read */
+		if (skip != NULL && skip[featureId]) {
+			Tcl_ListObjAppendElement(interp, featureList, Tcl_NewObj());
+			continue;
 		}
 		
-		/* add this part's coordinate list to the feature's part list */
-		if (Tcl_ListObjAppendElement(interp, coordParts, coords) != TCL_OK) {
+		if (shapes[featureId] == NULL) {
+			Tcl_DecrRefCount(featureList);
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
 			returnValue = TCL_ERROR;
-			goto crRelease;
+			goto crtRelease;
 		}
 		
-		/* advance vertex indices to the next part (disregarded if none) */
-		vertexStart = vertex;
-		if (part + 2 < partCount) {
-			vertexStop = shape->panPartStart[part + 2];
-		} else {
-			vertexStop = shape->nVertices;
+		if (cmd_coordinates_shape(interp, shapefile, shapes[featureId]) != TCL_OK) {
+			Tcl_DecrRefCount(featureList);
+			returnValue = TCL_ERROR;
+			goto crtRelease;
 		}
-		part++;
+		Tcl_ListObjAppendElement(interp, featureList, Tcl_GetObjResult(interp));
+		Tcl_ResetResult(interp);
+		
+		/* release each shape as soon as it has been formatted */
+		SHPDestroyObject(shapes[featureId]);
+		shapes[featureId] = NULL;
 	}
 	
-	Tcl_SetObjResult(interp, coordParts);
-
-   crRelease:
-	SHPDestroyObject(shape);
+	Tcl_SetObjResult(interp, featureList);
+	
+   crtRelease:
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		if (shapes[featureId] != NULL) {
+			SHPDestroyObject(shapes[featureId]);
+		}
+	}
+	ckfree((char *)shapes);
+	ckfree((char *)ranges);
+	if (skip != NULL) {
+		ckfree(skip);
+	}
 	return returnValue;
 }
 
 /*
- * cmd_attributes
+ * cmd_coordinates_decodeRange
  * 
- * Implements the [$shp attributes] command used to get or set attribute data.
+ * Worker thread procedure of cmd_coordinates_readThreads. Reads each feature
+ * in the given range with the range's own handle. Features that cannot be
+ * read are left NULL and reported by the calling thread.
+ */
+Tcl_ThreadCreateType cmd_coordinates_decodeRange(ClientData clientData) {
+	
+	ShapefileDecodeRangePtr range = (ShapefileDecodeRangePtr)clientData;
+	int featureId;
+	
+	for (featureId = range->start; featureId < range->stop; featureId++) {
+		if (range->skip != NULL && range->skip[featureId]) {
+			continue;
+		}
+		range->shapes[featureId] = SHPReadObject(range->shp, featureId);
+	}
+	
+	TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * cmd_coordinates_readAsync
  * 
- * Command Syntax:
- *   [$shp attributes read RECORD FIELD]
- *     Get the value of one field in one record.
- *   [$shp attributes read RECORD]
- *     Get the value of all fields in one record.
- *   [$shp attributes read]
- *     Get the value of all fields in all records.
- *   [$shp attributes write RECORD FIELD VALUE]
- *     Set the value of one field in one record.
- *   [$shp attributes write RECORD VALUELIST]
- *     Set the value of all fields in one record.
- *   [$shp attributes write VALUELIST]
- *     Set the value of all fields in a new record. The record is appended to
- *     the attribute table. A new feature with NULL geometry is also created.
- *   [$shp attributes search FIELD VALUE]
- *     Return record indices of features that match the given field value.
+ * Implements the [$shp coordinates read -async] action of the [$shp
+ * coordinates] command. Starts a background thread that reads and decodes
+ * features in order, queueing them in chunks to the calling thread with
+ * Tcl_ThreadQueueEvent. As each chunk is serviced by the event loop, the
+ * callback is invoked at global level with two arguments appended: a list of
+ * feature indices and a list of the corresponding coordinate lists. A final
+ * call with two empty lists indicates that the read is complete. Callback
+ * and read errors are reported as background errors; a callback error stops
+ * the read. Closing the shapefile cancels its reads without a final call.
+ * 
+ * Options (objv begins after -async):
+ *   -command CALLBACK
+ *     Command prefix to invoke with each chunk. Required.
+ *   -bbox {XMIN YMIN XMAX YMAX}
+ *     Only report features whose bounding box intersects these bounds.
+ *     Null features are omitted.
+ *   -chunk COUNT
+ *     Maximum number of features per callback (default ASYNC_CHUNK_SIZE).
  * 
  * Result:
- *   Read actions return attribute data in value (X), value list ({X Y Z}), or
- *   value list list ({{X Y Z} {A B C} {1 2 3}}) format, respectively.
- *   Write actions return the index of the written attribute record.
- *   The search action returns a list of record indices.
+ *   No Tcl result on success. Otherwise, throws error.
  */
-int cmd_attributes(
-		ClientData clientData,
+int cmd_coordinates_readAsync(
 		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
 		int objc,
 		Tcl_Obj *CONST objv[]) {
-
-	ShapefilePtr shapefile = (ShapefilePtr)clientData;
-	int recordId;
-	int actionIndex;
-	static const char *actionNames[] = {
-			"read",
-			"write",
-			"search",
-			NULL
-	};
-	
-	if (objc < 3) {
-		Tcl_WrongNumArgs(interp, 2, objv, "action ?args?");
-		return TCL_ERROR;
-	}
-	if (Tcl_GetIndexFromObj(interp, objv[2], actionNames, "action", TCL_EXACT, &actionIndex) != TCL_OK) {
-		return TCL_ERROR;
-	}
-	
-	if (actionIndex == 0) {
-		/* read attributes */
-		
-		if (objc == 3) {
-			/* return attributes of all records */
-			if (cmd_attributes_readAll(interp, shapefile) != TCL_OK) {
-				return TCL_ERROR;
-			}
-		} else if (objc == 4) {
-			/* return attributes of specified index */
 	
-			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+	static const char *optionNames[] = {"-bbox", "-chunk", "-command", NULL};
+	ShapefileAsyncReadPtr job;
+	Tcl_Obj *command = NULL;
+	Tcl_Obj **boundsElements;
+	int boundsCount, optionIndex, i, featureId;
+	int useBounds = 0, chunkSize = ASYNC_CHUNK_SIZE;
+	double bounds[4] = {0.0, 0.0, 0.0, 0.0};
+	SHPInfo info;
+	
+	for (i = 0; i < objc; i++) {
+		if (Tcl_GetIndexFromObj(interp, objv[i], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (i + 1 >= objc) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing value for %s option", optionNames[optionIndex]));
+			return TCL_ERROR;
+		}
+		i++;
+		if (optionIndex == 0) {
+			if (Tcl_ListObjGetElements(interp, objv[i], &boundsCount, &boundsElements) != TCL_OK) {
 				return TCL_ERROR;
 			}
-			
-			if (cmd_attributes_read(interp, shapefile, recordId) != TCL_OK) {
+			if (boundsCount != 4) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("bounds must be a list of 4 values (xmin ymin xmax ymax)"));
 				return TCL_ERROR;
 			}
-			
-		} else if (objc == 5) {
-			/* return value of specified field of specified index */
-			int fieldId;
-						
-			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
-				return TCL_ERROR;
+			for (boundsCount = 0; boundsCount < 4; boundsCount++) {
+				if (Tcl_GetDoubleFromObj(interp, boundsElements[boundsCount], &bounds[boundsCount]) != TCL_OK) {
+					return TCL_ERROR;
+				}
 			}
-			
-			if (Tcl_GetIntFromObj(interp, objv[4], &fieldId) != TCL_OK) {
+			if (bounds[0] > bounds[2] || bounds[1] > bounds[3]) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid bounds (minimum exceeds maximum)"));
 				return TCL_ERROR;
 			}
-			
-			/* sets interp result to field value; validates recordId and fieldId */
-			if (cmd_attributes_readField(interp, shapefile, recordId, fieldId) != TCL_OK) {
-				return TCL_ERROR;
-			}			
-		} else {
-			Tcl_WrongNumArgs(interp, 3, objv, "?recordIndex ?fieldIndex??");
-			return TCL_ERROR;
-		}	
-	} else if (actionIndex == 1) {
-		/* write attributes */
-		
-		if (objc == 4) {
-			/* write attributes to new record; create complementary null shape */
-			int featureId;
-			
-			if (cmd_attributes_write(interp, shapefile, -1 /* new record */, 1 /* validate */, objv[3]) != TCL_OK) {
+			useBounds = 1;
+		} else if (optionIndex == 1) {
+			if (Tcl_GetIntFromObj(interp, objv[i], &chunkSize) != TCL_OK) {
 				return TCL_ERROR;
 			}
-			
-			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &recordId);
-			Tcl_ResetResult(interp);
-			
-			if (cmd_coordinates_write(interp, shapefile, -1 /* new record */, NULL /* no coordinates */) != TCL_OK) {
+			if (chunkSize < 1) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid chunk size %d", chunkSize));
 				return TCL_ERROR;
 			}
-			
-			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &featureId);
-			if (recordId != featureId) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("new record index (%d) does not match new null feature index (%d)", recordId, featureId));
-				return TCL_ERROR;
-			}
-			
-		} else if (objc == 5) {
-			/* write attributes to record index */
-			
-			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			if (recordId == -1) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d (use write command)", recordId));
-				return TCL_ERROR;
-			}
-			
-			/* if successful, sets interp's result to the recordId of the written record */
-			if (cmd_attributes_write(interp, shapefile, recordId, 1 /* validate */, objv[4]) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			
-		} else if (objc == 6) {
-			/* write value to field index of record index */
-			int fieldId;
-			
-			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
-				return TCL_ERROR;
-			}
-				
-			if (Tcl_GetIntFromObj(interp, objv[4], &fieldId) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			
-			if (cmd_attributes_writeField(interp, shapefile, recordId, fieldId, 1 /* validate */, objv[5]) != TCL_OK) {
-				return TCL_ERROR;
-			}
-		} else {
-			Tcl_WrongNumArgs(interp, 3, objv, "?recordIndex ?fieldIndex?? attributes");
-			return TCL_ERROR;
-		}
-	} else if (actionIndex == 2) {
-		/* search for attribute value */
-		
-		if (objc == 5) {
-			
-			int fieldId;
-			
-			if (Tcl_GetIntFromObj(interp, objv[3], &fieldId) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			
-			if (cmd_attributes_search(interp, shapefile, fieldId, objv[4]) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			
 		} else {
-			Tcl_WrongNumArgs(interp, 3, objv, "FIELD VALUE");
-			return TCL_ERROR;
+			command = objv[i];
 		}
 	}
-			
-	return TCL_OK;
-}
-
-/*
- * cmd_attributes_write
- * 
- * Implements the [$shp attributes write ?RECORD? VALUELIST] action of the
- * [$shp attributes] command, used to write values to a new or existing record.
- * 
- * Result:
- *   Index number of the attribute record that was written.
- */
-int cmd_attributes_write(
-		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int recordId,
-		int validate,
-		Tcl_Obj *attrList) {
-	
-	Tcl_Obj *attr;
-	int fieldId, fieldCount, attrCount, dbfCount;
 	
-	if (shapefile->readonly) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write attributes to readonly shapefile"));
+	if (command == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing -command option"));
 		return TCL_ERROR;
 	}
 	
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-	if (recordId < -1 || recordId >= dbfCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+	/* channels cannot be handed to the worker thread */
+	if (shapefile_channelPath(shapefile->path)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("asynchronous reads are not supported for shapefiles in virtual filesystems"));
 		return TCL_ERROR;
 	}
-	if (recordId == -1) {
-		recordId = dbfCount;
-	}
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	job = (ShapefileAsyncReadPtr)ckalloc((unsigned int)sizeof(struct shapefile_asyncRead));
+	memset(job, 0, sizeof(struct shapefile_asyncRead));
+	job->interp = interp;
+	job->shapefile = shapefile;
+	job->command = command;
+	Tcl_IncrRefCount(command);
+	job->owner = Tcl_GetCurrentThread();
+	job->chunkSize = chunkSize;
+	job->useBounds = useBounds;
+	job->min[0] = bounds[0];
+	job->min[1] = bounds[1];
+	job->max[0] = bounds[2];
+	job->max[1] = bounds[3];
+	SHPGetInfo(shapefile->shp, &job->featureCount, NULL, NULL, NULL);
+	
+	/* as for -threads; the worker reads only records already on disk */
+	if (shapefile->shp->fpSHX != NULL) {
+		shapefile->shp->sHooks.FFlush(shapefile->shp->fpSHP);
+	}
 	
-	/* write null values for all fields if attrList is NULL... */
-	if (attrList == NULL) {
-		return cmd_attributes_writeNull(interp, shapefile, recordId);
+	if (shapefile->skipDeleted && job->featureCount > 0) {
+		job->skip = ckalloc((unsigned int)job->featureCount);
+		for (featureId = 0; featureId < job->featureCount; featureId++) {
+			job->skip[featureId] = (char)DBFIsRecordDeleted(shapefile->dbf, featureId);
+		}
 	}
 	
-	/* verify the provided attribute value list matches field count */
-	if (Tcl_ListObjLength(interp, attrList, &attrCount) != TCL_OK) {
+	/* the worker gets its own offset table, since the shapefile's may be
+	   reallocated by writes to other shapefile attributes meanwhile; it is
+	   allocated like Shapelib's, so SHPClose frees it */
+	memcpy(&info, shapefile->shp, sizeof(SHPInfo));
+	info.fpSHP = NULL;
+	info.fpSHX = NULL;
+	info.pabyRec = NULL;
+	info.nBufSize = 0;
+	info.bUpdated = 0;
+	info.nMaxRecords = job->featureCount;
+	info.panRecOffset = (SAOffset *)malloc(sizeof(SAOffset) * (job->featureCount + 1));
+	info.panRecSize = (unsigned int *)malloc(sizeof(unsigned int) * (job->featureCount + 1));
+	if (info.panRecOffset == NULL || info.panRecSize == NULL) {
+		free(info.panRecOffset);
+		free(info.panRecSize);
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate feature index"));
+		cmd_coordinates_asyncFree((char *)job);
 		return TCL_ERROR;
 	}
-	
-	/* ...also write a null record if an empty list is recieved */
-	if (attrCount == 0) {
-		return cmd_attributes_writeNull(interp, shapefile, recordId);
-	} else if (attrCount != fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute count (%d) does not match field count (%d)", attrCount, fieldCount));
+	memcpy(info.panRecOffset, shapefile->shp->panRecOffset, sizeof(SAOffset) * job->featureCount);
+	memcpy(info.panRecSize, shapefile->shp->panRecSize, sizeof(unsigned int) * job->featureCount);
+	
+	if ((job->shp = shapefile_cloneHandle(shapefile->path, &info)) == NULL) {
+		free(info.panRecOffset);
+		free(info.panRecSize);
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", shapefile->path));
+		cmd_coordinates_asyncFree((char *)job);
 		return TCL_ERROR;
 	}
 	
-	/* in the attributes command context, we validate now; w/the write command,
-	   we receive attrList pre-validated and can proceed to write it as-is. */
-	if (validate && (cmd_attributes_validate(interp, shapefile, attrList) != TCL_OK)) {
+	if (Tcl_CreateThread(&job->threadId, cmd_coordinates_asyncWorker, (ClientData)job,
+			TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create thread for asynchronous read"));
+		cmd_coordinates_asyncFree((char *)job);
 		return TCL_ERROR;
 	}
+	
+	job->next = shapefile->asyncReads;
+	shapefile->asyncReads = job;
+	return TCL_OK;
+}
+
+/*
+ * cmd_coordinates_asyncWorker
+ * 
+ * Background thread procedure of cmd_coordinates_readAsync. Reads features
+ * until done or cancelled, queueing each full chunk as it is completed. The
+ * final event is always queued, even if the job was cancelled.
+ */
+Tcl_ThreadCreateType cmd_coordinates_asyncWorker(ClientData clientData) {
+	
+	ShapefileAsyncReadPtr job = (ShapefileAsyncReadPtr)clientData;
+	SHPObject *shape;
+	SHPObject **shapes = NULL;
+	int *featureIds = NULL;
+	int featureId, count = 0, failedId = -1, cancelled;
+	
+	for (featureId = 0; featureId < job->featureCount; featureId++) {
 		
-	/* output pass - once the fields are validated, write 'em out. Output is
-	   performed separately from validation to avoid mangled/partial output. */
-	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		Tcl_MutexLock(&job->mutex);
+		cancelled = job->cancelled;
+		Tcl_MutexUnlock(&job->mutex);
+		if (cancelled) {
+			break;
+		}
 		
-		/* grab the attr provided for this field */
-		if (Tcl_ListObjIndex(interp, attrList, fieldId, &attr) != TCL_OK) {
-			return TCL_ERROR;
+		if (job->skip != NULL && job->skip[featureId]) {
+			continue;
 		}
-	
-		/* writes value attr to field fieldId of record recordId; sets interp result to recordId */
-		if (cmd_attributes_writeField(interp, shapefile, recordId, fieldId, 0 /* no validation */, attr) != TCL_OK) {
-			return TCL_ERROR;
+		
+		if ((shape = SHPReadObject(job->shp, featureId)) == NULL) {
+			failedId = featureId;
+			break;
 		}
-	}
 		
-	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
-	return TCL_OK;
+		if (job->useBounds && (shape->nSHPType == SHPT_NULL
+				|| shape->dfXMax < job->min[0] || shape->dfXMin > job->max[0]
+				|| shape->dfYMax < job->min[1] || shape->dfYMin > job->max[1])) {
+			SHPDestroyObject(shape);
+			continue;
+		}
+		
+		if (shapes == NULL) {
+			shapes = (SHPObject **)ckalloc((unsigned int)(sizeof(SHPObject *) * job->chunkSize));
+			featureIds = (int *)ckalloc((unsigned int)(sizeof(int) * job->chunkSize));
+		}
+		shapes[count] = shape;
+		featureIds[count] = featureId;
+		
+		if (++count == job->chunkSize) {
+			cmd_coordinates_asyncPost(job, count, featureIds, shapes, 0, -1);
+			shapes = NULL;
+			featureIds = NULL;
+			count = 0;
+		}
+	}
+	
+	cmd_coordinates_asyncPost(job, count, featureIds, shapes, 1, failedId);
+	TCL_THREAD_CREATE_RETURN;
 }
 
 /*
- * cmd_attributes_writeNull
- *
- * Write a null attribute record (null values are written to all fields).
- *
+ * cmd_coordinates_asyncPost
+ * 
+ * Queue a chunk of decoded shapes from an async read worker to the job's
+ * owner thread. The event takes ownership of the featureIds and shapes.
+ */
+void cmd_coordinates_asyncPost(
+		ShapefileAsyncReadPtr job,
+		int count,
+		int *featureIds,
+		SHPObject **shapes,
+		int final,
+		int failedId) {
+	
+	ShapefileAsyncEventPtr event;
+	
+	event = (ShapefileAsyncEventPtr)ckalloc((unsigned int)sizeof(struct shapefile_asyncEvent));
+	event->header.proc = cmd_coordinates_asyncEvent;
+	event->job = job;
+	event->count = count;
+	event->featureIds = featureIds;
+	event->shapes = shapes;
+	event->final = final;
+	event->failedId = failedId;
+	
+	Tcl_ThreadQueueEvent(job->owner, (Tcl_Event *)event, TCL_QUEUE_TAIL);
+	Tcl_ThreadAlert(job->owner);
+}
+
+/*
+ * cmd_coordinates_asyncEvent
+ * 
+ * Event procedure for chunks queued by cmd_coordinates_asyncPost. Formats
+ * the chunk's shapes as coordinate lists and invokes the job's callback. The
+ * interpreter result is preserved. Chunks of cancelled jobs are discarded.
+ * 
  * Result:
- *   Index number of the null record that was written.
+ *   1, since the event is always fully handled.
  */
-int cmd_attributes_writeNull(
-		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int recordId) {
+int cmd_coordinates_asyncEvent(
+		Tcl_Event *evPtr,
+		int flags) {
+	
+	ShapefileAsyncEventPtr event = (ShapefileAsyncEventPtr)evPtr;
+	ShapefileAsyncReadPtr job = event->job;
+	Tcl_Interp *interp = job->interp;
+	Tcl_InterpState state;
+	Tcl_Obj *featureIdList, *featureList;
+	int i, final = event->final, failedId = event->failedId;
+	int cancelled = job->cancelled;
+	
+	/* the callback may close the shapefile, releasing the job and deleting
+	   this event, so only these locals may be used after it is invoked */
+	Tcl_Preserve((ClientData)job);
+	Tcl_Preserve((ClientData)interp);
+	
+	state = Tcl_SaveInterpState(interp, TCL_OK);
+	featureIdList = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(featureIdList);
+	featureList = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(featureList);
+	for (i = 0; i < event->count; i++) {
+		if (!cancelled && cmd_coordinates_shape(interp, job->shapefile, event->shapes[i]) == TCL_OK) {
+			Tcl_ListObjAppendElement(NULL, featureIdList, Tcl_NewIntObj(event->featureIds[i]));
+			Tcl_ListObjAppendElement(NULL, featureList, Tcl_GetObjResult(interp));
+		}
+		SHPDestroyObject(event->shapes[i]);
+	}
+	if (event->shapes != NULL) {
+		ckfree((char *)event->shapes);
+		ckfree((char *)event->featureIds);
+	}
+	event->shapes = NULL;
+	event->featureIds = NULL;
+	event->count = 0;
 	
-	int fieldId, fieldCount;
+	/* the worker has queued its last event, so it can be joined now */
+	if (final) {
+		cmd_coordinates_asyncFinish(job);
+	}
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (cancelled) {
+		goto caeRelease;
+	}
 	
-	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
-		if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute"));
-			return TCL_ERROR;
-		}
+	if (failedId >= 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", failedId));
+		Tcl_BackgroundError(interp);
 	}
 	
-	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
-	return TCL_OK;
+	/* a callback error stops the read; any queued chunks are discarded */
+	(void)Tcl_ListObjLength(NULL, featureIdList, &i);
+	if (i > 0 && cmd_coordinates_asyncCallback(job, featureIdList, featureList) != TCL_OK) {
+		Tcl_BackgroundError(interp);
+		Tcl_MutexLock(&job->mutex);
+		job->cancelled = 1;
+		Tcl_MutexUnlock(&job->mutex);
+		goto caeRelease;
+	}
+	
+	if (final && cmd_coordinates_asyncCallback(job, Tcl_NewObj(), Tcl_NewObj()) != TCL_OK) {
+		Tcl_BackgroundError(interp);
+	}
+	
+   caeRelease:
+	Tcl_DecrRefCount(featureIdList);
+	Tcl_DecrRefCount(featureList);
+	Tcl_RestoreInterpState(interp, state);
+	Tcl_Release((ClientData)interp);
+	Tcl_Release((ClientData)job);
+	return 1;
 }
 
 /*
- * cmd_attributes_writeField
- * 
- * Implements the [$shp attributes write RECORD FIELD VALUE] action of the
- * [$shp attributes] command, used to set the value of a single field of a
- * specified attribute record. Also used by the [$shp attributes write
- * ?RECORD? VALUELIST] action to set each value in the record.
+ * cmd_coordinates_asyncCallback
  * 
- * The boolean validate argument indicates whether the attribute values AND
- * recordId need to be validated. If false, they are assumed to be pre-checked.
+ * Invoke the callback of an async read job at global level with featureIds
+ * and features appended as arguments.
  * 
  * Result:
- *   Index number of the record containing the value that was written.
+ *   Result code of the callback.
  */
-int cmd_attributes_writeField(
-		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int recordId,
-		int fieldId,
-		int validate,
-		Tcl_Obj *attrValue) {
-	
-	int dbfCount, fieldCount;
-	int intValue;
-	double doubleValue;
-	const char *stringValue;
-	int width, precision, reserved;
-	char buffer[NUMERIC_BUFFER_SIZE];
-	
-	if (shapefile->readonly) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write attribute value to readonly shapefile"));
+int cmd_coordinates_asyncCallback(
+		ShapefileAsyncReadPtr job,
+		Tcl_Obj *featureIds,
+		Tcl_Obj *features) {
+	
+	Tcl_Obj *script;
+	int returnValue;
+	
+	script = Tcl_DuplicateObj(job->command);
+	Tcl_IncrRefCount(script);
+	if (Tcl_ListObjAppendElement(job->interp, script, featureIds) != TCL_OK
+			|| Tcl_ListObjAppendElement(job->interp, script, features) != TCL_OK) {
+		Tcl_DecrRefCount(script);
 		return TCL_ERROR;
 	}
+	returnValue = Tcl_EvalObjEx(job->interp, script, TCL_EVAL_GLOBAL);
+	Tcl_DecrRefCount(script);
+	return returnValue;
+}
 
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-	if (validate && (recordId < 0 || recordId >= dbfCount)) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
-		return TCL_ERROR;
+/*
+ * cmd_coordinates_asyncDiscard
+ * 
+ * Tcl_DeleteEvents procedure used to discard events queued for the async
+ * read job given as clientData, freeing their shapes.
+ * 
+ * Result:
+ *   1 if the event belongs to the job, otherwise 0.
+ */
+int cmd_coordinates_asyncDiscard(
+		Tcl_Event *evPtr,
+		ClientData clientData) {
+	
+	ShapefileAsyncEventPtr event = (ShapefileAsyncEventPtr)evPtr;
+	int i;
+	
+	if (evPtr->proc != cmd_coordinates_asyncEvent || event->job != (ShapefileAsyncReadPtr)clientData) {
+		return 0;
 	}
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	if (fieldId < 0 || fieldId >= fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
-		return TCL_ERROR;
+	for (i = 0; i < event->count; i++) {
+		SHPDestroyObject(event->shapes[i]);
 	}
-
-	if (validate && (cmd_attributes_validateField(interp, shapefile, fieldId, attrValue) != TCL_OK)) {
-		return TCL_ERROR;
+	if (event->shapes != NULL) {
+		ckfree((char *)event->shapes);
+		ckfree((char *)event->featureIds);
 	}
+	return 1;
+}
+
+/*
+ * cmd_coordinates_asyncFinish
+ * 
+ * Wait for an async read job's worker to exit, remove the job from its
+ * shapefile's list, and release it once no event procedure is using it.
+ */
+void cmd_coordinates_asyncFinish(ShapefileAsyncReadPtr job) {
 	
-	if (attrValue == NULL || Tcl_GetCharLength(attrValue) == 0) {
-		if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
-			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute"));
-			return TCL_ERROR;
+	ShapefileAsyncReadPtr *link;
+	int threadResult;
+	
+	(void)Tcl_JoinThread(job->threadId, &threadResult);
+	
+	for (link = &job->shapefile->asyncReads; *link != NULL; link = &(*link)->next) {
+		if (*link == job) {
+			*link = job->next;
+			break;
 		}
-		Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
-		return TCL_OK;
 	}
 	
-	switch ((int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &width, &precision)) {
-		case FTInteger:
-			if ((Tcl_GetIntFromObj(interp, attrValue, &intValue) != TCL_OK)) {
-				return TCL_ERROR;
-			}
-			if ((DBFWriteIntegerAttribute(shapefile->dbf, recordId, fieldId, intValue) == 0) && !shapefile->allowTruncation) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write integer attribute \"%d\"", intValue));
-				return TCL_ERROR;
-			}
-			break;
-		case FTDouble:
-			if (Tcl_GetDoubleFromObj(interp, attrValue, &doubleValue) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			
-			/* If the value formatted as Shapelib would will not fit in width,
-			   reformat it in scientific notation, if not prohibited. */
-			if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%*.*f", width, precision, doubleValue) >= NUMERIC_BUFFER_SIZE) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("fixed format double value too large for buffer"));
-				return TCL_ERROR;
-			}
-			
-			if (((int)strlen(buffer) > width) && shapefile->allowAlternateNotation) {
-				reserved = 7 + (doubleValue < 0 ? 1 : 0);
-				if (reserved > width) {
-					Tcl_SetObjResult(interp, Tcl_ObjPrintf("field too narrow (%d) for fixed or scientific notation representation of value \"%s\"", width, buffer));
+	Tcl_EventuallyFree((ClientData)job, (Tcl_FreeProc *)cmd_coordinates_asyncFree);
+}
+
+/*
+ * cmd_coordinates_asyncFree
+ * 
+ * Free an async read job and its handle. The worker must have exited.
+ */
+void cmd_coordinates_asyncFree(char *clientData) {
+	
+	ShapefileAsyncReadPtr job = (ShapefileAsyncReadPtr)clientData;
+	
+	/* the handle owns its copy of the offset table */
+	if (job->shp != NULL) {
+		SHPClose(job->shp);
+	}
+	if (job->skip != NULL) {
+		ckfree(job->skip);
+	}
+	Tcl_DecrRefCount(job->command);
+	Tcl_MutexFinalize(&job->mutex);
+	ckfree((char *)job);
+}
+
+/*
+ * cmd_coordinates_asyncCancel
+ * 
+ * Stop all async read jobs of shapefile and discard their queued events
+ * without invoking callbacks. Invoked when the shapefile is closed.
+ */
+void cmd_coordinates_asyncCancel(ShapefilePtr shapefile) {
+	
+	ShapefileAsyncReadPtr job;
+	
+	while ((job = shapefile->asyncReads) != NULL) {
+		Tcl_MutexLock(&job->mutex);
+		job->cancelled = 1;
+		Tcl_MutexUnlock(&job->mutex);
+		
+		/* after the worker exits no more events for the job can be queued */
+		Tcl_Preserve((ClientData)job);
+		cmd_coordinates_asyncFinish(job);
+		Tcl_DeleteEvents(cmd_coordinates_asyncDiscard, (ClientData)job);
+		Tcl_Release((ClientData)job);
+	}
+}
+
+/*
+ * cmd_coordinates_read
+ * 
+ * Implements the [$shp coordinates read FEATURE] action of the [$shp
+ * coordinates] command, used to get coordinate list of the specified featured.
+ * Also used by the [$shp coordinates read] action to get each feature's coords.
+ * 
+ * Result:
+ *   Coordinate list for the specified feature.
+ */
+int cmd_coordinates_read(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int featureId) {
+	
+	SHPObject *shape;
+	int featureCount;
+	int returnValue, release;
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	if (featureId < 0 || featureId >= featureCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+		return TCL_ERROR;
+	}
+	
+	/* deleted features are read as empty without decoding their geometry */
+	if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId)) {
+		Tcl_SetObjResult(interp, Tcl_NewObj());
+		return TCL_OK;
+	}
+	
+	if ((shape = shapefile_readShape(interp, shapefile, featureId, &release)) == NULL) {
+		return TCL_ERROR;
+	}
+	
+	returnValue = cmd_coordinates_shape(interp, shapefile, shape);
+	if (release) {
+		SHPDestroyObject(shape);
+	}
+	return returnValue;
+}
+
+/*
+ * shapefile_readShape
+ * 
+ * Get the decoded geometry of a feature, from the cache if it is there.
+ * Shapes that are read are offered to the cache, which owns them if they
+ * are accepted. *release is set true if the caller must destroy the shape
+ * with SHPDestroyObject when done with it. The shape must not be used after
+ * other features are read, which may evict it from the cache.
+ * 
+ * Result:
+ *   Shape, or NULL (with an error message in interp) if it could not be read.
+ */
+SHPObject *shapefile_readShape(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int featureId,
+		int *release) {
+	
+	SHPObject *shape;
+	ShapefileCacheEntryPtr entry;
+	
+	*release = 0;
+	if ((entry = shapefile_cacheLookup(shapefile, featureId, 0)) != NULL) {
+		return entry->shape;
+	}
+	
+	if ((shape = SHPReadObject(shapefile->shp, featureId)) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+		return NULL;
+	}
+	
+	*release = !shapefile_cacheInsert(shapefile, featureId, shape, NULL);
+	return shape;
+}
+
+/*
+ * cmd_coordinates_shape
+ * 
+ * Format the geometry of a shape read from shapefile as a coordinate list.
+ * Used by the [$shp coordinates read] actions. The shape is not destroyed.
+ * 
+ * Result:
+ *   Coordinate list for the specified shape.
+ */
+int cmd_coordinates_shape(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		SHPObject *shape) {
+	
+	Tcl_Obj *coordParts;
+	int part, partCount, vertex, vertexStart, vertexStop;
+	
+	/* If this is a NULL shape, return empty list {} explicitly (just leaving
+	   coordParts empty would return a list containing an empty list). */
+	if (shape->nSHPType == SHPT_NULL) {
+		Tcl_SetObjResult(interp, Tcl_NewObj());
+		return TCL_OK;
+	}
+	
+	/* prepare a list of coordinate lists; each member list represents one part
+	   (a "ring") of the feature. Some features only have one part. */
+	coordParts = Tcl_NewListObj(0, NULL);
+	
+	/* initialize vertex indices. if there's only one part, add all vertices;
+	   if there are multiple parts, stop adding vertices at 1st part boundary */
+	part = 0;
+	vertexStart = 0;
+	if (shape->nParts < 2) {
+		partCount = 1;
+		vertexStop = shape->nVertices;
+	} else {
+		partCount = shape->nParts;
+		vertexStop = shape->panPartStart[1];
+	}
+	
+	while (part < partCount) {
+		
+		/* prepare a coordinate list for this part */
+		Tcl_Obj *coords = Tcl_NewListObj(0, NULL);
+		
+		/* get the vertex coordinates for this part */
+		for (vertex = vertexStart; vertex < vertexStop; vertex++) {
+			if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfX[vertex])) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfY[vertex])) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			/* don't bother considering Z or M coords if only xy is requested */
+			if (shapefile->getOnlyXyCoords) {
+				continue;
+			}
+			
+			/* for Z type features, append Z coordinate before Measure */
+			if (shapefile->getAllCoords
+					|| shapefile->dimType == DIM_XYZM) {
+				
+				if (Tcl_ListObjAppendElement(interp, coords, Tcl_NewDoubleObj(shape->padfZ[vertex])) != TCL_OK) {
+					return TCL_ERROR;
+				}
+			}
+			
+			/* for M and Z type features, append Measure (if used) last */
+			if (shapefile->getAllCoords
+					|| shapefile->dimType == DIM_XYZM
+					|| shapefile->dimType == DIM_XYM) {
+				
+				/* append M coordinate, or 0.0 if unused despite type */
+				if (Tcl_ListObjAppendElement(interp, coords,
+						Tcl_NewDoubleObj(shape->bMeasureIsUsed ? shape->padfM[vertex] : 0.0)) != TCL_OK) {
 					return TCL_ERROR;
 				}
-				if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%*.*e", width, width - reserved, doubleValue) >= NUMERIC_BUFFER_SIZE) {
-					Tcl_SetObjResult(interp, Tcl_ObjPrintf("exponential notation double value too large for buffer"));
-					return TCL_ERROR;
+			}			
+		}
+		
+		/* add this part's coordinate list to the feature's part list */
+		if (Tcl_ListObjAppendElement(interp, coordParts, coords) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		
+		/* advance vertex indices to the next part (disregarded if none) */
+		vertexStart = vertex;
+		if (part + 2 < partCount) {
+			vertexStop = shape->panPartStart[part + 2];
+		} else {
+			vertexStop = shape->nVertices;
+		}
+		part++;
+	}
+	
+	Tcl_SetObjResult(interp, coordParts);
+	return TCL_OK;
+}
+
+/*
+ * shapefile_isConvertOption
+ * 
+ * Result:
+ *   1 if obj names an option of cmd_coordinates_readConverted, otherwise 0.
+ */
+int shapefile_isConvertOption(Tcl_Obj *obj) {
+	const char *option = Tcl_GetString(obj);
+	return strcmp(option, "-clip") == 0 || strcmp(option, "-project") == 0
+			|| strcmp(option, "-simplify") == 0 || strcmp(option, "-method") == 0
+			|| strcmp(option, "-transform") == 0 || strcmp(option, "-viewport") == 0;
+}
+
+/*
+ * cmd_coordinates_readConverted
+ * 
+ * Implements the [$shp coordinates read ?FEATURE? ?-project {FROM TO}? ?-clip
+ * WINDOW? ?-simplify TOLERANCE ?-method dp|vw?? ?-transform MATRIX?
+ * ?-viewport VIEWPORT?] action of the [$shp coordinates] command. The x and y
+ * coordinates of each feature are converted from projection FROM to TO (see
+ * shapefile_projectCoords), then clipped to the rectangle WINDOW {xmin ymin
+ * xmax ymax} (see shapefile_clipShape), then arcs and polygons are simplified
+ * (see shapefile_simplifyShape) in the projected coordinates, and finally every
+ * vertex is mapped through the affine MATRIX {a b c d e f}, as x' = a*x + b*y
+ * + c and y' = d*x + e*y + f, followed by the mapping of the map rectangle
+ * {xmin ymin xmax ymax} of VIEWPORT onto a WIDTH by HEIGHT pixel grid with
+ * the y axis pointing down. Viewport coordinates are rounded to integer
+ * pixels (see shapefile_quantizeShape). Features that lie entirely outside
+ * WINDOW are read as empty; unless coordinates are projected, they are
+ * recognized by the bounding box in the record header without decoding them.
+ * 
+ * Result:
+ *   Coordinate list of the specified feature, or list of coordinate lists of
+ *   all features, as for [$shp coordinates read].
+ */
+int cmd_coordinates_readConverted(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	static const char *optionNames[] = {"-clip", "-method", "-project", "-simplify", "-transform", "-viewport", NULL};
+	static const char *methodNames[] = {"dp", "vw", NULL};
+	struct shapefile_projection projection;
+	struct shapefile_buffer input;
+	unsigned char record[52];
+	Tcl_Obj *featureList = NULL;
+	Tcl_Obj **values;
+	SHPObject *shape, *converted, *clipped, *simplified;
+	int featureId = -1, featureCount, first, last, method = 0, release, size;
+	int clip = 0, project = 0, simplify = 0, transform = 0, viewport = 0;
+	int methodGiven = 0, arg = 3, optionIndex, valueCount, i, empty;
+	int shapeValue, returnValue = TCL_ERROR;
+	double tolerance = 0.0, matrix[6] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0}, bounds[6], scaleX, scaleY;
+	double window[4], min[4], max[4];
+	
+	memset(&input, 0, sizeof(struct shapefile_buffer));
+	input.hooks = &shapefile->shp->sHooks;
+	input.file = shapefile->shp->fpSHP;
+	
+	/* an optional feature index precedes the options */
+	if (objc % 2 == 0) {
+		if (Tcl_GetIntFromObj(interp, objv[arg++], &featureId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	}
+	if (objc - arg == 0) {
+		Tcl_WrongNumArgs(interp, 3, objv, "?index? ?-project {from to}? ?-clip window? ?-simplify tolerance ?-method dp|vw?? ?-transform matrix? ?-viewport viewport?");
+		return TCL_ERROR;
+	}
+	
+	for (; arg < objc; arg += 2) {
+		if (Tcl_GetIndexFromObj(interp, objv[arg], optionNames, "option",
+				TCL_EXACT, &optionIndex) != TCL_OK) {
+			goto cleanup;
+		}
+		
+		if (optionIndex == 0) {
+			/* -clip */
+			if (Tcl_ListObjGetElements(interp, objv[arg + 1], &valueCount, &values) != TCL_OK) {
+				goto cleanup;
+			}
+			if (valueCount != 4) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid clip window \"%s\": must be a list of 4 values", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			for (i = 0; i < 4; i++) {
+				if (Tcl_GetDoubleFromObj(interp, values[i], &window[i]) != TCL_OK) {
+					goto cleanup;
+				}
+			}
+			if (window[2] < window[0] || window[3] < window[1]) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid clip window \"%s\": minimum exceeds maximum", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			clip = 1;
+		} else if (optionIndex == 1) {
+			/* -method */
+			if (Tcl_GetIndexFromObj(interp, objv[arg + 1], methodNames, "method",
+					TCL_EXACT, &method) != TCL_OK) {
+				goto cleanup;
+			}
+			methodGiven = 1;
+		} else if (optionIndex == 2) {
+			/* -project; a repeated option replaces the earlier projection */
+			if (project) {
+				shapefile_projectionFree(&projection);
+				project = 0;
+			}
+			if (shapefile_projectionParse(interp, objv[arg + 1], &projection) != TCL_OK) {
+				goto cleanup;
+			}
+			project = 1;
+		} else if (optionIndex == 3) {
+			/* -simplify */
+			if (Tcl_GetDoubleFromObj(interp, objv[arg + 1], &tolerance) != TCL_OK) {
+				goto cleanup;
+			}
+			if (tolerance < 0.0) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid tolerance %s", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			simplify = 1;
+		} else if (optionIndex == 4) {
+			/* -transform */
+			if (Tcl_ListObjGetElements(interp, objv[arg + 1], &valueCount, &values) != TCL_OK) {
+				goto cleanup;
+			}
+			if (valueCount != 6) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid transform \"%s\": must be a list of 6 values", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			for (i = 0; i < 6; i++) {
+				if (Tcl_GetDoubleFromObj(interp, values[i], &matrix[i]) != TCL_OK) {
+					goto cleanup;
+				}
+			}
+			transform = 1;
+		} else {
+			/* -viewport */
+			if (Tcl_ListObjGetElements(interp, objv[arg + 1], &valueCount, &values) != TCL_OK) {
+				goto cleanup;
+			}
+			if (valueCount != 6) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid viewport \"%s\": must be a list of 6 values", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			for (i = 0; i < 6; i++) {
+				if (Tcl_GetDoubleFromObj(interp, values[i], &bounds[i]) != TCL_OK) {
+					goto cleanup;
+				}
+			}
+			if (bounds[2] <= bounds[0] || bounds[3] <= bounds[1] || bounds[4] <= 0.0 || bounds[5] <= 0.0) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid viewport \"%s\": bounds and size must be nonempty", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			viewport = 1;
+		}
+	}
+	
+	/* the method only applies to simplification; reject it alone rather
+	   than return unsimplified coordinates */
+	if (methodGiven && !simplify) {
+		Tcl_SetObjResult(interp, Tcl_NewStringObj("-method requires -simplify", -1));
+		goto cleanup;
+	}
+	
+	/* compose the viewport mapping after the transform, so that each vertex
+	   is converted by a single affine matrix */
+	if (viewport) {
+		scaleX = bounds[4] / (bounds[2] - bounds[0]);
+		scaleY = bounds[5] / (bounds[3] - bounds[1]);
+		matrix[0] *= scaleX;
+		matrix[1] *= scaleX;
+		matrix[2] = (matrix[2] - bounds[0]) * scaleX;
+		matrix[3] *= -scaleY;
+		matrix[4] *= -scaleY;
+		matrix[5] = (bounds[3] - matrix[5]) * scaleY;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	if (featureId == -1) {
+		featureList = Tcl_NewListObj(0, NULL);
+		first = 0;
+		last = featureCount - 1;
+	} else if (featureId < 0 || featureId >= featureCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+		goto cleanup;
+	} else {
+		first = last = featureId;
+	}
+	
+	for (featureId = first; featureId <= last; featureId++) {
+		
+		/* deleted features are read as empty, as by cmd_coordinates_read */
+		empty = shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId);
+		
+		/* the record header bounding box (or point) suffices to skip features
+		   outside the clip window, unless they have yet to be projected */
+		if (!empty && clip && !project) {
+			size = (int)shapefile->shp->panRecSize[featureId] + 8;
+			if (size > (int)sizeof(record)) {
+				size = (int)sizeof(record);
+			}
+			if (!shapefile_bufferRead(&input, shapefile->shp->panRecOffset[featureId], record, size)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+				goto cleanup;
+			}
+			empty = shapefile_recordBounds(record + 8, size - 8, min, max)
+					&& (min[0] > window[2] || max[0] < window[0]
+					|| min[1] > window[3] || max[1] < window[1]);
+		}
+		
+		if (empty) {
+			Tcl_SetObjResult(interp, Tcl_NewObj());
+		} else {
+			if ((shape = shapefile_readShape(interp, shapefile, featureId, &release)) == NULL) {
+				goto cleanup;
+			}
+			
+			/* cached shapes are shared, so converted vertices are copied */
+			converted = NULL;
+			if (project && shape->nSHPType != SHPT_NULL) {
+				converted = shapefile_copyShape(shape);
+				if (shapefile_projectCoords(interp, &projection, converted->padfX,
+						converted->padfY, converted->nVertices) != TCL_OK) {
+					SHPDestroyObject(converted);
+					if (release) {
+						SHPDestroyObject(shape);
+					}
+					goto cleanup;
+				}
+				SHPComputeExtents(converted);
+			}
+			if (clip && shape->nSHPType != SHPT_NULL) {
+				
+				/* features within the window need no clipping */
+				clipped = converted != NULL ? converted : shape;
+				if (clipped->dfXMin < window[0] || clipped->dfXMax > window[2]
+						|| clipped->dfYMin < window[1] || clipped->dfYMax > window[3]) {
+					clipped = shapefile_clipShape(clipped, window);
+					if (converted != NULL) {
+						SHPDestroyObject(converted);
+					}
+					converted = clipped;
+					if (converted == NULL) {
+						if (release) {
+							SHPDestroyObject(shape);
+						}
+						Tcl_SetObjResult(interp, Tcl_NewObj());
+						goto append;
+					}
+				}
+			}
+			if (simplify && (simplified = shapefile_simplifyShape(converted != NULL ? converted : shape,
+					tolerance, method)) != NULL) {
+				if (converted != NULL) {
+					SHPDestroyObject(converted);
+				}
+				converted = simplified;
+			}
+			if ((transform || viewport) && shape->nSHPType != SHPT_NULL) {
+				if (converted == NULL) {
+					converted = shapefile_copyShape(shape);
+				}
+				shapefile_transformCoords(converted->padfX, converted->padfY, converted->nVertices, matrix);
+				if (viewport) {
+					shapefile_quantizeShape(converted);
+				}
+			}
+			shapeValue = cmd_coordinates_shape(interp, shapefile, converted != NULL ? converted : shape);
+			if (converted != NULL) {
+				SHPDestroyObject(converted);
+			}
+			if (release) {
+				SHPDestroyObject(shape);
+			}
+			if (shapeValue != TCL_OK) {
+				goto cleanup;
+			}
+		}
+		
+	   append:
+		if (featureList != NULL) {
+			Tcl_ListObjAppendElement(interp, featureList, Tcl_GetObjResult(interp));
+			Tcl_ResetResult(interp);
+		}
+	}
+	
+	if (featureList != NULL) {
+		Tcl_SetObjResult(interp, featureList);
+		featureList = NULL;
+	}
+	returnValue = TCL_OK;
+	
+   cleanup:
+	shapefile_bufferRelease(&input);
+	if (featureList != NULL) {
+		Tcl_DecrRefCount(featureList);
+	}
+	if (project) {
+		shapefile_projectionFree(&projection);
+	}
+	return returnValue;
+}
+
+/*
+ * shapefile_transformCoords
+ * 
+ * Map count x and y coordinate pairs in place through the affine matrix {a b
+ * c d e f}, as x' = a*x + b*y + c and y' = d*x + e*y + f. The loop body has no
+ * branches or calls, so compilers may vectorize it.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_transformCoords(
+		double *x,
+		double *y,
+		int count,
+		const double *matrix) {
+	
+	const double a = matrix[0], b = matrix[1], c = matrix[2];
+	const double d = matrix[3], e = matrix[4], f = matrix[5];
+	double px, py;
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		px = x[i];
+		py = y[i];
+		x[i] = a * px + b * py + c;
+		y[i] = d * px + e * py + f;
+	}
+}
+
+/*
+ * shapefile_quantizeShape
+ * 
+ * Round the x and y coordinates of shape to the nearest integers, as pixel
+ * coordinates. Within each part of an arc or polygon, vertices that round to
+ * the same pixel as the preceding vertex are dropped (with their Z and M
+ * values) and the part start indices are adjusted; the first vertex of each
+ * part is always kept. Shape bounds are not updated.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_quantizeShape(SHPObject *shape) {
+	int baseType, part, start, end, i, kept;
+	
+	for (i = 0; i < shape->nVertices; i++) {
+		shape->padfX[i] = floor(shape->padfX[i] + 0.5);
+		shape->padfY[i] = floor(shape->padfY[i] + 0.5);
+	}
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if (baseType != BASE_ARC && baseType != BASE_POLYGON) {
+		return;
+	}
+	
+	kept = 0;
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		shape->panPartStart[part] = kept;
+		for (i = start; i < end; i++) {
+			if (i > start && shape->padfX[i] == shape->padfX[kept - 1]
+					&& shape->padfY[i] == shape->padfY[kept - 1]) {
+				continue;
+			}
+			shape->padfX[kept] = shape->padfX[i];
+			shape->padfY[kept] = shape->padfY[i];
+			shape->padfZ[kept] = shape->padfZ[i];
+			shape->padfM[kept] = shape->padfM[i];
+			kept++;
+		}
+	}
+	shape->nVertices = kept;
+}
+
+/*
+ * shapefile_copyShape
+ * 
+ * Result:
+ *   New copy of shape, to be destroyed with SHPDestroyObject.
+ */
+SHPObject *shapefile_copyShape(const SHPObject *shape) {
+	return SHPCreateObject(shape->nSHPType, shape->nShapeId,
+			shape->nParts, shape->panPartStart, shape->panPartType,
+			shape->nVertices, shape->padfX, shape->padfY, shape->padfZ,
+			shape->bMeasureIsUsed ? shape->padfM : NULL);
+}
+
+/*
+ * shapefile_projectionParse
+ * 
+ * Initialize projection from spec, a {FROM TO} list of projection names. The
+ * built-in projections are lonlat (geographic degrees), webmercator,
+ * equirectangular, and mollweide. If Shapetcl is built with USE_PROJ, any
+ * other definition understood by PROJ may be named, such as EPSG:32633. A
+ * successfully parsed projection must be released with
+ * shapefile_projectionFree.
+ * 
+ * Result:
+ *   TCL_OK if spec names a supported pair of projections; otherwise
+ *   TCL_ERROR, with an error message in interp.
+ */
+int shapefile_projectionParse(
+		Tcl_Interp *interp,
+		Tcl_Obj *spec,
+		ShapefileProjectionPtr projection) {
+	
+	static const char *projectionNames[] = {"lonlat", "webmercator", "equirectangular", "mollweide", NULL};
+	Tcl_Obj **names;
+	int nameCount, i, *index;
+	
+	if (Tcl_ListObjGetElements(interp, spec, &nameCount, &names) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (nameCount != 2) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid projection \"%s\": must be a list of 2 projection names", Tcl_GetString(spec)));
+		return TCL_ERROR;
+	}
+	projection->fromName = Tcl_GetString(names[0]);
+	projection->toName = Tcl_GetString(names[1]);
+	
+	for (i = 0; i < 2; i++) {
+		index = i == 0 ? &projection->from : &projection->to;
+#ifdef USE_PROJ
+		/* names that are not built in are left to PROJ */
+		if (Tcl_GetIndexFromObj(NULL, names[i], projectionNames, "projection",
+				TCL_EXACT, index) != TCL_OK) {
+			*index = -1;
+		}
+#else
+		if (Tcl_GetIndexFromObj(interp, names[i], projectionNames, "projection",
+				TCL_EXACT, index) != TCL_OK) {
+			return TCL_ERROR;
+		}
+#endif
+	}
+	
+#ifdef USE_PROJ
+	projection->transform = NULL;
+	if (projection->from == -1 || projection->to == -1) {
+		/* PROJ definitions of the built-in projections */
+		static const char *projectionDefinitions[] = {
+				"EPSG:4326",
+				"EPSG:3857",
+				"+proj=eqc +a=6378137 +b=6378137 +units=m +type=crs",
+				"+proj=moll +a=6378137 +b=6378137 +units=m +type=crs"
+		};
+		PJ *transform;
+		
+		transform = proj_create_crs_to_crs(PJ_DEFAULT_CTX,
+				projection->from == -1 ? projection->fromName : projectionDefinitions[projection->from],
+				projection->to == -1 ? projection->toName : projectionDefinitions[projection->to],
+				NULL);
+		if (transform == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("unsupported projection \"%s\"", Tcl_GetString(spec)));
+			return TCL_ERROR;
+		}
+		
+		/* use longitude, latitude (x, y) order regardless of CRS axis order */
+		projection->transform = proj_normalize_for_visualization(PJ_DEFAULT_CTX, transform);
+		proj_destroy(transform);
+		if (projection->transform == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("unsupported projection \"%s\"", Tcl_GetString(spec)));
+			return TCL_ERROR;
+		}
+	}
+#endif
+	
+	return TCL_OK;
+}
+
+/*
+ * shapefile_projectionFree
+ * 
+ * Release any resources held by a projection parsed by
+ * shapefile_projectionParse.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_projectionFree(ShapefileProjectionPtr projection) {
+#ifdef USE_PROJ
+	if (projection->transform != NULL) {
+		proj_destroy(projection->transform);
+		projection->transform = NULL;
+	}
+#endif
+}
+
+/*
+ * shapefile_projectCoords
+ * 
+ * Convert count x and y coordinate pairs in place by projection. Built-in
+ * projections are converted to longitude and latitude by
+ * shapefile_projectInverse and then to the target projection by
+ * shapefile_projectForward, each in one pass over the arrays.
+ * 
+ * Result:
+ *   TCL_OK if all coordinates could be converted; otherwise TCL_ERROR, with an
+ *   error message in interp. Coordinates may be partially converted on error.
+ */
+int shapefile_projectCoords(
+		Tcl_Interp *interp,
+		ShapefileProjectionPtr projection,
+		double *x,
+		double *y,
+		int count) {
+	
+#ifdef USE_PROJ
+	if (projection->transform != NULL) {
+		proj_errno_reset(projection->transform);
+		proj_trans_generic(projection->transform, PJ_FWD,
+				x, sizeof(double), (size_t)count,
+				y, sizeof(double), (size_t)count,
+				NULL, 0, 0, NULL, 0, 0);
+		if (proj_errno(projection->transform) != 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot project coordinates from %s to %s: %s",
+					projection->fromName, projection->toName,
+					proj_errno_string(proj_errno(projection->transform))));
+			return TCL_ERROR;
+		}
+		return TCL_OK;
+	}
+#endif
+	
+	if (projection->from == projection->to) {
+		return TCL_OK;
+	}
+	if (shapefile_projectInverse(projection->from, x, y, count) != TCL_OK
+			|| shapefile_projectForward(projection->to, x, y, count) != TCL_OK) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot project coordinates from %s to %s: coordinates out of range",
+				projection->fromName, projection->toName));
+		return TCL_ERROR;
+	}
+	return TCL_OK;
+}
+
+/*
+ * shapefile_projectInverse
+ * 
+ * Convert count x and y coordinate pairs in place from built-in projection
+ * from to longitude and latitude in degrees.
+ * 
+ * Result:
+ *   TCL_OK, or TCL_ERROR if any coordinates are outside the projection.
+ */
+int shapefile_projectInverse(
+		int from,
+		double *x,
+		double *y,
+		int count) {
+	
+	const double r = PROJECTION_RADIUS, degrees = 180.0 / M_PI;
+	double theta;
+	int i;
+	
+	switch (from) {
+		case PROJECTION_WEBMERCATOR:
+			for (i = 0; i < count; i++) {
+				x[i] = x[i] / r * degrees;
+				y[i] = atan(sinh(y[i] / r)) * degrees;
+			}
+			break;
+		case PROJECTION_EQUIRECTANGULAR:
+			for (i = 0; i < count; i++) {
+				x[i] = x[i] / r * degrees;
+				y[i] = y[i] / r * degrees;
+				if (fabs(y[i]) > 90.0) {
+					return TCL_ERROR;
+				}
+			}
+			break;
+		case PROJECTION_MOLLWEIDE:
+			for (i = 0; i < count; i++) {
+				if (fabs(y[i]) > r * M_SQRT2) {
+					return TCL_ERROR;
+				}
+				theta = asin(y[i] / (r * M_SQRT2));
+				y[i] = asin(fmin(1.0, fmax(-1.0, (2.0 * theta + sin(2.0 * theta)) / M_PI))) * degrees;
+				x[i] = cos(theta) > 0.0 ? M_PI * x[i] / (2.0 * r * M_SQRT2 * cos(theta)) * degrees : 0.0;
+				if (fabs(x[i]) > 180.0 + 1e-9) {
+					return TCL_ERROR;
+				}
+			}
+			break;
+	}
+	return TCL_OK;
+}
+
+/*
+ * shapefile_projectForward
+ * 
+ * Convert count longitude and latitude pairs in degrees in place to built-in
+ * projection to. The Mollweide auxiliary angle is found by Newton iteration.
+ * 
+ * Result:
+ *   TCL_OK, or TCL_ERROR if any coordinates are outside the projection.
+ */
+int shapefile_projectForward(
+		int to,
+		double *x,
+		double *y,
+		int count) {
+	
+	const double r = PROJECTION_RADIUS, radians = M_PI / 180.0;
+	double target, theta, delta;
+	int i, iteration;
+	
+	for (i = 0; i < count; i++) {
+		if (fabs(y[i]) > 90.0) {
+			return TCL_ERROR;
+		}
+	}
+	
+	switch (to) {
+		case PROJECTION_WEBMERCATOR:
+			for (i = 0; i < count; i++) {
+				if (fabs(y[i]) == 90.0) {
+					return TCL_ERROR;
+				}
+				x[i] = r * x[i] * radians;
+				y[i] = r * log(tan(M_PI / 4.0 + y[i] * radians / 2.0));
+			}
+			break;
+		case PROJECTION_EQUIRECTANGULAR:
+			for (i = 0; i < count; i++) {
+				x[i] = r * x[i] * radians;
+				y[i] = r * y[i] * radians;
+			}
+			break;
+		case PROJECTION_MOLLWEIDE:
+			for (i = 0; i < count; i++) {
+				
+				/* solve 2 theta + sin(2 theta) = pi sin(latitude) for theta */
+				if (fabs(y[i]) == 90.0) {
+					theta = y[i] * radians;
+				} else {
+					target = M_PI * sin(y[i] * radians);
+					theta = y[i] * radians;
+					for (iteration = 0; iteration < 32; iteration++) {
+						delta = (2.0 * theta + sin(2.0 * theta) - target) / (2.0 + 2.0 * cos(2.0 * theta));
+						theta -= delta;
+						if (fabs(delta) < 1e-12) {
+							break;
+						}
+					}
+					
+					/* close to the poles the iteration may not settle */
+					if (iteration == 32 || fabs(theta) > M_PI / 2.0) {
+						theta = y[i] < 0.0 ? -M_PI / 2.0 : M_PI / 2.0;
+					}
+				}
+				x[i] = r * 2.0 * M_SQRT2 / M_PI * x[i] * radians * cos(theta);
+				y[i] = r * M_SQRT2 * sin(theta);
+			}
+			break;
+	}
+	return TCL_OK;
+}
+
+/*
+ * shapefile_clipShape
+ * 
+ * Clip shape to window {xmin ymin xmax ymax}. Polygon rings are clipped by
+ * the Sutherland-Hodgman algorithm (see shapefile_clipRing), which may leave
+ * zero-width edges along the window boundary where a concave ring leaves and
+ * reenters it. Arc parts are clipped segment by segment by the Cohen-
+ * Sutherland algorithm (see shapefile_clipArc), and split into several parts
+ * where they leave the window. Points and multipoint vertices outside the
+ * window are dropped. Z and M values of intersection vertices are
+ * interpolated. Window edges are inclusive.
+ * 
+ * Result:
+ *   New shape, to be destroyed with SHPDestroyObject, or NULL if no part of
+ *   shape lies within window.
+ */
+SHPObject *shapefile_clipShape(
+		const SHPObject *shape,
+		const double *window) {
+	
+	struct shapefile_clipOutput output, ring, scratch;
+	SHPObject *clipped = NULL;
+	double *vertices, *x, *y, *z, *m;
+	int baseType, part, start, end, i;
+	
+	if (shape->nVertices == 0) {
+		return NULL;
+	}
+	memset(&output, 0, sizeof(struct shapefile_clipOutput));
+	memset(&ring, 0, sizeof(struct shapefile_clipOutput));
+	memset(&scratch, 0, sizeof(struct shapefile_clipOutput));
+	
+	/* interleave coordinates so intersections can interpolate all four */
+	vertices = (double *)ckalloc((unsigned int)(sizeof(double) * 4 * shape->nVertices));
+	for (i = 0; i < shape->nVertices; i++) {
+		vertices[i * 4] = shape->padfX[i];
+		vertices[i * 4 + 1] = shape->padfY[i];
+		vertices[i * 4 + 2] = shape->padfZ[i];
+		vertices[i * 4 + 3] = shape->padfM[i];
+	}
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if (baseType == BASE_POINT || baseType == BASE_MULTIPOINT) {
+		for (i = 0; i < shape->nVertices; i++) {
+			if (shapefile_clipOutcode(vertices + i * 4, window) == 0) {
+				shapefile_clipAppend(&output, vertices + i * 4);
+			}
+		}
+	} else {
+		for (part = 0; part < shape->nParts; part++) {
+			start = shape->panPartStart[part];
+			end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+			if (end - start < 2) {
+				continue;
+			}
+			
+			if (baseType == BASE_ARC) {
+				shapefile_clipArc(&output, vertices + start * 4, end - start, window);
+				continue;
+			}
+			
+			/* clip rings as cycles, without the closing vertex */
+			if (vertices[start * 4] == vertices[(end - 1) * 4]
+					&& vertices[start * 4 + 1] == vertices[(end - 1) * 4 + 1]) {
+				end--;
+			}
+			ring.vertexCount = 0;
+			for (i = start; i < end; i++) {
+				shapefile_clipAppend(&ring, vertices + i * 4);
+			}
+			shapefile_clipRing(&output, &ring, &scratch, window);
+		}
+	}
+	
+	if (output.vertexCount > 0) {
+		x = (double *)ckalloc((unsigned int)(sizeof(double) * 4 * output.vertexCount));
+		y = x + output.vertexCount;
+		z = y + output.vertexCount;
+		m = z + output.vertexCount;
+		for (i = 0; i < output.vertexCount; i++) {
+			x[i] = output.vertices[i * 4];
+			y[i] = output.vertices[i * 4 + 1];
+			z[i] = output.vertices[i * 4 + 2];
+			m[i] = output.vertices[i * 4 + 3];
+		}
+		clipped = SHPCreateObject(shape->nSHPType, shape->nShapeId,
+				output.partCount, output.partStarts, NULL, output.vertexCount,
+				x, y, z, shape->bMeasureIsUsed ? m : NULL);
+		ckfree((char *)x);
+	}
+	
+	ckfree((char *)vertices);
+	shapefile_clipFree(&output);
+	shapefile_clipFree(&ring);
+	shapefile_clipFree(&scratch);
+	return clipped;
+}
+
+/*
+ * shapefile_clipRing
+ * 
+ * Clip the cyclic ring of vertices in ring against each edge of window in
+ * turn (Sutherland-Hodgman), using scratch for intermediate results. If at
+ * least three vertices remain, they are appended to output as a new closed
+ * part. The contents of ring and scratch are clobbered.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipRing(
+		ShapefileClipOutputPtr output,
+		ShapefileClipOutputPtr ring,
+		ShapefileClipOutputPtr scratch,
+		const double *window) {
+	
+	struct shapefile_clipOutput swap;
+	double vertex[4], *previous, *current;
+	int edge, i, previousInside, currentInside;
+	
+	for (edge = 0; edge < 4 && ring->vertexCount > 0; edge++) {
+		scratch->vertexCount = 0;
+		previous = ring->vertices + (ring->vertexCount - 1) * 4;
+		previousInside = !(shapefile_clipOutcode(previous, window) & (1 << edge));
+		for (i = 0; i < ring->vertexCount; i++) {
+			current = ring->vertices + i * 4;
+			currentInside = !(shapefile_clipOutcode(current, window) & (1 << edge));
+			if (currentInside != previousInside) {
+				shapefile_clipIntersect(previous, current, edge, window, vertex);
+				shapefile_clipAppend(scratch, vertex);
+			}
+			if (currentInside) {
+				shapefile_clipAppend(scratch, current);
+			}
+			previous = current;
+			previousInside = currentInside;
+		}
+		swap = *ring;
+		*ring = *scratch;
+		*scratch = swap;
+	}
+	
+	if (ring->vertexCount >= 3) {
+		shapefile_clipPart(output);
+		for (i = 0; i < ring->vertexCount; i++) {
+			shapefile_clipAppend(output, ring->vertices + i * 4);
+		}
+		shapefile_clipAppend(output, ring->vertices);
+	}
+}
+
+/*
+ * shapefile_clipArc
+ * 
+ * Clip each segment of an arc part of count interleaved vertices to window
+ * (Cohen-Sutherland), appending the visible pieces to output. Consecutive
+ * visible segments are joined; a new part is started wherever the arc
+ * reenters the window.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipArc(
+		ShapefileClipOutputPtr output,
+		const double *vertices,
+		int count,
+		const double *window) {
+	
+	double a[4], b[4], vertex[4];
+	int i, edge, codeA, codeB, code, open = 0;
+	
+	for (i = 0; i + 1 < count; i++) {
+		memcpy(a, vertices + i * 4, sizeof(a));
+		memcpy(b, vertices + (i + 1) * 4, sizeof(b));
+		codeA = shapefile_clipOutcode(a, window);
+		codeB = shapefile_clipOutcode(b, window);
+		
+		/* move outside endpoints onto the window edges they're beyond */
+		while ((codeA | codeB) != 0 && (codeA & codeB) == 0) {
+			code = codeA != 0 ? codeA : codeB;
+			for (edge = 0; !(code & (1 << edge)); edge++);
+			shapefile_clipIntersect(a, b, edge, window, vertex);
+			if (code == codeA) {
+				memcpy(a, vertex, sizeof(a));
+				codeA = shapefile_clipOutcode(a, window);
+			} else {
+				memcpy(b, vertex, sizeof(b));
+				codeB = shapefile_clipOutcode(b, window);
+			}
+		}
+		if ((codeA | codeB) != 0) {
+			/* segment lies entirely outside */
+			open = 0;
+			continue;
+		}
+		
+		if (!open) {
+			shapefile_clipPart(output);
+			shapefile_clipAppend(output, a);
+		}
+		shapefile_clipAppend(output, b);
+		
+		/* the part continues only if the segment ended inside the window */
+		open = memcmp(b, vertices + (i + 1) * 4, sizeof(b)) == 0;
+	}
+}
+
+/*
+ * shapefile_clipOutcode
+ * 
+ * Result:
+ *   Cohen-Sutherland outcode of vertex relative to window: bit 0, 1, 2, or 3
+ *   is set if vertex is beyond the xmin, ymin, xmax, or ymax edge.
+ */
+int shapefile_clipOutcode(
+		const double *vertex,
+		const double *window) {
+	
+	int code = 0;
+	
+	if (vertex[0] < window[0]) code |= 1;
+	if (vertex[1] < window[1]) code |= 2;
+	if (vertex[0] > window[2]) code |= 4;
+	if (vertex[1] > window[3]) code |= 8;
+	return code;
+}
+
+/*
+ * shapefile_clipIntersect
+ * 
+ * Set vertex to the intersection of segment a-b with the line through the
+ * given edge of window (0 xmin, 1 ymin, 2 xmax, 3 ymax), interpolating all
+ * four coordinate values. The segment must cross the line.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipIntersect(
+		const double *a,
+		const double *b,
+		int edge,
+		const double *window,
+		double *vertex) {
+	
+	int axis = edge % 2, i;
+	double t = (window[edge] - a[axis]) / (b[axis] - a[axis]);
+	
+	for (i = 0; i < 4; i++) {
+		vertex[i] = a[i] + t * (b[i] - a[i]);
+	}
+	vertex[axis] = window[edge];
+}
+
+/*
+ * shapefile_clipAppend
+ * 
+ * Append a copy of the four coordinate values of vertex to output.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipAppend(
+		ShapefileClipOutputPtr output,
+		const double *vertex) {
+	
+	if (output->vertexCount == output->vertexCapacity) {
+		output->vertexCapacity = output->vertexCapacity == 0 ? 64 : output->vertexCapacity * 2;
+		output->vertices = (double *)ckrealloc((char *)output->vertices,
+				(unsigned int)(sizeof(double) * 4 * output->vertexCapacity));
+	}
+	memcpy(output->vertices + output->vertexCount * 4, vertex, sizeof(double) * 4);
+	output->vertexCount++;
+}
+
+/*
+ * shapefile_clipPart
+ * 
+ * Start a new part at the next vertex appended to output.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipPart(ShapefileClipOutputPtr output) {
+	if (output->partCount == output->partCapacity) {
+		output->partCapacity = output->partCapacity == 0 ? 8 : output->partCapacity * 2;
+		output->partStarts = (int *)ckrealloc((char *)output->partStarts,
+				(unsigned int)(sizeof(int) * output->partCapacity));
+	}
+	output->partStarts[output->partCount++] = output->vertexCount;
+}
+
+/*
+ * shapefile_clipFree
+ * 
+ * Release the arrays of output.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_clipFree(ShapefileClipOutputPtr output) {
+	if (output->vertices != NULL) {
+		ckfree((char *)output->vertices);
+	}
+	if (output->partStarts != NULL) {
+		ckfree((char *)output->partStarts);
+	}
+	memset(output, 0, sizeof(struct shapefile_clipOutput));
+}
+
+/*
+ * shapefile_simplifyShape
+ * 
+ * Simplify each part of an arc or polygon shape with the Douglas-Peucker
+ * (method 0) or Visvalingam-Whyatt (method 1) algorithm. Each interior vertex
+ * of a part is ranked by the tolerance at which it would be removed (see
+ * shapefile_simplifyDp and shapefile_simplifyVw); vertices ranked above
+ * tolerance are kept. The first and last vertex of every part are always
+ * kept, so polygon rings stay closed, and the highest ranked vertices are
+ * kept as needed to leave at least four vertices in each ring that had
+ * them. Z and M values of kept vertices are preserved.
+ * 
+ * Result:
+ *   New shape, to be destroyed with SHPDestroyObject, or NULL if shape is not
+ *   an arc or polygon (which are not simplified).
+ */
+SHPObject *shapefile_simplifyShape(
+		const SHPObject *shape,
+		double tolerance,
+		int method) {
+	
+	SHPObject *simplified;
+	double *rank, *x, *y, *z, *m, best, second;
+	int *partStart;
+	int baseType, part, start, end, i, count, kept, bestIndex, secondIndex;
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if ((baseType != BASE_ARC && baseType != BASE_POLYGON) || shape->nVertices == 0) {
+		return NULL;
+	}
+	
+	rank = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nVertices));
+	x = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nVertices));
+	y = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nVertices));
+	z = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nVertices));
+	m = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nVertices));
+	partStart = (int *)ckalloc((unsigned int)(sizeof(int) * (shape->nParts + 1)));
+	
+	kept = 0;
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		count = end - start;
+		partStart[part] = kept;
+		
+		for (i = start; i < end; i++) {
+			rank[i] = HUGE_VAL;
+		}
+		if (count > 2) {
+			if (method == 0) {
+				shapefile_simplifyDp(shape->padfX + start, shape->padfY + start, count, rank + start);
+			} else {
+				shapefile_simplifyVw(shape->padfX + start, shape->padfY + start, count, rank + start);
+			}
+		}
+		
+		/* rings keep their two highest ranked interior vertices */
+		if (baseType == BASE_POLYGON && count >= 4) {
+			best = second = -1.0;
+			bestIndex = secondIndex = -1;
+			for (i = start + 1; i < end - 1; i++) {
+				if (rank[i] > best) {
+					second = best;
+					secondIndex = bestIndex;
+					best = rank[i];
+					bestIndex = i;
+				} else if (rank[i] > second) {
+					second = rank[i];
+					secondIndex = i;
+				}
+			}
+			rank[bestIndex] = rank[secondIndex] = HUGE_VAL;
+		}
+		
+		for (i = start; i < end; i++) {
+			if (rank[i] > tolerance || i == start || i == end - 1) {
+				x[kept] = shape->padfX[i];
+				y[kept] = shape->padfY[i];
+				z[kept] = shape->padfZ[i];
+				m[kept] = shape->padfM[i];
+				kept++;
+			}
+		}
+	}
+	
+	simplified = SHPCreateObject(shape->nSHPType, shape->nShapeId, shape->nParts,
+			partStart, shape->panPartType, kept, x, y, z, shape->bMeasureIsUsed ? m : NULL);
+	
+	ckfree((char *)rank);
+	ckfree((char *)x);
+	ckfree((char *)y);
+	ckfree((char *)z);
+	ckfree((char *)m);
+	ckfree((char *)partStart);
+	return simplified;
+}
+
+/*
+ * shapefile_simplifyDp
+ * 
+ * Rank the interior vertices of a part of count vertices for Douglas-Peucker
+ * simplification. Each range of the part is split at the vertex farthest
+ * from the segment joining its ends, starting with the whole part; a
+ * vertex's rank is that distance, limited to the rank of the vertex that
+ * split the enclosing range, so that any tolerance keeps exactly the
+ * vertices Douglas-Peucker would. Ranges are kept on a stack rather than by
+ * recursion, so long parts cannot overflow the C stack. The first and last
+ * ranks are not set.
+ */
+void shapefile_simplifyDp(
+		const double *x,
+		const double *y,
+		int count,
+		double *rank) {
+	
+	int *stack;
+	double *limits, limit, distance, farthest;
+	int depth = 0, first, last, i, split;
+	
+	/* each split leaves at most one more range pending */
+	stack = (int *)ckalloc((unsigned int)(sizeof(int) * 2 * count));
+	limits = (double *)ckalloc((unsigned int)(sizeof(double) * count));
+	
+	stack[0] = 0;
+	stack[1] = count - 1;
+	limits[0] = HUGE_VAL;
+	depth = 1;
+	
+	while (depth > 0) {
+		depth--;
+		first = stack[depth * 2];
+		last = stack[depth * 2 + 1];
+		limit = limits[depth];
+		
+		split = -1;
+		farthest = -1.0;
+		for (i = first + 1; i < last; i++) {
+			distance = shapefile_segmentDistance(x[first], y[first], x[last], y[last], x[i], y[i]);
+			if (distance > farthest) {
+				farthest = distance;
+				split = i;
+			}
+		}
+		if (split == -1) {
+			continue;
+		}
+		
+		rank[split] = farthest < limit ? farthest : limit;
+		stack[depth * 2] = first;
+		stack[depth * 2 + 1] = split;
+		limits[depth++] = rank[split];
+		stack[depth * 2] = split;
+		stack[depth * 2 + 1] = last;
+		limits[depth++] = rank[split];
+	}
+	
+	ckfree((char *)stack);
+	ckfree((char *)limits);
+}
+
+/*
+ * shapefile_simplifyVw
+ * 
+ * Rank the interior vertices of a part of count vertices for Visvalingam-
+ * Whyatt simplification. The vertex forming the smallest triangle with its
+ * neighbors is removed repeatedly, using a binary heap of triangle areas,
+ * until only the ends remain; a vertex's rank is its area when removed, or
+ * the largest area removed before it if that is greater, so that a tolerance
+ * (in squared units) keeps the vertices that removal to that area would. The
+ * first and last ranks are not set.
+ */
+void shapefile_simplifyVw(
+		const double *x,
+		const double *y,
+		int count,
+		double *rank) {
+	
+	int *prev, *next, *heap, *position;
+	double *area, removed = 0.0;
+	int heapCount, i, vertex, neighbor;
+	
+	prev = (int *)ckalloc((unsigned int)(sizeof(int) * count));
+	next = (int *)ckalloc((unsigned int)(sizeof(int) * count));
+	heap = (int *)ckalloc((unsigned int)(sizeof(int) * count));
+	position = (int *)ckalloc((unsigned int)(sizeof(int) * count));
+	area = (double *)ckalloc((unsigned int)(sizeof(double) * count));
+	
+	heapCount = 0;
+	for (i = 0; i < count; i++) {
+		prev[i] = i - 1;
+		next[i] = i + 1;
+		if (i > 0 && i < count - 1) {
+			area[i] = shapefile_triangleArea(x, y, i - 1, i, i + 1);
+			heap[heapCount] = i;
+			position[i] = heapCount++;
+		}
+	}
+	for (i = heapCount / 2 - 1; i >= 0; i--) {
+		shapefile_simplifySift(heap, position, area, heapCount, i);
+	}
+	
+	while (heapCount > 0) {
+		vertex = heap[0];
+		heap[0] = heap[--heapCount];
+		position[heap[0]] = 0;
+		shapefile_simplifySift(heap, position, area, heapCount, 0);
+		
+		if (area[vertex] > removed) {
+			removed = area[vertex];
+		}
+		rank[vertex] = removed;
+		
+		/* unlink the vertex and update its neighbors' triangles */
+		next[prev[vertex]] = next[vertex];
+		prev[next[vertex]] = prev[vertex];
+		for (i = 0; i < 2; i++) {
+			neighbor = i == 0 ? prev[vertex] : next[vertex];
+			if (neighbor > 0 && neighbor < count - 1) {
+				area[neighbor] = shapefile_triangleArea(x, y, prev[neighbor], neighbor, next[neighbor]);
+				shapefile_simplifySift(heap, position, area, heapCount, position[neighbor]);
+			}
+		}
+	}
+	
+	ckfree((char *)prev);
+	ckfree((char *)next);
+	ckfree((char *)heap);
+	ckfree((char *)position);
+	ckfree((char *)area);
+}
+
+/*
+ * shapefile_simplifySift
+ * 
+ * Restore the order of a binary heap of count vertex indices, ordered by
+ * smallest area, after the area of the vertex at heap index i has changed.
+ * position holds the heap index of each vertex in the heap.
+ */
+void shapefile_simplifySift(
+		int *heap,
+		int *position,
+		const double *area,
+		int count,
+		int i) {
+	
+	int vertex = heap[i], parent, child;
+	
+	while (i > 0 && area[heap[parent = (i - 1) / 2]] > area[vertex]) {
+		heap[i] = heap[parent];
+		position[heap[i]] = i;
+		i = parent;
+	}
+	while ((child = i * 2 + 1) < count) {
+		if (child + 1 < count && area[heap[child + 1]] < area[heap[child]]) {
+			child++;
+		}
+		if (area[heap[child]] >= area[vertex]) {
+			break;
+		}
+		heap[i] = heap[child];
+		position[heap[i]] = i;
+		i = child;
+	}
+	heap[i] = vertex;
+	position[vertex] = i;
+}
+
+/*
+ * shapefile_triangleArea
+ * 
+ * Result:
+ *   Area of the triangle formed by vertices a, b, and c of x and y.
+ */
+double shapefile_triangleArea(
+		const double *x,
+		const double *y,
+		int a,
+		int b,
+		int c) {
+	
+	return fabs((x[b] - x[a]) * (y[c] - y[a]) - (x[c] - x[a]) * (y[b] - y[a])) / 2.0;
+}
+
+/*
+ * cmd_geometry
+ * 
+ * Implements the [$shp geometry] command used to compute planar measures of
+ * feature geometry and to check and repair it. Measures use X and Y
+ * coordinates only and are computed from the decoded shapes, without
+ * building coordinate lists.
+ * 
+ * Command Syntax:
+ *   [$shp geometry area ?FEATURES|-all?]
+ *     Get the area of each polygon feature: the area of its outer rings
+ *     less that of its holes. Other feature types have area 0.
+ *   [$shp geometry length ?FEATURES|-all?]
+ *     Get the length of each arc feature, or perimeter of each polygon
+ *     feature (including holes). Point and multipoint features have length 0.
+ *   [$shp geometry centroid ?FEATURES|-all?]
+ *     Get the centroid of each feature as an {X Y} list: the area centroid
+ *     of polygons, length centroid of arcs, or mean of points. Degenerate
+ *     polygons and arcs fall back to the next of these that is defined.
+ *   [$shp geometry validate ?FEATURES|-all?]
+ *     Get a list of the issues found in each feature, in this order: nan
+ *     (coordinates that are not finite numbers), degenerate (arc parts with
+ *     fewer than 2 distinct vertices, or rings with fewer than 3 or no area),
+ *     unclosed (rings that do not end at their first vertex), winding (outer
+ *     rings not clockwise or holes not counterclockwise), and
+ *     selfintersection (edges of an arc part, or of a polygon's rings, that
+ *     cross or touch other than at shared vertices of consecutive edges).
+ *     Valid features have an empty list.
+ *   [$shp geometry repair ?-output PATH?]
+ *     Rewrite the shapefile with invalid features repaired (see
+ *     cmd_geometry_repair).
+ *   FEATURES is a list of feature indices; if omitted or -all, all features
+ *   are measured. Null features, and deleted features if skipDeleted is set,
+ *   have area and length 0, an empty centroid, and no issues.
+ * 
+ * Result:
+ *   List of one measure for each feature, in the order given, or for repair,
+ *   the number of features repaired.
+ */
+int cmd_geometry(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	static const char *measureNames[] = {"area", "centroid", "length", "repair", "validate", NULL};
+	static const char *issueNames[] = {"nan", "degenerate", "unclosed", "winding", "selfintersection", NULL};
+	int measureIndex, featureCount, count, i, featureId, release, issues, issue;
+	Tcl_Obj **featureIds = NULL;
+	Tcl_Obj *result, *value;
+	SHPObject *shape;
+	double x, y;
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "measure ?features|-all?");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetIndexFromObj(interp, objv[2], measureNames, "measure",
+			TCL_EXACT, &measureIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if (measureIndex == 3) {
+		return cmd_geometry_repair(interp, shapefile, objc, objv);
+	}
+	
+	if (objc != 3 && objc != 4) {
+		Tcl_WrongNumArgs(interp, 2, objv, "measure ?features|-all?");
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	count = featureCount;
+	if (objc == 4 && strcmp(Tcl_GetString(objv[3]), "-all") != 0
+			&& Tcl_ListObjGetElements(interp, objv[3], &count, &featureIds) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	result = Tcl_NewListObj(0, NULL);
+	for (i = 0; i < count; i++) {
+		featureId = i;
+		if (featureIds != NULL) {
+			if (Tcl_GetIntFromObj(interp, featureIds[i], &featureId) != TCL_OK) {
+				Tcl_DecrRefCount(result);
+				return TCL_ERROR;
+			}
+			if (featureId < 0 || featureId >= featureCount) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+				Tcl_DecrRefCount(result);
+				return TCL_ERROR;
+			}
+		}
+		
+		/* deleted features are measured as null features */
+		shape = NULL;
+		release = 0;
+		if (!(shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId))
+				&& (shape = shapefile_readShape(interp, shapefile, featureId, &release)) == NULL) {
+			Tcl_DecrRefCount(result);
+			return TCL_ERROR;
+		}
+		
+		switch (measureIndex) {
+			case 0: /* area */
+				value = Tcl_NewDoubleObj(shape == NULL ? 0.0 : shapefile_shapeArea(shape));
+				break;
+			case 1: /* centroid */
+				value = Tcl_NewListObj(0, NULL);
+				if (shape != NULL && shapefile_shapeCentroid(shape, &x, &y)) {
+					Tcl_ListObjAppendElement(interp, value, Tcl_NewDoubleObj(x));
+					Tcl_ListObjAppendElement(interp, value, Tcl_NewDoubleObj(y));
+				}
+				break;
+			case 2: /* length */
+				value = Tcl_NewDoubleObj(shape == NULL ? 0.0 : shapefile_shapeLength(shape));
+				break;
+			default: /* validate */
+				value = Tcl_NewListObj(0, NULL);
+				issues = shape == NULL ? 0 : shapefile_validateShape(shape, 1);
+				for (issue = 0; issueNames[issue] != NULL; issue++) {
+					if (issues & (1 << issue)) {
+						Tcl_ListObjAppendElement(interp, value, Tcl_NewStringObj(issueNames[issue], -1));
+					}
+				}
+				break;
+		}
+		Tcl_ListObjAppendElement(interp, result, value);
+		
+		if (release) {
+			SHPDestroyObject(shape);
+		}
+	}
+	
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+/*
+ * cmd_geometry_repair
+ * 
+ * Implements [$shp geometry repair], which streams every feature to a
+ * rewritten shapefile, repairing those with issues as shapefile_repairShape
+ * does: coordinates that are not finite and repeated vertices are dropped,
+ * rings are closed and rewound, and degenerate parts are dropped. Features
+ * left with no parts become null features. Self-intersections are not
+ * repaired. Feature indices and deletion flags are kept.
+ * 
+ * Command Syntax:
+ *   [$shp geometry repair]
+ *     Repair the shapefile in place, as [$shp compact] rewrites it. The
+ *     shapefile must be readwrite.
+ *   [$shp geometry repair -output PATH]
+ *     Write the repaired shapefile to PATH, leaving the original unmodified.
+ * 
+ * Result:
+ *   Number of features repaired.
+ */
+int cmd_geometry_repair(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	const char *outputPath = NULL;
+	int *featureIds;
+	int featureId, featureCount, repairCount;
+	int returnValue;
+	
+	if (objc != 3 && objc != 5) {
+		Tcl_WrongNumArgs(interp, 3, objv, "?-output path?");
+		return TCL_ERROR;
+	}
+	
+	if (objc == 5) {
+		if (strcmp(Tcl_GetString(objv[3]), "-output") != 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid option \"%s\": should be -output", Tcl_GetString(objv[3])));
+			return TCL_ERROR;
+		}
+		outputPath = Tcl_GetString(objv[4]);
+	}
+	
+	if (outputPath == NULL && shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot repair readonly shapefile in place (use -output)"));
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	if ((featureIds = (int *)ckalloc((unsigned int)(sizeof(int) * (featureCount + 1)))) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate feature index array"));
+		return TCL_ERROR;
+	}
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		featureIds[featureId] = featureId;
+	}
+	
+	returnValue = shapefile_rewrite(interp, shapefile, featureIds, featureCount, outputPath, &repairCount);
+	ckfree((char *)featureIds);
+	
+	if (returnValue == TCL_OK) {
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(repairCount));
+	}
+	return returnValue;
+}
+
+/*
+ * shapefile_shapeArea
+ * 
+ * Result:
+ *   Planar area of a polygon shape: the area of its outer rings less that of
+ *   its holes, whichever orientation they have. 0 for other shape types.
+ */
+double shapefile_shapeArea(const SHPObject *shape) {
+	int part, start, stop;
+	double area = 0.0, cx, cy;
+	
+	if (shapefile_typeBase(shape->nSHPType) != BASE_POLYGON || shape->nVertices == 0) {
+		return 0.0;
+	}
+	
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		stop = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		area += shapefile_ringArea(shape->padfX + start, shape->padfY + start, stop - start,
+				shape->padfX[0], shape->padfY[0], &cx, &cy);
+	}
+	
+	/* outer rings are clockwise, so their signed area is negative */
+	return fabs(area);
+}
+
+/*
+ * shapefile_shapeLength
+ * 
+ * Result:
+ *   Planar length of an arc shape, or perimeter of a polygon shape including
+ *   its holes. 0 for other shape types.
+ */
+double shapefile_shapeLength(const SHPObject *shape) {
+	int part, start, stop, baseType = shapefile_typeBase(shape->nSHPType);
+	double length = 0.0, cx, cy;
+	
+	if ((baseType != BASE_ARC && baseType != BASE_POLYGON) || shape->nVertices == 0) {
+		return 0.0;
+	}
+	
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		stop = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		length += shapefile_pathLength(shape->padfX + start, shape->padfY + start, stop - start,
+				shape->padfX[0], shape->padfY[0], &cx, &cy);
+	}
+	return length;
+}
+
+/*
+ * shapefile_shapeCentroid
+ * 
+ * Compute the centroid of a shape: the area centroid of a polygon, the
+ * length centroid of an arc or of a polygon with no area, or otherwise the
+ * mean of its vertices. Sums are taken relative to the first vertex to limit
+ * loss of precision with large coordinates.
+ * 
+ * Result:
+ *   1 with *x and *y set, or 0 if the shape has no vertices.
+ */
+int shapefile_shapeCentroid(
+		const SHPObject *shape,
+		double *x,
+		double *y) {
+	
+	int part, start, stop, i, baseType = shapefile_typeBase(shape->nSHPType);
+	double x0, y0, area = 0.0, length = 0.0, cx = 0.0, cy = 0.0, px, py;
+	
+	if (shape->nVertices == 0) {
+		return 0;
+	}
+	x0 = shape->padfX[0];
+	y0 = shape->padfY[0];
+	
+	if (baseType == BASE_POLYGON) {
+		for (part = 0; part < shape->nParts; part++) {
+			start = shape->panPartStart[part];
+			stop = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+			area += shapefile_ringArea(shape->padfX + start, shape->padfY + start, stop - start, x0, y0, &px, &py);
+			cx += px;
+			cy += py;
+		}
+		if (area != 0.0) {
+			*x = x0 + cx / (3.0 * area);
+			*y = y0 + cy / (3.0 * area);
+			return 1;
+		}
+		cx = cy = 0.0;
+	}
+	
+	if (baseType == BASE_POLYGON || baseType == BASE_ARC) {
+		for (part = 0; part < shape->nParts; part++) {
+			start = shape->panPartStart[part];
+			stop = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+			length += shapefile_pathLength(shape->padfX + start, shape->padfY + start, stop - start, x0, y0, &px, &py);
+			cx += px;
+			cy += py;
+		}
+		if (length != 0.0) {
+			*x = x0 + cx / length;
+			*y = y0 + cy / length;
+			return 1;
+		}
+		cx = cy = 0.0;
+	}
+	
+	for (i = 0; i < shape->nVertices; i++) {
+		cx += shape->padfX[i] - x0;
+		cy += shape->padfY[i] - y0;
+	}
+	*x = x0 + cx / shape->nVertices;
+	*y = y0 + cy / shape->nVertices;
+	return 1;
+}
+
+/*
+ * shapefile_ringArea
+ * 
+ * Compute the signed area of a ring of count vertices by the shoelace
+ * formula, with coordinates taken relative to (x0, y0). The ring is closed
+ * if its last vertex does not repeat its first. *cx and *cy are set to the
+ * ring's first moments times 3, so that the centroid of rings with total
+ * area A and summed moments CX, CY is (x0 + CX / 3A, y0 + CY / 3A).
+ * 
+ * Result:
+ *   Signed area; negative for clockwise rings.
+ */
+double shapefile_ringArea(
+		const double *x,
+		const double *y,
+		int count,
+		double x0,
+		double y0,
+		double *cx,
+		double *cy) {
+	
+	int i;
+	double cross, area = 0.0, mx = 0.0, my = 0.0;
+	double xi, yi, xj, yj;
+	
+	if (count < 2) {
+		*cx = *cy = 0.0;
+		return 0.0;
+	}
+	
+	/* the closing edge is added after the loop so the loop has no branch */
+	for (i = 0; i + 1 < count; i++) {
+		xi = x[i] - x0;
+		yi = y[i] - y0;
+		xj = x[i + 1] - x0;
+		yj = y[i + 1] - y0;
+		cross = xi * yj - xj * yi;
+		area += cross;
+		mx += (xi + xj) * cross;
+		my += (yi + yj) * cross;
+	}
+	xi = x[count - 1] - x0;
+	yi = y[count - 1] - y0;
+	xj = x[0] - x0;
+	yj = y[0] - y0;
+	cross = xi * yj - xj * yi;
+	area += cross;
+	mx += (xi + xj) * cross;
+	my += (yi + yj) * cross;
+	
+	*cx = mx / 2.0;
+	*cy = my / 2.0;
+	return area / 2.0;
+}
+
+/*
+ * shapefile_pathLength
+ * 
+ * Compute the length of a path of count vertices. *cx and *cy are set to
+ * the sums of segment midpoints, relative to (x0, y0), weighted by segment
+ * length, so that the centroid of paths with total length L and summed
+ * moments CX, CY is (x0 + CX / L, y0 + CY / L).
+ * 
+ * Result:
+ *   Path length.
+ */
+double shapefile_pathLength(
+		const double *x,
+		const double *y,
+		int count,
+		double x0,
+		double y0,
+		double *cx,
+		double *cy) {
+	
+	int i;
+	double dx, dy, segment, length = 0.0, mx = 0.0, my = 0.0;
+	
+	for (i = 0; i + 1 < count; i++) {
+		dx = x[i + 1] - x[i];
+		dy = y[i + 1] - y[i];
+		segment = sqrt(dx * dx + dy * dy);
+		length += segment;
+		mx += segment * ((x[i] + x[i + 1]) / 2.0 - x0);
+		my += segment * ((y[i] + y[i + 1]) / 2.0 - y0);
+	}
+	
+	*cx = mx;
+	*cy = my;
+	return length;
+}
+
+/*
+ * shapefile_validateShape
+ * 
+ * Check a shape for the issues reported by [$shp geometry validate]:
+ * ISSUE_NAN if any x, y, or z coordinate is not a finite number;
+ * ISSUE_DEGENERATE if an arc part has fewer than two distinct vertices or a
+ * polygon ring has fewer than three or no area; ISSUE_UNCLOSED if a ring's
+ * last vertex does not repeat its first; ISSUE_WINDING if an outer ring is
+ * not clockwise or a hole is not counterclockwise, with holes recognized as
+ * by SHPRewindObject (see shapefile_ringIsHole); and, if checkIntersections
+ * is true, ISSUE_INTERSECTION if edges of an arc part, or of any rings of a
+ * polygon, cross, touch, or overlap other than where consecutive edges meet
+ * (see shapefile_partsIntersect). Winding is not checked if coordinates are
+ * not finite, nor are intersections if there are also degenerate parts,
+ * whose edges would otherwise be reported as overlapping.
+ * 
+ * Result:
+ *   Mask of ISSUE_* bits; 0 if no issues were found.
+ */
+int shapefile_validateShape(
+		const SHPObject *shape,
+		int checkIntersections) {
+	
+	const double *x = shape->padfX, *y = shape->padfY;
+	int issues = 0, baseType, part, start, end, i, distinct;
+	double area, cx, cy;
+	
+	for (i = 0; i < shape->nVertices; i++) {
+		if (!isfinite(x[i]) || !isfinite(y[i]) || !isfinite(shape->padfZ[i])) {
+			issues |= ISSUE_NAN;
+			break;
+		}
+	}
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if (baseType != BASE_ARC && baseType != BASE_POLYGON) {
+		return issues;
+	}
+	
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		
+		/* count vertices that differ from their predecessor */
+		distinct = end > start ? 1 : 0;
+		for (i = start + 1; i < end; i++) {
+			if (x[i] != x[i - 1] || y[i] != y[i - 1]) {
+				distinct++;
+			}
+		}
+		
+		if (baseType == BASE_ARC) {
+			if (distinct < 2) {
+				issues |= ISSUE_DEGENERATE;
+			}
+			continue;
+		}
+		
+		if (end > start && (x[start] != x[end - 1] || y[start] != y[end - 1])) {
+			issues |= ISSUE_UNCLOSED;
+		} else if (distinct > 1) {
+			/* the closing vertex repeats the first */
+			distinct--;
+		}
+		area = shapefile_ringArea(x + start, y + start, end - start, x[start], y[start], &cx, &cy);
+		if (distinct < 3 || area == 0.0) {
+			issues |= ISSUE_DEGENERATE;
+			continue;
+		}
+		
+		/* outer rings are clockwise (negative area), holes counterclockwise */
+		if (!(issues & ISSUE_NAN) && (area < 0.0) == shapefile_ringIsHole(shape, part)) {
+			issues |= ISSUE_WINDING;
+		}
+	}
+	
+	if (checkIntersections && !(issues & (ISSUE_NAN | ISSUE_DEGENERATE))) {
+		if (baseType == BASE_POLYGON) {
+			if (shapefile_partsIntersect(shape, 0, shape->nParts)) {
+				issues |= ISSUE_INTERSECTION;
+			}
+		} else {
+			for (part = 0; part < shape->nParts; part++) {
+				if (shapefile_partsIntersect(shape, part, 1)) {
+					issues |= ISSUE_INTERSECTION;
+					break;
+				}
+			}
+		}
+	}
+	
+	return issues;
+}
+
+/*
+ * shapefile_ringIsHole
+ * 
+ * Test whether a ring of a polygon shape is a hole, as SHPRewindObject does:
+ * by whether the midpoint of its first edge lies inside the other rings,
+ * combined with the even-odd rule.
+ * 
+ * Result:
+ *   1 if the ring is a hole, 0 if it is an outer ring.
+ */
+int shapefile_ringIsHole(
+		const SHPObject *shape,
+		int part) {
+	
+	const double *px = shape->padfX, *py = shape->padfY;
+	int other, start, end, i, j, inside = 0;
+	double x, y;
+	
+	start = shape->panPartStart[part];
+	end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+	if (end - start < 2) {
+		return 0;
+	}
+	x = (px[start] + px[start + 1]) / 2.0;
+	y = (py[start] + py[start + 1]) / 2.0;
+	
+	for (other = 0; other < shape->nParts; other++) {
+		if (other == part) {
+			continue;
+		}
+		start = shape->panPartStart[other];
+		end = other + 1 < shape->nParts ? shape->panPartStart[other + 1] : shape->nVertices;
+		for (i = start, j = end - 1; i < end; j = i++) {
+			if ((py[i] > y) != (py[j] > y)
+					&& x < (px[j] - px[i]) * (y - py[i]) / (py[j] - py[i]) + px[i]) {
+				inside = !inside;
+			}
+		}
+	}
+	
+	return inside;
+}
+
+/*
+ * shapefile_repairShape
+ * 
+ * Repair the issues of a shape that [$shp geometry repair] can fix. Vertices
+ * with coordinates that are not finite and vertices that repeat their
+ * predecessor are dropped, unclosed polygon rings are closed, arc parts left
+ * with fewer than two vertices and rings left with fewer than four or no
+ * area are dropped, and polygon rings are rewound by SHPRewindObject.
+ * Points and multipoints only lose vertices that are not finite. A shape
+ * with no vertices left becomes a null shape. Self-intersections are not
+ * repaired.
+ * 
+ * Result:
+ *   New shape, to be destroyed with SHPDestroyObject.
+ */
+SHPObject *shapefile_repairShape(const SHPObject *shape) {
+	SHPObject *repaired;
+	double *x, *y, *z, *m, cx, cy;
+	int *partStarts, baseType, part, start, end, i, count = 0, partCount = 0, partStart;
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	
+	/* closing a ring may add one vertex to each part */
+	x = (double *)ckalloc((unsigned int)(sizeof(double) * 4 * (shape->nVertices + shape->nParts + 1)));
+	y = x + shape->nVertices + shape->nParts + 1;
+	z = y + shape->nVertices + shape->nParts + 1;
+	m = z + shape->nVertices + shape->nParts + 1;
+	partStarts = (int *)ckalloc((unsigned int)(sizeof(int) * (shape->nParts + 1)));
+	
+	if (baseType == BASE_POINT || baseType == BASE_MULTIPOINT) {
+		for (i = 0; i < shape->nVertices; i++) {
+			if (isfinite(shape->padfX[i]) && isfinite(shape->padfY[i]) && isfinite(shape->padfZ[i])) {
+				x[count] = shape->padfX[i];
+				y[count] = shape->padfY[i];
+				z[count] = shape->padfZ[i];
+				m[count] = shape->padfM[i];
+				count++;
+			}
+		}
+	} else {
+		for (part = 0; part < shape->nParts; part++) {
+			start = shape->panPartStart[part];
+			end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+			partStart = count;
+			for (i = start; i < end; i++) {
+				if (!isfinite(shape->padfX[i]) || !isfinite(shape->padfY[i]) || !isfinite(shape->padfZ[i])
+						|| (count > partStart && shape->padfX[i] == x[count - 1] && shape->padfY[i] == y[count - 1])) {
+					continue;
+				}
+				x[count] = shape->padfX[i];
+				y[count] = shape->padfY[i];
+				z[count] = shape->padfZ[i];
+				m[count] = shape->padfM[i];
+				count++;
+			}
+			
+			if (baseType == BASE_POLYGON && count > partStart
+					&& (x[partStart] != x[count - 1] || y[partStart] != y[count - 1])) {
+				x[count] = x[partStart];
+				y[count] = y[partStart];
+				z[count] = z[partStart];
+				m[count] = m[partStart];
+				count++;
+			}
+			
+			if (baseType == BASE_ARC ? count - partStart < 2 : count - partStart < 4
+					|| shapefile_ringArea(x + partStart, y + partStart, count - partStart,
+						x[partStart], y[partStart], &cx, &cy) == 0.0) {
+				count = partStart;
+				continue;
+			}
+			partStarts[partCount++] = partStart;
+		}
+	}
+	
+	if (count == 0) {
+		repaired = SHPCreateObject(SHPT_NULL, shape->nShapeId, 0, NULL, NULL, 0, NULL, NULL, NULL, NULL);
+	} else {
+		repaired = SHPCreateObject(shape->nSHPType, shape->nShapeId, partCount, partStarts, NULL,
+				count, x, y, z, shape->bMeasureIsUsed ? m : NULL);
+		SHPRewindObject(NULL, repaired);
+	}
+	
+	ckfree((char *)x);
+	ckfree((char *)partStarts);
+	return repaired;
+}
+
+/*
+ * shapefile_partsIntersect
+ * 
+ * Test whether any two edges of partCount parts of shape, starting with
+ * firstPart, cross, touch, or overlap, other than consecutive edges of a
+ * part meeting at their shared vertex. Repeated vertices are skipped, and the
+ * first and last edges of a closed part are consecutive. The Shamos-Hoey
+ * sweep line algorithm finds an intersection, if there is one, in O(n log n)
+ * time for n edges: edges are ordered along a vertical line swept across
+ * them, and each edge need only be tested against its neighbors on the line
+ * when it enters, and those neighbors against each other when it leaves.
+ * 
+ * Result:
+ *   1 if edges intersect, 0 otherwise.
+ */
+int shapefile_partsIntersect(
+		const SHPObject *shape,
+		int firstPart,
+		int partCount) {
+	
+	struct shapefile_sweep sweep;
+	struct shapefile_sweepSegment *segment;
+	struct shapefile_sweepEvent *events;
+	const double *x = shape->padfX, *y = shape->padfY;
+	int part, start, end, i, a, first, count = 0, eventCount, below, above, found = 0;
+	unsigned int seed = 1;
+	
+	start = shape->panPartStart[firstPart];
+	end = firstPart + partCount < shape->nParts ? shape->panPartStart[firstPart + partCount] : shape->nVertices;
+	if (end - start < 2) {
+		return 0;
+	}
+	sweep.segments = (struct shapefile_sweepSegment *)ckalloc(
+			(unsigned int)(sizeof(struct shapefile_sweepSegment) * (end - start)));
+	events = (struct shapefile_sweepEvent *)ckalloc(
+			(unsigned int)(sizeof(struct shapefile_sweepEvent) * 2 * (end - start)));
+	
+	for (part = firstPart; part < firstPart + partCount; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		first = count;
+		for (a = start, i = start + 1; i < end; i++) {
+			if (x[i] == x[a] && y[i] == y[a]) {
+				continue;
+			}
+			segment = &sweep.segments[count];
+			if (x[a] < x[i] || (x[a] == x[i] && y[a] < y[i])) {
+				segment->x1 = x[a]; segment->y1 = y[a];
+				segment->x2 = x[i]; segment->y2 = y[i];
+			} else {
+				segment->x1 = x[i]; segment->y1 = y[i];
+				segment->x2 = x[a]; segment->y2 = y[a];
+			}
+			segment->part = part;
+			segment->index = count - first;
+			seed = seed * 1103515245 + 12345;
+			segment->priority = seed;
+			count++;
+			a = i;
+		}
+		for (i = first; i < count; i++) {
+			sweep.segments[i].partSegments = count - first;
+			sweep.segments[i].closed = end > start && x[start] == x[end - 1] && y[start] == y[end - 1];
+		}
+	}
+	
+	/* each segment enters the sweep line at its lesser endpoint */
+	for (i = 0; i < count; i++) {
+		events[i * 2].x = sweep.segments[i].x1;
+		events[i * 2].y = sweep.segments[i].y1;
+		events[i * 2].segment = i;
+		events[i * 2].leave = 0;
+		events[i * 2 + 1].x = sweep.segments[i].x2;
+		events[i * 2 + 1].y = sweep.segments[i].y2;
+		events[i * 2 + 1].segment = i;
+		events[i * 2 + 1].leave = 1;
+	}
+	eventCount = count * 2;
+	qsort(events, eventCount, sizeof(struct shapefile_sweepEvent), shapefile_compareSweepEvent);
+	
+	sweep.root = -1;
+	for (i = 0; i < eventCount && !found; i++) {
+		sweep.x = events[i].x;
+		sweep.y = events[i].y;
+		a = events[i].segment;
+		if (events[i].leave) {
+			below = shapefile_sweepNeighbor(&sweep, a, 0);
+			above = shapefile_sweepNeighbor(&sweep, a, 1);
+			shapefile_sweepRemove(&sweep, a);
+			found = below != -1 && above != -1 && shapefile_sweepIntersect(&sweep, below, above);
+		} else {
+			shapefile_sweepInsert(&sweep, a);
+			below = shapefile_sweepNeighbor(&sweep, a, 0);
+			above = shapefile_sweepNeighbor(&sweep, a, 1);
+			found = (below != -1 && shapefile_sweepIntersect(&sweep, a, below))
+					|| (above != -1 && shapefile_sweepIntersect(&sweep, a, above));
+		}
+	}
+	
+	ckfree((char *)sweep.segments);
+	ckfree((char *)events);
+	return found;
+}
+
+/*
+ * shapefile_compareSweepEvent
+ * 
+ * qsort comparison function for sweep events: by x, then y, with segments
+ * entering the sweep line at a point before others leave it there, so that
+ * segments that only touch at an endpoint are on the line together.
+ */
+int shapefile_compareSweepEvent(
+		const void *a,
+		const void *b) {
+	
+	const struct shapefile_sweepEvent *ea = a, *eb = b;
+	
+	if (ea->x != eb->x) {
+		return ea->x < eb->x ? -1 : 1;
+	}
+	if (ea->y != eb->y) {
+		return ea->y < eb->y ? -1 : 1;
+	}
+	if (ea->leave != eb->leave) {
+		return ea->leave ? 1 : -1;
+	}
+	return ea->segment - eb->segment;
+}
+
+/*
+ * shapefile_sweepY
+ * 
+ * Result:
+ *   Y coordinate at which segment crosses the sweep line. Vertical segments
+ *   are taken to cross it at the current event point, within their extent.
+ */
+double shapefile_sweepY(
+		ShapefileSweepPtr sweep,
+		int segment) {
+	
+	const struct shapefile_sweepSegment *s = &sweep->segments[segment];
+	
+	if (s->x1 == s->x2) {
+		return sweep->y < s->y1 ? s->y1 : sweep->y > s->y2 ? s->y2 : sweep->y;
+	}
+	if (sweep->x == s->x1) {
+		return s->y1;
+	}
+	if (sweep->x == s->x2) {
+		return s->y2;
+	}
+	return s->y1 + (sweep->x - s->x1) * (s->y2 - s->y1) / (s->x2 - s->x1);
+}
+
+/*
+ * shapefile_sweepCompare
+ * 
+ * Order segments a and b along the sweep line, from bottom to top. Segments
+ * that cross the sweep line at the same point are ordered by slope, as they
+ * are just beyond it, and then by number.
+ * 
+ * Result:
+ *   Negative if a is below b, positive if it is above.
+ */
+int shapefile_sweepCompare(
+		ShapefileSweepPtr sweep,
+		int a,
+		int b) {
+	
+	const struct shapefile_sweepSegment *sa = &sweep->segments[a], *sb = &sweep->segments[b];
+	double ya, yb, cross;
+	
+	ya = shapefile_sweepY(sweep, a);
+	yb = shapefile_sweepY(sweep, b);
+	if (ya != yb) {
+		return ya < yb ? -1 : 1;
+	}
+	
+	/* vertical segments are steepest */
+	if ((sa->x1 == sa->x2) != (sb->x1 == sb->x2)) {
+		return sa->x1 == sa->x2 ? 1 : -1;
+	}
+	cross = (sa->y2 - sa->y1) * (sb->x2 - sb->x1) - (sb->y2 - sb->y1) * (sa->x2 - sa->x1);
+	if (cross != 0.0) {
+		return cross < 0.0 ? -1 : 1;
+	}
+	return a - b;
+}
+
+/*
+ * shapefile_sweepRotate
+ * 
+ * Rotate node above its parent in the treap of segments on the sweep line,
+ * preserving their order.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_sweepRotate(
+		ShapefileSweepPtr sweep,
+		int node) {
+	
+	struct shapefile_sweepSegment *s = sweep->segments;
+	int parent = s[node].parent, grandparent = s[parent].parent, moved;
+	
+	if (s[parent].left == node) {
+		moved = s[node].right;
+		s[parent].left = moved;
+		s[node].right = parent;
+	} else {
+		moved = s[node].left;
+		s[parent].right = moved;
+		s[node].left = parent;
+	}
+	if (moved != -1) {
+		s[moved].parent = parent;
+	}
+	s[parent].parent = node;
+	s[node].parent = grandparent;
+	if (grandparent == -1) {
+		sweep->root = node;
+	} else if (s[grandparent].left == parent) {
+		s[grandparent].left = node;
+	} else {
+		s[grandparent].right = node;
+	}
+}
+
+/*
+ * shapefile_sweepInsert
+ * 
+ * Add segment to the sweep line at its place in the order given by
+ * shapefile_sweepCompare.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_sweepInsert(
+		ShapefileSweepPtr sweep,
+		int segment) {
+	
+	struct shapefile_sweepSegment *s = sweep->segments;
+	int node = sweep->root, parent = -1, below = 0;
+	
+	while (node != -1) {
+		parent = node;
+		below = shapefile_sweepCompare(sweep, segment, node) < 0;
+		node = below ? s[node].left : s[node].right;
+	}
+	s[segment].left = s[segment].right = -1;
+	s[segment].parent = parent;
+	if (parent == -1) {
+		sweep->root = segment;
+	} else if (below) {
+		s[parent].left = segment;
+	} else {
+		s[parent].right = segment;
+	}
+	
+	/* restore the heap order of priorities */
+	while (s[segment].parent != -1 && s[segment].priority > s[s[segment].parent].priority) {
+		shapefile_sweepRotate(sweep, segment);
+	}
+}
+
+/*
+ * shapefile_sweepRemove
+ * 
+ * Remove segment from the sweep line. The treap is restructured by parent
+ * links rather than searched, so the order of segments need not be
+ * evaluated at the current sweep line position.
+ * 
+ * Result:
+ *   None.
+ */
+void shapefile_sweepRemove(
+		ShapefileSweepPtr sweep,
+		int segment) {
+	
+	struct shapefile_sweepSegment *s = sweep->segments;
+	int child, parent;
+	
+	while (s[segment].left != -1 || s[segment].right != -1) {
+		if (s[segment].left == -1) {
+			child = s[segment].right;
+		} else if (s[segment].right == -1) {
+			child = s[segment].left;
+		} else {
+			child = s[s[segment].left].priority > s[s[segment].right].priority
+					? s[segment].left : s[segment].right;
+		}
+		shapefile_sweepRotate(sweep, child);
+	}
+	
+	parent = s[segment].parent;
+	if (parent == -1) {
+		sweep->root = -1;
+	} else if (s[parent].left == segment) {
+		s[parent].left = -1;
+	} else {
+		s[parent].right = -1;
+	}
+}
+
+/*
+ * shapefile_sweepNeighbor
+ * 
+ * Result:
+ *   The segment next above (if above is true) or below segment on the sweep
+ *   line, or -1 if there is none.
+ */
+int shapefile_sweepNeighbor(
+		ShapefileSweepPtr sweep,
+		int segment,
+		int above) {
+	
+	struct shapefile_sweepSegment *s = sweep->segments;
+	int node;
+	
+	node = above ? s[segment].right : s[segment].left;
+	if (node != -1) {
+		while ((above ? s[node].left : s[node].right) != -1) {
+			node = above ? s[node].left : s[node].right;
+		}
+		return node;
+	}
+	
+	node = segment;
+	while (s[node].parent != -1 && (above ? s[s[node].parent].right : s[s[node].parent].left) == node) {
+		node = s[node].parent;
+	}
+	return s[node].parent;
+}
+
+/*
+ * shapefile_sweepIntersect
+ * 
+ * Test whether segments a and b intersect. Consecutive edges of a part only
+ * intersect if they overlap beyond their shared vertex.
+ * 
+ * Result:
+ *   1 if the segments intersect, 0 otherwise.
+ */
+int shapefile_sweepIntersect(
+		ShapefileSweepPtr sweep,
+		int a,
+		int b) {
+	
+	const struct shapefile_sweepSegment *sa = &sweep->segments[a], *sb = &sweep->segments[b];
+	double d1, d2, d3, d4;
+	
+	d1 = (sa->x2 - sa->x1) * (sb->y1 - sa->y1) - (sa->y2 - sa->y1) * (sb->x1 - sa->x1);
+	d2 = (sa->x2 - sa->x1) * (sb->y2 - sa->y1) - (sa->y2 - sa->y1) * (sb->x2 - sa->x1);
+	
+	if (sa->part == sb->part && (abs(sa->index - sb->index) == 1
+			|| (sa->closed && ((sa->index == 0 && sb->index == sa->partSegments - 1)
+			|| (sb->index == 0 && sa->index == sa->partSegments - 1))))) {
+		if (d1 != 0.0 || d2 != 0.0) {
+			return 0;
+		}
+		
+		/* collinear; endpoints are ordered in x, then y */
+		return sa->x1 == sa->x2
+				? (sa->y2 < sb->y2 ? sa->y2 : sb->y2) > (sa->y1 > sb->y1 ? sa->y1 : sb->y1)
+				: (sa->x2 < sb->x2 ? sa->x2 : sb->x2) > (sa->x1 > sb->x1 ? sa->x1 : sb->x1);
+	}
+	
+	d3 = (sb->x2 - sb->x1) * (sa->y1 - sb->y1) - (sb->y2 - sb->y1) * (sa->x1 - sb->x1);
+	d4 = (sb->x2 - sb->x1) * (sa->y2 - sb->y1) - (sb->y2 - sb->y1) * (sa->x2 - sb->x1);
+	
+	if (((d1 > 0.0 && d2 < 0.0) || (d1 < 0.0 && d2 > 0.0))
+			&& ((d3 > 0.0 && d4 < 0.0) || (d3 < 0.0 && d4 > 0.0))) {
+		return 1;
+	}
+	
+	/* an endpoint of one segment lies on the other */
+	return (d1 == 0.0 && shapefile_onSegment(sa, sb->x1, sb->y1))
+			|| (d2 == 0.0 && shapefile_onSegment(sa, sb->x2, sb->y2))
+			|| (d3 == 0.0 && shapefile_onSegment(sb, sa->x1, sa->y1))
+			|| (d4 == 0.0 && shapefile_onSegment(sb, sa->x2, sa->y2));
+}
+
+/*
+ * shapefile_onSegment
+ * 
+ * Result:
+ *   1 if point x, y, known to be collinear with segment, lies within its
+ *   extent; 0 otherwise.
+ */
+int shapefile_onSegment(
+		const struct shapefile_sweepSegment *segment,
+		double x,
+		double y) {
+	
+	return x >= segment->x1 && x <= segment->x2
+			&& y >= (segment->y1 < segment->y2 ? segment->y1 : segment->y2)
+			&& y <= (segment->y1 < segment->y2 ? segment->y2 : segment->y1);
+}
+
+/*
+ * cmd_spatial
+ * 
+ * Implements the [$shp spatial] command used to find features by location.
+ * Queries are answered from a packed R-tree of feature bounding boxes, built
+ * on first use (see shapefile_spatialBuild), and refined by exact tests of
+ * the candidate features' geometry.
+ * 
+ * Command Syntax:
+ *   [$shp spatial contains X Y ?-candidates FEATURES?]
+ *     Get the indices of polygon features that contain point X Y, in
+ *     ascending order. If -candidates is given, only the features in the
+ *     FEATURES list are tested, and matches are returned in the order given.
+ *   [$shp spatial locate POINTS]
+ *     Get the index of the polygon feature containing each point in the flat
+ *     {X Y X Y ...} list POINTS, or -1 for points outside all features. If
+ *     polygons overlap, the lowest index containing the point is returned.
+ *   [$shp spatial nearest X Y ?-k COUNT? ?-maxdist DISTANCE?]
+ *     Get the indices of the COUNT (default 1) features of any type nearest
+ *     to point X Y, nearest first, omitting any farther than DISTANCE.
+ *     Distance is measured to the nearest vertex or segment of each feature,
+ *     or is 0 inside polygons; equally distant features are in index order.
+ *   Polygon rings are combined with the even-odd rule. Null features, and
+ *   deleted features if skipDeleted is set, are never found.
+ * 
+ * Result:
+ *   List of feature indices.
+ */
+int cmd_spatial(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	static const char *actionNames[] = {"contains", "locate", "nearest", NULL};
+	int actionIndex;
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "action ?args?");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetIndexFromObj(interp, objv[2], actionNames, "action",
+			TCL_EXACT, &actionIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if (actionIndex == 2) {
+		return cmd_spatial_nearest(interp, shapefile, objc, objv);
+	}
+	
+	if (shapefile->baseType != BASE_POLYGON) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s queries require a polygon shapefile", actionNames[actionIndex]));
+		return TCL_ERROR;
+	}
+	
+	if (actionIndex == 0) {
+		return cmd_spatial_contains(interp, shapefile, objc, objv);
+	}
+	
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 3, objv, "points");
+		return TCL_ERROR;
+	}
+	return cmd_spatial_locate(interp, shapefile, objv[3]);
+}
+
+/*
+ * cmd_spatial_contains
+ * 
+ * Implements [$shp spatial contains X Y ?-candidates FEATURES?]. Without
+ * -candidates, the features whose bounding boxes contain the point are found
+ * with the spatial index; with it, each candidate's bounding box is checked.
+ * 
+ * Result:
+ *   List of indices of features that contain the point.
+ */
+int cmd_spatial_contains(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	static const char *optionNames[] = {"-candidates", NULL};
+	int optionIndex, featureCount, count, capacity = 0, i, featureId, release;
+	int *featureIds = NULL;
+	Tcl_Obj **candidates = NULL;
+	Tcl_Obj *result;
+	SHPObject *shape;
+	double x, y;
+	
+	if (objc != 5 && objc != 7) {
+		Tcl_WrongNumArgs(interp, 3, objv, "x y ?-candidates features?");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetDoubleFromObj(interp, objv[3], &x) != TCL_OK
+			|| Tcl_GetDoubleFromObj(interp, objv[4], &y) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	if (objc == 7) {
+		if (Tcl_GetIndexFromObj(interp, objv[5], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK
+				|| Tcl_ListObjGetElements(interp, objv[6], &count, &candidates) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	} else {
+		if (shapefile->spatialIndex == NULL
+				&& (shapefile->spatialIndex = shapefile_spatialBuild(interp, shapefile)) == NULL) {
+			return TCL_ERROR;
+		}
+		count = shapefile_spatialSearch(shapefile->spatialIndex, x, y, x, y, &featureIds, &capacity);
+		qsort(featureIds, count, sizeof(int), shapefile_compareId);
+	}
+	
+	result = Tcl_NewListObj(0, NULL);
+	for (i = 0; i < count; i++) {
+		if (candidates == NULL) {
+			featureId = featureIds[i];
+		} else {
+			if (Tcl_GetIntFromObj(interp, candidates[i], &featureId) != TCL_OK) {
+				goto error;
+			}
+			if (featureId < 0 || featureId >= featureCount) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+				goto error;
+			}
+		}
+		
+		if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId)) {
+			continue;
+		}
+		if ((shape = shapefile_readShape(interp, shapefile, featureId, &release)) == NULL) {
+			goto error;
+		}
+		if (shape->nVertices > 0
+				&& x >= shape->dfXMin && x <= shape->dfXMax
+				&& y >= shape->dfYMin && y <= shape->dfYMax
+				&& shapefile_pointInShape(shape, x, y)) {
+			Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(featureId));
+		}
+		if (release) {
+			SHPDestroyObject(shape);
+		}
+	}
+	
+	if (featureIds != NULL) ckfree((char *)featureIds);
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+	
+   error:
+	if (featureIds != NULL) ckfree((char *)featureIds);
+	Tcl_DecrRefCount(result);
+	return TCL_ERROR;
+}
+
+/*
+ * cmd_spatial_locate
+ * 
+ * Implements [$shp spatial locate POINTS]. Features decoded for one point are
+ * kept for the following points (see shapefile_shapeTableRead), so batches of
+ * nearby points read each feature about once.
+ * 
+ * Result:
+ *   List with the index of the feature containing each point, or -1.
+ */
+int cmd_spatial_locate(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		Tcl_Obj *points) {
+	
+	Tcl_HashTable shapes;
+	Tcl_Obj **coords;
+	Tcl_Obj *result;
+	SHPObject *shape;
+	int *featureIds = NULL;
+	int coordCount, count, capacity = 0, point, i, featureId, found;
+	int returnValue = TCL_ERROR;
+	double x, y;
+	
+	if (Tcl_ListObjGetElements(interp, points, &coordCount, &coords) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (coordCount % 2 != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("2 coordinate values are expected for each point"));
+		return TCL_ERROR;
+	}
+	
+	if (shapefile->spatialIndex == NULL
+			&& (shapefile->spatialIndex = shapefile_spatialBuild(interp, shapefile)) == NULL) {
+		return TCL_ERROR;
+	}
+	
+	Tcl_InitHashTable(&shapes, TCL_ONE_WORD_KEYS);
+	result = Tcl_NewListObj(0, NULL);
+	
+	for (point = 0; point < coordCount; point += 2) {
+		if (Tcl_GetDoubleFromObj(interp, coords[point], &x) != TCL_OK
+				|| Tcl_GetDoubleFromObj(interp, coords[point + 1], &y) != TCL_OK) {
+			goto cleanup;
+		}
+		
+		/* candidates are in index order; only lower indices can improve on
+		   a containing feature already found */
+		found = -1;
+		count = shapefile_spatialSearch(shapefile->spatialIndex, x, y, x, y, &featureIds, &capacity);
+		for (i = 0; i < count; i++) {
+			featureId = featureIds[i];
+			if ((found != -1 && featureId > found)
+					|| (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId))) {
+				continue;
+			}
+			
+			if ((shape = shapefile_shapeTableRead(&shapes, shapefile->shp, featureId)) == NULL) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+				goto cleanup;
+			}
+			if (shapefile_pointInShape(shape, x, y)) {
+				found = featureId;
+			}
+		}
+		Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(found));
+	}
+	
+	Tcl_SetObjResult(interp, result);
+	result = NULL;
+	returnValue = TCL_OK;
+	
+   cleanup:
+	shapefile_shapeTableClear(&shapes);
+	Tcl_DeleteHashTable(&shapes);
+	if (featureIds != NULL) ckfree((char *)featureIds);
+	if (result != NULL) Tcl_DecrRefCount(result);
+	return returnValue;
+}
+
+/*
+ * shapefile_shapeTableRead
+ * 
+ * Get a feature from a table of decoded shapes keyed by feature index, such
+ * as the one kept by [$shp spatial locate] for a batch of points. Features
+ * not in the table are read with shp and added; the table is cleared first
+ * if it already holds SPATIAL_LOCATE_SHAPES features. Uses no interpreter,
+ * so it may be called from worker threads with their own tables.
+ * 
+ * Result:
+ *   Shape, owned by the table, or NULL if the feature could not be read.
+ */
+SHPObject *shapefile_shapeTableRead(
+		Tcl_HashTable *shapes,
+		SHPHandle shp,
+		int featureId) {
+	
+	Tcl_HashEntry *hashEntry;
+	SHPObject *shape;
+	int isNew;
+	
+	if ((hashEntry = Tcl_FindHashEntry(shapes, (char *)(size_t)featureId)) != NULL) {
+		return (SHPObject *)Tcl_GetHashValue(hashEntry);
+	}
+	
+	if (shapes->numEntries >= SPATIAL_LOCATE_SHAPES) {
+		shapefile_shapeTableClear(shapes);
+		Tcl_DeleteHashTable(shapes);
+		Tcl_InitHashTable(shapes, TCL_ONE_WORD_KEYS);
+	}
+	if ((shape = SHPReadObject(shp, featureId)) == NULL) {
+		return NULL;
+	}
+	hashEntry = Tcl_CreateHashEntry(shapes, (char *)(size_t)featureId, &isNew);
+	Tcl_SetHashValue(hashEntry, shape);
+	return shape;
+}
+
+/*
+ * shapefile_shapeTableClear
+ * 
+ * Destroy the shapes held in a table read by shapefile_shapeTableRead. The
+ * table itself must still be deleted with Tcl_DeleteHashTable.
+ */
+void shapefile_shapeTableClear(Tcl_HashTable *shapes) {
+	Tcl_HashEntry *hashEntry;
+	Tcl_HashSearch search;
+	
+	for (hashEntry = Tcl_FirstHashEntry(shapes, &search); hashEntry != NULL;
+			hashEntry = Tcl_NextHashEntry(&search)) {
+		SHPDestroyObject((SHPObject *)Tcl_GetHashValue(hashEntry));
+	}
+}
+
+/*
+ * cmd_spatial_nearest
+ * 
+ * Implements [$shp spatial nearest X Y ?-k COUNT? ?-maxdist DISTANCE?]. The
+ * spatial index is traversed best first: a queue ordered by distance holds
+ * index nodes, at the distance to their boxes, and features, at their exact
+ * distance. Nodes are expanded and leaves measured as they reach the front of
+ * the queue, so features are found in order of distance and only nodes that
+ * could hold one of the nearest features are visited.
+ * 
+ * Result:
+ *   List of indices of the COUNT (default 1) nearest features, nearest first.
+ */
+int cmd_spatial_nearest(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	static const char *optionNames[] = {"-k", "-maxdist", NULL};
+	ShapefileSpatialIndexPtr index;
+	struct shapefile_spatialEntry *queue = NULL;
+	struct shapefile_spatialEntry entry;
+	int queueCount = 0, queueCapacity = 0;
+	int optionIndex, i, k = 1, found = 0, node, level, child, end, release;
+	double x, y, maxDistance = -1.0;
+	const double *box;
+	Tcl_Obj *result;
+	SHPObject *shape;
+	
+	if (objc < 5 || objc % 2 == 0) {
+		Tcl_WrongNumArgs(interp, 3, objv, "x y ?-k count? ?-maxdist distance?");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetDoubleFromObj(interp, objv[3], &x) != TCL_OK
+			|| Tcl_GetDoubleFromObj(interp, objv[4], &y) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	for (i = 5; i < objc; i += 2) {
+		if (Tcl_GetIndexFromObj(interp, objv[i], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (optionIndex == 0) {
+			if (Tcl_GetIntFromObj(interp, objv[i + 1], &k) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (k < 1) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid neighbor count %d", k));
+				return TCL_ERROR;
+			}
+		} else {
+			if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &maxDistance) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (maxDistance < 0.0) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid distance %s", Tcl_GetString(objv[i + 1])));
+				return TCL_ERROR;
+			}
+		}
+	}
+	
+	if (shapefile->spatialIndex == NULL
+			&& (shapefile->spatialIndex = shapefile_spatialBuild(interp, shapefile)) == NULL) {
+		return TCL_ERROR;
+	}
+	index = shapefile->spatialIndex;
+	
+	result = Tcl_NewListObj(0, NULL);
+	if (index->nodeCount > 0) {
+		entry.node = index->nodeCount - 1;
+		entry.featureId = -1;
+		entry.distance = shapefile_boxDistance(index->boxes + entry.node * 4, x, y);
+		shapefile_spatialPush(&queue, &queueCount, &queueCapacity, &entry);
+	}
+	
+	while (found < k && queueCount > 0) {
+		shapefile_spatialPop(queue, &queueCount, &entry);
+		if (maxDistance >= 0.0 && entry.distance > maxDistance) {
+			break;
+		}
+		
+		/* a feature at the front of the queue is nearer than anything left */
+		if (entry.node == -1) {
+			Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(entry.featureId));
+			found++;
+			continue;
+		}
+		
+		/* measure a leaf's feature; the distance to a point is exact already */
+		if (entry.node < index->leafCount) {
+			entry.featureId = index->children[entry.node];
+			entry.node = -1;
+			if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, entry.featureId)) {
+				continue;
+			}
+			if (shapefile->baseType != BASE_POINT) {
+				if ((shape = shapefile_readShape(interp, shapefile, entry.featureId, &release)) == NULL) {
+					if (queue != NULL) ckfree((char *)queue);
+					Tcl_DecrRefCount(result);
+					return TCL_ERROR;
+				}
+				entry.distance = shapefile_shapeDistance(shape, x, y);
+				if (release) {
+					SHPDestroyObject(shape);
+				}
+			}
+			shapefile_spatialPush(&queue, &queueCount, &queueCapacity, &entry);
+			continue;
+		}
+		
+		/* expand a parent node */
+		node = entry.node;
+		for (level = 1; node >= index->levelStart[level + 1]; level++);
+		end = node + 1 < index->levelStart[level + 1]
+				? index->children[node + 1] : index->levelStart[level];
+		for (child = index->children[node]; child < end; child++) {
+			box = index->boxes + child * 4;
+			entry.node = child;
+			entry.featureId = -1;
+			entry.distance = shapefile_boxDistance(box, x, y);
+			if (maxDistance < 0.0 || entry.distance <= maxDistance) {
+				shapefile_spatialPush(&queue, &queueCount, &queueCapacity, &entry);
+			}
+		}
+	}
+	
+	if (queue != NULL) ckfree((char *)queue);
+	Tcl_SetObjResult(interp, result);
+	return TCL_OK;
+}
+
+/*
+ * shapefile_spatialPush, shapefile_spatialPop
+ * 
+ * Add an entry to, or remove the first entry from, the binary heap of
+ * *count entries used as the queue of a nearest feature search. The push
+ * grows the heap array (of *capacity entries) as needed; the caller must
+ * free it with ckfree. Entries are ordered by distance; at equal distance,
+ * index nodes come before features, and features are ordered by index, so
+ * ties are resolved the same way however the index is arranged.
+ */
+void shapefile_spatialPush(
+		struct shapefile_spatialEntry **queue,
+		int *count,
+		int *capacity,
+		const struct shapefile_spatialEntry *entry) {
+	
+	struct shapefile_spatialEntry *heap;
+	int i, parent;
+	
+	if (*count == *capacity) {
+		*capacity = *capacity == 0 ? 64 : *capacity * 2;
+		*queue = (struct shapefile_spatialEntry *)ckrealloc((char *)*queue,
+				(unsigned int)(sizeof(struct shapefile_spatialEntry) * *capacity));
+	}
+	heap = *queue;
+	
+	for (i = (*count)++; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!shapefile_spatialBefore(entry, &heap[parent])) {
+			break;
+		}
+		heap[i] = heap[parent];
+	}
+	heap[i] = *entry;
+}
+
+void shapefile_spatialPop(
+		struct shapefile_spatialEntry *queue,
+		int *count,
+		struct shapefile_spatialEntry *entry) {
+	
+	struct shapefile_spatialEntry last;
+	int i, child;
+	
+	*entry = queue[0];
+	last = queue[--(*count)];
+	
+	for (i = 0; (child = i * 2 + 1) < *count; i = child) {
+		if (child + 1 < *count && shapefile_spatialBefore(&queue[child + 1], &queue[child])) {
+			child++;
+		}
+		if (!shapefile_spatialBefore(&queue[child], &last)) {
+			break;
+		}
+		queue[i] = queue[child];
+	}
+	queue[i] = last;
+}
+
+/*
+ * shapefile_spatialBefore
+ * 
+ * Result:
+ *   1 if queue entry a precedes entry b (see shapefile_spatialPush), else 0.
+ */
+int shapefile_spatialBefore(
+		const struct shapefile_spatialEntry *a,
+		const struct shapefile_spatialEntry *b) {
+	
+	if (a->distance != b->distance) {
+		return a->distance < b->distance;
+	}
+	if ((a->node == -1) != (b->node == -1)) {
+		return a->node != -1;
+	}
+	return a->node == -1 ? a->featureId < b->featureId : a->node < b->node;
+}
+
+/*
+ * shapefile_boxDistance
+ * 
+ * Result:
+ *   Distance from point x, y to the nearest point of box (Xmin, Ymin, Xmax,
+ *   Ymax), or 0 if the point is inside the box.
+ */
+double shapefile_boxDistance(const double *box, double x, double y) {
+	double dx = 0.0, dy = 0.0;
+	
+	if (x < box[0]) dx = box[0] - x;
+	else if (x > box[2]) dx = x - box[2];
+	if (y < box[1]) dy = box[1] - y;
+	else if (y > box[3]) dy = y - box[3];
+	return sqrt(dx * dx + dy * dy);
+}
+
+/*
+ * shapefile_shapeDistance
+ * 
+ * Get the planar distance from point x, y to the nearest point of a shape:
+ * its nearest vertex for point and multipoint shapes, or nearest segment for
+ * arcs and polygon rings. Points inside a polygon (see shapefile_pointInShape)
+ * are at distance 0.
+ * 
+ * Result:
+ *   Distance, or HUGE_VAL for shapes with no vertices.
+ */
+double shapefile_shapeDistance(const SHPObject *shape, double x, double y) {
+	int baseType, i;
+	double distance = HUGE_VAL, segment;
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if (shape->nVertices == 0) {
+		return distance;
+	}
+	if (baseType == BASE_POLYGON && shapefile_pointInShape(shape, x, y)) {
+		return 0.0;
+	}
+	
+	if (baseType == BASE_POINT || baseType == BASE_MULTIPOINT) {
+		for (i = 0; i < shape->nVertices; i++) {
+			segment = shapefile_segmentDistance(shape->padfX[i], shape->padfY[i],
+					shape->padfX[i], shape->padfY[i], x, y);
+			if (segment < distance) distance = segment;
+		}
+		return distance;
+	}
+	
+	return shapefile_partsDistance(shape, x, y);
+}
+
+/*
+ * shapefile_partsDistance
+ * 
+ * Get the planar distance from point x, y to the nearest segment of the parts
+ * of an arc or polygon shape. Unlike shapefile_shapeDistance, points inside a
+ * polygon are measured to its nearest ring.
+ * 
+ * Result:
+ *   Distance, or HUGE_VAL for shapes with no vertices.
+ */
+double shapefile_partsDistance(const SHPObject *shape, double x, double y) {
+	int part, start, end, i;
+	double distance = HUGE_VAL, segment;
+	
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		
+		/* a part with one vertex is measured to that vertex */
+		for (i = start; i < end && (i == start || i + 1 < end); i++) {
+			segment = shapefile_segmentDistance(shape->padfX[i], shape->padfY[i],
+					shape->padfX[i + 1 < end ? i + 1 : i], shape->padfY[i + 1 < end ? i + 1 : i], x, y);
+			if (segment < distance) distance = segment;
+		}
+	}
+	return distance;
+}
+
+/*
+ * shapefile_segmentDistance
+ * 
+ * Result:
+ *   Distance from point x, y to the nearest point of the segment from x1, y1
+ *   to x2, y2, which may have zero length.
+ */
+double shapefile_segmentDistance(
+		double x1,
+		double y1,
+		double x2,
+		double y2,
+		double x,
+		double y) {
+	
+	double dx = x2 - x1, dy = y2 - y1, lengthSquared, t;
+	
+	lengthSquared = dx * dx + dy * dy;
+	t = lengthSquared > 0.0 ? ((x - x1) * dx + (y - y1) * dy) / lengthSquared : 0.0;
+	if (t < 0.0) t = 0.0;
+	else if (t > 1.0) t = 1.0;
+	dx = x1 + t * dx - x;
+	dy = y1 + t * dy - y;
+	return sqrt(dx * dx + dy * dy);
+}
+
+/*
+ * shapefile_spatialBuild
+ * 
+ * Build a spatial index of the bounding boxes of shapefile's non-null
+ * features. Boxes are read from the record headers and sorted by the Hilbert
+ * code of their centers, as for [$shp sort -hilbert]; each run of
+ * SPATIAL_NODE_SIZE nodes is then grouped under a parent, level by level,
+ * until one root remains.
+ * 
+ * Result:
+ *   Spatial index, to be released with shapefile_spatialFree, or NULL (with
+ *   an error message in interp) if feature bounds could not be read.
+ */
+ShapefileSpatialIndexPtr shapefile_spatialBuild(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile) {
+	
+	ShapefileSpatialIndexPtr index = NULL;
+	ShapefileSortKeyPtr keys;
+	double *bounds, *box, *childBox;
+	int featureCount, nodeCount, levelNodes, start, end, next, i, child;
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	keys = (ShapefileSortKeyPtr)ckalloc((unsigned int)(sizeof(struct shapefile_sortKey) * (featureCount + 1)));
+	bounds = (double *)ckalloc((unsigned int)(sizeof(double) * 4 * (featureCount + 1)));
+	if (keys == NULL || bounds == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate spatial index"));
+		goto cleanup;
+	}
+	if (cmd_sort_spatialKeys(interp, shapefile, keys, featureCount, 1, bounds) != TCL_OK) {
+		goto cleanup;
+	}
+	
+	if ((index = (ShapefileSpatialIndexPtr)ckalloc((unsigned int)sizeof(struct shapefile_spatialIndex))) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate spatial index"));
+		goto cleanup;
+	}
+	
+	/* null keys sort last */
+	index->leafCount = 0;
+	while (index->leafCount < featureCount && !keys[index->leafCount].isNull) {
+		index->leafCount++;
+	}
+	
+	/* count the nodes of every level; even a single leaf gets a parent */
+	nodeCount = levelNodes = index->leafCount;
+	while (levelNodes > 1 || (levelNodes == 1 && nodeCount == 1)) {
+		levelNodes = (levelNodes + SPATIAL_NODE_SIZE - 1) / SPATIAL_NODE_SIZE;
+		nodeCount += levelNodes;
+	}
+	index->nodeCount = nodeCount;
+	index->boxes = (double *)ckalloc((unsigned int)(sizeof(double) * 4 * (nodeCount + 1)));
+	index->children = (int *)ckalloc((unsigned int)(sizeof(int) * (nodeCount + 1)));
+	
+	for (i = 0; i < index->leafCount; i++) {
+		index->children[i] = keys[i].featureId;
+		memcpy(index->boxes + i * 4, bounds + keys[i].featureId * 4, sizeof(double) * 4);
+	}
+	
+	index->levelCount = 1;
+	index->levelStart[0] = 0;
+	start = 0;
+	end = index->leafCount;
+	while (end - start > 1 || (end - start == 1 && index->levelCount == 1)) {
+		index->levelStart[index->levelCount++] = end;
+		next = end;
+		for (i = start; i < end; i += SPATIAL_NODE_SIZE) {
+			box = index->boxes + next * 4;
+			memcpy(box, index->boxes + i * 4, sizeof(double) * 4);
+			for (child = i + 1; child < end && child < i + SPATIAL_NODE_SIZE; child++) {
+				childBox = index->boxes + child * 4;
+				if (childBox[0] < box[0]) box[0] = childBox[0];
+				if (childBox[1] < box[1]) box[1] = childBox[1];
+				if (childBox[2] > box[2]) box[2] = childBox[2];
+				if (childBox[3] > box[3]) box[3] = childBox[3];
+			}
+			index->children[next++] = i;
+		}
+		start = end;
+		end = next;
+	}
+	index->levelStart[index->levelCount] = end;
+	
+   cleanup:
+	if (keys != NULL) ckfree((char *)keys);
+	if (bounds != NULL) ckfree((char *)bounds);
+	return index;
+}
+
+/*
+ * shapefile_spatialFree
+ * 
+ * Release a spatial index built by shapefile_spatialBuild.
+ */
+void shapefile_spatialFree(ShapefileSpatialIndexPtr index) {
+	ckfree((char *)index->boxes);
+	ckfree((char *)index->children);
+	ckfree((char *)index);
+}
+
+/*
+ * shapefile_spatialInvalidate
+ * 
+ * Discard the spatial index of a shapefile whose geometry has changed. The
+ * next [$shp spatial] query builds a new one.
+ */
+void shapefile_spatialInvalidate(ShapefilePtr shapefile) {
+	if (shapefile->spatialIndex != NULL) {
+		shapefile_spatialFree(shapefile->spatialIndex);
+		shapefile->spatialIndex = NULL;
+	}
+}
+
+/*
+ * shapefile_spatialSearch
+ * 
+ * Find the features whose bounding boxes intersect the box xmin, ymin, xmax,
+ * ymax. Feature indices are stored in *featureIds, an array of *capacity
+ * elements that is grown (or allocated, if NULL) as needed; the caller must
+ * free it with ckfree. Features are found in index order.
+ * 
+ * Result:
+ *   Number of features found.
+ */
+int shapefile_spatialSearch(
+		ShapefileSpatialIndexPtr index,
+		double xmin,
+		double ymin,
+		double xmax,
+		double ymax,
+		int **featureIds,
+		int *capacity) {
+	
+	/* at most one set of siblings per level is pending at a time */
+	int stack[SPATIAL_NODE_SIZE * SPATIAL_MAX_LEVELS];
+	int depth = 0, count = 0, node, level, child, end;
+	const double *box;
+	
+	if (index->nodeCount == 0) {
+		return 0;
+	}
+	
+	stack[depth++] = index->nodeCount - 1;
+	while (depth > 0) {
+		node = stack[--depth];
+		for (level = 1; node >= index->levelStart[level + 1]; level++);
+		end = node + 1 < index->levelStart[level + 1]
+				? index->children[node + 1] : index->levelStart[level];
+		
+		for (child = index->children[node]; child < end; child++) {
+			box = index->boxes + child * 4;
+			if (box[0] > xmax || box[2] < xmin || box[1] > ymax || box[3] < ymin) {
+				continue;
+			}
+			if (level > 1) {
+				stack[depth++] = child;
+				continue;
+			}
+			if (count == *capacity) {
+				*capacity = *capacity == 0 ? 64 : *capacity * 2;
+				*featureIds = (int *)ckrealloc((char *)*featureIds, (unsigned int)(sizeof(int) * *capacity));
+			}
+			(*featureIds)[count++] = index->children[child];
+		}
+	}
+	
+	return count;
+}
+
+/*
+ * shapefile_pointInShape
+ * 
+ * Test whether point x, y lies inside a polygon shape, combining all of its
+ * rings with the even-odd rule: a point inside a hole is outside the shape.
+ * Points exactly on a ring may be counted as inside or outside.
+ * 
+ * Result:
+ *   1 if the point is inside, 0 otherwise.
+ */
+int shapefile_pointInShape(const SHPObject *shape, double x, double y) {
+	int part, start, end, i, j, inside = 0;
+	const double *px = shape->padfX, *py = shape->padfY;
+	
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		for (i = start, j = end - 1; i < end; j = i++) {
+			if ((py[i] > y) != (py[j] > y)
+					&& x < (px[j] - px[i]) * (y - py[i]) / (py[j] - py[i]) + px[i]) {
+				inside = !inside;
+			}
+		}
+	}
+	
+	return inside;
+}
+
+/*
+ * shapefile_compareId
+ * 
+ * qsort comparison function for arrays of feature indices.
+ */
+int shapefile_compareId(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * cmd_attributes
+ * 
+ * Implements the [$shp attributes] command used to get or set attribute data.
+ * 
+ * Command Syntax:
+ *   [$shp attributes read RECORD FIELD]
+ *     Get the value of one field in one record.
+ *   [$shp attributes read RECORD]
+ *     Get the value of all fields in one record.
+ *   [$shp attributes read]
+ *     Get the value of all fields in all records.
+ *   [$shp attributes write RECORD FIELD VALUE]
+ *     Set the value of one field in one record.
+ *   [$shp attributes write RECORD VALUELIST]
+ *     Set the value of all fields in one record.
+ *   [$shp attributes write VALUELIST]
+ *     Set the value of all fields in a new record. The record is appended to
+ *     the attribute table. A new feature with NULL geometry is also created.
+ *   [$shp attributes search FIELD VALUE]
+ *     Return record indices of features that match the given field value.
+ * 
+ * Result:
+ *   Read actions return attribute data in value (X), value list ({X Y Z}), or
+ *   value list list ({{X Y Z} {A B C} {1 2 3}}) format, respectively.
+ *   Write actions return the index of the written attribute record.
+ *   The search action returns a list of record indices.
+ */
+int cmd_attributes(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	int recordId;
+	int actionIndex;
+	static const char *actionNames[] = {
+			"read",
+			"write",
+			"search",
+			NULL
+	};
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "action ?args?");
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[2], actionNames, "action", TCL_EXACT, &actionIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if (actionIndex == 0) {
+		/* read attributes */
+		
+		if (objc == 3) {
+			/* return attributes of all records */
+			if (cmd_attributes_readAll(interp, shapefile) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		} else if (objc == 4) {
+			/* return attributes of specified index */
+	
+			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			if (cmd_attributes_read(interp, shapefile, recordId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+		} else if (objc == 5) {
+			/* return value of specified field of specified index */
+			int fieldId;
+						
+			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			if (Tcl_GetIntFromObj(interp, objv[4], &fieldId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			/* sets interp result to field value; validates recordId and fieldId */
+			if (cmd_attributes_readField(interp, shapefile, recordId, fieldId) != TCL_OK) {
+				return TCL_ERROR;
+			}			
+		} else {
+			Tcl_WrongNumArgs(interp, 3, objv, "?recordIndex ?fieldIndex??");
+			return TCL_ERROR;
+		}	
+	} else if (actionIndex == 1) {
+		/* write attributes */
+		
+		if (objc == 4) {
+			/* write attributes to new record; create complementary null shape */
+			int featureId;
+			
+			if (cmd_attributes_write(interp, shapefile, -1 /* new record */, 1 /* validate */, objv[3]) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &recordId);
+			Tcl_ResetResult(interp);
+			
+			if (cmd_coordinates_write(interp, shapefile, -1 /* new record */, NULL /* no coordinates */, NULL) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &featureId);
+			if (recordId != featureId) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("new record index (%d) does not match new null feature index (%d)", recordId, featureId));
+				return TCL_ERROR;
+			}
+			
+		} else if (objc == 5) {
+			/* write attributes to record index */
+			
+			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (recordId == -1) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d (use write command)", recordId));
+				return TCL_ERROR;
+			}
+			
+			/* if successful, sets interp's result to the recordId of the written record */
+			if (cmd_attributes_write(interp, shapefile, recordId, 1 /* validate */, objv[4]) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+		} else if (objc == 6) {
+			/* write value to field index of record index */
+			int fieldId;
+			
+			if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+				
+			if (Tcl_GetIntFromObj(interp, objv[4], &fieldId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			if (cmd_attributes_writeField(interp, shapefile, recordId, fieldId, 1 /* validate */, objv[5]) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		} else {
+			Tcl_WrongNumArgs(interp, 3, objv, "?recordIndex ?fieldIndex?? attributes");
+			return TCL_ERROR;
+		}
+	} else if (actionIndex == 2) {
+		/* search for attribute value */
+		
+		if (objc == 5) {
+			
+			int fieldId;
+			
+			if (Tcl_GetIntFromObj(interp, objv[3], &fieldId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			if (cmd_attributes_search(interp, shapefile, fieldId, objv[4]) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+		} else {
+			Tcl_WrongNumArgs(interp, 3, objv, "FIELD VALUE");
+			return TCL_ERROR;
+		}
+	}
+			
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_write
+ * 
+ * Implements the [$shp attributes write ?RECORD? VALUELIST] action of the
+ * [$shp attributes] command, used to write values to a new or existing record.
+ * 
+ * Result:
+ *   Index number of the attribute record that was written.
+ */
+int cmd_attributes_write(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int recordId,
+		int validate,
+		Tcl_Obj *attrList) {
+	
+	Tcl_Obj *attr;
+	int fieldId, fieldCount, attrCount, dbfCount;
+	
+	if (shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write attributes to readonly shapefile"));
+		return TCL_ERROR;
+	}
+	
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	if (recordId < -1 || recordId >= dbfCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+		return TCL_ERROR;
+	}
+	if (recordId == -1) {
+		recordId = dbfCount;
+	}
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	
+	/* write null values for all fields if attrList is NULL... */
+	if (attrList == NULL) {
+		return cmd_attributes_writeNull(interp, shapefile, recordId);
+	}
+	
+	/* verify the provided attribute value list matches field count */
+	if (Tcl_ListObjLength(interp, attrList, &attrCount) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	/* ...also write a null record if an empty list is recieved */
+	if (attrCount == 0) {
+		return cmd_attributes_writeNull(interp, shapefile, recordId);
+	} else if (attrCount != fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute count (%d) does not match field count (%d)", attrCount, fieldCount));
+		return TCL_ERROR;
+	}
+	
+	/* in the attributes command context, we validate now; w/the write command,
+	   we receive attrList pre-validated and can proceed to write it as-is. */
+	if (validate && (cmd_attributes_validate(interp, shapefile, attrList) != TCL_OK)) {
+		return TCL_ERROR;
+	}
+		
+	/* output pass - once the fields are validated, write 'em out. Output is
+	   performed separately from validation to avoid mangled/partial output. */
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		
+		/* grab the attr provided for this field */
+		if (Tcl_ListObjIndex(interp, attrList, fieldId, &attr) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	
+		/* writes value attr to field fieldId of record recordId; sets interp result to recordId */
+		if (cmd_attributes_writeField(interp, shapefile, recordId, fieldId, 0 /* no validation */, attr) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	}
+		
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_writeNull
+ *
+ * Write a null attribute record (null values are written to all fields).
+ *
+ * Result:
+ *   Index number of the null record that was written.
+ */
+int cmd_attributes_writeNull(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int recordId) {
+	
+	int fieldId, fieldCount;
+	
+	shapefile_cacheInvalidate(shapefile, recordId, 1);
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute"));
+			return TCL_ERROR;
+		}
+	}
+	
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_writeField
+ * 
+ * Implements the [$shp attributes write RECORD FIELD VALUE] action of the
+ * [$shp attributes] command, used to set the value of a single field of a
+ * specified attribute record. Also used by the [$shp attributes write
+ * ?RECORD? VALUELIST] action to set each value in the record.
+ * 
+ * The boolean validate argument indicates whether the attribute values AND
+ * recordId need to be validated. If false, they are assumed to be pre-checked.
+ * 
+ * Result:
+ *   Index number of the record containing the value that was written.
+ */
+int cmd_attributes_writeField(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int recordId,
+		int fieldId,
+		int validate,
+		Tcl_Obj *attrValue) {
+	
+	int dbfCount, fieldCount;
+	int intValue;
+	double doubleValue;
+	const char *stringValue;
+	int width, precision, reserved;
+	char buffer[NUMERIC_BUFFER_SIZE];
+	
+	if (shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write attribute value to readonly shapefile"));
+		return TCL_ERROR;
+	}
+
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	if (validate && (recordId < 0 || recordId >= dbfCount)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+		return TCL_ERROR;
+	}
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (fieldId < 0 || fieldId >= fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+		return TCL_ERROR;
+	}
+	shapefile_cacheInvalidate(shapefile, recordId, 1);
+
+	if (validate && (cmd_attributes_validateField(interp, shapefile, fieldId, attrValue) != TCL_OK)) {
+		return TCL_ERROR;
+	}
+	
+	if (attrValue == NULL || Tcl_GetCharLength(attrValue) == 0) {
+		if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute"));
+			return TCL_ERROR;
+		}
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
+		return TCL_OK;
+	}
+	
+	switch ((int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &width, &precision)) {
+		case FTInteger:
+			if ((Tcl_GetIntFromObj(interp, attrValue, &intValue) != TCL_OK)) {
+				return TCL_ERROR;
+			}
+			if ((DBFWriteIntegerAttribute(shapefile->dbf, recordId, fieldId, intValue) == 0) && !shapefile->allowTruncation) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write integer attribute \"%d\"", intValue));
+				return TCL_ERROR;
+			}
+			break;
+		case FTDouble:
+			if (Tcl_GetDoubleFromObj(interp, attrValue, &doubleValue) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			
+			/* If the value formatted as Shapelib would will not fit in width,
+			   reformat it in scientific notation, if not prohibited. */
+			if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%*.*f", width, precision, doubleValue) >= NUMERIC_BUFFER_SIZE) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("fixed format double value too large for buffer"));
+				return TCL_ERROR;
+			}
+			
+			if (((int)strlen(buffer) > width) && shapefile->allowAlternateNotation) {
+				reserved = 7 + (doubleValue < 0 ? 1 : 0);
+				if (reserved > width) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("field too narrow (%d) for fixed or scientific notation representation of value \"%s\"", width, buffer));
+					return TCL_ERROR;
+				}
+				if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%*.*e", width, width - reserved, doubleValue) >= NUMERIC_BUFFER_SIZE) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("exponential notation double value too large for buffer"));
+					return TCL_ERROR;
+				}
+				if (DBFWriteAttributeDirectly(shapefile->dbf, recordId, fieldId, (void *)buffer) == 0) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write double attribute \"%s\"", buffer));
+					return TCL_ERROR;
+				}
+			} else {			
+				/* Anticipate this to fail due to truncation if len(buffer) > width
+				   and allowAlternateNotation and allowTruncation are false, meaning errors preferred. */
+				if ((DBFWriteDoubleAttribute(shapefile->dbf, recordId, fieldId, doubleValue) == 0) && !shapefile->allowTruncation) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write double attribute \"%lf\"", doubleValue));
+					return TCL_ERROR;
+				}
+			}
+			break;
+		case FTString:
+			if ((stringValue = Tcl_GetString(attrValue)) == NULL) {
+				return TCL_ERROR;
+			}
+			if ((DBFWriteStringAttribute(shapefile->dbf, recordId, fieldId, stringValue) == 0) && !shapefile->allowTruncation) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write string attribute \"%s\"", stringValue));
+				return TCL_ERROR;
+			}
+			break;
+		default:
+			if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute for unsupported field %d", fieldId));
+				return TCL_ERROR;
+			}
+			break;
+	}
+
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_validate
+ * 
+ * Confirm that a list of attribute values conforms to the shapefile's field
+ * definitions. Used by the [$shp write] command and [$shp attributes write]
+ * action in contexts where the value list has not already been pre-validated
+ * to check for obvious errors before writing attribute values to disk. Intent
+ * is to minimize the chance of leaving shapefile in an invalid state.
+ * 
+ * An empty attribute list {} is considered valid; it represents a null record.
+ * 
+ * Result:
+ *   No Tcl result if the attribute value list passes validation. Otherwise,
+ *   errors may be thrown.
+ */
+int cmd_attributes_validate(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		Tcl_Obj *attrList) {
+	
+	int fieldId, fieldCount, attrCount;
+	Tcl_Obj *attr;
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (Tcl_ListObjLength(interp, attrList, &attrCount) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (attrCount == 0) {
+		return TCL_OK;
+	} else if (attrCount != fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute count (%d) does not match field count (%d)", attrCount, fieldCount));
+		return TCL_ERROR;
+	}
+
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		
+		/* grab the attr provided for this field */
+		if (Tcl_ListObjIndex(interp, attrList, fieldId, &attr) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		
+		/* validate this field */
+		if (cmd_attributes_validateField(interp, shapefile, fieldId, attr) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	}
+	
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_validateField
+ * 
+ * Confirm that a single attribute value conforms to the specified attribute
+ * table field definition. Used by the cmd_attributes_validate function and
+ * by the [$shp attributes write RECORD FIELD VALUE] action in contexts where
+ * VALUE has previously been pre-validated.
+ * 
+ * Result:
+ *   No Tcl result if the attribute value passes validation. Otherwise, errors
+ *   may be thrown.
+ */
+int cmd_attributes_validateField(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int fieldId,
+		Tcl_Obj *attrValue) {
+	
+	int fieldCount, width, precision, fieldType;
+	int intValue;
+	double doubleValue;
+	const char *stringValue;
+	char buffer[NUMERIC_BUFFER_SIZE];
+
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (fieldId < 0 || fieldId >= fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+		return TCL_ERROR;
+	}
+	
+	/* null fields are ok; validation doesn't need to set any result if OK */
+	if (attrValue == NULL || (Tcl_GetCharLength(attrValue) == 0)) {
+		return TCL_OK;
+	}
+	
+	fieldType = (int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &width, &precision);
+	switch (fieldType) {
+		case FTInteger:
+			/* can this value be parsed as an integer? */
+			if (Tcl_GetIntFromObj(interp, attrValue, &intValue) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (shapefile->allowTruncation) {
+				break;
+			}
+			/* does this integer fit within the field width? */
+			if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%d", intValue) >= NUMERIC_BUFFER_SIZE) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("integer value too big for buffer"));
+				return TCL_ERROR;
+			}
+			if ((int)strlen(buffer) > width) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("integer value (%s) would be truncated to field width (%d)", buffer, width));
+				return TCL_ERROR;
+			}
+			break;
+		case FTDouble:
+			/* can this value be parsed as a double? */
+			if (Tcl_GetDoubleFromObj(interp, attrValue, &doubleValue) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			/* does this double fit within the field width? */
+			/* disabling double width check now with conditional scientific notation output */
+			/*sprintf(numericStringValue, "%.*lf", precision, doubleValue);
+			if (strlen(numericStringValue) > width) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("double value (%s) would be truncated to field width (%d)", numericStringValue, width));
+				return TCL_ERROR;
+			}*/
+			break;
+		case FTString:
+			/* can this value be parsed as a string? */
+			if ((stringValue = Tcl_GetString(attrValue)) == NULL) {
+				return TCL_ERROR;
+			}
+			if (shapefile->allowTruncation) {
+				break;
+			}
+			/* does this string fit within the field width? */
+			if ((int)strlen(stringValue) > width) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("string value (%s) would be truncated to field width (%d)", stringValue, width));
+				return TCL_ERROR;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return TCL_OK;	
+}
+
+/*
+ * cmd_attributes_readAll
+ * 
+ * Implements the [$shp attributes read] action of the [$shp attributes]
+ * command, used to get a list of attribute value lists for all records.
+ * 
+ * Result:
+ *   List containing an attribute value list for each record in shapefile.
+ */
+int cmd_attributes_readAll(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile) {
+
+	Tcl_Obj *recordList;
+	int dbfCount, recordId;
+	
+	recordList = Tcl_NewListObj(0, NULL);
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+
+	for (recordId = 0; recordId < dbfCount; recordId++) {
+		
+		if (cmd_attributes_read(interp, shapefile, recordId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+					
+		if (Tcl_ListObjAppendElement(interp, recordList, Tcl_GetObjResult(interp)) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		
+		Tcl_ResetResult(interp);
+	}
+	
+	Tcl_SetObjResult(interp, recordList);
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_read
+ * 
+ * Implements the [$shp attributes read RECORD] action of the [$shp attributes]
+ * command, used to get a list of attribute values for a specified record. Also
+ * used by the [$shp attributes read] action to get each record value list.
+ * 
+ * Result:
+ *   List containing each attribute value from the specified record.
+ */
+int cmd_attributes_read(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int recordId) {
+	
+	Tcl_Obj *attributes;
+	ShapefileCacheEntryPtr entry;
+	int dbfCount, fieldId, fieldCount;
+	
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	if (recordId < 0 || recordId >= dbfCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+		return TCL_ERROR;
+	}
+	
+	/* deleted records are read as empty without decoding their values */
+	if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, recordId)) {
+		Tcl_SetObjResult(interp, Tcl_NewObj());
+		return TCL_OK;
+	}
+	
+	if ((entry = shapefile_cacheLookup(shapefile, recordId, 1)) != NULL) {
+		Tcl_SetObjResult(interp, entry->record);
+		return TCL_OK;
+	}
+	
+	attributes = Tcl_NewListObj(0, NULL);
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+				
+		if (cmd_attributes_readField(interp, shapefile, recordId, fieldId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		
+		if (Tcl_ListObjAppendElement(interp, attributes, Tcl_GetObjResult(interp)) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		
+		Tcl_ResetResult(interp);
+	}
+	
+	Tcl_SetObjResult(interp, attributes);
+	(void)shapefile_cacheInsert(shapefile, recordId, NULL, attributes);
+	return TCL_OK;
+}
+
+/*
+ * cmd_attributes_readField
+ * 
+ * Implements the [$shp attributes read RECORD FIELD] action of the
+ * [$shp attributes] command, used to get the value of a single attribute field
+ * from the specified record. Also used by the [$shp attributes read RECORD]
+ * action to get each value in a record.
+ * 
+ * Result:
+ *   Value of the specified field from the specified record. NULL values are
+ *   represented as empty strings ({}). Unsupported field type values are
+ *   represented as strings (as stored within the DBF file).
+ */
+int cmd_attributes_readField(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int recordId,
+		int fieldId) {
+	
+	int dbfCount, fieldCount, fieldType;
+	
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	if (recordId < 0 || recordId >= dbfCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+		return TCL_ERROR;
+	}
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (fieldId < 0 || fieldId >= fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+		return TCL_ERROR;
+	}
+	
+	/* return an empty object for null values and skipped deleted records */
+	if ((shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, recordId))
+			|| DBFIsAttributeNULL(shapefile->dbf, recordId, fieldId)) {
+		Tcl_SetObjResult(interp, Tcl_NewObj());
+		return TCL_OK;
+	}
+	
+	/* return an object of appropriate type for fieldId, unless raw requested */
+	fieldType = (int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, NULL, NULL);
+	if (shapefile->readRawStrings) {
+		fieldType = FTString;
+	}
+	switch (fieldType) {
+		case FTInteger:
+			Tcl_SetObjResult(interp, Tcl_NewIntObj(DBFReadIntegerAttribute(shapefile->dbf, recordId, fieldId)));
+			break;
+		case FTDouble:
+			Tcl_SetObjResult(interp, Tcl_NewDoubleObj(DBFReadDoubleAttribute(shapefile->dbf, recordId, fieldId)));
+			break;
+		case FTString:
+		default:
+			Tcl_SetObjResult(interp, Tcl_NewStringObj(DBFReadStringAttribute(shapefile->dbf, recordId, fieldId), -1));
+			break;
+	}
+	
+	return TCL_OK;	
+}
+
+/*
+ * cmd_attributes_search
+ * 
+ * Implements the [$shp attributes search FIELD VALUE] action of the [$shp
+ * attributes] command, used to determine the record index of features that
+ * match the given attribute field value. Matching is currently performed by
+ * raw string value comparison. Matches must be exact.
+ * 
+ * Result:
+ *   List of feature indices that match the attribute search query.
+ *   Empty list if no matches.
+ */
+int cmd_attributes_search(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int fieldId,
+		Tcl_Obj *attrValue) {
+	
+	int dbfCount, recordId, fieldCount;
+	const char *searchValue, *fieldValue;
+	Tcl_Obj *hitList;
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	if (fieldId < 0 || fieldId >= fieldCount) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+		return TCL_ERROR;
+	}
+	
+	if ((searchValue = Tcl_GetString(attrValue)) == NULL) {
+		return TCL_ERROR;
+	}
+	
+	hitList = Tcl_NewListObj(0, NULL);
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	
+	for (recordId = 0; recordId < dbfCount; recordId++) {
+		
+		if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, recordId)) {
+			continue;
+		}
+		
+		fieldValue = DBFReadStringAttribute(shapefile->dbf, recordId, fieldId);
+		
+		if (strcmp(fieldValue, searchValue) == 0) {
+			if (Tcl_ListObjAppendElement(interp, hitList, Tcl_NewIntObj(recordId)) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		}
+	}
+	
+	Tcl_SetObjResult(interp, hitList);
+	return TCL_OK;
+}
+
+/*
+ * cmd_write
+ * 
+ * Implements the [$shp write] command used to add a new feature and attribute
+ * record to the shapefile.
+ * 
+ * Command Syntax:
+ *   [$shp write COORDINATES ATTRIBUTES]
+ *     Append a new entity to $shp. COORDINATES contains feature geometry and
+ *     ATTRIBUTES contains attribute values. See [coordinates] and [attributes]
+ *     commands for details on the format of these arguments.
+ * 
+ * Result:
+ *   Index number of the new feature.
+ */
+int cmd_write(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	int outputFeatureId, outputAttributeId;
+	
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 2, objv, "coordinates attributes");
+		return TCL_ERROR;
+	}
+	
+	if (shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write to readonly shapefile"));
+		return TCL_ERROR;
+	}
+	
+	/* pre-validate attributes before writing anything */
+	if (cmd_attributes_validate(interp, shapefile, objv[3]) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	Tcl_ResetResult(interp);
+	
+	/* write the new feature coords (nothing written if coordWrite fails) */
+	if (cmd_coordinates_write(interp, shapefile, -1, objv[2], NULL) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &outputFeatureId) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	Tcl_ResetResult(interp);
+	
+	/* write the pre-validated attribute record */
+	if (cmd_attributes_write(interp, shapefile, -1, 0, objv[3]) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &outputAttributeId) != TCL_OK) {
+		return TCL_ERROR;
+	}
+
+	/* assert that the new feature and attribute record ids match */
+	if (outputFeatureId != outputAttributeId) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("new coord index (%d) does not match new attribute record index (%d)", outputFeatureId, outputAttributeId));
+		return TCL_ERROR;
+	}
+	
+	/* result is new entity id, as set by attrWrite */
+	return TCL_OK;
+}
+
+/*
+ * cmd_export
+ * 
+ * Implements the [$shp export] command used to write features to a Tcl
+ * channel in another format. Features are formatted directly from the
+ * decoded shapes and attribute table, without building coordinate or
+ * attribute lists, and text is written to the channel whenever
+ * GEOJSON_FLUSH_SIZE bytes have accumulated, so memory use is bounded by
+ * the largest feature rather than the size of the shapefile.
+ * 
+ * Command Syntax:
+ *   [$shp export geojson CHANNEL ?-fields NAMES? ?-bbox BOUNDS? ?-precision DIGITS?]
+ *     Write a GeoJSON FeatureCollection of every feature to CHANNEL, which
+ *     must be open for writing. Each Feature has the feature index as its
+ *     id, the attribute values of the fields named in NAMES (default all
+ *     fields) as its properties, and its geometry: a Point, MultiPoint,
+ *     LineString or MultiLineString (arcs with several parts), or Polygon
+ *     or MultiPolygon (polygons with several outer rings), with holes
+ *     grouped with the smallest outer ring that contains them. Rings are
+ *     reversed, since GeoJSON winds outer rings counterclockwise. Z
+ *     coordinates are included for Z shapefiles; M values are omitted.
+ *     Null features have null geometry. Deleted features are omitted if
+ *     skipDeleted is set. If BOUNDS {XMIN YMIN XMAX YMAX} is given, only
+ *     features whose bounding boxes intersect it are written. Coordinates
+ *     are written in the shortest form that reads back as the same double,
+ *     or if DIGITS is given, rounded to that many decimal places.
+ * 
+ * Result:
+ *   Number of features written.
+ */
+int cmd_export(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	static const char *formatNames[] = {"geojson", NULL};
+	static const char *optionNames[] = {"-bbox", "-fields", "-precision", NULL};
+	struct shapefile_json json;
+	struct shapefile_buffer input;
+	unsigned char record[52];
+	char fieldName[12];
+	Tcl_Obj **values;
+	SHPObject *shape;
+	int *fieldIds = NULL;
+	int formatIndex, optionIndex, mode, arg, valueCount, i, fieldCount, field;
+	int featureId, featureCount, release, size, exported = 0, bbox = 0;
+	int returnValue = TCL_ERROR;
+	double window[4], min[4], max[4];
+	
+	if (objc < 4 || objc % 2 != 0) {
+		Tcl_WrongNumArgs(interp, 2, objv, "format channel ?-fields names? ?-bbox bounds? ?-precision digits?");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetIndexFromObj(interp, objv[2], formatNames, "format", TCL_EXACT, &formatIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if ((json.channel = Tcl_GetChannel(interp, Tcl_GetString(objv[3]), &mode)) == NULL) {
+		return TCL_ERROR;
+	}
+	if (!(mode & TCL_WRITABLE)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("channel \"%s\" wasn't opened for writing", Tcl_GetString(objv[3])));
+		return TCL_ERROR;
+	}
+	json.precision = -1;
+	
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	fieldIds = (int *)ckalloc((unsigned int)(sizeof(int) * (fieldCount + 1)));
+	for (field = 0; field < fieldCount; field++) {
+		fieldIds[field] = field;
+	}
+	
+	for (arg = 4; arg < objc; arg += 2) {
+		if (Tcl_GetIndexFromObj(interp, objv[arg], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			goto cleanup;
+		}
+		if (optionIndex == 0) {
+			/* -bbox */
+			if (Tcl_ListObjGetElements(interp, objv[arg + 1], &valueCount, &values) != TCL_OK) {
+				goto cleanup;
+			}
+			if (valueCount != 4) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid bbox \"%s\": must be a list of 4 values", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			for (i = 0; i < 4; i++) {
+				if (Tcl_GetDoubleFromObj(interp, values[i], &window[i]) != TCL_OK) {
+					goto cleanup;
+				}
+			}
+			if (window[0] > window[2] || window[1] > window[3]) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid bbox \"%s\": minimum exceeds maximum", Tcl_GetString(objv[arg + 1])));
+				goto cleanup;
+			}
+			bbox = 1;
+		} else if (optionIndex == 1) {
+			/* -fields */
+			if (Tcl_ListObjGetElements(interp, objv[arg + 1], &valueCount, &values) != TCL_OK) {
+				goto cleanup;
+			}
+			if (valueCount > fieldCount) {
+				fieldIds = (int *)ckrealloc((char *)fieldIds, (unsigned int)(sizeof(int) * valueCount));
+			}
+			for (i = 0; i < valueCount; i++) {
+				if ((fieldIds[i] = DBFGetFieldIndex(shapefile->dbf, Tcl_GetString(values[i]))) == -1) {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("field named \"%s\" not found", Tcl_GetString(values[i])));
+					goto cleanup;
+				}
+			}
+			fieldCount = valueCount;
+		} else {
+			/* -precision */
+			if (Tcl_GetIntFromObj(interp, objv[arg + 1], &json.precision) != TCL_OK) {
+				goto cleanup;
+			}
+			if (json.precision < 0 || json.precision > GEOJSON_MAX_PRECISION) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid precision %d: must be from 0 to %d", json.precision, GEOJSON_MAX_PRECISION));
+				goto cleanup;
+			}
+		}
+	}
+	
+	memset(&input, 0, sizeof(struct shapefile_buffer));
+	input.hooks = &shapefile->shp->sHooks;
+	input.file = shapefile->shp->fpSHP;
+	Tcl_DStringInit(&json.text);
+	Tcl_DStringAppend(&json.text, "{\"type\":\"FeatureCollection\",\"features\":[", -1);
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		if (shapefile->skipDeleted && DBFIsRecordDeleted(shapefile->dbf, featureId)) {
+			continue;
+		}
+		
+		/* the record header bounding box (or point) suffices to skip features
+		   outside the bbox; null features have none and are skipped too */
+		if (bbox) {
+			size = (int)shapefile->shp->panRecSize[featureId] + 8;
+			if (size > (int)sizeof(record)) {
+				size = (int)sizeof(record);
+			}
+			if (!shapefile_bufferRead(&input, shapefile->shp->panRecOffset[featureId], record, size)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+				goto release;
+			}
+			if (!shapefile_recordBounds(record + 8, size - 8, min, max)
+					|| min[0] > window[2] || max[0] < window[0]
+					|| min[1] > window[3] || max[1] < window[1]) {
+				continue;
+			}
+		}
+		
+		if ((shape = shapefile_readShape(interp, shapefile, featureId, &release)) == NULL) {
+			goto release;
+		}
+		
+		Tcl_DStringAppend(&json.text, exported == 0 ? "\n{\"type\":\"Feature\",\"id\":" : ",\n{\"type\":\"Feature\",\"id\":", -1);
+		shapefile_jsonNumber(&json, featureId, -1);
+		Tcl_DStringAppend(&json.text, ",\"properties\":{", -1);
+		for (i = 0; i < fieldCount; i++) {
+			field = fieldIds[i];
+			if (i > 0) {
+				Tcl_DStringAppend(&json.text, ",", 1);
+			}
+			(void)DBFGetFieldInfo(shapefile->dbf, field, fieldName, NULL, NULL);
+			shapefile_jsonString(&json, fieldName);
+			Tcl_DStringAppend(&json.text, ":", 1);
+			if (DBFIsAttributeNULL(shapefile->dbf, featureId, field)) {
+				Tcl_DStringAppend(&json.text, "null", 4);
+				continue;
+			}
+			switch ((int)DBFGetFieldInfo(shapefile->dbf, field, NULL, NULL, NULL)) {
+				case FTInteger:
+					shapefile_jsonNumber(&json, DBFReadIntegerAttribute(shapefile->dbf, featureId, field), -1);
+					break;
+				case FTDouble:
+					shapefile_jsonNumber(&json, DBFReadDoubleAttribute(shapefile->dbf, featureId, field), -1);
+					break;
+				default:
+					shapefile_jsonString(&json, DBFReadStringAttribute(shapefile->dbf, featureId, field));
+					break;
+			}
+		}
+		Tcl_DStringAppend(&json.text, "},\"geometry\":", -1);
+		shapefile_jsonGeometry(&json, shape, shapefile->dimType == DIM_XYZM);
+		Tcl_DStringAppend(&json.text, "}", 1);
+		exported++;
+		
+		if (release) {
+			SHPDestroyObject(shape);
+		}
+		
+		if (Tcl_DStringLength(&json.text) >= GEOJSON_FLUSH_SIZE && !shapefile_jsonFlush(&json)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write GeoJSON: %s", Tcl_PosixError(interp)));
+			goto release;
+		}
+	}
+	
+	Tcl_DStringAppend(&json.text, "\n]}\n", -1);
+	if (!shapefile_jsonFlush(&json)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write GeoJSON: %s", Tcl_PosixError(interp)));
+		goto release;
+	}
+	
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(exported));
+	returnValue = TCL_OK;
+	
+   release:
+	Tcl_DStringFree(&json.text);
+	shapefile_bufferRelease(&input);
+   cleanup:
+	ckfree((char *)fieldIds);
+	return returnValue;
+}
+
+/*
+ * shapefile_jsonFlush
+ * 
+ * Write the accumulated GeoJSON text to the channel and empty the buffer,
+ * keeping its storage for the features that follow.
+ * 
+ * Result:
+ *   1 on success, 0 if the channel could not be written.
+ */
+int shapefile_jsonFlush(ShapefileJsonPtr json) {
+	int length = Tcl_DStringLength(&json->text);
+	
+	if (length > 0 && Tcl_WriteChars(json->channel, Tcl_DStringValue(&json->text), length) == -1) {
+		return 0;
+	}
+	Tcl_DStringSetLength(&json->text, 0);
+	return 1;
+}
+
+/*
+ * shapefile_jsonNumber
+ * 
+ * Append value to the GeoJSON text. Integers, and values rounded to
+ * precision decimal places if precision is not -1, are formatted with
+ * integer arithmetic, which is much faster than the C library. Other
+ * values, and those of GEOJSON_EXACT_LIMIT or more, are written in the
+ * shortest form that reads back as the same double, by Tcl_PrintDouble.
+ * Values that are not finite, which JSON cannot represent, are written as
+ * null.
+ */
+void shapefile_jsonNumber(
+		ShapefileJsonPtr json,
+		double value,
+		int precision) {
+	
+	static const double scales[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+	char digits[TCL_DOUBLE_SPACE + GEOJSON_MAX_PRECISION + 2];
+	Tcl_WideUInt scaled;
+	double magnitude = fabs(value);
+	int i, start, end = (int)sizeof(digits);
+	
+	if (!isfinite(value)) {
+		Tcl_DStringAppend(&json->text, "null", 4);
+		return;
+	}
+	
+	/* values too large to have a fraction are written in the shortest form,
+	   which may have an exponent, whatever the precision */
+	if ((precision == -1 && magnitude != floor(magnitude)) || magnitude >= GEOJSON_EXACT_LIMIT) {
+		Tcl_PrintDouble(NULL, value, digits);
+		Tcl_DStringAppend(&json->text, digits, -1);
+		return;
+	}
+	if (precision == -1) {
+		precision = 0;
+	}
+	
+	/* values too large to scale exactly are rounded by the C library; they
+	   have at most 16 integer digits, so the buffer holds them */
+	if (magnitude * scales[precision] >= GEOJSON_EXACT_LIMIT) {
+		end = snprintf(digits, sizeof(digits), "%.*f", precision, value);
+		if (end < 0 || end >= (int)sizeof(digits)) {
+			Tcl_PrintDouble(NULL, value, digits);
+			Tcl_DStringAppend(&json->text, digits, -1);
+			return;
+		}
+		for (; precision > 0 && digits[end - 1] == '0'; end--);
+		if (digits[end - 1] == '.') {
+			end--;
+		}
+		Tcl_DStringAppend(&json->text, digits, end);
+		return;
+	}
+	
+	/* digits are formed backward from the end of the buffer, dropping
+	   trailing zeros of the fraction */
+	scaled = (Tcl_WideUInt)floor(magnitude * scales[precision] + 0.5);
+	for (i = 0; i < precision && scaled % 10 == 0; i++) {
+		scaled /= 10;
+	}
+	start = end;
+	for (; i < precision; i++) {
+		digits[--start] = (char)('0' + scaled % 10);
+		scaled /= 10;
+		if (i == precision - 1) {
+			digits[--start] = '.';
+		}
+	}
+	do {
+		digits[--start] = (char)('0' + scaled % 10);
+		scaled /= 10;
+	} while (scaled > 0);
+	
+	/* values that round to zero are written without a sign */
+	if (value < 0.0 && !(end - start == 1 && digits[start] == '0')) {
+		digits[--start] = '-';
+	}
+	Tcl_DStringAppend(&json->text, digits + start, end - start);
+}
+
+/*
+ * shapefile_jsonString
+ * 
+ * Append string to the GeoJSON text as a quoted JSON string. Quotes,
+ * backslashes, and control characters are escaped; other characters are
+ * copied as is, in runs.
+ */
+void shapefile_jsonString(
+		ShapefileJsonPtr json,
+		const char *string) {
+	
+	static const char hex[] = "0123456789abcdef";
+	char escape[7];
+	const char *run = string, *c;
+	
+	Tcl_DStringAppend(&json->text, "\"", 1);
+	for (c = string; *c != '\0'; c++) {
+		if (*c != '"' && *c != '\\' && (unsigned char)*c >= 0x20) {
+			continue;
+		}
+		Tcl_DStringAppend(&json->text, run, (int)(c - run));
+		run = c + 1;
+		if (*c == '"' || *c == '\\') {
+			escape[0] = '\\';
+			escape[1] = *c;
+			Tcl_DStringAppend(&json->text, escape, 2);
+		} else {
+			memcpy(escape, "\\u00", 4);
+			escape[4] = hex[(unsigned char)*c >> 4];
+			escape[5] = hex[(unsigned char)*c & 0xf];
+			Tcl_DStringAppend(&json->text, escape, 6);
+		}
+	}
+	Tcl_DStringAppend(&json->text, run, (int)(c - run));
+	Tcl_DStringAppend(&json->text, "\"", 1);
+}
+
+/*
+ * shapefile_jsonPosition
+ * 
+ * Append a vertex of shape as an [x,y] or [x,y,z] JSON position.
+ */
+void shapefile_jsonPosition(
+		ShapefileJsonPtr json,
+		const SHPObject *shape,
+		int vertex,
+		int hasZ) {
+	
+	Tcl_DStringAppend(&json->text, "[", 1);
+	shapefile_jsonNumber(json, shape->padfX[vertex], json->precision);
+	Tcl_DStringAppend(&json->text, ",", 1);
+	shapefile_jsonNumber(json, shape->padfY[vertex], json->precision);
+	if (hasZ) {
+		Tcl_DStringAppend(&json->text, ",", 1);
+		shapefile_jsonNumber(json, shape->padfZ[vertex], json->precision);
+	}
+	Tcl_DStringAppend(&json->text, "]", 1);
+}
+
+/*
+ * shapefile_jsonPositions
+ * 
+ * Append count vertices of shape, starting with vertex start, as a JSON
+ * array of positions, in reverse order if reverse is true.
+ */
+void shapefile_jsonPositions(
+		ShapefileJsonPtr json,
+		const SHPObject *shape,
+		int start,
+		int count,
+		int hasZ,
+		int reverse) {
+	
+	int i;
+	
+	Tcl_DStringAppend(&json->text, "[", 1);
+	for (i = 0; i < count; i++) {
+		if (i > 0) {
+			Tcl_DStringAppend(&json->text, ",", 1);
+		}
+		shapefile_jsonPosition(json, shape, reverse ? start + count - 1 - i : start + i, hasZ);
+	}
+	Tcl_DStringAppend(&json->text, "]", 1);
+}
+
+/*
+ * shapefile_jsonGeometry
+ * 
+ * Append shape to the GeoJSON text as a geometry object, or null for null
+ * shapes. Polygon rings are grouped by shapefile_jsonPolygons.
+ */
+void shapefile_jsonGeometry(
+		ShapefileJsonPtr json,
+		const SHPObject *shape,
+		int hasZ) {
+	
+	int baseType, part, start, end;
+	
+	if (shape->nSHPType == SHPT_NULL || shape->nVertices == 0) {
+		Tcl_DStringAppend(&json->text, "null", 4);
+		return;
+	}
+	
+	baseType = shapefile_typeBase(shape->nSHPType);
+	if (baseType == BASE_POINT) {
+		Tcl_DStringAppend(&json->text, "{\"type\":\"Point\",\"coordinates\":", -1);
+		shapefile_jsonPosition(json, shape, 0, hasZ);
+		Tcl_DStringAppend(&json->text, "}", 1);
+		return;
+	}
+	if (baseType == BASE_MULTIPOINT) {
+		Tcl_DStringAppend(&json->text, "{\"type\":\"MultiPoint\",\"coordinates\":", -1);
+		shapefile_jsonPositions(json, shape, 0, shape->nVertices, hasZ, 0);
+		Tcl_DStringAppend(&json->text, "}", 1);
+		return;
+	}
+	if (baseType == BASE_POLYGON) {
+		shapefile_jsonPolygons(json, shape, hasZ);
+		return;
+	}
+	
+	Tcl_DStringAppend(&json->text, shape->nParts == 1
+			? "{\"type\":\"LineString\",\"coordinates\":"
+			: "{\"type\":\"MultiLineString\",\"coordinates\":[", -1);
+	for (part = 0; part < shape->nParts; part++) {
+		start = shape->panPartStart[part];
+		end = part + 1 < shape->nParts ? shape->panPartStart[part + 1] : shape->nVertices;
+		if (part > 0) {
+			Tcl_DStringAppend(&json->text, ",", 1);
+		}
+		shapefile_jsonPositions(json, shape, start, end - start, hasZ, 0);
+	}
+	Tcl_DStringAppend(&json->text, shape->nParts == 1 ? "}" : "]}", -1);
+}
+
+/*
+ * shapefile_jsonPolygons
+ * 
+ * Append a polygon shape to the GeoJSON text as a Polygon, or MultiPolygon
+ * if it has several outer rings. Clockwise rings (and rings with no area)
+ * are outer rings; each counterclockwise ring is a hole of the smallest
+ * outer ring that contains its first vertex, or stands alone if there is
+ * none. Rings are reversed to follow the GeoJSON winding order.
+ */
+void shapefile_jsonPolygons(
+		ShapefileJsonPtr json,
+		const SHPObject *shape,
+		int hasZ) {
+	
+	const double *px = shape->padfX, *py = shape->padfY;
+	double *areas, x, y, cx, cy;
+	int *parents, *starts, part, other, i, j, polygonCount = 0, inside, first = 1;
+	
+	areas = (double *)ckalloc((unsigned int)(sizeof(double) * shape->nParts));
+	parents = (int *)ckalloc((unsigned int)(sizeof(int) * (shape->nParts * 2 + 1)));
+	starts = parents + shape->nParts;
+	
+	memcpy(starts, shape->panPartStart, sizeof(int) * shape->nParts);
+	starts[shape->nParts] = shape->nVertices;
+	for (part = 0; part < shape->nParts; part++) {
+		areas[part] = shapefile_ringArea(px + starts[part], py + starts[part], starts[part + 1] - starts[part],
+				px[starts[part]], py[starts[part]], &cx, &cy);
+		parents[part] = -1;
+	}
+	
+	for (part = 0; part < shape->nParts; part++) {
+		if (areas[part] <= 0.0) {
+			polygonCount++;
+			continue;
+		}
+		x = px[starts[part]];
+		y = py[starts[part]];
+		for (other = 0; other < shape->nParts; other++) {
+			if (areas[other] > 0.0 || (parents[part] != -1 && areas[other] < areas[parents[part]])) {
+				continue;
+			}
+			inside = 0;
+			for (i = starts[other], j = starts[other + 1] - 1; i < starts[other + 1]; j = i++) {
+				if ((py[i] > y) != (py[j] > y)
+						&& x < (px[j] - px[i]) * (y - py[i]) / (py[j] - py[i]) + px[i]) {
+					inside = !inside;
+				}
+			}
+			if (inside) {
+				parents[part] = other;
+			}
+		}
+		if (parents[part] == -1) {
+			polygonCount++;
+		}
+	}
+	
+	Tcl_DStringAppend(&json->text, polygonCount == 1
+			? "{\"type\":\"Polygon\",\"coordinates\":"
+			: "{\"type\":\"MultiPolygon\",\"coordinates\":[", -1);
+	for (part = 0; part < shape->nParts; part++) {
+		if (parents[part] != -1) {
+			continue;
+		}
+		Tcl_DStringAppend(&json->text, first ? "[" : ",[", -1);
+		first = 0;
+		shapefile_jsonPositions(json, shape, starts[part], starts[part + 1] - starts[part], hasZ, 1);
+		for (other = 0; other < shape->nParts; other++) {
+			if (parents[other] == part) {
+				Tcl_DStringAppend(&json->text, ",", 1);
+				shapefile_jsonPositions(json, shape, starts[other], starts[other + 1] - starts[other], hasZ, 1);
+			}
+		}
+		Tcl_DStringAppend(&json->text, "]", 1);
+	}
+	Tcl_DStringAppend(&json->text, polygonCount == 1 ? "}" : "]}", -1);
+	
+	ckfree((char *)areas);
+	ckfree((char *)parents);
+}
+
+/*
+ * cmd_save
+ * 
+ * Implements the [$shp save] command used to copy the files of a shapefile,
+ * such as one held in memory, to another path or to byte arrays. Pending
+ * changes to a readwrite shapefile are written first.
+ * 
+ * Command Syntax:
+ *   [$shp save PATH]
+ *     Write copies of the .shp, .shx, and .dbf files to PATH, replacing any
+ *     existing files. PATH may itself be a memory path (mem://NAME).
+ *   [$shp save]
+ *     Get the contents of the files.
+ * 
+ * Result:
+ *   With PATH, no Tcl result. Otherwise, a dictionary with keys shp, shx, and
+ *   dbf, whose values are byte arrays of the respective file contents.
+ */
+int cmd_save(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	static const char *extensions[] = {"shp", "shx", "dbf", NULL};
+	const char *outputPath = NULL;
+	Tcl_Obj *contents;
+	int i;
+	
+	if (objc != 2 && objc != 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "?path?");
+		return TCL_ERROR;
+	}
+	
+	if (objc == 3) {
+		outputPath = Tcl_GetString(objv[2]);
+		if (shapefile_samePath(shapefile->path, outputPath)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("output path \"%s\" is the shapefile itself", outputPath));
+			return TCL_ERROR;
+		}
+	}
+	
+	/* write current headers and any buffered record so the files are complete */
+	if (!shapefile->readonly) {
+		SHPWriteHeader(shapefile->shp);
+		DBFUpdateHeader(shapefile->dbf);
+	}
+	
+	contents = Tcl_NewDictObj();
+	for (i = 0; extensions[i] != NULL; i++) {
+		if (cmd_save_component(interp, shapefile, extensions[i], outputPath, contents) != TCL_OK) {
+			Tcl_DecrRefCount(contents);
+			return TCL_ERROR;
+		}
+	}
+	
+	if (outputPath == NULL) {
+		Tcl_SetObjResult(interp, contents);
+	} else {
+		Tcl_DecrRefCount(contents);
+	}
+	return TCL_OK;
+}
+
+/*
+ * cmd_save_component
+ * 
+ * Copy one component file of a shapefile to the same component of the
+ * shapefile at outputPath or, if outputPath is NULL, to a byte array stored
+ * in the contents dictionary under the extension. contents must be unshared.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_save_component(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		const char *extension,
+		const char *outputPath,
+		Tcl_Obj *contents) {
+	
+	SAHooks hooks;
+	SAFile input = NULL, output = NULL;
+	Tcl_Obj *componentPath, *outputComponentPath = NULL, *bytes;
+	unsigned char *data = NULL;
+	SAOffset size, offset, count;
+	int returnValue = TCL_ERROR;
+	
+	shapefile_streamHooks(&hooks);
+	componentPath = shapefile_componentPath(shapefile->path, extension);
+	Tcl_IncrRefCount(componentPath);
+	
+	if ((input = hooks.FOpen(Tcl_GetString(componentPath), "rb")) == NULL
+			|| hooks.FSeek(input, 0, SEEK_END) != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read \"%s\"", Tcl_GetString(componentPath)));
+		goto cleanup;
+	}
+	size = hooks.FTell(input);
+	
+	if (outputPath == NULL) {
+		if (size > INT_MAX) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is too large to return as a byte array", Tcl_GetString(componentPath)));
+			goto cleanup;
+		}
+		bytes = Tcl_NewByteArrayObj(NULL, 0);
+		data = Tcl_SetByteArrayLength(bytes, (int)size);
+		if (size > 0 && (hooks.FSeek(input, 0, SEEK_SET) != 0 || hooks.FRead(data, size, 1, input) != 1)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read \"%s\"", Tcl_GetString(componentPath)));
+			Tcl_DecrRefCount(bytes);
+			data = NULL;
+			goto cleanup;
+		}
+		data = NULL;
+		Tcl_DictObjPut(interp, contents, Tcl_NewStringObj(extension, -1), bytes);
+		returnValue = TCL_OK;
+		goto cleanup;
+	}
+	
+	outputComponentPath = shapefile_componentPath(outputPath, extension);
+	Tcl_IncrRefCount(outputComponentPath);
+	if ((output = hooks.FOpen(Tcl_GetString(outputComponentPath), "wb")) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create \"%s\"", Tcl_GetString(outputComponentPath)));
+		goto cleanup;
+	}
+	
+	data = (unsigned char *)ckalloc(COPY_BUFFER_SIZE);
+	for (offset = 0; offset < size; offset += count) {
+		count = size - offset < COPY_BUFFER_SIZE ? size - offset : COPY_BUFFER_SIZE;
+		if (hooks.FSeek(input, offset, SEEK_SET) != 0 || hooks.FRead(data, count, 1, input) != 1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read \"%s\"", Tcl_GetString(componentPath)));
+			goto cleanup;
+		}
+		if (hooks.FWrite(data, count, 1, output) != 1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write \"%s\"", Tcl_GetString(outputComponentPath)));
+			goto cleanup;
+		}
+	}
+	returnValue = TCL_OK;
+	
+   cleanup:
+	if (data != NULL) ckfree((char *)data);
+	if (input != NULL) hooks.FClose(input);
+	if (output != NULL) hooks.FClose(output);
+	if (outputComponentPath != NULL) Tcl_DecrRefCount(outputComponentPath);
+	Tcl_DecrRefCount(componentPath);
+	return returnValue;
+}
+
+/*
+ * cmd_compact
+ * 
+ * Implements the [$shp compact] command used to rewrite the shapefile without
+ * deleted records or the orphaned geometry left behind when features are
+ * overwritten with larger coordinate lists.
+ * 
+ * Command Syntax:
+ *   [$shp compact]
+ *     Rewrite the shapefile in place. Live records are streamed to temporary
+ *     files which then replace the original .shp, .shx, and .dbf files. The
+ *     shapefile must be readwrite.
+ *   [$shp compact -output PATH]
+ *     Write the live records to a new shapefile at PATH. The original
+ *     shapefile is not modified, so it may be readonly.
+ * 
+ * Result:
+ *   Number of records written to the compacted shapefile.
+ */
+int cmd_compact(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	const char *outputPath = NULL;
+	int *featureIds;
+	int featureId, featureCount, liveCount;
+	int returnValue;
+	
+	if (objc != 2 && objc != 4) {
+		Tcl_WrongNumArgs(interp, 2, objv, "?-output path?");
+		return TCL_ERROR;
+	}
+	
+	if (objc == 4) {
+		if (strcmp(Tcl_GetString(objv[2]), "-output") != 0) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid option \"%s\": should be -output", Tcl_GetString(objv[2])));
+			return TCL_ERROR;
+		}
+		outputPath = Tcl_GetString(objv[3]);
+	}
+	
+	if (outputPath == NULL && shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot compact readonly shapefile in place (use -output)"));
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	if ((featureIds = (int *)ckalloc((unsigned int)(sizeof(int) * (featureCount + 1)))) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate feature index array"));
+		return TCL_ERROR;
+	}
+	
+	/* live records are those not flagged as deleted in the attribute table */
+	liveCount = 0;
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		if (!DBFIsRecordDeleted(shapefile->dbf, featureId)) {
+			featureIds[liveCount++] = featureId;
+		}
+	}
+	
+	returnValue = shapefile_rewrite(interp, shapefile, featureIds, liveCount, outputPath, NULL);
+	ckfree((char *)featureIds);
+	
+	if (returnValue == TCL_OK) {
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(liveCount));
+	}
+	return returnValue;
+}
+
+/*
+ * cmd_delete
+ * 
+ * Implements the [$shp delete] command used to flag records as deleted.
+ * 
+ * Command Syntax:
+ *   [$shp delete FEATURES]
+ *     Set the deletion flag of each feature index in the FEATURES list. Only
+ *     the flag is changed; feature geometry and attribute values remain in
+ *     the shapefile until it is compacted (see [$shp compact]). Indices of
+ *     other features are unaffected. The shapefile must be readwrite.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_delete(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "indexList");
+		return TCL_ERROR;
+	}
+	
+	return cmd_delete_mark(interp, (ShapefilePtr)clientData, objv[2], 1);
+}
+
+/*
+ * cmd_undelete
+ * 
+ * Implements the [$shp undelete] command used to clear record deletion flags.
+ * 
+ * Command Syntax:
+ *   [$shp undelete FEATURES]
+ *     Clear the deletion flag of each feature index in the FEATURES list,
+ *     restoring features previously flagged by [$shp delete]. The shapefile
+ *     must be readwrite.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_undelete(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "indexList");
+		return TCL_ERROR;
+	}
+	
+	return cmd_delete_mark(interp, (ShapefilePtr)clientData, objv[2], 0);
+}
+
+/*
+ * cmd_delete_mark
+ * 
+ * Set or clear the attribute table deletion flag of each listed record. Used
+ * by [$shp delete] and [$shp undelete]. All indices are validated before any
+ * flag is changed. Each flag is a single byte of its record, so the cost of
+ * marking a record does not depend on the size of the shapefile.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_delete_mark(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		Tcl_Obj *featureIdList,
+		int deleted) {
+	
+	Tcl_Obj **featureIds;
+	int featureIdCount, featureId, dbfCount, i;
+	
+	if (shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot %s records in readonly mode", deleted ? "delete" : "undelete"));
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_ListObjGetElements(interp, featureIdList, &featureIdCount, &featureIds) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	dbfCount = DBFGetRecordCount(shapefile->dbf);
+	for (i = 0; i < featureIdCount; i++) {
+		if (Tcl_GetIntFromObj(interp, featureIds[i], &featureId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (featureId < 0 || featureId >= dbfCount) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+			return TCL_ERROR;
+		}
+	}
+	
+	for (i = 0; i < featureIdCount; i++) {
+		(void)Tcl_GetIntFromObj(NULL, featureIds[i], &featureId);
+		if (!DBFMarkRecordDeleted(shapefile->dbf, featureId, deleted)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to %s feature %d", deleted ? "delete" : "undelete", featureId));
+			return TCL_ERROR;
+		}
+	}
+	
+	return TCL_OK;
+}
+
+/*
+ * cmd_sort
+ * 
+ * Implements the [$shp sort] command used to reorder records for locality of
+ * reference. Sort keys are computed for all records and sorted in memory;
+ * records are then copied in key order with shapefile_rewrite, so memory use
+ * is proportional to the number of records, not the size of the shapefile.
+ * Ties (including null shapes or values, which sort last) keep file order.
+ * 
+ * Command Syntax:
+ *   [$shp sort -hilbert ?-output PATH?]
+ *     Order records by the position of their bounding box centers along a
+ *     Hilbert curve filling the shapefile bounds. Nearby features are likely
+ *     to be stored near each other.
+ *   [$shp sort -morton ?-output PATH?]
+ *     Order records by the Morton (Z-order) code of bounding box centers.
+ *     Cheaper to compute than -hilbert, but with poorer locality.
+ *   [$shp sort -field FIELD ?-output PATH?]
+ *     Order records by ascending value of the named attribute field. Numeric
+ *     fields are compared numerically and others as stored.
+ * 
+ *   If -output is given the sorted shapefile is written to PATH. Otherwise
+ *   the shapefile is sorted in place, which requires readwrite mode.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_sort(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile = (ShapefilePtr)clientData;
+	static const char *optionNames[] = {"-field", "-hilbert", "-morton", "-output", NULL};
+	int optionIndex, i;
+	int method = -1, fieldId = -1, fieldWidth = 0;
+	const char *outputPath = NULL;
+	ShapefileSortKeyPtr keys = NULL;
+	char *strings = NULL;
+	int *featureIds = NULL;
+	int featureCount;
+	int returnValue = TCL_ERROR;
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "-hilbert|-morton|-field name ?-output path?");
+		return TCL_ERROR;
+	}
+	
+	for (i = 2; i < objc; i++) {
+		if (Tcl_GetIndexFromObj(interp, objv[i], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if ((optionIndex == 0 || optionIndex == 3) && i + 1 >= objc) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing value for %s option", optionNames[optionIndex]));
+			return TCL_ERROR;
+		}
+		if (optionIndex == 3) {
+			outputPath = Tcl_GetString(objv[++i]);
+			continue;
+		}
+		if (method != -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("only one of -hilbert, -morton, or -field may be given"));
+			return TCL_ERROR;
+		}
+		method = optionIndex;
+		if (optionIndex == 0) {
+			if (cmd_fields_index(interp, shapefile, Tcl_GetString(objv[++i])) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			(void)Tcl_GetIntFromObj(NULL, Tcl_GetObjResult(interp), &fieldId);
+			Tcl_ResetResult(interp);
+		}
+	}
+	
+	if (method == -1) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("missing sort order (should be -hilbert, -morton, or -field)"));
+		return TCL_ERROR;
+	}
+	
+	if (outputPath == NULL && shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot sort readonly shapefile in place (use -output)"));
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(shapefile->shp, &featureCount, NULL, NULL, NULL);
+	keys = (ShapefileSortKeyPtr)ckalloc((unsigned int)(sizeof(struct shapefile_sortKey) * (featureCount + 1)));
+	featureIds = (int *)ckalloc((unsigned int)(sizeof(int) * (featureCount + 1)));
+	if (keys == NULL || featureIds == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate sort keys"));
+		goto cleanup;
+	}
+	
+	if (method == 0) {
+		/* string keys are stored as fixed-width copies of the raw field */
+		(void)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &fieldWidth, NULL);
+		if ((strings = (char *)ckalloc((unsigned int)((fieldWidth + 1) * (featureCount + 1)))) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate sort keys"));
+			goto cleanup;
+		}
+		if (cmd_sort_fieldKeys(interp, shapefile, keys, featureCount, fieldId, strings) != TCL_OK) {
+			goto cleanup;
+		}
+	} else if (cmd_sort_spatialKeys(interp, shapefile, keys, featureCount, method == 1, NULL) != TCL_OK) {
+		goto cleanup;
+	}
+	
+	for (i = 0; i < featureCount; i++) {
+		featureIds[i] = keys[i].featureId;
+	}
+	
+	/* keys are no longer needed once the record order is known */
+	ckfree((char *)keys);
+	keys = NULL;
+	if (strings != NULL) {
+		ckfree(strings);
+		strings = NULL;
+	}
+	
+	returnValue = shapefile_rewrite(interp, shapefile, featureIds, featureCount, outputPath, NULL);
+	
+cleanup:
+	if (keys != NULL) ckfree((char *)keys);
+	if (strings != NULL) ckfree(strings);
+	if (featureIds != NULL) ckfree((char *)featureIds);
+	return returnValue;
+}
+
+/*
+ * cmd_sort_spatialKeys
+ * 
+ * Compute Hilbert (if hilbert is true) or Morton sort keys from the bounding
+ * box center of each record, located on a grid spanning the shapefile bounds,
+ * and sort the keys. Bounding boxes are read from the raw record headers in a
+ * single sequential pass; vertices are not read. If bounds is not NULL, the
+ * Xmin, Ymin, Xmax, Ymax of each non-null record is also stored there, four
+ * values per feature index.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_sort_spatialKeys(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		ShapefileSortKeyPtr keys,
+		int featureCount,
+		int hilbert,
+		double *bounds) {
+	
+	struct shapefile_buffer input;
+	unsigned char record[52];
+	double fileMin[4], fileMax[4], min[4], max[4];
+	double scale[2], center;
+	unsigned int cell[2];
+	int featureId, size, axis;
+	
+	SHPGetInfo(shapefile->shp, NULL, NULL, fileMin, fileMax);
+	for (axis = 0; axis < 2; axis++) {
+		scale[axis] = fileMax[axis] > fileMin[axis]
+				? ((1 << SORT_GRID_ORDER) - 1) / (fileMax[axis] - fileMin[axis]) : 0.0;
+	}
+	
+	memset(&input, 0, sizeof(struct shapefile_buffer));
+	input.hooks = &shapefile->shp->sHooks;
+	input.file = shapefile->shp->fpSHP;
+	
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		keys[featureId].featureId = featureId;
+		keys[featureId].isNull = 1;
+		keys[featureId].code = 0;
+		
+		/* the record header, shape type, and bounding box (or point) suffice */
+		size = (int)shapefile->shp->panRecSize[featureId] + 8;
+		if (size > (int)sizeof(record)) {
+			size = (int)sizeof(record);
+		}
+		if (!shapefile_bufferRead(&input, shapefile->shp->panRecOffset[featureId], record, size)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+			shapefile_bufferRelease(&input);
+			return TCL_ERROR;
+		}
+		if (!shapefile_recordBounds(record + 8, size - 8, min, max)) {
+			continue;
+		}
+		if (bounds != NULL) {
+			bounds[featureId * 4] = min[0];
+			bounds[featureId * 4 + 1] = min[1];
+			bounds[featureId * 4 + 2] = max[0];
+			bounds[featureId * 4 + 3] = max[1];
+		}
+		
+		for (axis = 0; axis < 2; axis++) {
+			center = ((min[axis] + max[axis]) / 2.0 - fileMin[axis]) * scale[axis];
+			if (center < 0.0) {
+				center = 0.0;
+			} else if (center > (1 << SORT_GRID_ORDER) - 1) {
+				center = (1 << SORT_GRID_ORDER) - 1;
+			}
+			cell[axis] = (unsigned int)center;
+		}
+		keys[featureId].isNull = 0;
+		keys[featureId].code = hilbert
+				? shapefile_hilbertCode(cell[0], cell[1])
+				: shapefile_mortonCode(cell[0], cell[1]);
+	}
+	shapefile_bufferRelease(&input);
+	
+	qsort(keys, featureCount, sizeof(struct shapefile_sortKey), shapefile_compareCode);
+	return TCL_OK;
+}
+
+/*
+ * cmd_sort_fieldKeys
+ * 
+ * Read the value of field fieldId from each attribute record and sort the
+ * keys. Integer and double fields are compared as numbers; other values are
+ * compared as stored, using fixed-width copies kept in the strings buffer
+ * (which must hold featureCount strings of the field width plus one).
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int cmd_sort_fieldKeys(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		ShapefileSortKeyPtr keys,
+		int featureCount,
+		int fieldId,
+		char *strings) {
+	
+	int fieldType, fieldWidth, featureId, numeric;
+	const char *value;
+	
+	fieldType = (int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &fieldWidth, NULL);
+	numeric = fieldType == FTInteger || fieldType == FTDouble;
+	
+	for (featureId = 0; featureId < featureCount; featureId++) {
+		keys[featureId].featureId = featureId;
+		keys[featureId].isNull = DBFIsAttributeNULL(shapefile->dbf, featureId, fieldId);
+		keys[featureId].number = 0.0;
+		keys[featureId].string = strings + (fieldWidth + 1) * featureId;
+		strings[(fieldWidth + 1) * featureId] = '\0';
+		
+		if (keys[featureId].isNull) {
+			continue;
+		}
+		if (numeric) {
+			keys[featureId].number = DBFReadDoubleAttribute(shapefile->dbf, featureId, fieldId);
+		} else {
+			if ((value = DBFReadStringAttribute(shapefile->dbf, featureId, fieldId)) == NULL) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read attribute record %d", featureId));
+				return TCL_ERROR;
+			}
+			strncpy(strings + (fieldWidth + 1) * featureId, value, fieldWidth);
+			strings[(fieldWidth + 1) * featureId + fieldWidth] = '\0';
+		}
+	}
+	
+	qsort(keys, featureCount, sizeof(struct shapefile_sortKey),
+			numeric ? shapefile_compareNumber : shapefile_compareString);
+	return TCL_OK;
+}
+
+/*
+ * shapefile_hilbertCode
+ * 
+ * Get the distance along a Hilbert curve of order SORT_GRID_ORDER of grid
+ * cell x, y.
+ */
+unsigned int shapefile_hilbertCode(unsigned int x, unsigned int y) {
+	unsigned int rx, ry, s, t, d = 0;
+	
+	for (s = 1U << (SORT_GRID_ORDER - 1); s > 0; s >>= 1) {
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+		
+		/* rotate the quadrant so the curve remains continuous */
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - (x & (s - 1));
+				y = s - 1 - (y & (s - 1));
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return d;
+}
+
+/*
+ * shapefile_mortonCode
+ * 
+ * Get the Morton (Z-order) code of grid cell x, y by interleaving the bits of
+ * the SORT_GRID_ORDER bit cell coordinates.
+ */
+unsigned int shapefile_mortonCode(unsigned int x, unsigned int y) {
+	unsigned int code = 0;
+	int bit;
+	
+	for (bit = 0; bit < SORT_GRID_ORDER; bit++) {
+		code |= ((x >> bit) & 1U) << (2 * bit);
+		code |= ((y >> bit) & 1U) << (2 * bit + 1);
+	}
+	return code;
+}
+
+/*
+ * shapefile_compareCode, shapefile_compareNumber, shapefile_compareString
+ * 
+ * qsort comparison functions for ShapefileSortKeyPtr arrays. Null keys sort
+ * after all others. Equal keys are ordered by feature index, so sorting is
+ * stable with respect to the original record order.
+ */
+int shapefile_compareCode(const void *a, const void *b) {
+	const struct shapefile_sortKey *keyA = (const struct shapefile_sortKey *)a;
+	const struct shapefile_sortKey *keyB = (const struct shapefile_sortKey *)b;
+	
+	if (keyA->isNull != keyB->isNull) {
+		return keyA->isNull - keyB->isNull;
+	}
+	if (!keyA->isNull && keyA->code != keyB->code) {
+		return keyA->code < keyB->code ? -1 : 1;
+	}
+	return keyA->featureId - keyB->featureId;
+}
+
+int shapefile_compareNumber(const void *a, const void *b) {
+	const struct shapefile_sortKey *keyA = (const struct shapefile_sortKey *)a;
+	const struct shapefile_sortKey *keyB = (const struct shapefile_sortKey *)b;
+	
+	if (keyA->isNull != keyB->isNull) {
+		return keyA->isNull - keyB->isNull;
+	}
+	if (!keyA->isNull && keyA->number != keyB->number) {
+		return keyA->number < keyB->number ? -1 : 1;
+	}
+	return keyA->featureId - keyB->featureId;
+}
+
+int shapefile_compareString(const void *a, const void *b) {
+	const struct shapefile_sortKey *keyA = (const struct shapefile_sortKey *)a;
+	const struct shapefile_sortKey *keyB = (const struct shapefile_sortKey *)b;
+	int order;
+	
+	if (keyA->isNull != keyB->isNull) {
+		return keyA->isNull - keyB->isNull;
+	}
+	if (!keyA->isNull && (order = strcmp(keyA->string, keyB->string)) != 0) {
+		return order;
+	}
+	return keyA->featureId - keyB->featureId;
+}
+
+/*
+ * shapefile_cacheLookup
+ * 
+ * Find the cached feature (if isRecord is 0) or attribute record (if isRecord
+ * is 1) with the given index, and mark it most recently used. Cached shapes
+ * and records remain owned by the cache and must not be freed or modified.
+ * 
+ * Result:
+ *   Cache entry, or NULL if not cached or if the cache is disabled.
+ */
+ShapefileCacheEntryPtr shapefile_cacheLookup(
+		ShapefilePtr shapefile,
+		int index,
+		int isRecord) {
+	
+	Tcl_HashEntry *hashEntry;
+	ShapefileCacheEntryPtr entry;
+	
+	if (shapefile->cacheSize == 0) {
+		return NULL;
+	}
+	
+	hashEntry = Tcl_FindHashEntry(&shapefile->cacheTable, (char *)((size_t)index * 2 + isRecord));
+	if (hashEntry == NULL) {
+		shapefile->cacheMisses++;
+		return NULL;
+	}
+	shapefile->cacheHits++;
+	entry = (ShapefileCacheEntryPtr)Tcl_GetHashValue(hashEntry);
+	
+	/* move to the front of the list */
+	if (entry != shapefile->cacheFirst) {
+		entry->prev->next = entry->next;
+		if (entry->next != NULL) {
+			entry->next->prev = entry->prev;
+		} else {
+			shapefile->cacheLast = entry->prev;
+		}
+		entry->prev = NULL;
+		entry->next = shapefile->cacheFirst;
+		shapefile->cacheFirst->prev = entry;
+		shapefile->cacheFirst = entry;
+	}
+	
+	return entry;
+}
+
+/*
+ * shapefile_cacheInsert
+ * 
+ * Add a feature's shape, or an attribute record's formatted value list, to
+ * the cache as the most recently used entry, discarding least recently used
+ * entries to make room. Entries that would not fit are not added.
+ * 
+ * Result:
+ *   1 if the shape or record was cached, in which case the cache owns the
+ *   shape or holds a reference to the record; 0 if not.
+ */
+int shapefile_cacheInsert(
+		ShapefilePtr shapefile,
+		int index,
+		SHPObject *shape,
+		Tcl_Obj *record) {
+	
+	Tcl_HashEntry *hashEntry;
+	ShapefileCacheEntryPtr entry;
+	int size, isNew, fieldCount;
+	
+	if (shapefile->cacheSize == 0) {
+		return 0;
+	}
+	
+	/* approximate; records are counted as field objects plus raw text */
+	size = (int)sizeof(struct shapefile_cacheEntry);
+	if (shape != NULL) {
+		size += (int)sizeof(SHPObject) + shape->nParts * 2 * (int)sizeof(int)
+				+ shape->nVertices * 4 * (int)sizeof(double);
+	} else {
+		fieldCount = DBFGetFieldCount(shapefile->dbf);
+		size += (int)sizeof(Tcl_Obj) + fieldCount * (int)(sizeof(Tcl_Obj) + sizeof(Tcl_Obj *))
+				+ shapefile->dbf->nRecordLength;
+	}
+	if (size > shapefile->cacheSize) {
+		return 0;
+	}
+	
+	shapefile_cacheInvalidate(shapefile, index, shape == NULL);
+	shapefile_cacheTrim(shapefile, shapefile->cacheSize - size);
+	
+	entry = (ShapefileCacheEntryPtr)ckalloc((unsigned int)sizeof(struct shapefile_cacheEntry));
+	entry->size = size;
+	entry->shape = shape;
+	entry->record = record;
+	if (record != NULL) {
+		Tcl_IncrRefCount(record);
+	}
+	
+	hashEntry = Tcl_CreateHashEntry(&shapefile->cacheTable, (char *)((size_t)index * 2 + (shape == NULL)), &isNew);
+	Tcl_SetHashValue(hashEntry, (ClientData)entry);
+	entry->hashEntry = hashEntry;
+	
+	entry->prev = NULL;
+	entry->next = shapefile->cacheFirst;
+	if (shapefile->cacheFirst != NULL) {
+		shapefile->cacheFirst->prev = entry;
+	} else {
+		shapefile->cacheLast = entry;
+	}
+	shapefile->cacheFirst = entry;
+	shapefile->cacheUsed += size;
+	
+	return 1;
+}
+
+/*
+ * shapefile_cacheInvalidate
+ * 
+ * Discard the cached feature (if isRecord is 0) or attribute record (if
+ * isRecord is 1) with the given index, if any. Invoked before writes.
+ */
+void shapefile_cacheInvalidate(
+		ShapefilePtr shapefile,
+		int index,
+		int isRecord) {
+	
+	Tcl_HashEntry *hashEntry;
+	
+	if (shapefile->cacheFirst == NULL || index < 0) {
+		return;
+	}
+	
+	hashEntry = Tcl_FindHashEntry(&shapefile->cacheTable, (char *)((size_t)index * 2 + isRecord));
+	if (hashEntry != NULL) {
+		shapefile_cacheRemove(shapefile, (ShapefileCacheEntryPtr)Tcl_GetHashValue(hashEntry));
+	}
+}
+
+/*
+ * shapefile_cacheRemove
+ * 
+ * Unlink and free a cache entry, along with its shape or record reference.
+ */
+void shapefile_cacheRemove(
+		ShapefilePtr shapefile,
+		ShapefileCacheEntryPtr entry) {
+	
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		shapefile->cacheFirst = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	} else {
+		shapefile->cacheLast = entry->prev;
+	}
+	
+	Tcl_DeleteHashEntry(entry->hashEntry);
+	shapefile->cacheUsed -= entry->size;
+	if (entry->shape != NULL) {
+		SHPDestroyObject(entry->shape);
+	}
+	if (entry->record != NULL) {
+		Tcl_DecrRefCount(entry->record);
+	}
+	ckfree((char *)entry);
+}
+
+/*
+ * shapefile_cacheTrim
+ * 
+ * Discard least recently used cache entries until no more than size bytes
+ * are used. A size of 0 empties the cache.
+ */
+void shapefile_cacheTrim(
+		ShapefilePtr shapefile,
+		int size) {
+	
+	while (shapefile->cacheLast != NULL && shapefile->cacheUsed > size) {
+		shapefile_cacheRemove(shapefile, shapefile->cacheLast);
+	}
+}
+
+/*
+ * shapefile_getBigInt, shapefile_putBigInt,
+ * shapefile_getLittleInt, shapefile_putLittleInt,
+ * shapefile_getLittleDouble, shapefile_putLittleDouble
+ * 
+ * Read or write the big-endian integers and little-endian integers and
+ * doubles that make up shapefile headers and records, regardless of the
+ * host byte order. Used to handle raw records without Shapelib decoding.
+ */
+unsigned int shapefile_getBigInt(const unsigned char *bytes) {
+	return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16)
+			| ((unsigned int)bytes[2] << 8) | (unsigned int)bytes[3];
+}
+
+void shapefile_putBigInt(unsigned char *bytes, unsigned int value) {
+	bytes[0] = (unsigned char)(value >> 24);
+	bytes[1] = (unsigned char)(value >> 16);
+	bytes[2] = (unsigned char)(value >> 8);
+	bytes[3] = (unsigned char)value;
+}
+
+int shapefile_getLittleInt(const unsigned char *bytes) {
+	return (int)(((unsigned int)bytes[3] << 24) | ((unsigned int)bytes[2] << 16)
+			| ((unsigned int)bytes[1] << 8) | (unsigned int)bytes[0]);
+}
+
+void shapefile_putLittleInt(unsigned char *bytes, int value) {
+	bytes[0] = (unsigned char)value;
+	bytes[1] = (unsigned char)((unsigned int)value >> 8);
+	bytes[2] = (unsigned char)((unsigned int)value >> 16);
+	bytes[3] = (unsigned char)((unsigned int)value >> 24);
+}
+
+double shapefile_getLittleDouble(const unsigned char *bytes) {
+	Tcl_WideUInt bits = 0;
+	double value;
+	int i;
+	for (i = 7; i >= 0; i--) {
+		bits = (bits << 8) | (Tcl_WideUInt)bytes[i];
+	}
+	memcpy(&value, &bits, sizeof(double));
+	return value;
+}
+
+void shapefile_putLittleDouble(unsigned char *bytes, double value) {
+	Tcl_WideUInt bits;
+	int i;
+	memcpy(&bits, &value, sizeof(double));
+	for (i = 0; i < 8; i++) {
+		bytes[i] = (unsigned char)(bits & 0xff);
+		bits >>= 8;
+	}
+}
+
+/*
+ * shapefile_encodeShape
+ * 
+ * Encode shape as raw record content, in the layout SHPWriteObject would
+ * write, for output written without Shapelib. M values are written only if
+ * the shape's measures are used. If content is NULL, only the length is
+ * computed.
+ * 
+ * Result:
+ *   Length of the record content, in bytes.
+ */
+int shapefile_encodeShape(
+		const SHPObject *shape,
+		unsigned char *content) {
+	
+	int type = shape->nSHPType, count = shape->nVertices, parts = shape->nParts;
+	int hasZ, hasM, isPoint, isMultipoint, isMultipatch, length, offset, i;
+	
+	if (type == SHPT_NULL) {
+		if (content != NULL) {
+			shapefile_putLittleInt(content, SHPT_NULL);
+		}
+		return 4;
+	}
+	
+	hasZ = (type >= SHPT_POINTZ && type <= SHPT_MULTIPOINTZ) || type == SHPT_MULTIPATCH;
+	hasM = shape->bMeasureIsUsed && (hasZ || (type >= SHPT_POINTM && type <= SHPT_MULTIPOINTM));
+	isPoint = type == SHPT_POINT || type == SHPT_POINTZ || type == SHPT_POINTM;
+	isMultipoint = type == SHPT_MULTIPOINT || type == SHPT_MULTIPOINTZ || type == SHPT_MULTIPOINTM;
+	isMultipatch = type == SHPT_MULTIPATCH;
+	
+	if (isPoint) {
+		length = 20 + (hasZ ? 8 : 0) + (hasM ? 8 : 0);
+	} else {
+		if (isMultipoint) {
+			parts = 0;
+		}
+		length = (isMultipoint ? 40 : 44) + parts * (isMultipatch ? 8 : 4) + count * 16
+				+ (hasZ ? 16 + count * 8 : 0) + (hasM ? 16 + count * 8 : 0);
+	}
+	if (content == NULL) {
+		return length;
+	}
+	
+	shapefile_putLittleInt(content, type);
+	if (isPoint) {
+		shapefile_putLittleDouble(content + 4, shape->padfX[0]);
+		shapefile_putLittleDouble(content + 12, shape->padfY[0]);
+		offset = 20;
+		if (hasZ) {
+			shapefile_putLittleDouble(content + offset, shape->padfZ[0]);
+			offset += 8;
+		}
+		if (hasM) {
+			shapefile_putLittleDouble(content + offset, shape->padfM[0]);
+		}
+		return length;
+	}
+	
+	shapefile_putLittleDouble(content + 4, shape->dfXMin);
+	shapefile_putLittleDouble(content + 12, shape->dfYMin);
+	shapefile_putLittleDouble(content + 20, shape->dfXMax);
+	shapefile_putLittleDouble(content + 28, shape->dfYMax);
+	if (isMultipoint) {
+		shapefile_putLittleInt(content + 36, count);
+		offset = 40;
+	} else {
+		shapefile_putLittleInt(content + 36, parts);
+		shapefile_putLittleInt(content + 40, count);
+		offset = 44;
+		for (i = 0; i < parts; i++, offset += 4) {
+			shapefile_putLittleInt(content + offset, shape->panPartStart[i]);
+		}
+		for (i = 0; isMultipatch && i < parts; i++, offset += 4) {
+			shapefile_putLittleInt(content + offset, shape->panPartType[i]);
+		}
+	}
+	for (i = 0; i < count; i++, offset += 16) {
+		shapefile_putLittleDouble(content + offset, shape->padfX[i]);
+		shapefile_putLittleDouble(content + offset + 8, shape->padfY[i]);
+	}
+	if (hasZ) {
+		shapefile_putLittleDouble(content + offset, shape->dfZMin);
+		shapefile_putLittleDouble(content + offset + 8, shape->dfZMax);
+		for (i = 0, offset += 16; i < count; i++, offset += 8) {
+			shapefile_putLittleDouble(content + offset, shape->padfZ[i]);
+		}
+	}
+	if (hasM) {
+		shapefile_putLittleDouble(content + offset, shape->dfMMin);
+		shapefile_putLittleDouble(content + offset + 8, shape->dfMMax);
+		for (i = 0, offset += 16; i < count; i++, offset += 8) {
+			shapefile_putLittleDouble(content + offset, shape->padfM[i]);
+		}
+	}
+	return length;
+}
+
+/*
+ * shapefile_recordBounds
+ * 
+ * Get the XYZM bounds of a raw shape record without decoding its vertices.
+ * The content pointer addresses the record content following the 8 byte
+ * record header. Absent Z or M ranges are reported as 0, as Shapelib would.
+ * 
+ * Result:
+ *   1 if min and max were set; 0 if the record is null or truncated.
+ */
+int shapefile_recordBounds(
+		const unsigned char *content,
+		int contentLength,
+		double *min,
+		double *max) {
+	
+	int shapeType, partCount, vertexCount, offset;
+	
+	if (contentLength < 4) {
+		return 0;
+	}
+	
+	min[2] = max[2] = 0.0;
+	min[3] = max[3] = 0.0;
+	shapeType = shapefile_getLittleInt(content);
+	
+	switch (shapeType) {
+		case SHPT_POINT:
+		case SHPT_POINTM:
+		case SHPT_POINTZ:
+			if (contentLength < 20) {
+				return 0;
+			}
+			min[0] = max[0] = shapefile_getLittleDouble(content + 4);
+			min[1] = max[1] = shapefile_getLittleDouble(content + 12);
+			if (shapeType == SHPT_POINTZ && contentLength >= 28) {
+				min[2] = max[2] = shapefile_getLittleDouble(content + 20);
+				if (contentLength >= 36) {
+					min[3] = max[3] = shapefile_getLittleDouble(content + 28);
+				}
+			} else if (shapeType == SHPT_POINTM && contentLength >= 28) {
+				min[3] = max[3] = shapefile_getLittleDouble(content + 20);
+			}
+			return 1;
+		case SHPT_ARC:
+		case SHPT_ARCM:
+		case SHPT_ARCZ:
+		case SHPT_POLYGON:
+		case SHPT_POLYGONM:
+		case SHPT_POLYGONZ:
+		case SHPT_MULTIPOINT:
+		case SHPT_MULTIPOINTM:
+		case SHPT_MULTIPOINTZ:
+			if (contentLength < 40) {
+				return 0;
+			}
+			min[0] = shapefile_getLittleDouble(content + 4);
+			min[1] = shapefile_getLittleDouble(content + 12);
+			max[0] = shapefile_getLittleDouble(content + 20);
+			max[1] = shapefile_getLittleDouble(content + 28);
+			
+			/* locate the end of the XY vertex array */
+			if (shapefile_typeBase(shapeType) == BASE_MULTIPOINT) {
+				vertexCount = shapefile_getLittleInt(content + 36);
+				offset = 40 + 16 * vertexCount;
+			} else {
+				if (contentLength < 44) {
+					return 0;
+				}
+				partCount = shapefile_getLittleInt(content + 36);
+				vertexCount = shapefile_getLittleInt(content + 40);
+				offset = 44 + 4 * partCount + 16 * vertexCount;
+			}
+			if (vertexCount < 0 || offset < 0) {
+				return 0;
+			}
+			
+			/* Z range and array, then optional M range and array */
+			if (shapefile_typeDimension(shapeType) == DIM_XYZM && contentLength >= offset + 16) {
+				min[2] = shapefile_getLittleDouble(content + offset);
+				max[2] = shapefile_getLittleDouble(content + offset + 8);
+				offset += 16 + 8 * vertexCount;
+			}
+			if (shapefile_typeDimension(shapeType) != DIM_XY && contentLength >= offset + 16) {
+				min[3] = shapefile_getLittleDouble(content + offset);
+				max[3] = shapefile_getLittleDouble(content + offset + 8);
+			}
+			return 1;
+	}
+	
+	return 0;
+}
+
+/*
+ * shapefile_header
+ * 
+ * Fill a 100 byte .shp or .shx file header. fileSize is the total length in
+ * bytes of the file the header describes.
+ */
+void shapefile_header(
+		unsigned char *header,
+		SAOffset fileSize,
+		int shapeType,
+		const double *min,
+		const double *max) {
+	
+	memset(header, 0, 100);
+	shapefile_putBigInt(header, 9994);
+	shapefile_putBigInt(header + 24, (unsigned int)(fileSize / 2));
+	shapefile_putLittleInt(header + 28, 1000);
+	shapefile_putLittleInt(header + 32, shapeType);
+	shapefile_putLittleDouble(header + 36, min[0]);
+	shapefile_putLittleDouble(header + 44, min[1]);
+	shapefile_putLittleDouble(header + 52, max[0]);
+	shapefile_putLittleDouble(header + 60, max[1]);
+	shapefile_putLittleDouble(header + 68, min[2]);
+	shapefile_putLittleDouble(header + 76, max[2]);
+	shapefile_putLittleDouble(header + 84, min[3]);
+	shapefile_putLittleDouble(header + 92, max[3]);
+}
+
+/*
+ * shapefile_componentPath
+ * 
+ * Get the path of one component file of a shapefile. Any extension on path
+ * is replaced with the given extension, following Shapelib's convention.
+ * 
+ * Result:
+ *   New path object (zero reference count).
+ */
+Tcl_Obj *shapefile_componentPath(const char *path, const char *extension) {
+	int i;
+	
+	for (i = (int)strlen(path) - 1; i > 0 && path[i] != '.' && path[i] != '/' && path[i] != '\\'; i--) {}
+	if (i <= 0 || path[i] != '.') {
+		i = (int)strlen(path);
+	}
+	
+	return Tcl_ObjPrintf("%.*s.%s", i, path, extension);
+}
+
+/*
+ * shapefile_bufferRead
+ * 
+ * Read size bytes at offset from a buffered input file. Requests that
+ * continue where the previous one left off, or skip ahead by less than the
+ * buffer size, refill the buffer with a single large read; other requests
+ * are read directly.
+ * 
+ * Result:
+ *   1 on success, 0 if the requested bytes could not be read.
+ */
+int shapefile_bufferRead(
+		ShapefileBufferPtr buffer,
+		SAOffset offset,
+		void *data,
+		int size) {
+	
+	if (buffer->length > 0 && offset >= buffer->start
+			&& offset + size <= buffer->start + buffer->length) {
+		memcpy(data, buffer->data + (offset - buffer->start), size);
+	} else if (offset >= buffer->next && offset - buffer->next < COPY_BUFFER_SIZE
+			&& size < COPY_BUFFER_SIZE) {
+		if (buffer->data == NULL
+				&& (buffer->data = (unsigned char *)ckalloc(COPY_BUFFER_SIZE)) == NULL) {
+			return 0;
+		}
+		buffer->length = 0;
+		if (buffer->hooks->FSeek(buffer->file, offset, SEEK_SET) != 0) {
+			return 0;
+		}
+		buffer->length = (int)buffer->hooks->FRead(buffer->data, 1, COPY_BUFFER_SIZE, buffer->file);
+		buffer->start = offset;
+		if (buffer->length < size) {
+			return 0;
+		}
+		memcpy(data, buffer->data, size);
+	} else {
+		if (buffer->hooks->FSeek(buffer->file, offset, SEEK_SET) != 0
+				|| buffer->hooks->FRead(data, size, 1, buffer->file) != 1) {
+			return 0;
+		}
+	}
+	
+	buffer->next = offset + size;
+	return 1;
+}
+
+/*
+ * shapefile_bufferWrite
+ * 
+ * Append size bytes to a buffered output file. Data is written when the
+ * buffer is full; writes larger than the buffer are passed through.
+ * 
+ * Result:
+ *   1 on success, 0 if a write failed.
+ */
+int shapefile_bufferWrite(
+		ShapefileBufferPtr buffer,
+		const void *data,
+		int size) {
+	
+	if (buffer->length + size > COPY_BUFFER_SIZE && !shapefile_bufferFlush(buffer)) {
+		return 0;
+	}
+	
+	if (size >= COPY_BUFFER_SIZE) {
+		return buffer->hooks->FWrite((void *)data, size, 1, buffer->file) == 1;
+	}
+	
+	if (buffer->data == NULL
+			&& (buffer->data = (unsigned char *)ckalloc(COPY_BUFFER_SIZE)) == NULL) {
+		return 0;
+	}
+	memcpy(buffer->data + buffer->length, data, size);
+	buffer->length += size;
+	return 1;
+}
+
+/*
+ * shapefile_bufferFlush
+ * 
+ * Write any data held in an output buffer.
+ * 
+ * Result:
+ *   1 on success, 0 if the write failed.
+ */
+int shapefile_bufferFlush(ShapefileBufferPtr buffer) {
+	if (buffer->length > 0) {
+		if (buffer->hooks->FWrite(buffer->data, buffer->length, 1, buffer->file) != 1) {
+			return 0;
+		}
+		buffer->length = 0;
+	}
+	return 1;
+}
+
+/*
+ * shapefile_bufferRelease
+ * 
+ * Free buffer memory. Does not close the underlying file.
+ */
+void shapefile_bufferRelease(ShapefileBufferPtr buffer) {
+	if (buffer->data != NULL) {
+		ckfree((char *)buffer->data);
+		buffer->data = NULL;
+	}
+	buffer->length = 0;
+}
+
+/*
+ * shapefile_streamHooks
+ * 
+ * Initialize hooks that open shapefile component files as read-ahead
+ * streams. Otherwise the same as Shapelib's default hooks.
+ */
+void shapefile_streamHooks(SAHooks *hooks) {
+	SASetupDefaultHooks(hooks);
+	hooks->FOpen = shapefile_streamOpen;
+	hooks->FRead = shapefile_streamRead;
+	hooks->FWrite = shapefile_streamWrite;
+	hooks->FSeek = shapefile_streamSeek;
+	hooks->FTell = shapefile_streamTell;
+	hooks->FFlush = shapefile_streamFlush;
+	hooks->FClose = shapefile_streamClose;
+	hooks->Remove = shapefile_streamRemove;
+}
+
+/*
+ * shapefile_streamOpen
+ * 
+ * FOpen hook of shapefile_streamHooks. Filenames beginning with MEMORY_PREFIX
+ * open memory files (see shapefile_memoryOpen); other filenames outside the
+ * native filesystem are opened with Tcl_FSOpenFileChannel.
+ * 
+ * Result:
+ *   Stream handle, or NULL if the file could not be opened.
+ */
+SAFile shapefile_streamOpen(
+		const char *filename,
+		const char *access) {
+	
+	ShapefileStreamPtr stream;
+	FILE *file = NULL;
+	Tcl_Channel channel = NULL;
+	ShapefileMemoryFilePtr memory = NULL;
+	Tcl_Obj *pathObj;
+	char mode[3];
+	
+	if (shapefile_memoryPath(filename)) {
+		if ((memory = shapefile_memoryOpen(filename, access)) == NULL) {
+			return NULL;
+		}
+	} else if (shapefile_channelPath(filename)) {
+		/* channel modes are fopen modes without the binary flag */
+		mode[0] = access[0];
+		mode[1] = strchr(access, '+') != NULL ? '+' : '\0';
+		mode[2] = '\0';
+		pathObj = Tcl_NewStringObj(filename, -1);
+		Tcl_IncrRefCount(pathObj);
+		channel = Tcl_FSOpenFileChannel(NULL, pathObj, mode, 0666);
+		Tcl_DecrRefCount(pathObj);
+		if (channel == NULL) {
+			return NULL;
+		}
+		if (Tcl_SetChannelOption(NULL, channel, "-translation", "binary") != TCL_OK) {
+			(void)Tcl_Close(NULL, channel);
+			return NULL;
+		}
+	} else if ((file = fopen(filename, access)) == NULL) {
+		return NULL;
+	}
+	
+	stream = (ShapefileStreamPtr)ckalloc((unsigned int)sizeof(struct shapefile_stream));
+	memset(stream, 0, sizeof(struct shapefile_stream));
+	stream->file = file;
+	stream->channel = channel;
+	stream->memory = memory;
+	return (SAFile)stream;
+}
+
+/*
+ * shapefile_streamRead
+ * 
+ * FRead hook of shapefile_streamHooks. Reads that begin at or less than one
+ * block past the end of the previous read extend the current run. During a
+ * run, requests are served from read-ahead blocks; other reads, and reads
+ * of at least a block, are passed directly to the file. Channel streams
+ * serve all reads of less than a block from read-ahead blocks.
+ * 
+ * Result:
+ *   Number of complete items read.
+ */
+SAOffset shapefile_streamRead(
+		void *p,
+		SAOffset size,
+		SAOffset nmemb,
+		SAFile file) {
+	
+	ShapefileStreamPtr stream = (ShapefileStreamPtr)file;
+	SAOffset total = size * nmemb, done = 0, offset, count;
+	
+	if (total == 0) {
+		return 0;
+	}
+	
+	if (stream->memory != NULL) {
+		done = shapefile_memoryRead(stream->memory, stream->position, p, total);
+		stream->position += done;
+		stream->next = stream->position;
+		return done / size;
+	}
+	
+	if (stream->position >= stream->next && stream->position - stream->next <= READ_AHEAD_SIZE) {
+		if (stream->run < READ_AHEAD_RUN) {
+			stream->run++;
+		}
+	} else {
+		stream->run = 0;
+	}
+	
+	while (done < total) {
+		offset = stream->position + done;
+		
+		if (stream->length > 0 && offset >= stream->start
+				&& offset < stream->start + stream->length) {
+			count = stream->start + stream->length - offset;
+			if (count > total - done) {
+				count = total - done;
+			}
+			memcpy((unsigned char *)p + done, stream->data + (offset - stream->start), count);
+			done += count;
+			continue;
+		}
+		
+		if ((stream->run < READ_AHEAD_RUN && stream->channel == NULL) || total - done >= READ_AHEAD_SIZE) {
+			done += shapefile_streamReadAt(stream, offset, (unsigned char *)p + done, total - done);
+			break;
+		}
+		
+		if (!shapefile_streamFill(stream, offset)) {
+			break;
+		}
+	}
+	
+	stream->position += done;
+	stream->next = stream->position;
+	return done / size;
+}
+
+/*
+ * shapefile_streamFill
+ * 
+ * Read the aligned block containing offset into a stream's read-ahead
+ * buffer. Where supported, the operating system is told that access is
+ * sequential and asked to prefetch the following block.
+ * 
+ * Result:
+ *   1 if the block contains offset, 0 at end of file or on error.
+ */
+int shapefile_streamFill(
+		ShapefileStreamPtr stream,
+		SAOffset offset) {
+	
+	if (stream->data == NULL) {
+		stream->data = (unsigned char *)ckalloc(READ_AHEAD_SIZE);
+	}
+	
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (!stream->advised && stream->file != NULL) {
+		(void)posix_fadvise(fileno(stream->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+		stream->advised = 1;
+	}
+#endif
+	
+	stream->start = offset - offset % READ_AHEAD_ALIGN;
+	stream->length = (int)shapefile_streamReadAt(stream, stream->start, stream->data, READ_AHEAD_SIZE);
+	
+#ifdef POSIX_FADV_WILLNEED
+	if (stream->length == READ_AHEAD_SIZE && stream->file != NULL) {
+		(void)posix_fadvise(fileno(stream->file), (off_t)(stream->start + READ_AHEAD_SIZE),
+				READ_AHEAD_SIZE, POSIX_FADV_WILLNEED);
+	}
+#endif
+	
+	return offset < stream->start + stream->length;
+}
+
+/*
+ * shapefile_streamReadAt
+ * 
+ * Read up to size bytes at offset directly from a stream's file or channel.
+ * 
+ * Result:
+ *   Number of bytes read.
+ */
+SAOffset shapefile_streamReadAt(
+		ShapefileStreamPtr stream,
+		SAOffset offset,
+		void *p,
+		SAOffset size) {
+	
+	int count;
+	
+	if (stream->channel != NULL) {
+		if (Tcl_Seek(stream->channel, (Tcl_WideInt)offset, SEEK_SET) < 0
+				|| (count = Tcl_Read(stream->channel, (char *)p, (int)size)) < 0) {
+			return 0;
+		}
+		return (SAOffset)count;
+	}
+	
+	if (fseek(stream->file, (long)offset, SEEK_SET) != 0) {
+		return 0;
+	}
+	return fread(p, 1, size, stream->file);
+}
+
+/*
+ * shapefile_streamWrite
+ * 
+ * FWrite hook of shapefile_streamHooks. Discards any read-ahead block, which
+ * the write may overlap, and ends the current run.
+ * 
+ * Result:
+ *   Number of complete items written.
+ */
+SAOffset shapefile_streamWrite(
+		void *p,
+		SAOffset size,
+		SAOffset nmemb,
+		SAFile file) {
+	
+	ShapefileStreamPtr stream = (ShapefileStreamPtr)file;
+	SAOffset count;
+	
+	stream->length = 0;
+	stream->run = 0;
+	
+	if (stream->memory != NULL) {
+		count = shapefile_memoryWrite(stream->memory, stream->position, p, size * nmemb) / size;
+		stream->position += count * size;
+		return count;
+	}
+	
+	if (stream->channel != NULL) {
+		if (Tcl_Seek(stream->channel, (Tcl_WideInt)stream->position, SEEK_SET) < 0
+				|| Tcl_Write(stream->channel, (const char *)p, (int)(size * nmemb)) < 0) {
+			return 0;
+		}
+		stream->position += size * nmemb;
+		return nmemb;
+	}
+	
+	if (fseek(stream->file, (long)stream->position, SEEK_SET) != 0) {
+		return 0;
+	}
+	count = fwrite(p, size, nmemb, stream->file);
+	stream->position += count * size;
+	return count;
+}
+
+/*
+ * shapefile_streamSeek
+ * 
+ * FSeek hook of shapefile_streamHooks. Only the logical position changes;
+ * the file is positioned by the next read or write.
+ * 
+ * Result:
+ *   0 on success, -1 on error (as fseek).
+ */
+SAOffset shapefile_streamSeek(
+		SAFile file,
+		SAOffset offset,
+		int whence) {
+	
+	ShapefileStreamPtr stream = (ShapefileStreamPtr)file;
+	Tcl_WideInt end;
+	
+	if (whence == SEEK_SET) {
+		stream->position = offset;
+	} else if (whence == SEEK_CUR) {
+		stream->position += offset;
+	} else if (stream->memory != NULL) {
+		stream->position = shapefile_memorySize(stream->memory) + offset;
+	} else if (stream->channel != NULL) {
+		if ((end = Tcl_Seek(stream->channel, 0, SEEK_END)) < 0) {
+			return (SAOffset)-1;
+		}
+		stream->position = (SAOffset)end + offset;
+	} else {
+		if (fseek(stream->file, 0, SEEK_END) != 0 || (end = ftell(stream->file)) < 0) {
+			return (SAOffset)-1;
+		}
+		stream->position = (SAOffset)end + offset;
+	}
+	return 0;
+}
+
+/*
+ * shapefile_streamTell
+ * 
+ * FTell hook of shapefile_streamHooks.
+ */
+SAOffset shapefile_streamTell(SAFile file) {
+	return ((ShapefileStreamPtr)file)->position;
+}
+
+/*
+ * shapefile_streamFlush
+ * 
+ * FFlush hook of shapefile_streamHooks.
+ */
+int shapefile_streamFlush(SAFile file) {
+	ShapefileStreamPtr stream = (ShapefileStreamPtr)file;
+	if (stream->channel != NULL) {
+		return Tcl_Flush(stream->channel) == TCL_OK ? 0 : EOF;
+	}
+	return stream->memory != NULL ? 0 : fflush(stream->file);
+}
+
+/*
+ * shapefile_streamClose
+ * 
+ * FClose hook of shapefile_streamHooks. Closes the file and frees the stream.
+ */
+int shapefile_streamClose(SAFile file) {
+	
+	ShapefileStreamPtr stream = (ShapefileStreamPtr)file;
+	int result = 0;
+	
+	if (stream->memory != NULL) {
+		shapefile_memoryClose(stream->memory);
+	} else if (stream->channel != NULL) {
+		result = Tcl_Close(NULL, stream->channel) == TCL_OK ? 0 : EOF;
+	} else {
+		result = fclose(stream->file);
+	}
+	if (stream->data != NULL) {
+		ckfree((char *)stream->data);
+	}
+	ckfree((char *)stream);
+	return result;
+}
+
+/*
+ * shapefile_streamRemove
+ * 
+ * Remove hook of shapefile_streamHooks.
+ * 
+ * Result:
+ *   0 on success, -1 on error (as remove).
+ */
+int shapefile_streamRemove(const char *filename) {
+	Tcl_Obj *pathObj;
+	int result;
+	
+	if (shapefile_memoryPath(filename)) {
+		return shapefile_memoryRemove(filename);
+	}
+	if (shapefile_channelPath(filename)) {
+		pathObj = Tcl_NewStringObj(filename, -1);
+		Tcl_IncrRefCount(pathObj);
+		result = Tcl_FSDeleteFile(pathObj) == TCL_OK ? 0 : -1;
+		Tcl_DecrRefCount(pathObj);
+		return result;
+	}
+	return remove(filename);
+}
+
+/*
+ * shapefile_channelPath
+ * 
+ * Result:
+ *   True if path is outside the native filesystem (as in a starkit or other
+ *   Tcl virtual filesystem), so that its files must be opened as channels.
+ *   Memory paths are not channel paths.
+ */
+int shapefile_channelPath(const char *path) {
+	Tcl_Obj *pathObj;
+	int isChannel;
+	
+	if (shapefile_memoryPath(path)) {
+		return 0;
+	}
+	pathObj = Tcl_NewStringObj(path, -1);
+	Tcl_IncrRefCount(pathObj);
+	isChannel = Tcl_FSGetNativePath(pathObj) == NULL;
+	Tcl_DecrRefCount(pathObj);
+	return isChannel;
+}
+
+/*
+ * shapefile_memoryPath
+ * 
+ * Result:
+ *   True if path names a memory file or shapefile (begins with MEMORY_PREFIX).
+ */
+int shapefile_memoryPath(const char *path) {
+	return strncmp(path, MEMORY_PREFIX, strlen(MEMORY_PREFIX)) == 0;
+}
+
+/*
+ * shapefile_memoryOpen
+ * 
+ * Open the memory file registered as name. Read access ("r" and "rb+") fails
+ * if there is no such file; write access ("w", "wb") creates the file, or
+ * truncates it if it exists. Each successful open must be matched by
+ * shapefile_memoryClose.
+ * 
+ * Result:
+ *   Memory file, or NULL if it does not exist.
+ */
+ShapefileMemoryFilePtr shapefile_memoryOpen(
+		const char *name,
+		const char *access) {
+	
+	ShapefileMemoryFilePtr memory = NULL;
+	Tcl_HashEntry *entry;
+	int isNew;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	if (!MEMORY_FILES_INITIALIZED) {
+		Tcl_InitHashTable(&MEMORY_FILES, TCL_STRING_KEYS);
+		MEMORY_FILES_INITIALIZED = 1;
+	}
+	
+	if (access[0] == 'w') {
+		entry = Tcl_CreateHashEntry(&MEMORY_FILES, name, &isNew);
+		if (isNew) {
+			memory = (ShapefileMemoryFilePtr)ckalloc((unsigned int)sizeof(struct shapefile_memoryFile));
+			memset(memory, 0, sizeof(struct shapefile_memoryFile));
+			memory->hashEntry = entry;
+			Tcl_SetHashValue(entry, (ClientData)memory);
+		} else {
+			memory = (ShapefileMemoryFilePtr)Tcl_GetHashValue(entry);
+			memory->size = 0;
+		}
+	} else if ((entry = Tcl_FindHashEntry(&MEMORY_FILES, name)) != NULL) {
+		memory = (ShapefileMemoryFilePtr)Tcl_GetHashValue(entry);
+	}
+	
+	if (memory != NULL) {
+		memory->openCount++;
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return memory;
+}
+
+/*
+ * shapefile_memoryRead
+ * 
+ * Copy up to size bytes at offset from a memory file to p.
+ * 
+ * Result:
+ *   Number of bytes read, which is less than size at end of file.
+ */
+SAOffset shapefile_memoryRead(
+		ShapefileMemoryFilePtr memory,
+		SAOffset offset,
+		void *p,
+		SAOffset size) {
+	
+	SAOffset count = 0;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	if (offset < memory->size) {
+		count = memory->size - offset < size ? memory->size - offset : size;
+		memcpy(p, memory->data + offset, count);
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return count;
+}
+
+/*
+ * shapefile_memoryWrite
+ * 
+ * Copy size bytes from p to a memory file at offset. The file grows as
+ * needed, by at least doubling its allocation, up to the UINT_MAX bytes Tcl
+ * can allocate; a gap between the end of the file and offset is filled with
+ * zeros.
+ * 
+ * Result:
+ *   Number of bytes written: size, or 0 if the file could not grow.
+ */
+SAOffset shapefile_memoryWrite(
+		ShapefileMemoryFilePtr memory,
+		SAOffset offset,
+		const void *p,
+		SAOffset size) {
+	
+	SAOffset capacity;
+	unsigned char *data;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	if (offset + size > memory->capacity) {
+		capacity = memory->capacity < 4096 ? 4096 : memory->capacity * 2;
+		while (capacity < offset + size && capacity <= UINT_MAX / 2) {
+			capacity *= 2;
+		}
+		
+		/* Tcl allocations are limited to UINT_MAX bytes; a failed
+		   reallocation leaves the existing data in place */
+		if (capacity > UINT_MAX) {
+			capacity = UINT_MAX;
+		}
+		if (capacity < offset + size) {
+			Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+			return 0;
+		}
+		if (memory->data == NULL) {
+			data = (unsigned char *)attemptckalloc((unsigned int)capacity);
+		} else {
+			data = (unsigned char *)attemptckrealloc((char *)memory->data, (unsigned int)capacity);
+		}
+		if (data == NULL) {
+			Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+			return 0;
+		}
+		memory->data = data;
+		memory->capacity = capacity;
+	}
+	if (offset > memory->size) {
+		memset(memory->data + memory->size, 0, offset - memory->size);
+	}
+	memcpy(memory->data + offset, p, size);
+	if (offset + size > memory->size) {
+		memory->size = offset + size;
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return size;
+}
+
+/*
+ * shapefile_memorySize
+ * 
+ * Result:
+ *   Size in bytes of a memory file.
+ */
+SAOffset shapefile_memorySize(ShapefileMemoryFilePtr memory) {
+	SAOffset size;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	size = memory->size;
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return size;
+}
+
+/*
+ * shapefile_memoryClose
+ * 
+ * Close one open of a memory file. A file that has been removed or replaced
+ * is freed when its last open is closed.
+ */
+void shapefile_memoryClose(ShapefileMemoryFilePtr memory) {
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	memory->openCount--;
+	if (memory->hashEntry == NULL && memory->openCount == 0) {
+		shapefile_memoryDetach(memory);
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+}
+
+/*
+ * shapefile_memoryDetach
+ * 
+ * Remove a memory file from the registry, so that it can no longer be
+ * opened, and free it if it is not open. Caller must hold MEMORY_FILES_MUTEX.
+ */
+void shapefile_memoryDetach(ShapefileMemoryFilePtr memory) {
+	if (memory->hashEntry != NULL) {
+		Tcl_DeleteHashEntry(memory->hashEntry);
+		memory->hashEntry = NULL;
+	}
+	if (memory->openCount == 0) {
+		if (memory->data != NULL) {
+			ckfree((char *)memory->data);
+		}
+		ckfree((char *)memory);
+	}
+}
+
+/*
+ * shapefile_memoryRemove
+ * 
+ * Remove the memory file registered as name. Streams that have the file
+ * open may continue to use it.
+ * 
+ * Result:
+ *   0 on success, -1 if there is no such file (as remove).
+ */
+int shapefile_memoryRemove(const char *name) {
+	Tcl_HashEntry *entry;
+	int result = -1;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	if (MEMORY_FILES_INITIALIZED && (entry = Tcl_FindHashEntry(&MEMORY_FILES, name)) != NULL) {
+		shapefile_memoryDetach((ShapefileMemoryFilePtr)Tcl_GetHashValue(entry));
+		result = 0;
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return result;
+}
+
+/*
+ * shapefile_memoryRename
+ * 
+ * Register the memory file source as target, replacing any existing target
+ * file. The moved file is used by the same shapefile commands as the file
+ * it replaces, as when shapefile_rewrite replaces a shapefile's own files.
+ * 
+ * Result:
+ *   0 on success, -1 if there is no source file (as rename).
+ */
+int shapefile_memoryRename(
+		const char *source,
+		const char *target) {
+	
+	ShapefileMemoryFilePtr memory, replaced;
+	Tcl_HashEntry *entry;
+	int isNew, result = -1;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	if (MEMORY_FILES_INITIALIZED && (entry = Tcl_FindHashEntry(&MEMORY_FILES, source)) != NULL) {
+		memory = (ShapefileMemoryFilePtr)Tcl_GetHashValue(entry);
+		Tcl_DeleteHashEntry(entry);
+		memory->refCount = 0;
+		
+		entry = Tcl_CreateHashEntry(&MEMORY_FILES, target, &isNew);
+		if (!isNew) {
+			replaced = (ShapefileMemoryFilePtr)Tcl_GetHashValue(entry);
+			memory->refCount = replaced->refCount;
+			replaced->hashEntry = NULL;
+			shapefile_memoryDetach(replaced);
+		}
+		memory->hashEntry = entry;
+		Tcl_SetHashValue(entry, (ClientData)memory);
+		result = 0;
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+	return result;
+}
+
+/*
+ * shapefile_memoryRetain
+ * 
+ * Add delta (1 or -1) to the number of shapefile commands using the memory
+ * shapefile at path. Each component file that exists is updated; components
+ * no longer used by any command are removed. Called as memory shapefiles are
+ * opened and closed, so that they last as long as they are in use.
+ */
+void shapefile_memoryRetain(
+		const char *path,
+		int delta) {
+	
+	static const char *extensions[] = {"shp", "shx", "dbf", "cpg", NULL};
+	ShapefileMemoryFilePtr memory;
+	Tcl_HashEntry *entry;
+	Tcl_Obj *componentPath;
+	int i;
+	
+	Tcl_MutexLock(&MEMORY_FILES_MUTEX);
+	for (i = 0; MEMORY_FILES_INITIALIZED && extensions[i] != NULL; i++) {
+		componentPath = shapefile_componentPath(path, extensions[i]);
+		Tcl_IncrRefCount(componentPath);
+		if ((entry = Tcl_FindHashEntry(&MEMORY_FILES, Tcl_GetString(componentPath))) != NULL) {
+			memory = (ShapefileMemoryFilePtr)Tcl_GetHashValue(entry);
+			memory->refCount += delta;
+			if (memory->refCount <= 0) {
+				shapefile_memoryDetach(memory);
+			}
+		}
+		Tcl_DecrRefCount(componentPath);
+	}
+	Tcl_MutexUnlock(&MEMORY_FILES_MUTEX);
+}
+
+/*
+ * shapefile_outputOpen
+ * 
+ * Create the .shp, .shx, and .dbf files of a new shapefile at path to be
+ * populated with shapefile_outputRecord. Placeholder headers are written;
+ * the attribute table field definitions are copied verbatim from dbf.
+ * 
+ * Result:
+ *   Output state, or NULL (with an error message in interp) on failure.
+ */
+ShapefileOutputPtr shapefile_outputOpen(
+		Tcl_Interp *interp,
+		const char *path,
+		int shapeType,
+		DBFHandle dbf) {
+	
+	ShapefileOutputPtr output;
+	unsigned char header[100];
+	unsigned char *dbfHeader;
+	Tcl_Obj *componentPath;
+	
+	if ((output = (ShapefileOutputPtr)ckalloc((unsigned int)sizeof(struct shapefile_output))) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate shapefile output data"));
+		return NULL;
+	}
+	memset(output, 0, sizeof(struct shapefile_output));
+	shapefile_streamHooks(&output->hooks);
+	output->shp.hooks = &output->hooks;
+	output->shx.hooks = &output->hooks;
+	output->dbf.hooks = &output->hooks;
+	output->shapeType = shapeType;
+	output->shpSize = 100;
+	output->path = Tcl_NewStringObj(path, -1);
+	Tcl_IncrRefCount(output->path);
+	
+	componentPath = shapefile_componentPath(path, "shp");
+	Tcl_IncrRefCount(componentPath);
+	output->shp.file = output->hooks.FOpen(Tcl_GetString(componentPath), "wb");
+	Tcl_DecrRefCount(componentPath);
+	
+	componentPath = shapefile_componentPath(path, "shx");
+	Tcl_IncrRefCount(componentPath);
+	output->shx.file = output->hooks.FOpen(Tcl_GetString(componentPath), "wb");
+	Tcl_DecrRefCount(componentPath);
+	
+	componentPath = shapefile_componentPath(path, "dbf");
+	Tcl_IncrRefCount(componentPath);
+	output->dbf.file = output->hooks.FOpen(Tcl_GetString(componentPath), "wb");
+	Tcl_DecrRefCount(componentPath);
+	
+	if (output->shp.file == NULL || output->shx.file == NULL || output->dbf.file == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create output shapefile \"%s\"", path));
+		(void)shapefile_outputClose(interp, output, 0);
+		return NULL;
+	}
+	
+	/* headers are rewritten with final sizes and bounds on close */
+	memset(header, 0, 100);
+	if (!shapefile_bufferWrite(&output->shp, header, 100) || !shapefile_bufferWrite(&output->shx, header, 100)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write output shapefile header"));
+		(void)shapefile_outputClose(interp, output, 0);
+		return NULL;
+	}
+	
+	/* copy the attribute table header and field descriptors as stored */
+	if ((dbfHeader = (unsigned char *)ckalloc((unsigned int)dbf->nHeaderLength)) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate attribute table header"));
+		(void)shapefile_outputClose(interp, output, 0);
+		return NULL;
+	}
+	if (dbf->sHooks.FSeek(dbf->fp, 0, SEEK_SET) != 0
+			|| dbf->sHooks.FRead(dbfHeader, dbf->nHeaderLength, 1, dbf->fp) != 1
+			|| !shapefile_bufferWrite(&output->dbf, dbfHeader, dbf->nHeaderLength)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to copy attribute table header"));
+		ckfree((char *)dbfHeader);
+		(void)shapefile_outputClose(interp, output, 0);
+		return NULL;
+	}
+	ckfree((char *)dbfHeader);
+	
+	return output;
+}
+
+/*
+ * shapefile_outputRecord
+ * 
+ * Append a copy of feature featureId of shp and the corresponding record of
+ * dbf to the output shapefile. shp and dbf must be the handles most recently
+ * passed to shapefile_outputSource. The raw record bytes are copied as stored;
+ * only the record number is changed to reflect the new position.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_outputRecord(
+		Tcl_Interp *interp,
+		ShapefileOutputPtr output,
+		SHPHandle shp,
+		DBFHandle dbf,
+		int featureId) {
+	
+	int size;
+	
+	size = (int)shp->panRecSize[featureId] + 8;
+	if (size > output->recordSize) {
+		output->record = (unsigned char *)ckrealloc((char *)output->record, (unsigned int)size);
+		if (output->record == NULL) {
+			output->recordSize = 0;
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate record buffer"));
+			return TCL_ERROR;
+		}
+		output->recordSize = size;
+	}
+	
+	if (!shapefile_bufferRead(&output->shpInput, shp->panRecOffset[featureId], output->record, size)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureId));
+		return TCL_ERROR;
+	}
+	
+	return shapefile_outputAppend(interp, output, dbf, featureId, size);
+}
+
+/*
+ * shapefile_outputShape
+ * 
+ * Append shape, encoded by shapefile_encodeShape, and the record of dbf
+ * corresponding to feature featureId to the output shapefile. Used in place
+ * of shapefile_outputRecord for features changed as they are copied.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_outputShape(
+		Tcl_Interp *interp,
+		ShapefileOutputPtr output,
+		DBFHandle dbf,
+		int featureId,
+		const SHPObject *shape) {
+	
+	int size;
+	
+	size = shapefile_encodeShape(shape, NULL) + 8;
+	if (size > output->recordSize) {
+		output->record = (unsigned char *)ckrealloc((char *)output->record, (unsigned int)size);
+		if (output->record == NULL) {
+			output->recordSize = 0;
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate record buffer"));
+			return TCL_ERROR;
+		}
+		output->recordSize = size;
+	}
+	(void)shapefile_encodeShape(shape, output->record + 8);
+	
+	return shapefile_outputAppend(interp, output, dbf, featureId, size);
+}
+
+/*
+ * shapefile_outputAppend
+ * 
+ * Write the size byte shape record in the output record buffer, numbered to
+ * follow those already written, with its index entry, and copy the record
+ * of dbf corresponding to feature featureId. Common to shapefile_outputRecord
+ * and shapefile_outputShape.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_outputAppend(
+		Tcl_Interp *interp,
+		ShapefileOutputPtr output,
+		DBFHandle dbf,
+		int featureId,
+		int size) {
+	
+	unsigned char entry[8];
+	int i;
+	double min[4], max[4];
+	
+	/* record numbers are one-based; content length is in 16 bit words */
+	shapefile_putBigInt(output->record, (unsigned int)(output->recordCount + 1));
+	shapefile_putBigInt(output->record + 4, (unsigned int)((size - 8) / 2));
+	shapefile_putBigInt(entry, (unsigned int)(output->shpSize / 2));
+	shapefile_putBigInt(entry + 4, (unsigned int)((size - 8) / 2));
+	
+	if (!shapefile_bufferWrite(&output->shp, output->record, size)
+			|| !shapefile_bufferWrite(&output->shx, entry, 8)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write feature %d", featureId));
+		return TCL_ERROR;
+	}
+	output->shpSize += size;
+	
+	if (shapefile_recordBounds(output->record + 8, size - 8, min, max)) {
+		for (i = 0; i < 4; i++) {
+			if (!output->hasBounds || min[i] < output->min[i]) {
+				output->min[i] = min[i];
+			}
+			if (!output->hasBounds || max[i] > output->max[i]) {
+				output->max[i] = max[i];
+			}
+		}
+		output->hasBounds = 1;
+	}
+	
+	/* attribute records are fixed length; the deletion flag is kept as is */
+	if (output->recordSize < dbf->nRecordLength) {
+		output->record = (unsigned char *)ckrealloc((char *)output->record, (unsigned int)dbf->nRecordLength);
+		if (output->record == NULL) {
+			output->recordSize = 0;
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate record buffer"));
+			return TCL_ERROR;
+		}
+		output->recordSize = dbf->nRecordLength;
+	}
+	if (!shapefile_bufferRead(&output->dbfInput,
+			(SAOffset)dbf->nHeaderLength + (SAOffset)dbf->nRecordLength * featureId,
+			output->record, dbf->nRecordLength)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read attribute record %d", featureId));
+		return TCL_ERROR;
+	}
+	if (!shapefile_bufferWrite(&output->dbf, output->record, dbf->nRecordLength)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write attribute record %d", featureId));
+		return TCL_ERROR;
+	}
+	
+	output->recordCount++;
+	return TCL_OK;
+}
+
+/*
+ * shapefile_outputSource
+ * 
+ * Select the shapefile from which subsequent shapefile_outputRecord calls
+ * copy records. Must be called before records are copied from a different
+ * source, since read-ahead buffers belong to the current source files.
+ */
+void shapefile_outputSource(
+		ShapefileOutputPtr output,
+		SHPHandle shp,
+		DBFHandle dbf) {
+	
+	shapefile_bufferRelease(&output->shpInput);
+	output->shpInput.hooks = &shp->sHooks;
+	output->shpInput.file = shp->fpSHP;
+	output->shpInput.next = 0;
+	
+	shapefile_bufferRelease(&output->dbfInput);
+	output->dbfInput.hooks = &dbf->sHooks;
+	output->dbfInput.file = dbf->fp;
+	output->dbfInput.next = 0;
+}
+
+/*
+ * shapefile_outputClose
+ * 
+ * Finish an output shapefile. If commit is true, buffered data is written
+ * and the headers are updated with final sizes, bounds, and record count.
+ * Otherwise, or if writing fails, the partially written files are removed.
+ * Output state is freed.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_outputClose(
+		Tcl_Interp *interp,
+		ShapefileOutputPtr output,
+		int commit) {
+	
+	unsigned char header[100];
+	int returnValue = TCL_OK;
+	
+	if (commit) {
+		if (!output->hasBounds) {
+			memset(output->min, 0, sizeof(output->min));
+			memset(output->max, 0, sizeof(output->max));
+		}
+		
+		if (!shapefile_bufferFlush(&output->shp)
+				|| !shapefile_bufferFlush(&output->shx)
+				|| !shapefile_bufferFlush(&output->dbf)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write output shapefile"));
+			returnValue = TCL_ERROR;
+		}
+		
+		shapefile_header(header, output->shpSize, output->shapeType, output->min, output->max);
+		if (returnValue == TCL_OK
+				&& (output->hooks.FSeek(output->shp.file, 0, SEEK_SET) != 0
+				|| output->hooks.FWrite(header, 100, 1, output->shp.file) != 1)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write output .shp header"));
+			returnValue = TCL_ERROR;
+		}
+		
+		shapefile_header(header, 100 + (SAOffset)output->recordCount * 8, output->shapeType, output->min, output->max);
+		if (returnValue == TCL_OK
+				&& (output->hooks.FSeek(output->shx.file, 0, SEEK_SET) != 0
+				|| output->hooks.FWrite(header, 100, 1, output->shx.file) != 1)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write output .shx header"));
+			returnValue = TCL_ERROR;
+		}
+		
+		/* attribute record count is a little-endian integer at offset 4 */
+		shapefile_putLittleInt(header, output->recordCount);
+		if (returnValue == TCL_OK
+				&& (output->hooks.FSeek(output->dbf.file, 4, SEEK_SET) != 0
+				|| output->hooks.FWrite(header, 4, 1, output->dbf.file) != 1)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write output .dbf header"));
+			returnValue = TCL_ERROR;
+		}
+	}
+	
+	if (output->shp.file != NULL) output->hooks.FClose(output->shp.file);
+	if (output->shx.file != NULL) output->hooks.FClose(output->shx.file);
+	if (output->dbf.file != NULL) output->hooks.FClose(output->dbf.file);
+	
+	/* remove incomplete output */
+	if (!commit || returnValue != TCL_OK) {
+		shapefile_deleteFiles(Tcl_GetString(output->path));
+	}
+	Tcl_DecrRefCount(output->path);
+	
+	shapefile_bufferRelease(&output->shp);
+	shapefile_bufferRelease(&output->shx);
+	shapefile_bufferRelease(&output->dbf);
+	shapefile_bufferRelease(&output->shpInput);
+	shapefile_bufferRelease(&output->dbfInput);
+	if (output->record != NULL) ckfree((char *)output->record);
+	ckfree((char *)output);
+	
+	return returnValue;
+}
+
+/*
+ * shapefile_rewrite
+ * 
+ * Copy the listed features and their attribute records, in the order given,
+ * to a new shapefile. If outputPath is NULL, the new files replace the
+ * shapefile's own files and the shapefile is reopened in its original mode.
+ * Used by [$shp compact] and other commands that reorganize shapefiles.
+ * If repairCount is not NULL, features with issues found by
+ * shapefile_validateShape are repaired by shapefile_repairShape as they are
+ * copied, and the number repaired is stored in *repairCount; other features
+ * are still copied as stored. Used by [$shp geometry repair].
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_rewrite(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		const int *featureIds,
+		int featureCount,
+		const char *outputPath,
+		int *repairCount) {
+	
+	static const char *extensions[] = {"shp", "shx", "dbf", NULL};
+	ShapefileOutputPtr output;
+	SHPObject *shape, *repaired;
+	Tcl_Obj *tempPath, *backupPath, *targetPath, *error;
+	const char *path;
+	int i, largeFile, moved, replaced, returnValue;
+	
+	/* output files are truncated when opened, so they must not be the input */
+	if (outputPath != NULL && shapefile_samePath(shapefile->path, outputPath)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("output path \"%s\" is the shapefile itself", outputPath));
+		return TCL_ERROR;
+	}
+	
+	/* files rewritten in place must not be replaced under background readers */
+	if (outputPath == NULL && shapefile->asyncReads != NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot rewrite shapefile during asynchronous read"));
+		return TCL_ERROR;
+	}
+	
+	/* make sure any pending attribute changes are on disk before copying */
+	if (!shapefile->readonly) {
+		DBFUpdateHeader(shapefile->dbf);
+	}
+	
+	/* temporary files share the base name, minus the extension separator */
+	tempPath = shapefile_componentPath(shapefile->path, "");
+	Tcl_IncrRefCount(tempPath);
+	(void)Tcl_GetStringFromObj(tempPath, &i);
+	Tcl_SetObjLength(tempPath, i - 1);
+	Tcl_AppendToObj(tempPath, "-shapetcl-tmp", -1);
+	path = outputPath == NULL ? Tcl_GetString(tempPath) : outputPath;
+	
+	if ((output = shapefile_outputOpen(interp, path, shapefile->shapeType, shapefile->dbf)) == NULL) {
+		Tcl_DecrRefCount(tempPath);
+		return TCL_ERROR;
+	}
+	
+	shapefile_outputSource(output, shapefile->shp, shapefile->dbf);
+	if (repairCount != NULL) {
+		*repairCount = 0;
+	}
+	for (i = 0; i < featureCount; i++) {
+		
+		/* self-intersections are reported by validate but not repaired */
+		if (repairCount != NULL) {
+			if ((shape = SHPReadObject(shapefile->shp, featureIds[i])) == NULL) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d", featureIds[i]));
+				(void)shapefile_outputClose(interp, output, 0);
+				Tcl_DecrRefCount(tempPath);
+				return TCL_ERROR;
+			}
+			if (shapefile_validateShape(shape, 0) != 0) {
+				repaired = shapefile_repairShape(shape);
+				SHPDestroyObject(shape);
+				(*repairCount)++;
+				if (shapefile_outputShape(interp, output, shapefile->dbf, featureIds[i], repaired) != TCL_OK) {
+					SHPDestroyObject(repaired);
+					(void)shapefile_outputClose(interp, output, 0);
+					Tcl_DecrRefCount(tempPath);
+					return TCL_ERROR;
+				}
+				SHPDestroyObject(repaired);
+				continue;
+			}
+			SHPDestroyObject(shape);
+		}
+		
+		if (shapefile_outputRecord(interp, output, shapefile->shp, shapefile->dbf, featureIds[i]) != TCL_OK) {
+			(void)shapefile_outputClose(interp, output, 0);
+			Tcl_DecrRefCount(tempPath);
+			return TCL_ERROR;
+		}
+	}
+	
+	if (shapefile_outputClose(interp, output, 1) != TCL_OK) {
+		Tcl_DecrRefCount(tempPath);
+		return TCL_ERROR;
+	}
+	
+	if (outputPath != NULL) {
+		shapefile_copySidecars(shapefile->path, outputPath);
+		Tcl_DecrRefCount(tempPath);
+		return TCL_OK;
+	}
+	
+	/* replace the original files with the rewritten files and reopen them */
+	largeFile = shapefile->shp->bLargeFile;
+	SHPClose(shapefile->shp);
+	shapefile->shp = NULL;
+	DBFClose(shapefile->dbf);
+	shapefile->dbf = NULL;
+	shapefile_cacheTrim(shapefile, 0);
+	shapefile_spatialInvalidate(shapefile);
+	
+	/* memory files are renamed in place, which cannot fail partway */
+	if (shapefile_memoryPath(shapefile->path)) {
+		(void)shapefile_moveFiles(Tcl_GetString(tempPath), shapefile->path, 3);
+		Tcl_DecrRefCount(tempPath);
+		return shapefile_reopen(interp, shapefile, largeFile);
+	}
+	
+	/* the original files are moved aside until the rewritten files are in
+	   place and open, so that they can be restored if either step fails */
+	backupPath = shapefile_componentPath(shapefile->path, "");
+	Tcl_IncrRefCount(backupPath);
+	(void)Tcl_GetStringFromObj(backupPath, &i);
+	Tcl_SetObjLength(backupPath, i - 1);
+	Tcl_AppendToObj(backupPath, "-shapetcl-old", -1);
+	
+	moved = shapefile_moveFiles(shapefile->path, Tcl_GetString(backupPath), 3);
+	replaced = moved == 3 ? shapefile_moveFiles(Tcl_GetString(tempPath), shapefile->path, 3) : 0;
+	if (replaced == 3 && shapefile_reopen(interp, shapefile, largeFile) == TCL_OK) {
+		shapefile_deleteFiles(Tcl_GetString(backupPath));
+		returnValue = TCL_OK;
+	} else {
+		if (replaced < 3) {
+			targetPath = shapefile_componentPath(shapefile->path, extensions[moved < 3 ? moved : replaced]);
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to replace \"%s\"", Tcl_GetString(targetPath)));
+			Tcl_DecrRefCount(targetPath);
+		}
+		error = Tcl_GetObjResult(interp);
+		Tcl_IncrRefCount(error);
+		
+		/* if the original files cannot be reopened either, the shapefile
+		   is left without handles and can only be closed */
+		(void)shapefile_moveFiles(shapefile->path, Tcl_GetString(tempPath), replaced);
+		(void)shapefile_moveFiles(Tcl_GetString(backupPath), shapefile->path, moved);
+		shapefile_deleteFiles(Tcl_GetString(tempPath));
+		(void)shapefile_reopen(interp, shapefile, largeFile);
+		Tcl_SetObjResult(interp, error);
+		Tcl_DecrRefCount(error);
+		returnValue = TCL_ERROR;
+	}
+	
+	Tcl_DecrRefCount(backupPath);
+	Tcl_DecrRefCount(tempPath);
+	return returnValue;
+}
+
+/*
+ * shapefile_moveFiles
+ * 
+ * Rename the first count of the .shp, .shx, and .dbf files of the shapefile
+ * at sourceBase to the corresponding files at targetBase, replacing them.
+ * Stops at the first file that cannot be renamed.
+ * 
+ * Result:
+ *   Number of files renamed.
+ */
+int shapefile_moveFiles(
+		const char *sourceBase,
+		const char *targetBase,
+		int count) {
+	
+	static const char *extensions[] = {"shp", "shx", "dbf", NULL};
+	Tcl_Obj *sourcePath, *targetPath;
+	int i, failed = 0;
+	
+	for (i = 0; i < count && extensions[i] != NULL; i++) {
+		sourcePath = shapefile_componentPath(sourceBase, extensions[i]);
+		targetPath = shapefile_componentPath(targetBase, extensions[i]);
+		Tcl_IncrRefCount(sourcePath);
+		Tcl_IncrRefCount(targetPath);
+		failed = shapefile_memoryPath(targetBase)
+				? shapefile_memoryRename(Tcl_GetString(sourcePath), Tcl_GetString(targetPath)) != 0
+				: Tcl_FSRenameFile(sourcePath, targetPath) != TCL_OK;
+		Tcl_DecrRefCount(sourcePath);
+		Tcl_DecrRefCount(targetPath);
+		if (failed) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * shapefile_deleteFiles
+ * 
+ * Delete any .shp, .shx, and .dbf files of the shapefile at base, as when
+ * output is incomplete.
+ */
+void shapefile_deleteFiles(const char *base) {
+	static const char *extensions[] = {"shp", "shx", "dbf", NULL};
+	Tcl_Obj *componentPath;
+	int i;
+	
+	for (i = 0; extensions[i] != NULL; i++) {
+		componentPath = shapefile_componentPath(base, extensions[i]);
+		Tcl_IncrRefCount(componentPath);
+		if (shapefile_memoryPath(Tcl_GetString(componentPath))) {
+			(void)shapefile_memoryRemove(Tcl_GetString(componentPath));
+		} else {
+			(void)Tcl_FSDeleteFile(componentPath);
+		}
+		Tcl_DecrRefCount(componentPath);
+	}
+}
+
+/*
+ * shapefile_reopen
+ * 
+ * Open the files of a shapefile closed by shapefile_rewrite in its original
+ * mode, recovering record offsets if largeFile is set. If they cannot be
+ * opened, the shapefile is left without handles, and cmd_dispatcher allows
+ * only [$shp close].
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_reopen(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		int largeFile) {
+	
+	SAHooks hooks;
+	
+	shapefile_streamHooks(&hooks);
+	shapefile->dbf = DBFOpenLL(shapefile->path, shapefile->readonly ? "rb" : "rb+", &hooks);
+	shapefile->shp = SHPOpenLL(shapefile->path, shapefile->readonly ? "rb" : "rb+", &hooks);
+	if (shapefile->dbf == NULL || shapefile->shp == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to reopen shapefile \"%s\"", shapefile->path));
+	} else if (!largeFile || shapefile_largeOffsets(interp, shapefile->shp, shapefile->path) == TCL_OK) {
+		return TCL_OK;
+	}
+	
+	if (shapefile->shp != NULL) SHPClose(shapefile->shp);
+	if (shapefile->dbf != NULL) DBFClose(shapefile->dbf);
+	shapefile->shp = NULL;
+	shapefile->dbf = NULL;
+	return TCL_ERROR;
+}
+
+/*
+ * shapefile_rebuildIndex_cmd
+ * 
+ * Implements the [rebuildIndex] command used to regenerate the .shx index of
+ * a shapefile from its .shp file, as when the index is missing or damaged.
+ * 
+ * Command Syntax:
+ *   [rebuildIndex PATH]
+ *     Rebuild the index of the shapefile at PATH. The shapefile must not be
+ *     open for writing.
+ * 
+ * Result:
+ *   Number of records indexed.
+ */
+int shapefile_rebuildIndex_cmd(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	int recordCount;
+	
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "path");
+		return TCL_ERROR;
+	}
+	
+	if (shapefile_rebuildIndex(interp, Tcl_GetString(objv[1]), &recordCount) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordCount));
+	return TCL_OK;
+}
+
+/*
+ * shapefile_rebuildIndex
+ * 
+ * Write a new .shx index for the shapefile at path by scanning the record
+ * headers of the .shp file. Only the 8 byte header and shape type of each
+ * record are read, using large sequential reads; geometry is not decoded.
+ * Scanning stops at the first record that is truncated or has an invalid
+ * length or shape type, so records following a damaged record are dropped.
+ * If recordCount is not NULL, it is set to the number of records indexed.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_rebuildIndex(
+		Tcl_Interp *interp,
+		const char *path,
+		int *recordCount) {
+	
+	SAHooks hooks;
+	struct shapefile_buffer input, output;
+	unsigned char header[100], record[12], entry[8];
+	SAOffset fileSize, offset;
+	unsigned int contentLength;
+	int shapeType, recordType, count = 0;
+	Tcl_Obj *componentPath;
+	int returnValue = TCL_ERROR;
+	
+	shapefile_streamHooks(&hooks);
+	memset(&input, 0, sizeof(struct shapefile_buffer));
+	memset(&output, 0, sizeof(struct shapefile_buffer));
+	input.hooks = &hooks;
+	output.hooks = &hooks;
+	
+	componentPath = shapefile_componentPath(path, "shp");
+	Tcl_IncrRefCount(componentPath);
+	input.file = hooks.FOpen(Tcl_GetString(componentPath), "rb");
+	Tcl_DecrRefCount(componentPath);
+	if (input.file == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", path));
+		return TCL_ERROR;
+	}
+	
+	/* the actual file size bounds the scan; the header size may be wrong */
+	if (hooks.FSeek(input.file, 0, SEEK_END) != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read shapefile for \"%s\"", path));
+		goto cleanup;
+	}
+	fileSize = hooks.FTell(input.file);
+	
+	if (!shapefile_bufferRead(&input, 0, header, 100) || shapefile_getBigInt(header) != 9994) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid shapefile header for \"%s\"", path));
+		goto cleanup;
+	}
+	shapeType = shapefile_getLittleInt(header + 32);
+	
+	componentPath = shapefile_componentPath(path, "shx");
+	Tcl_IncrRefCount(componentPath);
+	output.file = hooks.FOpen(Tcl_GetString(componentPath), "wb");
+	Tcl_DecrRefCount(componentPath);
+	if (output.file == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create index for \"%s\"", path));
+		goto cleanup;
+	}
+	
+	/* placeholder header; the file length is known once records are counted */
+	if (!shapefile_bufferWrite(&output, header, 100)) {
+		goto writeError;
+	}
+	
+	for (offset = 100; offset + 12 <= fileSize; offset += 8 + contentLength) {
+		if (!shapefile_bufferRead(&input, offset, record, 12)) {
+			break;
+		}
+		contentLength = shapefile_getBigInt(record + 4) * 2;
+		recordType = shapefile_getLittleInt(record + 8);
+		if (contentLength < 4 || contentLength > fileSize - offset - 8
+				|| (recordType != SHPT_NULL && recordType != shapeType)) {
+			break;
+		}
+		shapefile_putBigInt(entry, (unsigned int)(offset / 2));
+		shapefile_putBigInt(entry + 4, contentLength / 2);
+		if (!shapefile_bufferWrite(&output, entry, 8)) {
+			goto writeError;
+		}
+		count++;
+	}
+	
+	/* same header as the .shp, except for the file length */
+	shapefile_putBigInt(header + 24, (unsigned int)((100 + (SAOffset)count * 8) / 2));
+	if (!shapefile_bufferFlush(&output)
+			|| hooks.FSeek(output.file, 0, SEEK_SET) != 0
+			|| hooks.FWrite(header, 100, 1, output.file) != 1) {
+		goto writeError;
+	}
+	
+	if (recordCount != NULL) {
+		*recordCount = count;
+	}
+	returnValue = TCL_OK;
+	goto cleanup;
+	
+writeError:
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write index for \"%s\"", path));
+	
+cleanup:
+	if (output.file != NULL) {
+		hooks.FClose(output.file);
+		shapefile_sharedForget(path);
+	}
+	hooks.FClose(input.file);
+	shapefile_bufferRelease(&input);
+	shapefile_bufferRelease(&output);
+	return returnValue;
+}
+
+/*
+ * shapefile_concatShapefiles_cmd
+ * 
+ * Implements the [concatShapefiles] command used to merge shapefiles with
+ * identical shape types and attribute table schemas. Records are copied as
+ * stored with shapefile_outputRecord; only record numbers, index offsets,
+ * header bounds, and record counts are changed. Deleted records are copied
+ * too.
+ * 
+ * Command Syntax:
+ *   [concatShapefiles OUTPUT INPUT ?INPUT ...?]
+ *     Write a new shapefile at OUTPUT containing the records of each INPUT
+ *     shapefile in turn. Any .prj or .cpg file of the first INPUT is copied.
+ * 
+ * Result:
+ *   Number of records written to OUTPUT.
+ */
+int shapefile_concatShapefiles_cmd(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefileOutputPtr output = NULL;
+	SHPHandle firstShp, shp;
+	DBFHandle firstDbf, dbf;
+	const char *outputPath, *path;
+	int shapeType, inputType, shpCount, featureId, i, copied;
+	int returnValue = TCL_ERROR;
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 1, objv, "outputPath inputPath ?inputPath ...?");
+		return TCL_ERROR;
+	}
+	
+	outputPath = Tcl_GetString(objv[1]);
+	for (i = 2; i < objc; i++) {
+		if (shapefile_samePath(outputPath, Tcl_GetString(objv[i]))) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("output path \"%s\" is also an input", outputPath));
+			return TCL_ERROR;
+		}
+	}
+	
+	/* the first input defines the shape type and schema of the output */
+	path = Tcl_GetString(objv[2]);
+	if ((firstDbf = DBFOpen(path, "rb")) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open attribute table for \"%s\"", path));
+		return TCL_ERROR;
+	}
+	if ((firstShp = SHPOpen(path, "rb")) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", path));
+		DBFClose(firstDbf);
+		return TCL_ERROR;
+	}
+	SHPGetInfo(firstShp, NULL, &shapeType, NULL, NULL);
+	
+	if ((output = shapefile_outputOpen(interp, outputPath, shapeType, firstDbf)) == NULL) {
+		SHPClose(firstShp);
+		DBFClose(firstDbf);
+		return TCL_ERROR;
+	}
+	
+	for (i = 2; i < objc; i++) {
+		path = Tcl_GetString(objv[i]);
+		if (i == 2) {
+			shp = firstShp;
+			dbf = firstDbf;
+		} else {
+			if ((dbf = DBFOpen(path, "rb")) == NULL) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open attribute table for \"%s\"", path));
+				goto cleanup;
+			}
+			if ((shp = SHPOpen(path, "rb")) == NULL) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", path));
+				DBFClose(dbf);
+				goto cleanup;
+			}
+		}
+		
+		copied = 0;
+		SHPGetInfo(shp, &shpCount, &inputType, NULL, NULL);
+		if (inputType != shapeType) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("shape type of \"%s\" does not match \"%s\"", path, Tcl_GetString(objv[2])));
+		} else if (shpCount != DBFGetRecordCount(dbf)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("shapefile feature count (%d) does not match attribute record count (%d) in \"%s\"", shpCount, DBFGetRecordCount(dbf), path));
+		} else if (shapefile_schemaMatch(interp, firstDbf, dbf, path) == TCL_OK) {
+			shapefile_outputSource(output, shp, dbf);
+			for (featureId = 0; featureId < shpCount; featureId++) {
+				if (shapefile_outputRecord(interp, output, shp, dbf, featureId) != TCL_OK) {
+					break;
+				}
+			}
+			copied = featureId == shpCount;
+		}
+		
+		if (i != 2) {
+			SHPClose(shp);
+			DBFClose(dbf);
+		}
+		
+		if (!copied) {
+			goto cleanup;
+		}
+	}
+	
+	shpCount = output->recordCount;
+	returnValue = shapefile_outputClose(interp, output, 1);
+	output = NULL;
+	if (returnValue == TCL_OK) {
+		shapefile_copySidecars(Tcl_GetString(objv[2]), outputPath);
+		Tcl_SetObjResult(interp, Tcl_NewIntObj(shpCount));
+	}
+	
+cleanup:
+	if (output != NULL) {
+		(void)shapefile_outputClose(interp, output, 0);
+	}
+	SHPClose(firstShp);
+	DBFClose(firstDbf);
+	return returnValue;
+}
+
+/*
+ * shapefile_schemaMatch
+ * 
+ * Check that the attribute table otherDbf (of the shapefile at otherPath) has
+ * the same fields, in the same order, as dbf, and the same record layout, so
+ * that raw records may be copied from one to the other.
+ * 
+ * Result:
+ *   No Tcl result if schemas match. Otherwise, throws error.
+ */
+int shapefile_schemaMatch(
+		Tcl_Interp *interp,
+		DBFHandle dbf,
+		DBFHandle otherDbf,
+		const char *otherPath) {
+	
+	char name[12], otherName[12];
+	int fieldCount, fieldId, width, otherWidth, precision, otherPrecision;
+	DBFFieldType type, otherType;
+	
+	fieldCount = DBFGetFieldCount(dbf);
+	if (DBFGetFieldCount(otherDbf) != fieldCount || dbf->nRecordLength != otherDbf->nRecordLength) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute fields of \"%s\" do not match", otherPath));
+		return TCL_ERROR;
+	}
+	
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		type = DBFGetFieldInfo(dbf, fieldId, name, &width, &precision);
+		otherType = DBFGetFieldInfo(otherDbf, fieldId, otherName, &otherWidth, &otherPrecision);
+		if (type != otherType || width != otherWidth || precision != otherPrecision
+				|| strcmp(name, otherName) != 0
+				|| DBFGetNativeFieldType(dbf, fieldId) != DBFGetNativeFieldType(otherDbf, fieldId)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute field %d of \"%s\" does not match", fieldId, otherPath));
+			return TCL_ERROR;
+		}
+	}
+	
+	return TCL_OK;
+}
+
+/*
+ * shapefile_samePath
+ * 
+ * Check whether two shapefile paths refer to the same shapefile, regardless
+ * of any extension given.
+ * 
+ * Result:
+ *   1 if the normalized .shp paths are equal, 0 otherwise.
+ */
+int shapefile_samePath(const char *path, const char *otherPath) {
+	Tcl_Obj *shpPath, *otherShpPath;
+	int same;
+	
+	shpPath = shapefile_componentPath(path, "shp");
+	otherShpPath = shapefile_componentPath(otherPath, "shp");
+	Tcl_IncrRefCount(shpPath);
+	Tcl_IncrRefCount(otherShpPath);
+	same = Tcl_FSEqualPaths(shpPath, otherShpPath);
+	Tcl_DecrRefCount(shpPath);
+	Tcl_DecrRefCount(otherShpPath);
+	
+	return same;
+}
+
+/*
+ * shapefile_copySidecars
+ * 
+ * Copy the optional .prj (projection) and .cpg (code page) files of the
+ * shapefile at sourcePath, if present, to a new shapefile at targetPath.
+ */
+void shapefile_copySidecars(const char *sourcePath, const char *targetPath) {
+	static const char *extensions[] = {"prj", "cpg", NULL};
+	Tcl_Obj *sourceObj, *targetObj;
+	int i;
+	
+	for (i = 0; extensions[i] != NULL; i++) {
+		sourceObj = shapefile_componentPath(sourcePath, extensions[i]);
+		targetObj = shapefile_componentPath(targetPath, extensions[i]);
+		Tcl_IncrRefCount(sourceObj);
+		Tcl_IncrRefCount(targetObj);
+		/* sidecar files are optional, so a failed copy is not an error */
+		(void)Tcl_FSCopyFile(sourceObj, targetObj);
+		Tcl_DecrRefCount(sourceObj);
+		Tcl_DecrRefCount(targetObj);
+	}
+}
+
+/*
+ * shapefile_spatialjoin_cmd
+ * 
+ * Implements the [spatialjoin] command used to pair the features of a point
+ * shapefile with the polygon features that contain them. The polygons are
+ * found with the spatial index of the polygon shapefile (see [$shp spatial]);
+ * point features are read in one pass, divided into contiguous ranges that
+ * may be joined by worker threads, each with its own .shp handles (see
+ * shapefile_cloneHandle) and decoded polygons.
+ * 
+ * Command Syntax:
+ *   [spatialjoin POINTS POLYGONS ?-predicate within|intersects? ?-threads COUNT?]
+ *     POINTS is an open point or multipoint shapefile and POLYGONS an open
+ *     polygon shapefile, both given as the commands returned by
+ *     [shapefile]. With the default within predicate, a feature is paired
+ *     with each polygon whose interior contains all of its points; with
+ *     intersects, with each polygon that contains or touches any of its
+ *     points. Null features, and deleted features of either shapefile if
+ *     its skipDeleted option is set, are not paired.
+ * 
+ * Result:
+ *   List of {POINT POLYGON} feature index pairs, ordered by point index and
+ *   then polygon index.
+ */
+int shapefile_spatialjoin_cmd(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	static const char *optionNames[] = {"-predicate", "-threads", NULL};
+	static const char *predicateNames[] = {"intersects", "within", NULL};
+	ShapefilePtr points, polygons;
+	ShapefileJoinRangePtr ranges;
+	SHPInfo pointInfo, polygonInfo;
+	Tcl_Obj *result, *pair[2];
+	char *skipPoints = NULL, *skipPolygons = NULL;
+	int optionIndex, predicate = 1, threadCount = 1, i, rangeIndex, threadResult;
+	int pointCount, polygonCount, featureId;
+	int returnValue = TCL_OK;
+	int channel;
+	
+	if (objc < 3 || objc % 2 == 0) {
+		Tcl_WrongNumArgs(interp, 1, objv, "points polygons ?-predicate within|intersects? ?-threads count?");
+		return TCL_ERROR;
+	}
+	
+	if ((points = shapefile_command(interp, objv[1])) == NULL
+			|| (polygons = shapefile_command(interp, objv[2])) == NULL) {
+		return TCL_ERROR;
+	}
+	
+	for (i = 3; i < objc; i += 2) {
+		if (Tcl_GetIndexFromObj(interp, objv[i], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (optionIndex == 0) {
+			if (Tcl_GetIndexFromObj(interp, objv[i + 1], predicateNames, "predicate", TCL_EXACT, &predicate) != TCL_OK) {
+				return TCL_ERROR;
+			}
+		} else {
+			if (Tcl_GetIntFromObj(interp, objv[i + 1], &threadCount) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			if (threadCount < 1) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid thread count %d", threadCount));
+				return TCL_ERROR;
+			}
+		}
+	}
+	
+	if (points->baseType != BASE_POINT && points->baseType != BASE_MULTIPOINT) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not a point or multipoint shapefile", Tcl_GetString(objv[1])));
+		return TCL_ERROR;
+	}
+	if (polygons->baseType != BASE_POLYGON) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not a polygon shapefile", Tcl_GetString(objv[2])));
+		return TCL_ERROR;
+	}
+	
+	if ((points->lazy && shapefile_lazyLoad(interp, points) != TCL_OK)
+			|| (polygons->lazy && shapefile_lazyLoad(interp, polygons) != TCL_OK)) {
+		return TCL_ERROR;
+	}
+	if (polygons->spatialIndex == NULL
+			&& (polygons->spatialIndex = shapefile_spatialBuild(interp, polygons)) == NULL) {
+		return TCL_ERROR;
+	}
+	
+	SHPGetInfo(points->shp, &pointCount, NULL, NULL, NULL);
+	SHPGetInfo(polygons->shp, &polygonCount, NULL, NULL, NULL);
+	result = Tcl_NewListObj(0, NULL);
+	if (pointCount == 0 || polygons->spatialIndex->nodeCount == 0) {
+		Tcl_SetObjResult(interp, result);
+		return TCL_OK;
+	}
+	if (threadCount > pointCount) {
+		threadCount = pointCount;
+	}
+	
+	/* workers read from their own descriptors, so pending writes must reach
+	   the .shp files first; the offset tables are current in memory */
+	if (points->shp->fpSHX != NULL) {
+		points->shp->sHooks.FFlush(points->shp->fpSHP);
+	}
+	if (polygons->shp->fpSHX != NULL) {
+		polygons->shp->sHooks.FFlush(polygons->shp->fpSHP);
+	}
+	
+	/* the attribute tables are not safe to read from workers */
+	if (points->skipDeleted) {
+		skipPoints = ckalloc((unsigned int)pointCount);
+		for (featureId = 0; featureId < pointCount; featureId++) {
+			skipPoints[featureId] = (char)DBFIsRecordDeleted(points->dbf, featureId);
+		}
+	}
+	if (polygons->skipDeleted) {
+		skipPolygons = ckalloc((unsigned int)polygonCount);
+		for (featureId = 0; featureId < polygonCount; featureId++) {
+			skipPolygons[featureId] = (char)DBFIsRecordDeleted(polygons->dbf, featureId);
+		}
+	}
+	
+	ranges = (ShapefileJoinRangePtr)ckalloc((unsigned int)(sizeof(struct shapefile_joinRange) * threadCount));
+	memset(ranges, 0, sizeof(struct shapefile_joinRange) * threadCount);
+	
+	/* clones share the handles' offset tables but none of their files */
+	memcpy(&pointInfo, points->shp, sizeof(SHPInfo));
+	memcpy(&polygonInfo, polygons->shp, sizeof(SHPInfo));
+	pointInfo.fpSHP = polygonInfo.fpSHP = NULL;
+	pointInfo.fpSHX = polygonInfo.fpSHX = NULL;
+	pointInfo.pabyRec = polygonInfo.pabyRec = NULL;
+	pointInfo.nBufSize = polygonInfo.nBufSize = 0;
+	pointInfo.bUpdated = polygonInfo.bUpdated = 0;
+	channel = shapefile_channelPath(points->path) || shapefile_channelPath(polygons->path);
+	
+	for (rangeIndex = 0; rangeIndex < threadCount; rangeIndex++) {
+		ShapefileJoinRangePtr range = &ranges[rangeIndex];
+		
+		range->index = polygons->spatialIndex;
+		range->within = predicate == 1;
+		range->skipPoints = skipPoints;
+		range->skipPolygons = skipPolygons;
+		range->start = (int)(((Tcl_WideInt)pointCount * rangeIndex) / threadCount);
+		range->stop = (int)(((Tcl_WideInt)pointCount * (rangeIndex + 1)) / threadCount);
+		range->failedId = -1;
+		
+		if ((range->points = shapefile_cloneHandle(points->path, &pointInfo)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", points->path));
+			returnValue = TCL_ERROR;
+			break;
+		}
+		if ((range->polygons = shapefile_cloneHandle(polygons->path, &polygonInfo)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", polygons->path));
+			returnValue = TCL_ERROR;
+			break;
+		}
+		
+		/* a single range is joined by this thread */
+		range->threaded = threadCount > 1 && !channel
+				&& Tcl_CreateThread(&range->threadId, shapefile_joinRange,
+						(ClientData)range, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) == TCL_OK;
+	}
+	
+	/* join any ranges that were not given a thread here, then wait for the
+	   others; every range with handles must finish before cleanup */
+	for (rangeIndex = 0; rangeIndex < threadCount; rangeIndex++) {
+		ShapefileJoinRangePtr range = &ranges[rangeIndex];
+		
+		if (range->threaded) {
+			(void)Tcl_JoinThread(range->threadId, &threadResult);
+		} else if (returnValue == TCL_OK && range->polygons != NULL) {
+			shapefile_joinRange((ClientData)range);
+		}
+		
+		/* SHPClose must not free the borrowed offset tables */
+		if (range->points != NULL) {
+			range->points->panRecOffset = NULL;
+			range->points->panRecSize = NULL;
+			SHPClose(range->points);
+		}
+		if (range->polygons != NULL) {
+			range->polygons->panRecOffset = NULL;
+			range->polygons->panRecSize = NULL;
+			SHPClose(range->polygons);
+		}
+	}
+	
+	/* ranges are in point order, so their pairs are too */
+	for (rangeIndex = 0; rangeIndex < threadCount && returnValue == TCL_OK; rangeIndex++) {
+		ShapefileJoinRangePtr range = &ranges[rangeIndex];
+		
+		if (range->failedId != -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d of \"%s\"", range->failedId,
+					range->failedPolygon ? polygons->path : points->path));
+			returnValue = TCL_ERROR;
+			break;
+		}
+		for (i = 0; i < range->pairCount; i += 2) {
+			pair[0] = Tcl_NewIntObj(range->pairs[i]);
+			pair[1] = Tcl_NewIntObj(range->pairs[i + 1]);
+			Tcl_ListObjAppendElement(interp, result, Tcl_NewListObj(2, pair));
+		}
+	}
+	
+	for (rangeIndex = 0; rangeIndex < threadCount; rangeIndex++) {
+		if (ranges[rangeIndex].pairs != NULL) {
+			ckfree((char *)ranges[rangeIndex].pairs);
+		}
+	}
+	ckfree((char *)ranges);
+	if (skipPoints != NULL) ckfree(skipPoints);
+	if (skipPolygons != NULL) ckfree(skipPolygons);
+	
+	if (returnValue == TCL_OK) {
+		Tcl_SetObjResult(interp, result);
+	} else {
+		Tcl_DecrRefCount(result);
+	}
+	return returnValue;
+}
+
+/*
+ * shapefile_joinRange
+ * 
+ * Worker thread procedure of shapefile_spatialjoin_cmd. Reads each point
+ * feature in the given range, finds the polygons whose boxes hold its bounds
+ * in the spatial index, and tests it against each of them. Pairs are stored
+ * in the range's pairs array, point index then polygon index. If a feature
+ * cannot be read, its index is stored in failedId and the join stops.
+ */
+Tcl_ThreadCreateType shapefile_joinRange(ClientData clientData) {
+	
+	ShapefileJoinRangePtr range = (ShapefileJoinRangePtr)clientData;
+	Tcl_HashTable shapes;
+	SHPObject *point, *polygon;
+	int *candidates = NULL;
+	int capacity = 0, count, featureId, i, vertex, matched, inside, onRing;
+	
+	Tcl_InitHashTable(&shapes, TCL_ONE_WORD_KEYS);
+	
+	for (featureId = range->start; featureId < range->stop; featureId++) {
+		if (range->skipPoints != NULL && range->skipPoints[featureId]) {
+			continue;
+		}
+		if ((point = SHPReadObject(range->points, featureId)) == NULL) {
+			range->failedId = featureId;
+			break;
+		}
+		if (point->nVertices == 0) {
+			SHPDestroyObject(point);
+			continue;
+		}
+		
+		/* with the bounds swapped, only boxes that contain the feature's
+		   bounds are found, as within requires */
+		count = range->within
+				? shapefile_spatialSearch(range->index, point->dfXMax, point->dfYMax,
+						point->dfXMin, point->dfYMin, &candidates, &capacity)
+				: shapefile_spatialSearch(range->index, point->dfXMin, point->dfYMin,
+						point->dfXMax, point->dfYMax, &candidates, &capacity);
+		qsort(candidates, count, sizeof(int), shapefile_compareId);
+		
+		for (i = 0; i < count; i++) {
+			if (range->skipPolygons != NULL && range->skipPolygons[candidates[i]]) {
+				continue;
+			}
+			if ((polygon = shapefile_shapeTableRead(&shapes, range->polygons, candidates[i])) == NULL) {
+				range->failedId = candidates[i];
+				range->failedPolygon = 1;
+				break;
+			}
+			
+			/* points on a ring touch the polygon but are not within it */
+			matched = range->within;
+			for (vertex = 0; vertex < point->nVertices; vertex++) {
+				inside = shapefile_pointInShape(polygon, point->padfX[vertex], point->padfY[vertex]);
+				onRing = shapefile_partsDistance(polygon, point->padfX[vertex], point->padfY[vertex]) == 0.0;
+				if (range->within && (!inside || onRing)) {
+					matched = 0;
+					break;
+				}
+				if (!range->within && (inside || onRing)) {
+					matched = 1;
+					break;
+				}
+			}
+			if (!matched) {
+				continue;
+			}
+			
+			if (range->pairCount + 2 > range->pairCapacity) {
+				range->pairCapacity = range->pairCapacity == 0 ? 64 : range->pairCapacity * 2;
+				range->pairs = (int *)ckrealloc((char *)range->pairs, (unsigned int)(sizeof(int) * range->pairCapacity));
+			}
+			range->pairs[range->pairCount++] = featureId;
+			range->pairs[range->pairCount++] = candidates[i];
+		}
+		
+		SHPDestroyObject(point);
+		if (range->failedId != -1) {
+			break;
+		}
+	}
+	
+	shapefile_shapeTableClear(&shapes);
+	Tcl_DeleteHashTable(&shapes);
+	if (candidates != NULL) ckfree((char *)candidates);
+	
+	TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * shapefile_import_cmd
+ * 
+ * Implements the [import] command used to add features read from a Tcl
+ * channel in another format to an open shapefile.
+ * 
+ * Command Syntax:
+ *   [import geojson CHANNEL SHAPEFILE]
+ *     Read a GeoJSON FeatureCollection from CHANNEL and append each Feature
+ *     to SHAPEFILE, a readwrite shapefile given as the command returned by
+ *     [shapefile], as [$shp write] would. The text is scanned as it is
+ *     read, in blocks of GEOJSON_CHUNK_SIZE characters, and only one
+ *     feature is parsed and held at a time, so memory use is bounded by the
+ *     largest feature rather than the size of the collection. Point and
+ *     MultiPoint geometry may be imported to point and multipoint
+ *     shapefiles, LineString and MultiLineString to arc shapefiles, and
+ *     Polygon and MultiPolygon to polygon shapefiles; rings are closed and
+ *     rewound as by [$shp coordinates write]. Null geometry is imported as
+ *     a null feature. Z and M values are taken from the third and fourth
+ *     elements of each position, or are 0 if it has none. Property values
+ *     are written to the fields of the same name; fields with missing or
+ *     null properties get null values, and other properties are ignored.
+ *     Features read before an error remain in the shapefile.
+ * 
+ * Result:
+ *   Number of features imported.
+ */
+int shapefile_import_cmd(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	static const char *formatNames[] = {"geojson", NULL};
+	ShapefilePtr shapefile;
+	Tcl_Channel channel;
+	Tcl_DString feature;
+	Tcl_Obj *chunk, *value;
+	const char *text, *cursor, *error;
+	char key[GEOJSON_KEY_SIZE], nesting[GEOJSON_MAX_DEPTH];
+	int formatIndex, mode, length, i, captureStart = 0, imported = 0;
+	int depth = 0, inString = 0, escaped = 0, inToken = 0, empty = 0, capturing = 0, keyLength = -1;
+	int returnValue = TCL_ERROR;
+	
+	/* progress through the top-level object: before the features member,
+	   after its name, within its array, and after it */
+	enum {FEATURES_BEFORE, FEATURES_NAMED, FEATURES_WITHIN, FEATURES_AFTER} state = FEATURES_BEFORE;
+	
+	/* what may come next: a value, a member name, the colon after it, or
+	   the comma or bracket after a value */
+	enum {EXPECT_VALUE, EXPECT_KEY, EXPECT_COLON, EXPECT_SEPARATOR} expect = EXPECT_VALUE;
+	
+	if (objc != 4) {
+		Tcl_WrongNumArgs(interp, 1, objv, "format channel shapefile");
+		return TCL_ERROR;
+	}
+	
+	if (Tcl_GetIndexFromObj(interp, objv[1], formatNames, "format", TCL_EXACT, &formatIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if ((channel = Tcl_GetChannel(interp, Tcl_GetString(objv[2]), &mode)) == NULL) {
+		return TCL_ERROR;
+	}
+	if (!(mode & TCL_READABLE)) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("channel \"%s\" wasn't opened for reading", Tcl_GetString(objv[2])));
+		return TCL_ERROR;
+	}
+	
+	if ((shapefile = shapefile_command(interp, objv[3])) == NULL) {
+		return TCL_ERROR;
+	}
+	if (shapefile->readonly) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write to readonly shapefile"));
+		return TCL_ERROR;
+	}
+	
+	/* features are written through the index, which -lazy has not read */
+	if (shapefile->lazy && shapefile_lazyLoad(interp, shapefile) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	chunk = Tcl_NewObj();
+	Tcl_IncrRefCount(chunk);
+	Tcl_DStringInit(&feature);
+	
+	/* only the structure of the text is checked, to find the features array
+	   and the extent of each feature in it; features are parsed whole, and
+	   the numbers and literals of other members are not checked */
+	while (1) {
+		if ((length = Tcl_ReadChars(channel, chunk, GEOJSON_CHUNK_SIZE, 0)) == -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read GeoJSON: %s", Tcl_PosixError(interp)));
+			goto cleanup;
+		}
+		if (length == 0) {
+			if (Tcl_Eof(channel)) {
+				break;
+			}
+			if (Tcl_InputBlocked(channel)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot read GeoJSON from nonblocking channel"));
+				goto cleanup;
+			}
+			continue;
+		}
+		text = Tcl_GetStringFromObj(chunk, &length);
+		captureStart = 0;
+		
+		for (i = 0; i < length; i++) {
+			if (inString) {
+				if (escaped) {
+					escaped = 0;
+				} else if (text[i] == '\\') {
+					escaped = 1;
+				} else if (text[i] == '"') {
+					inString = 0;
+					continue;
+				}
+				if (keyLength >= 0 && keyLength < GEOJSON_KEY_SIZE - 1) {
+					key[keyLength++] = text[i];
+				}
+				continue;
+			}
+			
+			/* the first character of each value */
+			if (expect == EXPECT_VALUE && !inToken && text[i] != '\0' && strchr(" \t\r\n]},:", text[i]) == NULL) {
+				if (depth == 0 && text[i] != '{') {
+					Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: expected an object"));
+					goto cleanup;
+				}
+				if (depth == 1 && state == FEATURES_NAMED) {
+					if (text[i] != '[') {
+						Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: features is not an array"));
+						goto cleanup;
+					}
+					state = FEATURES_WITHIN;
+				} else if (depth == 2 && state == FEATURES_WITHIN) {
+					if (text[i] != '{') {
+						Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: feature %d is not a Feature object", imported));
+						goto cleanup;
+					}
+					capturing = 1;
+					captureStart = i;
+				}
+			}
+			
+			switch (text[i]) {
+				case ' ': case '\t': case '\r': case '\n':
+					break;
+				case '"':
+					if (expect == EXPECT_KEY) {
+						keyLength = depth == 1 ? 0 : -1;
+						expect = EXPECT_COLON;
+					} else if (expect == EXPECT_VALUE) {
+						keyLength = -1;
+						expect = EXPECT_SEPARATOR;
+					} else {
+						goto unexpected;
+					}
+					inString = 1;
+					empty = 0;
+					break;
+				case '{':
+				case '[':
+					if (expect != EXPECT_VALUE) {
+						goto unexpected;
+					}
+					if (depth == GEOJSON_MAX_DEPTH) {
+						Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: too deeply nested"));
+						goto cleanup;
+					}
+					nesting[depth++] = text[i];
+					expect = text[i] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+					empty = 1;
+					break;
+				case '}':
+				case ']':
+					if (depth == 0 || nesting[depth - 1] != (text[i] == '}' ? '{' : '[')) {
+						Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: unbalanced \"%c\"", text[i]));
+						goto cleanup;
+					}
+					
+					/* a container may close after a value, or if it is empty */
+					if (expect != EXPECT_SEPARATOR && !empty) {
+						goto unexpected;
+					}
+					depth--;
+					expect = EXPECT_SEPARATOR;
+					empty = 0;
+					if (depth == 1 && state == FEATURES_WITHIN) {
+						state = FEATURES_AFTER;
+					}
+					if (capturing && depth == 2) {
+						Tcl_DStringAppend(&feature, text + captureStart, i + 1 - captureStart);
+						capturing = 0;
+						
+						cursor = Tcl_DStringValue(&feature);
+						if (!shapefile_jsonParse(&cursor, cursor + Tcl_DStringLength(&feature), 0, &value, &error)) {
+							Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON feature %d: %s", imported, error));
+							goto cleanup;
+						}
+						Tcl_IncrRefCount(value);
+						if (shapefile_importFeature(interp, shapefile, objv[3], value) != TCL_OK) {
+							Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to import GeoJSON feature %d: %s",
+									imported, Tcl_GetString(Tcl_GetObjResult(interp))));
+							Tcl_DecrRefCount(value);
+							goto cleanup;
+						}
+						Tcl_DecrRefCount(value);
+						Tcl_DStringSetLength(&feature, 0);
+						imported++;
+					}
+					break;
+				case ',':
+					if (depth == 0 || expect != EXPECT_SEPARATOR) {
+						goto unexpected;
+					}
+					expect = nesting[depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+					break;
+				case ':':
+					if (expect != EXPECT_COLON) {
+						goto unexpected;
+					}
+					if (depth == 1 && state == FEATURES_BEFORE && keyLength == 8 && memcmp(key, "features", 8) == 0) {
+						state = FEATURES_NAMED;
+					}
+					keyLength = -1;
+					expect = EXPECT_VALUE;
+					break;
+				default:
+					/* the characters of a number or literal */
+					if (!inToken) {
+						if (expect != EXPECT_VALUE) {
+							goto unexpected;
+						}
+						expect = EXPECT_SEPARATOR;
+						empty = 0;
+					}
+					inToken = 1;
+					continue;
+			}
+			inToken = 0;
+		}
+		
+		/* a feature continues in the next chunk */
+		if (capturing) {
+			Tcl_DStringAppend(&feature, text + captureStart, length - captureStart);
+		}
+	}
+	
+	if (depth != 0 || inString || expect != EXPECT_SEPARATOR) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: unexpected end of text"));
+		goto cleanup;
+	}
+	if (state != FEATURES_AFTER) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: missing features array"));
+		goto cleanup;
+	}
+	
+	Tcl_SetObjResult(interp, Tcl_NewIntObj(imported));
+	returnValue = TCL_OK;
+	goto cleanup;
+	
+   unexpected:
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid GeoJSON: unexpected \"%c\"", text[i]));
+	
+   cleanup:
+	Tcl_DStringFree(&feature);
+	Tcl_DecrRefCount(chunk);
+	return returnValue;
+}
+
+/*
+ * shapefile_jsonParse
+ * 
+ * Parse one JSON value from the text at *cursor, which must end before end,
+ * and advance *cursor past it. Objects are parsed as dictionaries, arrays as
+ * lists, integers as wide integers, other numbers as doubles, true and
+ * false as 1 and 0, and null as an empty object. depth is the number of
+ * enclosing objects and arrays, which is limited to GEOJSON_MAX_DEPTH.
+ * 
+ * Result:
+ *   1 with the value in *value, or 0 with a description of the problem in
+ *   *error. The value has no references.
+ */
+int shapefile_jsonParse(
+		const char **cursor,
+		const char *end,
+		int depth,
+		Tcl_Obj **value,
+		const char **error) {
+	
+	const char *c = *cursor, *start;
+	Tcl_Obj *container = NULL, *key, *element;
+	Tcl_DString string;
+	Tcl_WideInt integer;
+	char utf[TCL_UTF_MAX];
+	int code, i, count, isObject, isInteger;
+	double number;
+	
+	c = shapefile_jsonSpace(c, end);
+	if (c == end) {
+		*error = "unexpected end of text";
+		return 0;
+	}
+	
+	switch (*c) {
+		case '{':
+		case '[':
+			if (depth >= GEOJSON_MAX_DEPTH) {
+				*error = "too deeply nested";
+				return 0;
+			}
+			isObject = *c == '{';
+			container = isObject ? Tcl_NewDictObj() : Tcl_NewListObj(0, NULL);
+			for (c++, count = 0; ; count++) {
+				c = shapefile_jsonSpace(c, end);
+				if (c < end && *c == (isObject ? '}' : ']')) {
+					c++;
+					break;
+				}
+				
+				/* members after the first follow a comma */
+				if (count > 0) {
+					if (c == end || *c != ',') {
+						*error = "expected \",\"";
+						goto invalid;
+					}
+					c = shapefile_jsonSpace(c + 1, end);
 				}
-				if (DBFWriteAttributeDirectly(shapefile->dbf, recordId, fieldId, (void *)buffer) == 0) {
-					Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write double attribute \"%s\"", buffer));
-					return TCL_ERROR;
+				
+				if (!isObject) {
+					if (!shapefile_jsonParse(&c, end, depth + 1, &element, error)) {
+						goto invalid;
+					}
+					(void)Tcl_ListObjAppendElement(NULL, container, element);
+					continue;
 				}
-			} else {			
-				/* Anticipate this to fail due to truncation if len(buffer) > width
-				   and allowAlternateNotation and allowTruncation are false, meaning errors preferred. */
-				if ((DBFWriteDoubleAttribute(shapefile->dbf, recordId, fieldId, doubleValue) == 0) && !shapefile->allowTruncation) {
-					Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write double attribute \"%lf\"", doubleValue));
-					return TCL_ERROR;
+				
+				if (c == end || *c != '"') {
+					*error = "expected a string";
+					goto invalid;
+				}
+				if (!shapefile_jsonParse(&c, end, depth + 1, &key, error)) {
+					goto invalid;
+				}
+				Tcl_IncrRefCount(key);
+				c = shapefile_jsonSpace(c, end);
+				if (c == end || *c != ':') {
+					*error = "expected \":\"";
+					Tcl_DecrRefCount(key);
+					goto invalid;
+				}
+				c++;
+				if (!shapefile_jsonParse(&c, end, depth + 1, &element, error)) {
+					Tcl_DecrRefCount(key);
+					goto invalid;
 				}
+				(void)Tcl_DictObjPut(NULL, container, key, element);
+				Tcl_DecrRefCount(key);
 			}
+			*value = container;
 			break;
-		case FTString:
-			if ((stringValue = Tcl_GetString(attrValue)) == NULL) {
-				return TCL_ERROR;
+		case '"':
+			start = ++c;
+			while (c < end && *c != '"' && *c != '\\') {
+				c++;
 			}
-			if ((DBFWriteStringAttribute(shapefile->dbf, recordId, fieldId, stringValue) == 0) && !shapefile->allowTruncation) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write string attribute \"%s\"", stringValue));
-				return TCL_ERROR;
+			if (c < end && *c == '"') {
+				*value = Tcl_NewStringObj(start, (int)(c - start));
+				c++;
+				break;
+			}
+			
+			/* strings with escapes are decoded into a buffer */
+			Tcl_DStringInit(&string);
+			Tcl_DStringAppend(&string, start, (int)(c - start));
+			while (c < end && *c != '"') {
+				if (*c != '\\') {
+					Tcl_DStringAppend(&string, c++, 1);
+					continue;
+				}
+				if (++c == end) {
+					break;
+				}
+				switch (*c) {
+					case 'b': Tcl_DStringAppend(&string, "\b", 1); break;
+					case 'f': Tcl_DStringAppend(&string, "\f", 1); break;
+					case 'n': Tcl_DStringAppend(&string, "\n", 1); break;
+					case 'r': Tcl_DStringAppend(&string, "\r", 1); break;
+					case 't': Tcl_DStringAppend(&string, "\t", 1); break;
+					case 'u':
+						for (code = 0, i = 1; i <= 4 && c + i < end && isxdigit((unsigned char)c[i]); i++) {
+							code = code * 16 + (isdigit((unsigned char)c[i]) ? c[i] - '0' : tolower((unsigned char)c[i]) - 'a' + 10);
+						}
+						if (i <= 4) {
+							*error = "invalid \\u escape";
+							Tcl_DStringFree(&string);
+							return 0;
+						}
+						Tcl_DStringAppend(&string, utf, Tcl_UniCharToUtf(code, utf));
+						c += 4;
+						break;
+					default:
+						Tcl_DStringAppend(&string, c, 1);
+						break;
+				}
+				c++;
+			}
+			if (c == end) {
+				*error = "unterminated string";
+				Tcl_DStringFree(&string);
+				return 0;
+			}
+			*value = Tcl_NewStringObj(Tcl_DStringValue(&string), Tcl_DStringLength(&string));
+			Tcl_DStringFree(&string);
+			c++;
+			break;
+		case 't':
+			if (end - c < 4 || memcmp(c, "true", 4) != 0) {
+				*error = "invalid literal";
+				return 0;
 			}
+			*value = Tcl_NewIntObj(1);
+			c += 4;
+			break;
+		case 'f':
+			if (end - c < 5 || memcmp(c, "false", 5) != 0) {
+				*error = "invalid literal";
+				return 0;
+			}
+			*value = Tcl_NewIntObj(0);
+			c += 5;
+			break;
+		case 'n':
+			if (end - c < 4 || memcmp(c, "null", 4) != 0) {
+				*error = "invalid literal";
+				return 0;
+			}
+			*value = Tcl_NewObj();
+			c += 4;
 			break;
 		default:
-			if (DBFWriteNULLAttribute(shapefile->dbf, recordId, fieldId) == 0) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to write null attribute for unsupported field %d", fieldId));
-				return TCL_ERROR;
+			/* numbers must follow the JSON grammar: no leading zeros,
+			   signs, or bare decimal points, which strtod accepts */
+			start = c;
+			isInteger = 1;
+			if (c < end && *c == '-') {
+				c++;
+			}
+			if (c < end && *c == '0') {
+				c++;
+			} else if (c < end && isdigit((unsigned char)*c)) {
+				while (c < end && isdigit((unsigned char)*c)) {
+					c++;
+				}
+			} else {
+				*error = "unexpected character";
+				return 0;
+			}
+			if (c < end && *c == '.') {
+				isInteger = 0;
+				if (++c == end || !isdigit((unsigned char)*c)) {
+					*error = "invalid number";
+					return 0;
+				}
+				while (c < end && isdigit((unsigned char)*c)) {
+					c++;
+				}
+			}
+			if (c < end && (*c == 'e' || *c == 'E')) {
+				isInteger = 0;
+				if (++c < end && (*c == '+' || *c == '-')) {
+					c++;
+				}
+				if (c == end || !isdigit((unsigned char)*c)) {
+					*error = "invalid number";
+					return 0;
+				}
+				while (c < end && isdigit((unsigned char)*c)) {
+					c++;
+				}
+			}
+			if (c < end && isdigit((unsigned char)*c)) {
+				*error = "invalid number";
+				return 0;
+			}
+			
+			/* integers of up to 18 digits cannot overflow */
+			if (isInteger && c - start < 19) {
+				for (integer = 0, i = *start == '-' ? 1 : 0; i < c - start; i++) {
+					integer = integer * 10 + (start[i] - '0');
+				}
+				*value = Tcl_NewWideIntObj(*start == '-' ? -integer : integer);
+				break;
+			}
+			
+			/* the text is terminated; strtod reads further than the number
+			   matched above only into text rejected after it, such as the x
+			   of a hexadecimal number */
+			number = strtod(start, NULL);
+			if (!isfinite(number)) {
+				*error = "number out of range";
+				return 0;
 			}
+			*value = Tcl_NewDoubleObj(number);
 			break;
 	}
-
-	Tcl_SetObjResult(interp, Tcl_NewIntObj(recordId));
+	
+	*cursor = c;
+	return 1;
+	
+   invalid:
+	/* free the partial value, which has no references */
+	Tcl_IncrRefCount(container);
+	Tcl_DecrRefCount(container);
+	return 0;
+}
+
+/*
+ * shapefile_jsonSpace
+ * 
+ * Result:
+ *   Pointer to the first character at or after c, and before end, that is
+ *   not JSON whitespace; end if there is none.
+ */
+const char *shapefile_jsonSpace(
+		const char *c,
+		const char *end) {
+	
+	while (c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')) {
+		c++;
+	}
+	return c;
+}
+
+/*
+ * shapefile_jsonMember
+ * 
+ * Get the value of the member called name of a JSON object parsed by
+ * shapefile_jsonParse. Null objects have no members. Values are owned by
+ * object, which must not shimmer while they are in use.
+ * 
+ * Result:
+ *   Value, or NULL if the object has no such member. Throws error if object
+ *   is not an object.
+ */
+int shapefile_jsonMember(
+		Tcl_Interp *interp,
+		Tcl_Obj *object,
+		const char *name,
+		Tcl_Obj **value) {
+	
+	Tcl_Obj *key;
+	int result;
+	
+	/* null parses as an empty string, which is an empty dict */
+	key = Tcl_NewStringObj(name, -1);
+	Tcl_IncrRefCount(key);
+	result = Tcl_DictObjGet(interp, object, key, value);
+	Tcl_DecrRefCount(key);
+	return result;
+}
+
+/*
+ * shapefile_importFeature
+ * 
+ * Append a GeoJSON Feature, parsed by shapefile_jsonParse, to shapefile
+ * with cmd_write. name is the shapefile's command name.
+ * 
+ * Result:
+ *   Index of the new feature. Otherwise, throws error.
+ */
+int shapefile_importFeature(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		Tcl_Obj *name,
+		Tcl_Obj *feature) {
+	
+	static const char *typeNames[] = {"LineString", "MultiLineString", "MultiPoint", "MultiPolygon", "Point", "Polygon", NULL};
+	static const int typeBases[] = {BASE_ARC, BASE_ARC, BASE_MULTIPOINT, BASE_POLYGON, BASE_POINT, BASE_POLYGON};
+	static const char *baseNames[] = {"point", "arc", "polygon", "multipoint"};
+	Tcl_Obj *type, *geometry, *coordinates, *properties, *value, *parts, *attributes;
+	Tcl_Obj **polygons, **lines, **positions, *writeObjv[4];
+	char fieldName[12];
+	int typeIndex, polygonCount, lineCount, positionCount, polygon, line, fieldId, fieldCount, size;
+	int returnValue = TCL_ERROR;
+	
+	if (shapefile_jsonMember(interp, feature, "type", &type) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (type == NULL || strcmp(Tcl_GetString(type), "Feature") != 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("not a Feature"));
+		return TCL_ERROR;
+	}
+	
+	parts = Tcl_NewListObj(0, NULL);
+	attributes = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(parts);
+	Tcl_IncrRefCount(attributes);
+	
+	/* features with null geometry become null features */
+	if (shapefile_jsonMember(interp, feature, "geometry", &geometry) != TCL_OK) {
+		goto cleanup;
+	}
+	if (geometry != NULL && Tcl_DictObjSize(interp, geometry, &size) != TCL_OK) {
+		goto cleanup;
+	}
+	if (geometry != NULL && size > 0) {
+		if (shapefile_jsonMember(interp, geometry, "type", &type) != TCL_OK
+				|| shapefile_jsonMember(interp, geometry, "coordinates", &coordinates) != TCL_OK) {
+			goto cleanup;
+		}
+		if (type == NULL || coordinates == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("geometry must have type and coordinates"));
+			goto cleanup;
+		}
+		if (Tcl_GetIndexFromObj(interp, type, typeNames, "geometry type", TCL_EXACT, &typeIndex) != TCL_OK) {
+			goto cleanup;
+		}
+		if (typeBases[typeIndex] != shapefile->baseType
+				&& !(typeBases[typeIndex] == BASE_POINT && shapefile->baseType == BASE_MULTIPOINT)
+				&& !(typeBases[typeIndex] == BASE_MULTIPOINT && shapefile->baseType == BASE_POINT)) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot import %s geometry to %s shapefile",
+					typeNames[typeIndex], baseNames[shapefile->baseType]));
+			goto cleanup;
+		}
+		
+		/* each LineString, MultiPoint, and ring of a Polygon is one part */
+		if (Tcl_ListObjGetElements(interp, coordinates, &polygonCount, &polygons) != TCL_OK) {
+			goto cleanup;
+		}
+		switch (typeIndex) {
+			case 4: /* Point */
+				if (shapefile_importPositions(interp, shapefile, parts, &coordinates, 1) != TCL_OK) {
+					goto cleanup;
+				}
+				break;
+			case 0: /* LineString */
+			case 2: /* MultiPoint */
+				if (shapefile_importPositions(interp, shapefile, parts, polygons, polygonCount) != TCL_OK) {
+					goto cleanup;
+				}
+				break;
+			case 1: /* MultiLineString */
+			case 5: /* Polygon */
+				for (line = 0; line < polygonCount; line++) {
+					if (Tcl_ListObjGetElements(interp, polygons[line], &positionCount, &positions) != TCL_OK
+							|| shapefile_importPositions(interp, shapefile, parts, positions, positionCount) != TCL_OK) {
+						goto cleanup;
+					}
+				}
+				break;
+			default: /* MultiPolygon */
+				for (polygon = 0; polygon < polygonCount; polygon++) {
+					if (Tcl_ListObjGetElements(interp, polygons[polygon], &lineCount, &lines) != TCL_OK) {
+						goto cleanup;
+					}
+					for (line = 0; line < lineCount; line++) {
+						if (Tcl_ListObjGetElements(interp, lines[line], &positionCount, &positions) != TCL_OK
+								|| shapefile_importPositions(interp, shapefile, parts, positions, positionCount) != TCL_OK) {
+							goto cleanup;
+						}
+					}
+				}
+				break;
+		}
+	}
+	
+	/* properties are matched to fields by name; missing or null properties
+	   are written as null values */
+	if (shapefile_jsonMember(interp, feature, "properties", &properties) != TCL_OK) {
+		goto cleanup;
+	}
+	fieldCount = DBFGetFieldCount(shapefile->dbf);
+	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+		(void)DBFGetFieldInfo(shapefile->dbf, fieldId, fieldName, NULL, NULL);
+		value = NULL;
+		if (properties != NULL && shapefile_jsonMember(interp, properties, fieldName, &value) != TCL_OK) {
+			goto cleanup;
+		}
+		Tcl_ListObjAppendElement(interp, attributes, value == NULL ? Tcl_NewObj() : value);
+	}
+	
+	writeObjv[0] = name;
+	writeObjv[1] = Tcl_NewStringObj("write", -1);
+	writeObjv[2] = parts;
+	writeObjv[3] = attributes;
+	Tcl_IncrRefCount(writeObjv[1]);
+	returnValue = cmd_write((ClientData)shapefile, interp, 4, writeObjv);
+	Tcl_DecrRefCount(writeObjv[1]);
+	
+   cleanup:
+	Tcl_DecrRefCount(parts);
+	Tcl_DecrRefCount(attributes);
+	return returnValue;
+}
+
+/*
+ * shapefile_importPositions
+ * 
+ * Append count GeoJSON positions to parts as one part of a coordinate list
+ * for shapefile, with Z and M values as its dimensions require.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_importPositions(
+		Tcl_Interp *interp,
+		ShapefilePtr shapefile,
+		Tcl_Obj *parts,
+		Tcl_Obj **positions,
+		int count) {
+	
+	Tcl_Obj *part, **values;
+	double number;
+	int i, j, valueCount, returnValue = TCL_ERROR;
+	
+	part = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(part);
+	for (i = 0; i < count; i++) {
+		if (Tcl_ListObjGetElements(interp, positions[i], &valueCount, &values) != TCL_OK) {
+			goto cleanup;
+		}
+		if (valueCount < 2) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid position \"%s\": must have at least 2 values", Tcl_GetString(positions[i])));
+			goto cleanup;
+		}
+		for (j = 0; j < valueCount; j++) {
+			if (Tcl_GetDoubleFromObj(NULL, values[j], &number) != TCL_OK || !isfinite(number)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid position \"%s\": values must be finite numbers", Tcl_GetString(positions[i])));
+				goto cleanup;
+			}
+		}
+		Tcl_ListObjAppendElement(interp, part, values[0]);
+		Tcl_ListObjAppendElement(interp, part, values[1]);
+		if (shapefile->dimType == DIM_XYZM) {
+			Tcl_ListObjAppendElement(interp, part, valueCount > 2 ? values[2] : Tcl_NewDoubleObj(0.0));
+		}
+		if (shapefile->dimType != DIM_XY) {
+			Tcl_ListObjAppendElement(interp, part, valueCount > 3 ? values[3] : Tcl_NewDoubleObj(0.0));
+		}
+	}
+	returnValue = Tcl_ListObjAppendElement(interp, parts, part);
+	
+   cleanup:
+	Tcl_DecrRefCount(part);
+	return returnValue;
+}
+
+/*
+ * shapefile_command
+ * 
+ * Get the shapefile of a command returned by [shapefile], for commands that
+ * take open shapefiles as arguments.
+ * 
+ * Result:
+ *   Shapefile, or NULL (with an error message in interp) if name is not a
+ *   shapefile command.
+ */
+ShapefilePtr shapefile_command(Tcl_Interp *interp, Tcl_Obj *name) {
+	Tcl_CmdInfo info;
+	
+	if (!Tcl_GetCommandInfo(interp, Tcl_GetString(name), &info)
+			|| info.objProc != (Tcl_ObjCmdProc *)cmd_dispatcher) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not an open shapefile", Tcl_GetString(name)));
+		return NULL;
+	}
+	return (ShapefilePtr)info.objClientData;
+}
+
+/*
+ * shapefile_layer_cmd
+ * 
+ * Implements the [layer] command used to read a set of shapefiles, such as
+ * the tiles or administrative units of a large dataset, as a single layer.
+ * 
+ * Command Syntax:
+ *   [layer open PATHLIST ?-maxOpen COUNT?]
+ *     Open the shapefiles in PATHLIST readonly as one layer. All must have
+ *     the same shape type and attribute fields. Only file headers are read
+ *     now; each shapefile is opened when it is first accessed, and the least
+ *     recently used are closed to keep at most COUNT (default 64) open.
+ * 
+ * Result:
+ *   Name of an ensemble command for subsequent operations on the layer.
+ */
+int shapefile_layer_cmd(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefileLayerPtr layer;
+	ShapefileShardPtr shard;
+	DBFHandle firstDbf = NULL, dbf;
+	SAHooks hooks;
+	Tcl_Obj **paths, *cmdNameObj;
+	Tcl_Namespace *ns;
+	const char *path;
+	int pathCount, shapeType, actionIndex, optionIndex, i, axis;
+	int maxOpen = LAYER_MAX_OPEN, hasBounds = 0;
+	static const char *actionNames[] = {"open", NULL};
+	static const char *optionNames[] = {"-maxOpen", NULL};
+	
+	if (objc < 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "action ?args?");
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[1], actionNames, "action", TCL_EXACT, &actionIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (objc != 3 && objc != 5) {
+		Tcl_WrongNumArgs(interp, 2, objv, "paths ?-maxOpen count?");
+		return TCL_ERROR;
+	}
+	
+	if (objc == 5) {
+		if (Tcl_GetIndexFromObj(interp, objv[3], optionNames, "option", TCL_EXACT, &optionIndex) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (Tcl_GetIntFromObj(interp, objv[4], &maxOpen) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (maxOpen < 1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid open shapefile limit %d", maxOpen));
+			return TCL_ERROR;
+		}
+	}
+	
+	if (Tcl_ListObjGetElements(interp, objv[2], &pathCount, &paths) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	if (pathCount == 0) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("no shapefiles given"));
+		return TCL_ERROR;
+	}
+	
+	layer = (ShapefileLayerPtr)ckalloc((unsigned int)sizeof(struct shapefile_layer));
+	memset(layer, 0, sizeof(struct shapefile_layer));
+	layer->shards = (ShapefileShardPtr)ckalloc((unsigned int)(pathCount * sizeof(struct shapefile_shard)));
+	memset(layer->shards, 0, pathCount * sizeof(struct shapefile_shard));
+	layer->maxOpen = maxOpen;
+	shapefile_streamHooks(&hooks);
+	
+	for (i = 0; i < pathCount; i++) {
+		shard = &layer->shards[i];
+		path = Tcl_GetString(paths[i]);
+		shard->path = (char *)ckalloc((unsigned int)(strlen(path) + 1));
+		strcpy(shard->path, path);
+		layer->shardCount++;
+		
+		/* the first shard defines the attribute fields of the layer */
+		if ((dbf = DBFOpenLL(path, "rb", &hooks)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open attribute table for \"%s\"", path));
+			goto layerCleanup;
+		}
+		shard->count = DBFGetRecordCount(dbf);
+		if (firstDbf == NULL) {
+			firstDbf = dbf;
+			if (DBFGetFieldCount(dbf) == 0) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute table for \"%s\" contains no fields", path));
+				goto layerCleanup;
+			}
+		} else {
+			optionIndex = shapefile_schemaMatch(interp, firstDbf, dbf, path);
+			DBFClose(dbf);
+			if (optionIndex != TCL_OK) {
+				goto layerCleanup;
+			}
+		}
+		
+		/* the first shard also defines the shape type */
+		if (shapefile_layerHeader(interp, shard, &shapeType) != TCL_OK) {
+			goto layerCleanup;
+		}
+		if (i == 0) {
+			if (!shapefile_typeSupported(shapeType)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("unsupported shape type \"%d\"", shapeType));
+				goto layerCleanup;
+			}
+			layer->shapeType = shapeType;
+		} else if (shapeType != layer->shapeType) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("shape type of \"%s\" does not match \"%s\"", path, layer->shards[0].path));
+			goto layerCleanup;
+		}
+		
+		shard->base = layer->featureCount;
+		layer->featureCount += shard->count;
+		
+		/* headers of empty shapefiles have no meaningful bounds */
+		if (shard->count > 0) {
+			for (axis = 0; axis < 4; axis++) {
+				if (!hasBounds || shard->min[axis] < layer->min[axis]) {
+					layer->min[axis] = shard->min[axis];
+				}
+				if (!hasBounds || shard->max[axis] > layer->max[axis]) {
+					layer->max[axis] = shard->max[axis];
+				}
+			}
+			hasBounds = 1;
+		}
+	}
+	DBFClose(firstDbf);
+	firstDbf = NULL;
+	layer->dimType = shapefile_typeDimension(layer->shapeType);
+	
+	ns = Tcl_GetCurrentNamespace(interp);
+	Tcl_MutexLock(&COMMAND_COUNT_MUTEX);
+	if (ns->parentPtr == NULL) {
+		cmdNameObj = Tcl_ObjPrintf("::layer%d", COMMAND_COUNT++);
+	} else {
+		cmdNameObj = Tcl_ObjPrintf("%s::layer%d", ns->fullName, COMMAND_COUNT++);
+	}
+	Tcl_MutexUnlock(&COMMAND_COUNT_MUTEX);
+	
+	if (Tcl_CreateObjCommand(interp, Tcl_GetString(cmdNameObj), (Tcl_ObjCmdProc *)cmd_layer_dispatcher, (ClientData)layer, (Tcl_CmdDeleteProc *)layer_delete_handler) == NULL) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to create command for %s", Tcl_GetString(cmdNameObj)));
+		goto layerCleanup;
+	}
+	Tcl_CreateExitHandler((Tcl_ExitProc *)layer_exit_handler, (ClientData)layer);
+	Tcl_SetObjResult(interp, cmdNameObj);
+	return TCL_OK;
+	
+   layerCleanup:
+	if (firstDbf != NULL) {
+		DBFClose(firstDbf);
+	}
+	layer_exit_handler(layer);
+	ckfree((char *)layer);
+	return TCL_ERROR;
+}
+
+/*
+ * shapefile_layerHeader
+ * 
+ * Read the shape type and header bounds of a layer shard from its .shp file
+ * without opening the shapefile.
+ * 
+ * Result:
+ *   No Tcl result on success; shapeType and shard bounds are set. Otherwise,
+ *   throws error.
+ */
+int shapefile_layerHeader(
+		Tcl_Interp *interp,
+		ShapefileShardPtr shard,
+		int *shapeType) {
+	
+	unsigned char header[100];
+	SAHooks hooks;
+	SAFile file;
+	Tcl_Obj *shpPath;
+	int count = 0;
+	
+	shapefile_streamHooks(&hooks);
+	shpPath = shapefile_componentPath(shard->path, "shp");
+	Tcl_IncrRefCount(shpPath);
+	if ((file = hooks.FOpen(Tcl_GetString(shpPath), "rb")) != NULL) {
+		count = (int)hooks.FRead(header, sizeof(header), 1, file);
+		hooks.FClose(file);
+	}
+	Tcl_DecrRefCount(shpPath);
+	
+	if (count != 1 || shapefile_getBigInt(header) != 9994) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read shapefile header for \"%s\"", shard->path));
+		return TCL_ERROR;
+	}
+	
+	/* bounds are stored as Xmin, Ymin, Xmax, Ymax, Zmin, Zmax, Mmin, Mmax */
+	*shapeType = shapefile_getLittleInt(header + 32);
+	shard->min[0] = shapefile_getLittleDouble(header + 36);
+	shard->min[1] = shapefile_getLittleDouble(header + 44);
+	shard->max[0] = shapefile_getLittleDouble(header + 52);
+	shard->max[1] = shapefile_getLittleDouble(header + 60);
+	shard->min[2] = shapefile_getLittleDouble(header + 68);
+	shard->max[2] = shapefile_getLittleDouble(header + 76);
+	shard->min[3] = shapefile_getLittleDouble(header + 84);
+	shard->max[3] = shapefile_getLittleDouble(header + 92);
 	return TCL_OK;
 }
 
 /*
- * cmd_attributes_validate
- * 
- * Confirm that a list of attribute values conforms to the shapefile's field
- * definitions. Used by the [$shp write] command and [$shp attributes write]
- * action in contexts where the value list has not already been pre-validated
- * to check for obvious errors before writing attribute values to disk. Intent
- * is to minimize the chance of leaving shapefile in an invalid state.
+ * shapefile_layerShard
  * 
- * An empty attribute list {} is considered valid; it represents a null record.
+ * Get the open shapefile of a layer shard, opening it readonly if needed.
+ * The shard becomes the most recently used; if the layer's limit of open
+ * shards is reached, the least recently used shard is closed first. The
+ * shapefile remains valid only until the next shard is requested.
  * 
  * Result:
- *   No Tcl result if the attribute value list passes validation. Otherwise,
- *   errors may be thrown.
+ *   Shapefile of the shard, or NULL (with an error result) if it could not
+ *   be opened or no longer matches the layer.
  */
-int cmd_attributes_validate(
+ShapefilePtr shapefile_layerShard(
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		Tcl_Obj *attrList) {
+		ShapefileLayerPtr layer,
+		int shardId) {
 	
-	int fieldId, fieldCount, attrCount;
-	Tcl_Obj *attr;
+	ShapefileShardPtr shard = &layer->shards[shardId];
+	SHPHandle shp;
+	DBFHandle dbf;
+	SAHooks hooks;
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	if (Tcl_ListObjLength(interp, attrList, &attrCount) != TCL_OK) {
-		return TCL_ERROR;
-	}
-	if (attrCount == 0) {
-		return TCL_OK;
-	} else if (attrCount != fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("attribute count (%d) does not match field count (%d)", attrCount, fieldCount));
-		return TCL_ERROR;
+	if (shard == layer->openFirst) {
+		return shard->shapefile;
 	}
-
-	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
+	
+	if (shard->shapefile != NULL) {
+		/* unlink the shard; it is relinked first below */
+		shard->prev->next = shard->next;
+		if (shard->next != NULL) {
+			shard->next->prev = shard->prev;
+		} else {
+			layer->openLast = shard->prev;
+		}
+	} else {
+		while (layer->openCount >= layer->maxOpen) {
+			shapefile_layerRelease(layer, layer->openLast);
+		}
 		
-		/* grab the attr provided for this field */
-		if (Tcl_ListObjIndex(interp, attrList, fieldId, &attr) != TCL_OK) {
-			return TCL_ERROR;
+		shapefile_streamHooks(&hooks);
+		if ((dbf = DBFOpenLL(shard->path, "rb", &hooks)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open attribute table for \"%s\"", shard->path));
+			return NULL;
+		}
+		if ((shp = SHPOpenLL(shard->path, "rb", &hooks)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to open shapefile for \"%s\"", shard->path));
+			DBFClose(dbf);
+			return NULL;
 		}
 		
-		/* validate this field */
-		if (cmd_attributes_validateField(interp, shapefile, fieldId, attr) != TCL_OK) {
-			return TCL_ERROR;
+		/* the counts and type read when the layer was opened must still hold */
+		if (shp->nRecords != shard->count || DBFGetRecordCount(dbf) != shard->count
+				|| shp->nShapeType != layer->shapeType) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("shapefile \"%s\" has changed since layer was opened", shard->path));
+			SHPClose(shp);
+			DBFClose(dbf);
+			return NULL;
+		}
+		
+		if ((shard->shapefile = shapefile_new(shard->path, shp, dbf, 1 /* readonly */, NULL)) == NULL) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to allocate shapefile data"));
+			SHPClose(shp);
+			DBFClose(dbf);
+			return NULL;
 		}
+		layer->openCount++;
 	}
 	
-	return TCL_OK;
+	shard->prev = NULL;
+	shard->next = layer->openFirst;
+	if (layer->openFirst != NULL) {
+		layer->openFirst->prev = shard;
+	} else {
+		layer->openLast = shard;
+	}
+	layer->openFirst = shard;
+	
+	return shard->shapefile;
 }
 
 /*
- * cmd_attributes_validateField
+ * shapefile_layerRelease
  * 
- * Confirm that a single attribute value conforms to the specified attribute
- * table field definition. Used by the cmd_attributes_validate function and
- * by the [$shp attributes write RECORD FIELD VALUE] action in contexts where
- * VALUE has previously been pre-validated.
+ * Close the shapefile of an open layer shard.
+ */
+void shapefile_layerRelease(
+		ShapefileLayerPtr layer,
+		ShapefileShardPtr shard) {
+	
+	if (shard->prev != NULL) {
+		shard->prev->next = shard->next;
+	} else {
+		layer->openFirst = shard->next;
+	}
+	if (shard->next != NULL) {
+		shard->next->prev = shard->prev;
+	} else {
+		layer->openLast = shard->prev;
+	}
+	shard->prev = NULL;
+	shard->next = NULL;
+	
+	shapefile_exit_handler(shard->shapefile);
+	ckfree((char *)shard->shapefile);
+	shard->shapefile = NULL;
+	layer->openCount--;
+}
+
+/*
+ * shapefile_layerLocate
+ * 
+ * Find the shard containing a global feature index of a layer.
  * 
  * Result:
- *   No Tcl result if the attribute value passes validation. Otherwise, errors
- *   may be thrown.
+ *   Index of the shard, with localId set to the feature's index within the
+ *   shard, or -1 if featureId is not a valid feature index.
  */
-int cmd_attributes_validateField(
+int shapefile_layerLocate(
+		ShapefileLayerPtr layer,
+		int featureId,
+		int *localId) {
+	
+	int low = 0, high = layer->shardCount - 1, middle;
+	
+	if (featureId < 0 || featureId >= layer->featureCount) {
+		return -1;
+	}
+	
+	/* the last shard that begins at or before featureId contains it; any
+	   empty shards that begin at the same index precede it */
+	while (low < high) {
+		middle = (low + high + 1) / 2;
+		if (layer->shards[middle].base <= featureId) {
+			low = middle;
+		} else {
+			high = middle - 1;
+		}
+	}
+	
+	*localId = featureId - layer->shards[low].base;
+	return low;
+}
+
+/*
+ * shapefile_layerAppend
+ * 
+ * Append the elements of the list in the interpreter result to list. If
+ * base is not negative, the elements are feature indices of a shard that
+ * begins at base, and are appended as global feature indices.
+ * 
+ * Result:
+ *   No Tcl result on success. Otherwise, throws error.
+ */
+int shapefile_layerAppend(
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int fieldId,
-		Tcl_Obj *attrValue) {
+		Tcl_Obj *list,
+		int base) {
 	
-	int fieldCount, width, precision, fieldType;
-	int intValue;
-	double doubleValue;
-	const char *stringValue;
-	char buffer[NUMERIC_BUFFER_SIZE];
+	Tcl_Obj **elements;
+	int elementCount, i, featureId;
+	
+	if (Tcl_ListObjGetElements(interp, Tcl_GetObjResult(interp), &elementCount, &elements) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	for (i = 0; i < elementCount; i++) {
+		if (base < 0) {
+			Tcl_ListObjAppendElement(interp, list, elements[i]);
+		} else {
+			if (Tcl_GetIntFromObj(interp, elements[i], &featureId) != TCL_OK) {
+				return TCL_ERROR;
+			}
+			Tcl_ListObjAppendElement(interp, list, Tcl_NewIntObj(base + featureId));
+		}
+	}
+	
+	Tcl_ResetResult(interp);
+	return TCL_OK;
+}
 
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	if (fieldId < 0 || fieldId >= fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+/*
+ * cmd_layer_dispatcher
+ * 
+ * Ensemble command dispatcher handles the layer identifier [$layer] returned
+ * by shapefile_layer_cmd. The clientData is the associated ShapefileLayerPtr.
+ * 
+ * Command Syntax:
+ *   [$layer attributes|close|coordinates|fields|info|locate|query ?args?]
+ *     Invokes the function handler associated with selected subcommand.
+ *     Unambiguous abbreviations are valid. The fields subcommand is that of
+ *     the first shapefile in the layer (see cmd_fields).
+ * 
+ * Result:
+ *   Result of the selected subcommand.
+ */
+int cmd_layer_dispatcher(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefilePtr shapefile;
+	int subcommandIndex;
+	static const char *subcommandNames[] = {
+			"attributes",
+			"close",
+			"coordinates",
+			"fields",
+			"info",
+			"locate",
+			"query",
+			NULL
+	};
+	int result;
+	
+	if (objc < 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?args?");
 		return TCL_ERROR;
 	}
 	
-	/* null fields are ok; validation doesn't need to set any result if OK */
-	if (attrValue == NULL || (Tcl_GetCharLength(attrValue) == 0)) {
-		return TCL_OK;
+	if (Tcl_GetIndexFromObj(interp, objv[1], subcommandNames, "subcommand",
+			0 /* not TCL_EXACT */, &subcommandIndex) != TCL_OK) {
+		return TCL_ERROR;
 	}
 	
-	fieldType = (int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, &width, &precision);
-	switch (fieldType) {
-		case FTInteger:
-			/* can this value be parsed as an integer? */
-			if (Tcl_GetIntFromObj(interp, attrValue, &intValue) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			if (shapefile->allowTruncation) {
-				break;
-			}
-			/* does this integer fit within the field width? */
-			if (snprintf(buffer, NUMERIC_BUFFER_SIZE, "%d", intValue) >= NUMERIC_BUFFER_SIZE) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("integer value too big for buffer"));
-				return TCL_ERROR;
-			}
-			if ((int)strlen(buffer) > width) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("integer value (%s) would be truncated to field width (%d)", buffer, width));
-				return TCL_ERROR;
-			}
-			break;
-		case FTDouble:
-			/* can this value be parsed as a double? */
-			if (Tcl_GetDoubleFromObj(interp, attrValue, &doubleValue) != TCL_OK) {
-				return TCL_ERROR;
-			}
-			/* does this double fit within the field width? */
-			/* disabling double width check now with conditional scientific notation output */
-			/*sprintf(numericStringValue, "%.*lf", precision, doubleValue);
-			if (strlen(numericStringValue) > width) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("double value (%s) would be truncated to field width (%d)", numericStringValue, width));
-				return TCL_ERROR;
-			}*/
-			break;
-		case FTString:
-			/* can this value be parsed as a string? */
-			if ((stringValue = Tcl_GetString(attrValue)) == NULL) {
-				return TCL_ERROR;
-			}
-			if (shapefile->allowTruncation) {
-				break;
-			}
-			/* does this string fit within the field width? */
-			if ((int)strlen(stringValue) > width) {
-				Tcl_SetObjResult(interp, Tcl_ObjPrintf("string value (%s) would be truncated to field width (%d)", stringValue, width));
-				return TCL_ERROR;
+	switch (subcommandIndex) {
+		case 0: result = cmd_layer_attributes (clientData, interp, objc, objv); break;
+		case 1: result = cmd_layer_close      (clientData, interp, objc, objv); break;
+		case 2: result = cmd_layer_coordinates(clientData, interp, objc, objv); break;
+		case 3:
+			/* all shards have the fields of the first */
+			if ((shapefile = shapefile_layerShard(interp, (ShapefileLayerPtr)clientData, 0)) == NULL) {
+				result = TCL_ERROR;
+			} else {
+				result = cmd_fields(shapefile, interp, objc, objv);
 			}
 			break;
+		case 4: result = cmd_layer_info       (clientData, interp, objc, objv); break;
+		case 5: result = cmd_layer_locate     (clientData, interp, objc, objv); break;
+		case 6: result = cmd_layer_query      (clientData, interp, objc, objv); break;
 		default:
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid subcommand index (%d)", subcommandIndex));
+			result = TCL_ERROR;
 			break;
 	}
-
-	return TCL_OK;	
+	
+	return result;
 }
 
 /*
- * cmd_attributes_readAll
+ * cmd_layer_close
  * 
- * Implements the [$shp attributes read] action of the [$shp attributes]
- * command, used to get a list of attribute value lists for all records.
+ * Implements the [$layer close] command.
  * 
  * Result:
- *   List containing an attribute value list for each record in shapefile.
+ *   No Tcl return value. Open shards are closed, $layer command is deleted,
+ *   and associated resources are released.
  */
-int cmd_attributes_readAll(
+int cmd_layer_close(
+		ClientData clientData,
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile) {
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	if (objc != 2) {
+		Tcl_WrongNumArgs(interp, 2, objv, NULL);
+		return TCL_ERROR;
+	}
+	
+	layer_exit_handler(clientData);
+	Tcl_DeleteCommand(interp, Tcl_GetString(objv[0]));
+	
+	return TCL_OK;
+}
 
-	Tcl_Obj *recordList;
-	int dbfCount, recordId;
+/*
+ * layer_exit_handler
+ * 
+ * Closes any open shards of the layer and releases its shard list. Invoked
+ * by [$layer close], when the layer command is deleted, and as exit handler.
+ * Has no effect on a layer that is already closed.
+ */
+void layer_exit_handler(ClientData clientData) {
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	int i;
+	
+	while (layer->openFirst != NULL) {
+		shapefile_layerRelease(layer, layer->openFirst);
+	}
+	for (i = 0; i < layer->shardCount; i++) {
+		ckfree(layer->shards[i].path);
+	}
+	if (layer->shards != NULL) {
+		ckfree((char *)layer->shards);
+	}
+	layer->shards = NULL;
+	layer->shardCount = 0;
+}
+
+/*
+ * layer_delete_handler
+ * 
+ * Deletes exit handler, closes the layer if still open, and releases layer
+ * resources. Invoked as delete handler of the layer command.
+ */
+void layer_delete_handler(ClientData clientData) {
+	Tcl_DeleteExitHandler((Tcl_ExitProc *)layer_exit_handler, clientData);
+	layer_exit_handler(clientData);
+	ckfree((char *)clientData);
+}
+
+/*
+ * cmd_layer_info
+ * 
+ * Implements the [$layer info] command used to query layer metadata.
+ * 
+ * Command Syntax:
+ *   [$layer info bounds ?FEATURE?]
+ *     Get the bounds of the layer (the union of its shapefiles' header
+ *     bounds) or of the specified feature.
+ *   [$layer info count]
+ *     Get the total number of features in the layer.
+ *   [$layer info open]
+ *     Get the number of shapefiles of the layer that are currently open.
+ *   [$layer info shards]
+ *     Get the paths of the layer's shapefiles, in feature index order.
+ *   [$layer info type ?option?]
+ *     Get the geometry type of the layer (see cmd_info_type).
+ * 
+ * Result:
+ *   As described under Command Syntax above.
+ */
+int cmd_layer_info(
+		ClientData clientData,
+		Tcl_Interp *interp,
+		int objc,
+		Tcl_Obj *CONST objv[]) {
+	
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	ShapefilePtr shapefile;
+	Tcl_Obj *result, *args[4];
+	double *values;
+	int optionIndex, featureId, localId, shardId, i;
+	static const char *optionNames[] = {"bounds", "count", "open", "shards", "type", NULL};
+	
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "option ?args?");
+		return TCL_ERROR;
+	}
 	
-	recordList = Tcl_NewListObj(0, NULL);
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-
-	for (recordId = 0; recordId < dbfCount; recordId++) {
-		
-		if (cmd_attributes_read(interp, shapefile, recordId) != TCL_OK) {
+	if (Tcl_GetIndexFromObj(interp, objv[2], optionNames, "option",
+			0 /* not TCL_EXACT */, &optionIndex) != TCL_OK) {
+		return TCL_ERROR;
+	}
+	
+	if (optionIndex == 4) {
+		/* type */
+		if ((shapefile = shapefile_layerShard(interp, layer, 0)) == NULL) {
 			return TCL_ERROR;
 		}
-					
-		if (Tcl_ListObjAppendElement(interp, recordList, Tcl_GetObjResult(interp)) != TCL_OK) {
+		return cmd_info_type(shapefile, interp, objc, objv);
+	}
+	
+	if (optionIndex == 0 && objc == 4) {
+		/* bounds of one feature, as reported by its shapefile */
+		if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
 			return TCL_ERROR;
 		}
-		
-		Tcl_ResetResult(interp);
+		if ((shardId = shapefile_layerLocate(layer, featureId, &localId)) == -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+			return TCL_ERROR;
+		}
+		if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL) {
+			return TCL_ERROR;
+		}
+		args[0] = objv[0];
+		args[1] = objv[1];
+		args[2] = objv[2];
+		args[3] = Tcl_NewIntObj(localId);
+		Tcl_IncrRefCount(args[3]);
+		i = cmd_info_bounds(shapefile, interp, 4, args);
+		Tcl_DecrRefCount(args[3]);
+		return i;
 	}
 	
-	Tcl_SetObjResult(interp, recordList);
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 3, objv, optionIndex == 0 ? "?index?" : NULL);
+		return TCL_ERROR;
+	}
+	
+	switch (optionIndex) {
+		case 0: /* bounds */
+			result = Tcl_NewListObj(0, NULL);
+			for (i = 0; i < 2; i++) {
+				values = i == 0 ? layer->min : layer->max;
+				Tcl_ListObjAppendElement(interp, result, Tcl_NewDoubleObj(values[0]));
+				Tcl_ListObjAppendElement(interp, result, Tcl_NewDoubleObj(values[1]));
+				if (layer->dimType == DIM_XYZM) {
+					Tcl_ListObjAppendElement(interp, result, Tcl_NewDoubleObj(values[2]));
+				}
+				if (layer->dimType != DIM_XY) {
+					Tcl_ListObjAppendElement(interp, result, Tcl_NewDoubleObj(values[3]));
+				}
+			}
+			break;
+		case 1: /* count */
+			result = Tcl_NewIntObj(layer->featureCount);
+			break;
+		case 2: /* open */
+			result = Tcl_NewIntObj(layer->openCount);
+			break;
+		default: /* shards */
+			result = Tcl_NewListObj(0, NULL);
+			for (i = 0; i < layer->shardCount; i++) {
+				Tcl_ListObjAppendElement(interp, result, Tcl_NewStringObj(layer->shards[i].path, -1));
+			}
+			break;
+	}
+	
+	Tcl_SetObjResult(interp, result);
 	return TCL_OK;
 }
 
 /*
- * cmd_attributes_read
+ * cmd_layer_coordinates
  * 
- * Implements the [$shp attributes read RECORD] action of the [$shp attributes]
- * command, used to get a list of attribute values for a specified record. Also
- * used by the [$shp attributes read] action to get each record value list.
+ * Implements the [$layer coordinates] command used to read feature geometry.
+ * 
+ * Command Syntax:
+ *   [$layer coordinates read]
+ *     Get the coordinates of all features in the layer.
+ *   [$layer coordinates read FEATURE]
+ *     Get the coordinates of the feature with global index FEATURE.
  * 
  * Result:
- *   List containing each attribute value from the specified record.
+ *   Feature coordinates, as returned by [$shp coordinates read].
  */
-int cmd_attributes_read(
+int cmd_layer_coordinates(
+		ClientData clientData,
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int recordId) {
+		int objc,
+		Tcl_Obj *CONST objv[]) {
 	
-	Tcl_Obj *attributes = Tcl_NewListObj(0, NULL);
-	int dbfCount, fieldId, fieldCount;
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	ShapefilePtr shapefile;
+	Tcl_Obj *features;
+	int actionIndex, featureId, localId, shardId;
+	static const char *actionNames[] = {"read", NULL};
 	
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-	if (recordId < 0 || recordId >= dbfCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "action ?args?");
+		return TCL_ERROR;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[2], actionNames, "action", TCL_EXACT, &actionIndex) != TCL_OK) {
 		return TCL_ERROR;
 	}
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	for (fieldId = 0; fieldId < fieldCount; fieldId++) {
-				
-		if (cmd_attributes_readField(interp, shapefile, recordId, fieldId) != TCL_OK) {
+	if (objc == 3) {
+		/* read each shard in turn, so no more than one need be open */
+		features = Tcl_NewListObj(0, NULL);
+		for (shardId = 0; shardId < layer->shardCount; shardId++) {
+			if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL
+					|| cmd_coordinates_readAll(interp, shapefile) != TCL_OK
+					|| shapefile_layerAppend(interp, features, -1) != TCL_OK) {
+				Tcl_DecrRefCount(features);
+				return TCL_ERROR;
+			}
+		}
+		Tcl_SetObjResult(interp, features);
+	} else if (objc == 4) {
+		if (Tcl_GetIntFromObj(interp, objv[3], &featureId) != TCL_OK) {
 			return TCL_ERROR;
 		}
-		
-		if (Tcl_ListObjAppendElement(interp, attributes, Tcl_GetObjResult(interp)) != TCL_OK) {
+		if ((shardId = shapefile_layerLocate(layer, featureId, &localId)) == -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
 			return TCL_ERROR;
 		}
-		
-		Tcl_ResetResult(interp);
+		if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL) {
+			return TCL_ERROR;
+		}
+		if (cmd_coordinates_read(interp, shapefile, localId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+	} else {
+		Tcl_WrongNumArgs(interp, 3, objv, "?index?");
+		return TCL_ERROR;
 	}
 	
-	Tcl_SetObjResult(interp, attributes);
 	return TCL_OK;
 }
 
 /*
- * cmd_attributes_readField
+ * cmd_layer_attributes
  * 
- * Implements the [$shp attributes read RECORD FIELD] action of the
- * [$shp attributes] command, used to get the value of a single attribute field
- * from the specified record. Also used by the [$shp attributes read RECORD]
- * action to get each value in a record.
+ * Implements the [$layer attributes] command used to read attribute data.
+ * 
+ * Command Syntax:
+ *   [$layer attributes read ?RECORD ?FIELD??]
+ *     Get attribute values as [$shp attributes read] does. RECORD is a
+ *     global index.
+ *   [$layer attributes search FIELD VALUE]
+ *     Return global indices of records that match the given field value.
  * 
  * Result:
- *   Value of the specified field from the specified record. NULL values are
- *   represented as empty strings ({}). Unsupported field type values are
- *   represented as strings (as stored within the DBF file).
+ *   As described under Command Syntax above.
  */
-int cmd_attributes_readField(
+int cmd_layer_attributes(
+		ClientData clientData,
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int recordId,
-		int fieldId) {
+		int objc,
+		Tcl_Obj *CONST objv[]) {
 	
-	int dbfCount, fieldCount, fieldType;
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	ShapefilePtr shapefile;
+	Tcl_Obj *records;
+	int actionIndex, recordId, localId, fieldId, shardId, result;
+	static const char *actionNames[] = {"read", "search", NULL};
 	
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-	if (recordId < 0 || recordId >= dbfCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+	if (objc < 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "action ?args?");
 		return TCL_ERROR;
 	}
-	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	if (fieldId < 0 || fieldId >= fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+	if (Tcl_GetIndexFromObj(interp, objv[2], actionNames, "action", TCL_EXACT, &actionIndex) != TCL_OK) {
 		return TCL_ERROR;
 	}
 	
-	/* return an empty object for null values */
-	if (DBFIsAttributeNULL(shapefile->dbf, recordId, fieldId)) {
-		Tcl_SetObjResult(interp, Tcl_NewObj());
-		return TCL_OK;
+	if (actionIndex == 0 && (objc == 4 || objc == 5)) {
+		/* read one record, or one field of one record */
+		if (Tcl_GetIntFromObj(interp, objv[3], &recordId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if (objc == 5 && Tcl_GetIntFromObj(interp, objv[4], &fieldId) != TCL_OK) {
+			return TCL_ERROR;
+		}
+		if ((shardId = shapefile_layerLocate(layer, recordId, &localId)) == -1) {
+			Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid record index %d", recordId));
+			return TCL_ERROR;
+		}
+		if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL) {
+			return TCL_ERROR;
+		}
+		if (objc == 4) {
+			return cmd_attributes_read(interp, shapefile, localId);
+		}
+		return cmd_attributes_readField(interp, shapefile, localId, fieldId);
 	}
 	
-	/* return an object of appropriate type for fieldId, unless raw requested */
-	fieldType = (int)DBFGetFieldInfo(shapefile->dbf, fieldId, NULL, NULL, NULL);
-	if (shapefile->readRawStrings) {
-		fieldType = FTString;
+	if (actionIndex == 0 && objc != 3) {
+		Tcl_WrongNumArgs(interp, 3, objv, "?recordIndex ?fieldIndex??");
+		return TCL_ERROR;
 	}
-	switch (fieldType) {
-		case FTInteger:
-			Tcl_SetObjResult(interp, Tcl_NewIntObj(DBFReadIntegerAttribute(shapefile->dbf, recordId, fieldId)));
-			break;
-		case FTDouble:
-			Tcl_SetObjResult(interp, Tcl_NewDoubleObj(DBFReadDoubleAttribute(shapefile->dbf, recordId, fieldId)));
-			break;
-		case FTString:
-		default:
-			Tcl_SetObjResult(interp, Tcl_NewStringObj(DBFReadStringAttribute(shapefile->dbf, recordId, fieldId), -1));
-			break;
+	if (actionIndex == 1 && objc != 5) {
+		Tcl_WrongNumArgs(interp, 3, objv, "FIELD VALUE");
+		return TCL_ERROR;
+	}
+	if (actionIndex == 1 && Tcl_GetIntFromObj(interp, objv[3], &fieldId) != TCL_OK) {
+		return TCL_ERROR;
 	}
 	
-	return TCL_OK;	
+	/* read or search all records, one shard at a time */
+	records = Tcl_NewListObj(0, NULL);
+	for (shardId = 0; shardId < layer->shardCount; shardId++) {
+		if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL) {
+			Tcl_DecrRefCount(records);
+			return TCL_ERROR;
+		}
+		if (actionIndex == 0) {
+			result = cmd_attributes_readAll(interp, shapefile);
+		} else {
+			result = cmd_attributes_search(interp, shapefile, fieldId, objv[4]);
+		}
+		if (result != TCL_OK || shapefile_layerAppend(interp, records,
+				actionIndex == 0 ? -1 : layer->shards[shardId].base) != TCL_OK) {
+			Tcl_DecrRefCount(records);
+			return TCL_ERROR;
+		}
+	}
+	
+	Tcl_SetObjResult(interp, records);
+	return TCL_OK;
 }
 
 /*
- * cmd_attributes_search
+ * cmd_layer_locate
  * 
- * Implements the [$shp attributes search FIELD VALUE] action of the [$shp
- * attributes] command, used to determine the record index of features that
- * match the given attribute field value. Matching is currently performed by
- * raw string value comparison. Matches must be exact.
+ * Implements the [$layer locate FEATURE] command used to find the shapefile
+ * that contains a feature of the layer.
  * 
  * Result:
- *   List of feature indices that match the attribute search query.
- *   Empty list if no matches.
+ *   List containing the path of the shapefile and the feature's index in it.
  */
-int cmd_attributes_search(
+int cmd_layer_locate(
+		ClientData clientData,
 		Tcl_Interp *interp,
-		ShapefilePtr shapefile,
-		int fieldId,
-		Tcl_Obj *attrValue) {
+		int objc,
+		Tcl_Obj *CONST objv[]) {
 	
-	int dbfCount, recordId, fieldCount;
-	const char *searchValue, *fieldValue;
-	Tcl_Obj *hitList;
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	Tcl_Obj *location;
+	int featureId, localId, shardId;
 	
-	fieldCount = DBFGetFieldCount(shapefile->dbf);
-	if (fieldId < 0 || fieldId >= fieldCount) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid field index %d", fieldId));
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "index");
 		return TCL_ERROR;
 	}
-	
-	if ((searchValue = Tcl_GetString(attrValue)) == NULL) {
+	if (Tcl_GetIntFromObj(interp, objv[2], &featureId) != TCL_OK) {
 		return TCL_ERROR;
 	}
-	
-	hitList = Tcl_NewListObj(0, NULL);
-	dbfCount = DBFGetRecordCount(shapefile->dbf);
-	
-	for (recordId = 0; recordId < dbfCount; recordId++) {
-		
-		fieldValue = DBFReadStringAttribute(shapefile->dbf, recordId, fieldId);
-		
-		if (strcmp(fieldValue, searchValue) == 0) {
-			if (Tcl_ListObjAppendElement(interp, hitList, Tcl_NewIntObj(recordId)) != TCL_OK) {
-				return TCL_ERROR;
-			}
-		}
+	if ((shardId = shapefile_layerLocate(layer, featureId, &localId)) == -1) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid feature index %d", featureId));
+		return TCL_ERROR;
 	}
 	
-	Tcl_SetObjResult(interp, hitList);
+	location = Tcl_NewListObj(0, NULL);
+	Tcl_ListObjAppendElement(interp, location, Tcl_NewStringObj(layer->shards[shardId].path, -1));
+	Tcl_ListObjAppendElement(interp, location, Tcl_NewIntObj(localId));
+	Tcl_SetObjResult(interp, location);
 	return TCL_OK;
 }
 
 /*
- * cmd_write
- * 
- * Implements the [$shp write] command used to add a new feature and attribute
- * record to the shapefile.
+ * cmd_layer_query
  * 
- * Command Syntax:
- *   [$shp write COORDINATES ATTRIBUTES]
- *     Append a new entity to $shp. COORDINATES contains feature geometry and
- *     ATTRIBUTES contains attribute values. See [coordinates] and [attributes]
- *     commands for details on the format of these arguments.
+ * Implements the [$layer query BOUNDS] command used to find the features
+ * whose bounding boxes intersect BOUNDS, given as {xmin ymin xmax ymax}.
+ * Shapefiles whose header bounds do not intersect BOUNDS are not opened.
+ * Feature bounds are read from raw records without decoding vertices.
  * 
  * Result:
- *   Index number of the new feature.
+ *   List of global indices of intersecting features. Null features are
+ *   never included.
  */
-int cmd_write(
+int cmd_layer_query(
 		ClientData clientData,
 		Tcl_Interp *interp,
 		int objc,
 		Tcl_Obj *CONST objv[]) {
-
-	ShapefilePtr shapefile = (ShapefilePtr)clientData;
-	int outputFeatureId, outputAttributeId;
-	
-	if (objc != 4) {
-		Tcl_WrongNumArgs(interp, 2, objv, "coordinates attributes");
-		return TCL_ERROR;
-	}
 	
-	if (shapefile->readonly) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write to readonly shapefile"));
-		return TCL_ERROR;
-	}
+	ShapefileLayerPtr layer = (ShapefileLayerPtr)clientData;
+	ShapefileShardPtr shard;
+	ShapefilePtr shapefile;
+	struct shapefile_buffer input;
+	unsigned char record[52];
+	Tcl_Obj **boundsElements, *hits;
+	double bounds[4], min[4], max[4];
+	int boundsCount, shardId, featureId, size;
 	
-	/* pre-validate attributes before writing anything */
-	if (cmd_attributes_validate(interp, shapefile, objv[3]) != TCL_OK) {
+	if (objc != 3) {
+		Tcl_WrongNumArgs(interp, 2, objv, "bounds");
 		return TCL_ERROR;
 	}
-	Tcl_ResetResult(interp);
 	
-	/* write the new feature coords (nothing written if coordWrite fails) */
-	if (cmd_coordinates_write(interp, shapefile, -1, objv[2]) != TCL_OK) {
+	if (Tcl_ListObjGetElements(interp, objv[2], &boundsCount, &boundsElements) != TCL_OK) {
 		return TCL_ERROR;
 	}
-	if (Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &outputFeatureId) != TCL_OK) {
+	if (boundsCount != 4) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("bounds must be a list of 4 values (xmin ymin xmax ymax)"));
 		return TCL_ERROR;
 	}
-	Tcl_ResetResult(interp);
-	
-	/* write the pre-validated attribute record */
-	if (cmd_attributes_write(interp, shapefile, -1, 0, objv[3]) != TCL_OK) {
-		return TCL_ERROR;
+	for (boundsCount = 0; boundsCount < 4; boundsCount++) {
+		if (Tcl_GetDoubleFromObj(interp, boundsElements[boundsCount], &bounds[boundsCount]) != TCL_OK) {
+			return TCL_ERROR;
+		}
 	}
-	if (Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp), &outputAttributeId) != TCL_OK) {
+	if (bounds[0] > bounds[2] || bounds[1] > bounds[3]) {
+		Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid bounds (minimum exceeds maximum)"));
 		return TCL_ERROR;
 	}
-
-	/* assert that the new feature and attribute record ids match */
-	if (outputFeatureId != outputAttributeId) {
-		Tcl_SetObjResult(interp, Tcl_ObjPrintf("new coord index (%d) does not match new attribute record index (%d)", outputFeatureId, outputAttributeId));
-		return TCL_ERROR;
+	
+	hits = Tcl_NewListObj(0, NULL);
+	for (shardId = 0; shardId < layer->shardCount; shardId++) {
+		shard = &layer->shards[shardId];
+		if (shard->count == 0
+				|| shard->min[0] > bounds[2] || shard->max[0] < bounds[0]
+				|| shard->min[1] > bounds[3] || shard->max[1] < bounds[1]) {
+			continue;
+		}
+		
+		if ((shapefile = shapefile_layerShard(interp, layer, shardId)) == NULL) {
+			Tcl_DecrRefCount(hits);
+			return TCL_ERROR;
+		}
+		
+		memset(&input, 0, sizeof(struct shapefile_buffer));
+		input.hooks = &shapefile->shp->sHooks;
+		input.file = shapefile->shp->fpSHP;
+		
+		for (featureId = 0; featureId < shard->count; featureId++) {
+			
+			/* the record header, shape type, and bounding box (or point) suffice */
+			size = (int)shapefile->shp->panRecSize[featureId] + 8;
+			if (size > (int)sizeof(record)) {
+				size = (int)sizeof(record);
+			}
+			if (!shapefile_bufferRead(&input, shapefile->shp->panRecOffset[featureId], record, size)) {
+				Tcl_SetObjResult(interp, Tcl_ObjPrintf("failed to read feature %d of \"%s\"", featureId, shard->path));
+				shapefile_bufferRelease(&input);
+				Tcl_DecrRefCount(hits);
+				return TCL_ERROR;
+			}
+			if (!shapefile_recordBounds(record + 8, size - 8, min, max)
+					|| min[0] > bounds[2] || max[0] < bounds[0]
+					|| min[1] > bounds[3] || max[1] < bounds[1]) {
+				continue;
+			}
+			Tcl_ListObjAppendElement(interp, hits, Tcl_NewIntObj(shard->base + featureId));
+		}
+		shapefile_bufferRelease(&input);
 	}
 	
-	/* result is new entity id, as set by attrWrite */
+	Tcl_SetObjResult(interp, hits);
 	return TCL_OK;
 }
-
@@ -304,6 +304,22 @@ test attr-2.18 {
 	error
 } -match glob -result "invalid record index *"
 
+test attr-2.19 {
+# confirm sequential reads see records written between them
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set before [$shp attr read]
+	$shp attr write 200 [lreplace [lindex $before 200] 0 0 99]
+	set after [$shp attr read]
+	list [lindex $after 200 0] [expr {[lrange $after 0 199] eq [lrange $before 0 199]}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset before after
+} -result {99 1}
+
 #
 # [attr write] action
 #
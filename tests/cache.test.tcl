@@ -0,0 +1,158 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+#
+# feature and attribute record cache (cacheSize config option)
+#
+
+test cache-1.0 {
+# repeated reads of a feature are served from the cache
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+} -body {
+	set first [$shp coord read 5]
+	set second [$shp coord read 5]
+	set stats [$shp file cache]
+	list [expr {$first eq $second}] [dict get $stats entries] [dict get $stats hits] [dict get $stats misses]
+} -cleanup {
+	$shp close
+	unset first second stats
+} -result {1 1 1 1}
+
+test cache-1.1 {
+# repeated reads of an attribute record are served from the cache
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+} -body {
+	set first [$shp attr read 5]
+	set second [$shp attr read 5]
+	set stats [$shp file cache]
+	list [expr {$first eq $second}] [dict get $stats entries] [dict get $stats hits] [dict get $stats misses]
+} -cleanup {
+	$shp close
+	unset first second stats
+} -result {1 1 1 1}
+
+test cache-1.2 {
+# cached features are formatted according to the current config options
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+} -body {
+	$shp coord read 0
+	$shp config getAllCoordinates 1
+	$shp coord read 0
+} -cleanup {
+	$shp close
+} -result {{12.453386544971766 41.903282179960115 0.0 0.0}}
+
+test cache-1.3 {
+# writing a feature or record replaces its cached value
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+	$shp config cacheSize 1048576
+} -body {
+	$shp coord read 5
+	set attrs [$shp attr read 5]
+	$shp coord write 5 {{1 2}}
+	$shp attr write 5 0 99
+	list [$shp coord read 5] [lindex [$shp attr read 5] 0] [expr {[lrange [$shp attr read 5] 1 end] eq [lrange $attrs 1 end]}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset attrs
+} -result {{{1.0 2.0}} 99 1}
+
+test cache-1.4 {
+# least recently used entries are discarded to stay within cacheSize
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+	$shp coord read 0
+	set entrySize [dict get [$shp file cache] used]
+	$shp config cacheSize [expr {$entrySize * 2 + $entrySize / 2}]
+} -body {
+	$shp coord read 0
+	$shp coord read 1
+	$shp coord read 2
+	set stats [$shp file cache]
+	set result [list [dict get $stats entries] [expr {[dict get $stats used] <= [dict get $stats size]}]]
+	set hits [dict get $stats hits]
+	$shp coord read 2
+	lappend result [expr {[dict get [$shp file cache] hits] - $hits}]
+	$shp coord read 0
+	lappend result [expr {[dict get [$shp file cache] hits] - $hits}]
+} -cleanup {
+	$shp close
+	unset entrySize stats result hits
+} -result {2 1 1 1}
+
+test cache-1.5 {
+# setting cacheSize to 0 empties and disables the cache
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+} -body {
+	$shp coord read 0
+	$shp attr read 0
+	$shp config cacheSize 0
+	$shp coord read 0
+	set stats [$shp file cache]
+	list [dict get $stats entries] [dict get $stats used] [dict get $stats misses]
+} -cleanup {
+	$shp close
+	unset stats
+} -result {0 0 2}
+
+test cache-1.6 {
+# changing readRawStrings discards cached attribute records
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	$shp config cacheSize 1048576
+} -body {
+	set formatted [$shp attr read 0]
+	$shp config readRawStrings 1
+	set raw [$shp attr read 0]
+	list [dict get [$shp file cache] hits] [expr {$raw eq $formatted}]
+} -cleanup {
+	$shp close
+	unset formatted raw
+} -result {0 0}
+
+test cache-1.7 {
+# rewriting a shapefile in place discards the cache
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+	$shp config cacheSize 1048576
+} -body {
+	$shp coord read 0
+	set next [$shp coord read 1]
+	$shp delete 0
+	$shp compact
+	expr {[$shp coord read 0] eq $next}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset next
+} -result {1}
+
+::tcltest::cleanupTests
@@ -0,0 +1,157 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+test compact-1.0 {
+# invoke compact cmd with too many arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp compact -output tmp/foo bar
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test compact-1.1 {
+# invoke compact cmd with invalid option
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp compact -foo tmp/foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {invalid option "-foo"*}
+
+test compact-1.2 {
+# attempt to compact a readonly shapefile in place
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp compact
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {cannot compact readonly shapefile in place*}
+
+test compact-2.0 {
+# compact a readonly shapefile to a new output shapefile
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	set count [$shp compact -output tmp/foo]
+	set out [shapefile tmp/foo readonly]
+	set result [list \
+			[expr {$count == [$shp info count]}] \
+			[expr {[$out info count] == [$shp info count]}] \
+			[expr {[$out info type] eq [$shp info type]}] \
+			[expr {[$out info bounds] eq [$shp info bounds]}] \
+			[expr {[$out coord read] eq [$shp coord read]}] \
+			[expr {[$out attr read] eq [$shp attr read]}] \
+			[expr {[$out fields list] eq [$shp fields list]}]]
+	$out close
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1 1 1 1 1}
+
+test compact-2.1 {
+# compact xyzm features to a new output shapefile, preserving z and m bounds
+} -setup {
+	set shp [shapefile sample/xyzm/arcz readonly]
+} -body {
+	$shp compact -output tmp/foo
+	set out [shapefile tmp/foo readonly]
+	set result [list \
+			[expr {[$out info bounds] eq [$shp info bounds]}] \
+			[expr {[$out info bounds 0] eq [$shp info bounds 0]}] \
+			[expr {[$out coord read] eq [$shp coord read]}]]
+	$out close
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1}
+
+test compact-2.2 {
+# compact in place reclaims space orphaned by an enlarged feature
+} -setup {
+	foreach f [glob sample/xy/arc.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set coords [$shp coord read 0]
+	lappend coords {*}$coords
+	$shp coord write 0 $coords
+	set expected [$shp coord read]
+	set before [file size tmp/foo.shp]
+	set count [$shp compact]
+	list [expr {$count == [$shp info count]}] \
+			[expr {[file size tmp/foo.shp] < $before}] \
+			[expr {[$shp coord read] eq $expected}] \
+			[$shp file mode]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1 readwrite}
+
+test compact-2.3 {
+# confirm in-place compaction leaves no temporary files behind
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	$shp compact
+	lsort [glob -tails -directory tmp foo*]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {foo.dbf foo.shp foo.shx}
+
+test compact-2.4 {
+# confirm a failed in-place compaction restores and reopens the original
+# files (the .shx cannot be moved aside onto a nonempty directory)
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+	$shp delete 0
+	set expected [$shp coord read]
+	file mkdir tmp/foo-shapetcl-old.shx
+	close [open tmp/foo-shapetcl-old.shx/bar w]
+} -body {
+	list [catch {$shp compact} message] $message \
+			[$shp info count] \
+			[expr {[$shp coord read] eq $expected}] \
+			[lsort [glob -tails -directory tmp foo*]]
+} -cleanup {
+	$shp close
+	file delete -force tmp/foo-shapetcl-old.shx
+	file delete {*}[glob tmp/foo.*]
+	unset shp expected message
+} -result {1 {failed to replace "tmp/foo.shx"} 243 1 {foo-shapetcl-old.shx foo.dbf foo.shp foo.shx}}
+
+::tcltest::cleanupTests
@@ -0,0 +1,125 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+test concat-1.0 {
+# invoke concat with too few arguments
+} -body {
+	shapetcl::concatShapefiles tmp/foo
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test concat-1.1 {
+# attempt to concatenate shapefiles of different types
+} -body {
+	shapetcl::concatShapefiles tmp/foo sample/xy/point sample/xy/arc
+} -cleanup {
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -returnCodes {
+	error
+} -match glob -result {shape type of "sample/xy/arc" does not match *}
+
+test concat-1.2 {
+# attempt to concatenate shapefiles with different attribute fields
+} -setup {
+	set shp [shapefile tmp/bar point {integer id 10 0}]
+	$shp write {{0 0}} 1
+	$shp close
+} -body {
+	shapetcl::concatShapefiles tmp/foo sample/xy/point tmp/bar
+} -cleanup {
+	file delete {*}[glob -nocomplain tmp/foo.* tmp/bar.*]
+} -returnCodes {
+	error
+} -match glob -result {attribute fields of "tmp/bar" do not match}
+
+test concat-1.3 {
+# attempt to concatenate shapefiles with differently named attribute fields
+} -setup {
+	set shp [shapefile tmp/bar point {integer id 10 0}]
+	$shp close
+	set shp [shapefile tmp/baz point {integer key 10 0}]
+	$shp close
+} -body {
+	set result [catch {shapetcl::concatShapefiles tmp/foo tmp/bar tmp/baz} message]
+	list $result $message [glob -nocomplain tmp/foo.*]
+} -cleanup {
+	file delete {*}[glob -nocomplain tmp/foo.* tmp/bar.* tmp/baz.*]
+} -result {1 {attribute field 0 of "tmp/baz" does not match} {}}
+
+test concat-1.4 {
+# attempt to write output over an input shapefile
+} -body {
+	shapetcl::concatShapefiles sample/xy/point.shp sample/xy/point
+} -returnCodes {
+	error
+} -match glob -result {output path "sample/xy/point.shp" is also an input}
+
+test concat-1.5 {
+# attempt to concatenate a nonexistent shapefile
+} -body {
+	shapetcl::concatShapefiles tmp/foo sample/xy/point tmp/nonexistent
+} -cleanup {
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -returnCodes {
+	error
+} -match glob -result {failed to open attribute table for "tmp/nonexistent"}
+
+test concat-2.0 {
+# concatenate a shapefile with itself twice; records are repeated in order
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	set count [shapetcl::concatShapefiles tmp/foo sample/xy/polygon sample/xy/polygon.shp sample/xy/polygon]
+	set out [shapefile tmp/foo readonly]
+	set coords [$shp coord read]
+	set attrs [$shp attr read]
+	set result [list \
+			[expr {$count == 3 * [$shp info count]}] \
+			[expr {[$out info count] == $count}] \
+			[expr {[$out info bounds] eq [$shp info bounds]}] \
+			[expr {[$out coord read] eq [concat $coords $coords $coords]}] \
+			[expr {[$out attr read] eq [concat $attrs $attrs $attrs]}]]
+	$out close
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1 1 1}
+
+test concat-2.1 {
+# concatenate shapefiles with different extents; bounds are merged
+} -setup {
+	set shp [shapefile tmp/bar pointz {integer id 10 0}]
+	$shp write {{1 2 3 4}} 1
+	$shp close
+	set shp [shapefile tmp/baz pointz {integer id 10 0}]
+	$shp write {{-1 5 -3 8}} 2
+	$shp write {{0 0 0 0}} 3
+	$shp close
+} -body {
+	shapetcl::concatShapefiles tmp/foo tmp/bar tmp/baz
+	set out [shapefile tmp/foo readonly]
+	set result [list [$out info bounds] [$out coord read] [$out attr read]]
+	$out close
+	set result
+} -cleanup {
+	file delete {*}[glob -nocomplain tmp/foo.* tmp/bar.* tmp/baz.*]
+} -result {{-1.0 0.0 -3.0 0.0 1.0 5.0 3.0 8.0} {{{1.0 2.0 3.0 4.0}} {{-1.0 5.0 -3.0 8.0}} {{0.0 0.0 0.0 0.0}}} {1 2 3}}
+
+::tcltest::cleanupTests
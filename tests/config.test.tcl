@@ -295,4 +295,50 @@ test config-2.7 {
 	file delete {*}[glob -nocomplain tmp/config-2-7.*]
 } -result {abcde}
 
+test config-2.8 {
+# confirm function of skipDeleted config option on read and search actions
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/config-2-8[file extension $f]
+	}
+	set shp [shapefile tmp/config-2-8 readwrite]
+} -body {
+	set value [$shp attr read 1 0]
+	$shp delete 1
+	set before [list [llength [$shp coord read 1]] [expr {1 in [$shp attr search 0 $value]}]]
+	$shp config skipDeleted 1
+	set coords [$shp coord read]
+	set attrs [$shp attr read]
+	list {*}$before [$shp config skipDeleted] \
+			[$shp coord read 1] [$shp attr read 1] [$shp attr read 1 0] \
+			[lindex $coords 1] [lindex $attrs 1] \
+			[expr {[llength $coords] == [$shp info count]}] \
+			[expr {1 in [$shp attr search 0 $value]}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob -nocomplain tmp/config-2-8.*]
+} -result {1 1 1 {} {} {} {} {} 1 0}
+
+test config-2.9 {
+# get and set the cacheSize config option
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	list [$shp config cacheSize] [$shp config cacheSize 65536] [$shp config cacheSize]
+} -cleanup {
+	$shp close
+} -result {0 65536 65536}
+
+test config-2.10 {
+# invoke config command with invalid cacheSize value
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp config cacheSize -1
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {invalid cache size *}
+
 ::tcltest::cleanupTests
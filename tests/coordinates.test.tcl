@@ -161,6 +161,106 @@ test coord-2.8 {
 	file delete {*}[glob tmp/foo.*]
 } -result {}
 
+test coord-2.9 {
+# invoke [coord read -threads] with non-integer thread count
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -threads foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "expected integer but got *"
+
+test coord-2.10 {
+# invoke [coord read -threads] with invalid thread count
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -threads 0
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "invalid thread count *"
+
+test coord-2.11 {
+# confirm [coord read -threads] matches [coord read] for each sample type
+} -setup {
+	set shps {}
+	foreach name {point multipoint arc polygon} {
+		lappend shps [shapefile sample/xy/$name readonly]
+	}
+} -body {
+	set result {}
+	foreach shp $shps {
+		lappend result [expr {[$shp coord read -threads 4] eq [$shp coord read]}]
+	}
+	set result
+} -cleanup {
+	foreach shp $shps {
+		$shp close
+	}
+} -result {1 1 1 1}
+
+test coord-2.12 {
+# confirm [coord read -threads] with more threads than features
+} -setup {
+	set shp [shapefile tmp/foo point {integer Id 10 0}]
+	$shp write {{1 2}} {0}
+	$shp write {} {1}
+	$shp write {{3 4}} {2}
+} -body {
+	$shp coord read -threads 8
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {{{1.0 2.0}} {} {{3.0 4.0}}}
+
+test coord-2.13 {
+# confirm [coord read -threads] returns empty list for empty shapefile
+} -setup {
+	set shp [shapefile tmp/foo point {integer Id 10 0}]
+} -body {
+	$shp coord read -threads 2
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {}
+
+test coord-2.14 {
+# confirm [coord read -threads] reads deleted features as empty if skipDeleted
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+	$shp delete {1 100}
+	$shp config skipDeleted 1
+} -body {
+	set features [$shp coord read -threads 3]
+	list [llength $features] [lindex $features 1] [lindex $features 100] [expr {[lindex $features 0] eq [$shp coord read 0]}]
+} -cleanup {
+	unset features
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {243 {} {} 1}
+
+test coord-2.15 {
+# confirm sequential reads see features written between them
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set before [$shp coord read]
+	$shp coord write 200 {{1 2}}
+	set after [$shp coord read]
+	list [lindex $after 200] [expr {[lrange $after 0 199] eq [lrange $before 0 199]}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset before after
+} -result {{{1.0 2.0}} 1}
+
 #
 # [coord write] action
 #
@@ -929,4 +1029,551 @@ test coord-7.10 {
 	file delete {*}[glob tmp/islands.*]
 } -result {{0.0 10.0 10.0 10.0 10.0 0.0 0.0 0.0 0.0 10.0} {13.0 7.0 17.0 7.0 17.0 3.0 13.0 3.0 13.0 7.0}}
 
+#
+# [coord read -async] action
+#
+
+# Async read callback; records each call in ::asyncCalls and sets ::asyncDone
+# on the final call.
+proc asyncCollect {ids features} {
+	lappend ::asyncCalls [list $ids $features]
+	if {[llength $ids] == 0} {
+		set ::asyncDone 1
+	}
+}
+
+test coord-8.0 {
+# invoke [coord read -async] without a callback
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -async
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "missing -command option"
+
+test coord-8.1 {
+# invoke [coord read -async] with an invalid option
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -async -command asyncCollect -foo 1
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "bad option *"
+
+test coord-8.2 {
+# invoke [coord read -async] with an invalid chunk size
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -async -command asyncCollect -chunk 0
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "invalid chunk size *"
+
+test coord-8.3 {
+# invoke [coord read -async] with invalid bounds
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp coord read -async -command asyncCollect -bbox {0 0 1}
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result "bounds must be a list of 4 values *"
+
+test coord-8.4 {
+# confirm [coord read -async] passes all features in chunks, then a final empty call
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set ::asyncCalls {}
+	set ::asyncDone 0
+} -body {
+	$shp coord read -async -command asyncCollect -chunk 100
+	vwait ::asyncDone
+	set ids {}
+	set features {}
+	foreach call $::asyncCalls {
+		lappend ids {*}[lindex $call 0]
+		lappend features {*}[lindex $call 1]
+	}
+	list [llength $::asyncCalls] [lindex $::asyncCalls end] [llength $ids] [lindex $ids 0] [lindex $ids end] [expr {$features eq [$shp coord read]}]
+} -cleanup {
+	$shp close
+	unset ids features
+} -result {4 {{} {}} 243 0 242 1}
+
+test coord-8.5 {
+# confirm [coord read -async -bbox] passes only features within bounds
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set ::asyncCalls {}
+	set ::asyncDone 0
+} -body {
+	$shp coord read -async -command asyncCollect -bbox {0 40 20 50}
+	vwait ::asyncDone
+	set ids {}
+	foreach call $::asyncCalls {
+		lappend ids {*}[lindex $call 0]
+	}
+	set expected {}
+	set i 0
+	foreach feature [$shp coord read] {
+		lassign [lindex $feature 0] x y
+		if {$x >= 0 && $x <= 20 && $y >= 40 && $y <= 50} {
+			lappend expected $i
+		}
+		incr i
+	}
+	list [expr {[llength $ids] > 0}] [expr {$ids eq $expected}]
+} -cleanup {
+	$shp close
+	unset ids expected i feature x y
+} -result {1 1}
+
+test coord-8.6 {
+# confirm closing a shapefile cancels its async reads without callbacks
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set ::asyncCalls {}
+} -body {
+	$shp coord read -async -command asyncCollect -chunk 1
+	$shp close
+	update
+	llength $::asyncCalls
+} -result {0}
+
+test coord-8.7 {
+# confirm a callback error is reported in the background and stops the read
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set ::asyncCalls {}
+	set ::asyncError {}
+	set handler [interp bgerror {}]
+	interp bgerror {} {apply {{message options} {set ::asyncError $message}}}
+} -body {
+	$shp coord read -async -command {apply {{ids features} {
+		lappend ::asyncCalls $ids
+		error "callback failed"
+	}}} -chunk 10
+	vwait ::asyncError
+	after 100 {set ::asyncWait 1}
+	vwait ::asyncWait
+	list $::asyncError [llength $::asyncCalls]
+} -cleanup {
+	$shp close
+	interp bgerror {} $handler
+	unset handler
+} -result {{callback failed} 1}
+
+test coord-8.8 {
+# confirm coordinates cannot be written while an async read is pending
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite]
+	set ::asyncDone 0
+} -body {
+	$shp coord read -async -command asyncCollect
+	set result [list [catch {$shp coord write 0 {{1 2}}} message] $message]
+	vwait ::asyncDone
+	lappend result [$shp coord write 0 {{1 2}}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset result message
+} -result {1 {cannot write coordinates during asynchronous read} 0}
+
+#
+# coordinates read -simplify
+#
+
+test coord-9.0 {
+# attempt to simplify with a negative tolerance
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -simplify -1
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid tolerance -1}
+
+test coord-9.1 {
+# attempt to simplify with an unknown method
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -simplify 1 -method bezier
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {bad method "bezier": must be dp or vw}
+
+test coord-9.2 {
+# Douglas-Peucker and Visvalingam-Whyatt simplification of an arc
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 11 10.1 12 10 13 15 14 10 15 10.2 16 10}} 0
+} -body {
+	list [$shp coord read 0 -simplify 0.5] [$shp coord read 0 -simplify 0.5 -method vw] \
+			[$shp coord read 0 -simplify 0]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{{10.0 10.0 12.0 10.0 13.0 15.0 14.0 10.0 16.0 10.0}} {{10.0 10.0 12.0 10.0 13.0 15.0 14.0 10.0 16.0 10.0}} {{10.0 10.0 11.0 10.1 12.0 10.0 13.0 15.0 14.0 10.0 15.0 10.2 16.0 10.0}}}
+
+test coord-9.3 {
+# simplified rings stay closed and keep at least four vertices
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 15 20.1 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 0
+} -body {
+	set result {}
+	foreach method {dp vw} {
+		foreach tolerance {0.6 1000} {
+			set rings {}
+			foreach ring [$shp coord read 0 -simplify $tolerance -method $method] {
+				lappend rings [expr {[llength $ring] / 2}] \
+						[expr {[lrange $ring 0 1] eq [lrange $ring end-1 end]}]
+			}
+			lappend result $rings
+		}
+	}
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp result method tolerance rings ring
+} -result {{5 1 5 1} {4 1 4 1} {5 1 5 1} {4 1 4 1}}
+
+test coord-9.4 {
+# simplify all features; points are not simplified, deleted features are empty
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 11 10.1 12 10}} 0
+	$shp write {{10 10 20 20}} 1
+	$shp delete 1
+	$shp configure skipDeleted 1
+	set pts [shapefile sample/xy/point readonly]
+} -body {
+	list [$shp coord read -simplify 1] \
+			[expr {[$pts coord read -simplify 1000] eq [$pts coord read]}]
+} -cleanup {
+	$shp close
+	$pts close
+	file delete {*}[glob tmp/foo.*]
+	unset shp pts
+} -result {{{{10.0 10.0 12.0 10.0}} {}} 1}
+
+test coord-9.5 {
+# simplification keeps Z and M values of kept vertices
+} -setup {
+	set shp [shapefile tmp/foo arcz {integer id 10 0}]
+	$shp write {{10 10 1 5 11 10.1 2 6 12 10 3 7}} 0
+} -body {
+	$shp coord read 0 -simplify 1
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{10.0 10.0 1.0 5.0 12.0 10.0 3.0 7.0}}
+
+test coord-9.6 {
+# attempt to choose a simplification method without simplifying
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -method vw
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {-method requires -simplify}
+
+#
+# coordinates read -transform and -viewport
+#
+
+test coord-10.0 {
+# attempt to transform with a malformed matrix
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -transform {1 0 0 1}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid transform "1 0 0 1": must be a list of 6 values}
+
+test coord-10.1 {
+# attempt to map onto an empty viewport
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -viewport {0 0 0 10 100 100}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid viewport "0 0 0 10 100 100": bounds and size must be nonempty}
+
+test coord-10.2 {
+# affine transform of an arc, keeping z and m values
+} -setup {
+	set shp [shapefile tmp/foo arcz {integer id 10 0}]
+	$shp write {{10 10 1 5 12 11 2 6}} 0
+} -body {
+	$shp coord read 0 -transform {2 0 1 0 -1 100}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{21.0 90.0 1.0 5.0 25.0 89.0 2.0 6.0}}
+
+test coord-10.3 {
+# viewport mapping rounds to pixels and drops repeated pixels
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{-170 -80 -170 80 -169.9 80.1 170 80 170 -80 -170 -80}} 0
+} -body {
+	$shp coord read 0 -viewport {-180 -90 180 90 360 180}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{10.0 170.0 10.0 10.0 350.0 10.0 350.0 170.0 10.0 170.0}}
+
+test coord-10.4 {
+# transform and viewport compose; points are mapped but never dropped
+} -setup {
+	set shp [shapefile tmp/foo multipoint {integer id 10 0}]
+	$shp write {{10 10 10 10 30 20}} 0
+	$shp write {{20 20}} 1
+} -body {
+	$shp coord read -transform {1 0 -10 0 1 -10} -viewport {0 0 20 10 40 20}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{{0.0 20.0 0.0 20.0 40.0 0.0}} {{20.0 0.0}}}
+
+test coord-10.5 {
+# simplify before transforming
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 11 10.1 12 10}} 0
+} -body {
+	$shp coord read 0 -transform {10 0 0 0 10 0} -simplify 1
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{100.0 100.0 120.0 100.0}}
+
+#
+# coordinates read and write -project
+#
+
+proc roundCoords {feature} {
+	set parts {}
+	foreach part $feature {
+		set coords {}
+		foreach coord $part {
+			lappend coords [format %.2f $coord]
+		}
+		lappend parts $coords
+	}
+	return $parts
+}
+
+test coord-11.0 {
+# attempt to read with an unknown projection
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -project {lonlat utm}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {bad projection "utm": must be lonlat, webmercator, equirectangular, or mollweide}
+
+test coord-11.1 {
+# attempt to read with a malformed projection
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -project lonlat
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid projection "lonlat": must be a list of 2 projection names}
+
+test coord-11.2 {
+# read geographic coordinates in built-in projections
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{-122.5 37.7 10 50}} 0
+} -body {
+	set result {}
+	foreach to {webmercator equirectangular mollweide} {
+		lappend result [roundCoords [$shp coord read 0 -project [list lonlat $to]]]
+	}
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp result to
+} -result {{{-13636637.62 4537132.13 1113194.91 6446275.84}} {{-13636637.62 4196744.80 1113194.91 5565974.54}} {{-10616121.36 4530729.84 760633.19 5873471.96}}}
+
+test coord-11.3 {
+# write projected coordinates as geographic coordinates
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+} -body {
+	$shp coord write {{-1113194.91 -1118889.97 -1113194.91 1118889.97 1113194.91 1118889.97 1113194.91 -1118889.97 -1113194.91 -1118889.97}} -project {webmercator lonlat}
+	roundCoords [$shp coord read 0]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{-10.00 -10.00 -10.00 10.00 10.00 10.00 10.00 -10.00 -10.00 -10.00}}
+
+test coord-11.4 {
+# projections between built-in projections round trip
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{-122.5 37.7 10 50 179 -85}} 0
+} -body {
+	set mollweide [$shp coord read 0 -project {lonlat mollweide}]
+	set mercator [$shp coord read 0 -project {lonlat webmercator}]
+	$shp coord write 0 $mollweide -project {mollweide equirectangular}
+	list [roundCoords [$shp coord read 0 -project {equirectangular webmercator}]] [roundCoords $mercator]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp mollweide mercator
+} -result {{{-13636637.62 4537132.13 1113194.91 6446275.84 19926188.85 -19971868.88}} {{-13636637.62 4537132.13 1113194.91 6446275.84 19926188.85 -19971868.88}}}
+
+test coord-11.5 {
+# attempt to project coordinates outside the projection
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+} -body {
+	$shp coord write {{0 90 10 10}} -project {lonlat webmercator}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -returnCodes {
+	error
+} -result {cannot project coordinates from lonlat to webmercator: coordinates out of range}
+
+test coord-11.6 {
+# project before mapping onto a viewport
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{-90 0 90 45}} 0
+} -body {
+	$shp coord read 0 -project {lonlat equirectangular} -viewport {-20037508.34 -10018754.17 20037508.34 10018754.17 360 180}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{90.0 90.0 270.0 45.0}}
+
+rename roundCoords {}
+
+#
+# coordinates read -clip
+#
+
+test coord-12.0 {
+# attempt to clip with a malformed window
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -clip {1 2 3}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid clip window "1 2 3": must be a list of 4 values}
+
+test coord-12.1 {
+# attempt to clip with an inverted window
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp coord read 0 -clip {3 2 1 4}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid clip window "3 2 1 4": minimum exceeds maximum}
+
+test coord-12.2 {
+# clip polygons; features outside are empty, features inside are unchanged
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 30 30 30 30 10 10 10} {12 12 18 12 18 18 12 18 12 12}} 0
+	$shp write {{100 100 100 110 110 110 110 100 100 100}} 1
+	$shp write {{16 16 16 24 24 24 24 16 16 16}} 2
+} -body {
+	$shp coord read -clip {15 15 25 25}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{{25.0 25.0 25.0 15.0 15.0 15.0 15.0 25.0 25.0 25.0} {15.0 15.0 18.0 15.0 18.0 18.0 15.0 18.0 15.0 15.0}} {} {{16.0 16.0 16.0 24.0 24.0 24.0 24.0 16.0 16.0 16.0}}}
+
+test coord-12.3 {
+# clip arcs, splitting parts and interpolating z and m values
+} -setup {
+	set shp [shapefile tmp/foo arcz {integer id 10 0}]
+	$shp write {{10 10 0 0 20 10 10 10 20 20 20 20 10 20 30 30}} 0
+} -body {
+	list [$shp coord read 0 -clip {12 5 25 25}] [$shp coord read 0 -clip {12 5 15 25}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{{12.0 10.0 2.0 2.0 20.0 10.0 10.0 10.0 20.0 20.0 20.0 20.0 12.0 20.0 28.0 28.0}} {{12.0 10.0 2.0 2.0 15.0 10.0 5.0 5.0} {15.0 20.0 25.0 25.0 12.0 20.0 28.0 28.0}}}
+
+test coord-12.4 {
+# clip multipoints and combine clipping with projection
+} -setup {
+	set shp [shapefile tmp/foo multipoint {integer id 10 0}]
+	$shp write {{10 10 20 20 30 30}} 0
+} -body {
+	list [$shp coord read -clip {15 15 30 30}] [$shp coord read 0 -clip {40 40 50 50}] \
+			[llength [lindex [$shp coord read 0 -project {lonlat webmercator} -clip {2000000 0 4000000 4000000}] 0]]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{{{20.0 20.0 30.0 30.0}}} {} 4}
+
 ::tcltest::cleanupTests
@@ -0,0 +1,128 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+test delete-1.0 {
+# invoke delete cmd with too few arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp delete
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test delete-1.1 {
+# invoke undelete cmd with too many arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp undelete 0 1
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test delete-1.2 {
+# attempt to delete a record from a readonly shapefile
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp delete 0
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {cannot delete records in readonly mode}
+
+test delete-1.3 {
+# attempt to delete an invalid feature index; no records should be flagged
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set result [catch {$shp delete [list 0 [$shp info count]]} message]
+	list $result $message [$shp info deleted]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -match glob -result {1 {invalid feature index *} {}}
+
+test delete-1.4 {
+# attempt to delete a non-integer feature index
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	$shp delete {0 foo}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -returnCodes {
+	error
+} -match glob -result {expected integer *}
+
+test delete-2.0 {
+# delete and undelete records; flags persist after the shapefile is reopened
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	$shp delete {3 1 2}
+	$shp undelete 2
+	set count [$shp info count]
+	$shp close
+	set shp [shapefile tmp/foo readonly]
+	list [$shp info deleted] [$shp info deleted 1] [$shp info deleted 2] \
+			[expr {[$shp info count] == $count}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {{1 3} 1 0 1}
+
+test delete-2.1 {
+# compact removes deleted records and preserves the others in order
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set coords [lreplace [$shp coord read] 1 1]
+	set attrs [lreplace [$shp attr read] 1 1]
+	set count [$shp info count]
+	$shp delete 1
+	list [expr {[$shp compact] == $count - 1}] \
+			[expr {[$shp info count] == $count - 1}] \
+			[$shp info deleted] \
+			[expr {[$shp coord read] eq $coords}] \
+			[expr {[$shp attr read] eq $attrs}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 {} 1 1}
+
+::tcltest::cleanupTests
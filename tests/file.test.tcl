@@ -92,6 +92,43 @@ test file-1.6 {
 	$shp close
 } -result {sample/xy/point}
 
+test file-1.7 {
+# confirm file shared reports whether the shapefile was opened with -shared
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set shared [shapefile sample/xy/point readonly -shared]
+} -body {
+	list [$shp file shared] [$shared file shared] [$shared file mode]
+} -cleanup {
+	$shp close
+	$shared close
+} -result {0 1 readonly}
+
+test file-1.8 {
+# confirm file cache reports an empty, disabled cache by default
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp file cache
+} -cleanup {
+	$shp close
+} -result {size 0 used 0 entries 0 hits 0 misses 0}
+
+test file-1.9 {
+# confirm file indexed reports whether the .shx index has been loaded
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set lazy [shapefile sample/xy/point readonly -lazy]
+} -body {
+	set before [$lazy file indexed]
+	$lazy coord read 0
+	list [$shp file indexed] $before [$lazy file indexed]
+} -cleanup {
+	$shp close
+	$lazy close
+	unset before
+} -result {1 0 1}
+
 # lots of other path variations to consider, including filesystem tricks.
 
 ::tcltest::cleanupTests
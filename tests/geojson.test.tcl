@@ -0,0 +1,357 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+# Return the contents of a text file.
+proc slurp {path} {
+	set f [open $path r]
+	set text [read $f]
+	close $f
+	return $text
+}
+
+# Write text to a file.
+proc spew {path text} {
+	set f [open $path w]
+	puts -nonewline $f $text
+	close $f
+}
+
+# Create tmp/foo with a polygon with a hole, a multipolygon with null
+# attributes, and a null feature.
+proc makeSample {} {
+	set shp [shapefile tmp/foo polygon {integer id 10 0 string name 20 0 double val 12 3}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} {1 "a \"q\" b\\" 1.5}
+	$shp write {{0 0 0 5 5 5 5 0 0 0} {30 30 30 35 35 35 35 30 30 30}} {2 {} {}}
+	$shp write {} {3 null 0.1}
+	return $shp
+}
+
+#
+# export subcommand
+#
+
+test geojson-1.0 {
+# attempt to export with missing arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp export geojson
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test geojson-1.1 {
+# attempt to export to an unknown format
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set f [open tmp/foo.json w]
+} -body {
+	$shp export kml $f
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f
+	file delete tmp/foo.json
+} -returnCodes {
+	error
+} -result {bad format "kml": must be geojson}
+
+test geojson-1.2 {
+# attempt to export to a channel not opened for writing
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp export geojson stdin
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {channel "stdin" wasn't opened for writing}
+
+test geojson-1.3 {
+# attempt to export with invalid options
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set f [open tmp/foo.json w]
+} -body {
+	list \
+		[catch {$shp export geojson $f -bbox {0 0 1}} message] $message \
+		[catch {$shp export geojson $f -bbox {1 0 0 1}} message] $message \
+		[catch {$shp export geojson $f -fields {nope}} message] $message \
+		[catch {$shp export geojson $f -precision 16} message] $message
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f message
+	file delete tmp/foo.json
+} -match glob -result {1 {invalid bbox "0 0 1": must be a list of 4 values} 1 {invalid bbox "1 0 0 1": minimum exceeds maximum} 1 {field named "nope" not found} 1 {invalid precision 16: must be from 0 to 15}}
+
+test geojson-1.4 {
+# export polygons, holes, null attributes, and null geometry
+} -setup {
+	set shp [makeSample]
+	set f [open tmp/foo.json w]
+} -body {
+	set count [$shp export geojson $f]
+	close $f
+	list $count [slurp tmp/foo.json]
+} -cleanup {
+	$shp close
+	unset shp f count
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result {3 {{"type":"FeatureCollection","features":[
+{"type":"Feature","id":0,"properties":{"id":1,"name":"a \"q\" b\\","val":1.5},"geometry":{"type":"Polygon","coordinates":[[[10,10],[20,10],[20,20],[10,20],[10,10]],[[12,12],[12,14],[14,14],[14,12],[12,12]]]}},
+{"type":"Feature","id":1,"properties":{"id":2,"name":null,"val":null},"geometry":{"type":"MultiPolygon","coordinates":[[[[0,0],[5,0],[5,5],[0,5],[0,0]]],[[[30,30],[35,30],[35,35],[30,35],[30,30]]]]}},
+{"type":"Feature","id":2,"properties":{"id":3,"name":"null","val":0.1},"geometry":null}
+]}
+}}
+
+test geojson-1.5 {
+# export selected fields of features within a bounding box
+} -setup {
+	set shp [makeSample]
+	set f [open tmp/foo.json w]
+} -body {
+	set count [$shp export geojson $f -fields {name} -bbox {0 0 6 6}]
+	close $f
+	list $count [slurp tmp/foo.json]
+} -cleanup {
+	$shp close
+	unset shp f count
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result {1 {{"type":"FeatureCollection","features":[
+{"type":"Feature","id":1,"properties":{"name":null},"geometry":{"type":"MultiPolygon","coordinates":[[[[0,0],[5,0],[5,5],[0,5],[0,0]]],[[[30,30],[35,30],[35,35],[30,35],[30,30]]]]}}
+]}
+}}
+
+test geojson-1.6 {
+# export coordinates rounded to a fixed precision
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+	$shp write {{1.23456 -0.000049}} 1
+	$shp write {{2.5 1e20}} 2
+	$shp write {{-1e300 1234567.125}} 3
+	set f [open tmp/foo.json w]
+} -body {
+	$shp export geojson $f -precision 2
+	close $f
+	slurp tmp/foo.json
+} -cleanup {
+	$shp close
+	unset shp f
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result {{"type":"FeatureCollection","features":[
+{"type":"Feature","id":0,"properties":{"id":1},"geometry":{"type":"Point","coordinates":[1.23,0]}},
+{"type":"Feature","id":1,"properties":{"id":2},"geometry":{"type":"Point","coordinates":[2.5,1e+20]}},
+{"type":"Feature","id":2,"properties":{"id":3},"geometry":{"type":"Point","coordinates":[-1e+300,1234567.13]}}
+]}
+}
+
+#
+# import command
+#
+
+test geojson-2.0 {
+# attempt to import with missing arguments
+} -body {
+	shapetcl::import geojson
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test geojson-2.1 {
+# attempt to import into a readonly shapefile
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	spew tmp/foo.json {{"type":"FeatureCollection","features":[]}}
+	set f [open tmp/foo.json r]
+} -body {
+	shapetcl::import geojson $f $shp
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f
+	file delete tmp/foo.json
+} -returnCodes {
+	error
+} -result {cannot write to readonly shapefile}
+
+test geojson-2.2 {
+# attempt to import invalid GeoJSON
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+} -body {
+	set result {}
+	foreach text {
+		{{"type":"FeatureCollection"}}
+		{{"type":"FeatureCollection","features":{}}}
+		{{"type":"FeatureCollection","features":[{"type":"Feature"}, {"type":tru}]}}
+		{{"type":"FeatureCollection","features":[{"type":"Feature","geometry":{"type":"LineString","coordinates":[[0,0],[1,1]]}}]}}
+	} {
+		spew tmp/foo.json $text
+		set f [open tmp/foo.json r]
+		catch {shapetcl::import geojson $f $shp} message
+		close $f
+		lappend result $message
+	}
+	set result
+} -cleanup {
+	$shp close
+	unset shp f text result message
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -match glob -result {{invalid GeoJSON: missing features array} {invalid GeoJSON: features is not an array} {invalid GeoJSON feature 1: *} {failed to import GeoJSON feature 0: cannot import LineString geometry to point shapefile}}
+
+test geojson-2.3 {
+# import exported features
+} -setup {
+	set shp [makeSample]
+	set f [open tmp/foo.json w]
+	$shp export geojson $f
+	close $f
+	$shp close
+	set shp [shapefile tmp/bar polygon {integer id 10 0 string name 20 0 double val 12 3}]
+	set f [open tmp/foo.json r]
+} -body {
+	set count [shapetcl::import geojson $f $shp]
+	list $count [$shp coord read] [lrange [$shp attr read] 1 end] \
+		[string equal [lindex [$shp attr read 0] 1] "a \"q\" b\\"]
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f count
+	file delete {*}[glob -nocomplain tmp/foo.* tmp/bar.*]
+} -result {3 {{{10.0 10.0 10.0 20.0 20.0 20.0 20.0 10.0 10.0 10.0} {12.0 12.0 14.0 12.0 14.0 14.0 12.0 14.0 12.0 12.0}} {{0.0 0.0 0.0 5.0 5.0 5.0 5.0 0.0 0.0 0.0} {30.0 30.0 30.0 35.0 35.0 35.0 35.0 30.0 30.0 30.0}} {}} {{2 {} {}} {3 null 0.1}} 1}
+
+test geojson-2.4 {
+# import points with missing dimensions and unmatched properties
+} -setup {
+	set shp [shapefile tmp/foo multipointm {integer id 10 0}]
+	spew tmp/foo.json {{"type":"FeatureCollection","features":[
+		{"type":"Feature","properties":{"id":7,"extra":[1,{"a":true}]},"geometry":{"type":"Point","coordinates":[1.5,-2e1]}},
+		{"type":"Feature","properties":null,"geometry":{"type":"MultiPoint","coordinates":[[1,2,3,4],[5,6]]}}
+	]}}
+	set f [open tmp/foo.json r]
+} -body {
+	set count [shapetcl::import geojson $f $shp]
+	list $count [$shp coord read] [$shp attr read]
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f count
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result {2 {{{1.5 -20.0 0.0}} {{1.0 2.0 4.0 5.0 6.0 0.0}}} {7 {{}}}}
+
+test geojson-2.5 {
+# import more exported text than fits in one read or write buffer
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0 string name 40 0}]
+	for {set i 0} {$i < 2000} {incr i} {
+		$shp write [list [list $i 0.125 [expr {$i + 1}] -0.25]] [list $i "feature \{$i\}"]
+	}
+	set f [open tmp/foo.json w]
+	$shp export geojson $f
+	close $f
+	set out [shapefile tmp/bar arc {integer id 10 0 string name 40 0}]
+	set f [open tmp/foo.json r]
+} -body {
+	list [expr {[file size tmp/foo.json] > 65536}] [shapetcl::import geojson $f $out] \
+		[expr {[$out coord read] eq [$shp coord read]}] \
+		[expr {[$out attr read] eq [$shp attr read]}]
+} -cleanup {
+	close $f
+	$shp close
+	$out close
+	unset shp out f i
+	file delete {*}[glob -nocomplain tmp/foo.* tmp/bar.*]
+} -result {1 2000 1 1}
+
+test geojson-2.6 {
+# attempt to import text that is not valid JSON; only the null feature
+# before the trailing comma is imported
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+} -body {
+	set result {}
+	foreach text {
+		{{"features":[[1]]}}
+		{{"features":[1,"x"]}}
+		{{"features":[],}}
+		{{"features":[{"type":"Feature","geometry":null},]}}
+		{{"features" []}}
+		{{"features":[}}
+		{{"features":[]}x}
+		{{"features":[{"type":"Feature","geometry":{"type":"Point","coordinates":[1,2,]}}]}}
+		{{"features":[{"type":"Feature","geometry":{"type":"Point","coordinates":[01,2]}}]}}
+		{{"features":[{"type":"Feature","geometry":{"type":"Point","coordinates":[1.,2]}}]}}
+		{{"features":[{"type":"Feature","geometry":{"type":"Point","coordinates":[1e999,2]}}]}}
+		{{"features":[{"type":"Feature","geometry":{"type":"Point","coordinates":["Inf",2]}}]}}
+	} {
+		spew tmp/foo.json $text
+		set f [open tmp/foo.json r]
+		catch {shapetcl::import geojson $f $shp} message
+		close $f
+		lappend result $message
+	}
+	lappend result [$shp info count]
+} -cleanup {
+	$shp close
+	unset shp f text result message
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result [list \
+	{invalid GeoJSON: feature 0 is not a Feature object} \
+	{invalid GeoJSON: feature 0 is not a Feature object} \
+	"invalid GeoJSON: unexpected \"\}\"" \
+	{invalid GeoJSON: unexpected "]"} \
+	{invalid GeoJSON: unexpected "["} \
+	"invalid GeoJSON: unbalanced \"\}\"" \
+	{invalid GeoJSON: unexpected "x"} \
+	{invalid GeoJSON: unexpected "]"} \
+	{invalid GeoJSON feature 0: invalid number} \
+	{invalid GeoJSON feature 0: invalid number} \
+	{invalid GeoJSON feature 0: number out of range} \
+	{failed to import GeoJSON feature 0: invalid position "Inf 2": values must be finite numbers} \
+	1]
+
+test geojson-2.7 {
+# import into a shapefile opened with -lazy
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+	$shp write {{0 0}} 1
+	$shp close
+	spew tmp/foo.json {{"type":"FeatureCollection","features":[
+		{"type":"Feature","properties":{"id":2},"geometry":{"type":"Point","coordinates":[1,2]}}
+	]}}
+	set shp [shapefile tmp/foo readwrite -lazy]
+	set f [open tmp/foo.json r]
+} -body {
+	set count [shapetcl::import geojson $f $shp]
+	$shp close
+	set shp [shapefile tmp/foo readonly]
+	list $count [$shp coord read] [$shp attr read]
+} -cleanup {
+	close $f
+	$shp close
+	unset shp f count
+	file delete {*}[glob -nocomplain tmp/foo.*]
+} -result {1 {{{0.0 0.0}} {{1.0 2.0}}} {1 2}}
+
+::tcltest::cleanupTests
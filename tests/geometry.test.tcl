@@ -0,0 +1,316 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+#
+# geometry subcommand
+#
+
+test geometry-1.0 {
+# attempt to compute an unknown measure
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp geometry volume
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {bad measure "volume": must be area, centroid, length, repair, or validate}
+
+test geometry-1.1 {
+# attempt to measure an invalid feature
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp geometry area {0 1 999}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid feature index 999}
+
+test geometry-1.2 {
+# geometry with too many arguments
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp geometry area 0 1
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: should be "* geometry measure ?features|-all?"}
+
+test geometry-2.0 {
+# area, perimeter, and centroid of a polygon with a hole
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 1
+} -body {
+	set centroid [lindex [$shp geometry centroid] 0]
+	list [$shp geometry area] [$shp geometry length] [format {%.6f %.6f} {*}$centroid]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp centroid
+} -result {96.0 48.0 {15.083333 15.083333}}
+
+test geometry-2.1 {
+# length and centroid of arcs; arcs have no area
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 13 14}} 1
+	$shp write {{10 10 20 10} {10 20 20 20}} 2
+} -body {
+	list [$shp geometry area] [$shp geometry length] [$shp geometry centroid]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{0.0 0.0} {5.0 20.0} {{11.5 12.0} {15.0 15.0}}}
+
+test geometry-2.2 {
+# points and multipoints have no area or length; centroid is the mean point
+} -setup {
+	set shp [shapefile tmp/foo multipoint {integer id 10 0}]
+	$shp write {{10 10 20 10 15 40}} 1
+} -body {
+	list [$shp geometry area] [$shp geometry length] [$shp geometry centroid]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {0.0 0.0 {{15.0 20.0}}}
+
+test geometry-2.3 {
+# null features, and deleted features if skipDeleted is set, are empty
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {} 1
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 2
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 3
+	$shp delete 2
+	$shp config skipDeleted 1
+} -body {
+	list [$shp geometry area] [$shp geometry centroid]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{0.0 100.0 0.0} {{} {15.0 15.0} {}}}
+
+test geometry-2.4 {
+# selected features are measured in the order given
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 13 14}} 1
+	$shp write {{10 10 20 10}} 2
+} -body {
+	list [$shp geometry length {1 0 1}] [$shp geometry length -all] [$shp geometry length {}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{10.0 5.0 10.0} {5.0 10.0} {}}
+
+test geometry-3.0 {
+# native areas of sample polygons match a Tcl shoelace computation
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+	proc shoelace {feature} {
+		set total 0.0
+		foreach ring $feature {
+			set sum 0.0
+			for {set i 0} {$i < [llength $ring] - 2} {incr i 2} {
+				lassign [lrange $ring $i [expr {$i + 3}]] x1 y1 x2 y2
+				set sum [expr {$sum + $x1 * $y2 - $x2 * $y1}]
+			}
+			set total [expr {$total + $sum / 2.0}]
+		}
+		return [expr {abs($total)}]
+	}
+} -body {
+	set mismatches 0
+	foreach area [$shp geometry area] feature [$shp coord read] {
+		set expected [shoelace $feature]
+		if {abs($area - $expected) > 1e-9 * max(1.0, $expected)} {
+			incr mismatches
+		}
+	}
+	set mismatches
+} -cleanup {
+	$shp close
+	rename shoelace {}
+	unset shp mismatches area feature expected
+} -result 0
+
+# overwrite the vertices of the first feature, assumed to have one part,
+# bypassing the closing and rewinding done by [$shp coordinates write]
+proc patchVertices {path bytes} {
+	set f [open $path.shp r+]
+	fconfigure $f -translation binary
+	seek $f 156
+	puts -nonewline $f $bytes
+	close $f
+}
+
+test geometry-4.0 {
+# valid features, including a polygon with a hole, have no issues
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 1
+	$shp write {{0 0 0 10 10 10 10 0 0 0}} 2
+} -body {
+	$shp geometry validate
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{} {}}
+
+test geometry-4.1 {
+# self-intersecting polygon rings and arcs; overlapping rings are also
+# wound as if one were a hole of the other
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{0 0 10 10 10 0 0 4 0 0}} 1
+	$shp write {{0 0 0 10 10 10 10 0 0 0} {5 5 15 5 15 15 5 15 5 5}} 2
+	set arc [shapefile tmp/bar arc {integer id 10 0}]
+	$arc write {{0 0 10 10 10 0 0 10}} 1
+	$arc write {{0 0 10 0 5 0 5 5}} 2
+	$arc write {{0 0 10 0} {0 5 10 5}} 3
+} -body {
+	list [$shp geometry validate] [$arc geometry validate]
+} -cleanup {
+	$shp close
+	$arc close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset shp arc
+} -result {{selfintersection {winding selfintersection}} {selfintersection selfintersection {}}}
+
+test geometry-4.2 {
+# degenerate arc parts and polygon rings
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{0 0 5 5 10 10 0 0}} 1
+	set arc [shapefile tmp/bar arc {integer id 10 0}]
+	$arc write {{5 5 5 5}} 1
+} -body {
+	list [$shp geometry validate] [$arc geometry validate]
+} -cleanup {
+	$shp close
+	$arc close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset shp arc
+} -result {degenerate degenerate}
+
+test geometry-4.3 {
+# unclosed, counterclockwise, and not finite polygon rings
+} -setup {
+	foreach {path bytes} [list \
+			tmp/foo [binary format q* {0 0 0 10 10 10 10 0 5 0}] \
+			tmp/bar [binary format q* {0 0 10 0 10 10 0 10 0 0}] \
+			tmp/baz [binary format q*H16 {0 0 0 10 10 10 10 0 0} 000000000000f87f]] {
+		set shp [shapefile $path polygon {integer id 10 0}]
+		$shp write {{0 0 0 10 10 10 10 0 0 0}} 1
+		$shp close
+		patchVertices $path $bytes
+	}
+} -body {
+	set result {}
+	foreach path {tmp/foo tmp/bar tmp/baz} {
+		set shp [shapefile $path readonly]
+		lappend result [$shp geometry validate 0]
+		$shp close
+	}
+	set result
+} -cleanup {
+	file delete {*}[glob tmp/foo.* tmp/bar.* tmp/baz.*]
+	unset shp path bytes result
+} -result {unclosed winding {{nan unclosed}}}
+
+test geometry-5.0 {
+# repair to a new shapefile
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{0 0 0 10 10 10 10 0 0 0}} 1
+	$shp write {{20 20 20 30 30 30 30 20 20 20}} 2
+	$shp write {{0 0 5 5 10 10 0 0}} 3
+	$shp close
+	patchVertices tmp/foo [binary format q* {0 0 10 0 10 10 10 10 0 10}]
+	set shp [shapefile tmp/foo readonly]
+} -body {
+	set count [$shp geometry repair -output tmp/bar]
+	set repaired [shapefile tmp/bar readonly]
+	list $count [$shp geometry validate] [$repaired geometry validate] \
+			[$repaired coord read] [$repaired attr read]
+} -cleanup {
+	$shp close
+	$repaired close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset shp repaired count
+} -result {2 {{unclosed winding} {} degenerate} {{} {} {}} {{{0.0 0.0 0.0 10.0 10.0 10.0 10.0 0.0 0.0 0.0}} {{20.0 20.0 20.0 30.0 30.0 30.0 30.0 20.0 20.0 20.0}} {}} {1 2 3}}
+
+test geometry-5.1 {
+# repair in place
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{0 0 0 10 10 10 10 0 0 0}} 1
+	$shp close
+	patchVertices tmp/foo [binary format q* {0 0 10 0 10 10 0 10 0 0}]
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	list [$shp geometry repair] [$shp geometry validate] [$shp geometry repair]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {1 {{}} 0}
+
+test geometry-5.2 {
+# attempt to repair a readonly shapefile in place
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp geometry repair
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {cannot repair readonly shapefile in place (use -output)}
+
+test geometry-5.3 {
+# attempt to repair with an invalid option
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp geometry repair -into tmp/foo
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid option "-into": should be -output}
+
+rename patchVertices {}
+
+::tcltest::cleanupTests
@@ -296,4 +296,38 @@ test info-4.5 {
 	$shp close
 } -result {xyzm} 
 
+test info-5.0 {
+# confirm [info deleted] reports no deleted records for a sample shapefile
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	list [$shp info deleted] [$shp info deleted 0]
+} -cleanup {
+	$shp close
+} -result {{} 0}
+
+test info-5.1 {
+# invoke [info deleted] with an invalid record index
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp info deleted -1
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {invalid record index *}
+
+test info-5.2 {
+# invoke [info deleted] with too many arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp info deleted 0 1
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
 ::tcltest::cleanupTests
@@ -0,0 +1,124 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+# Copy sample/xy/arc to tmp/foo and replace its .shx record offsets with the
+# values they would wrap to if the .shp were 8 GB larger, as in an index of
+# an oversized shapefile.
+proc wrapOffsets {} {
+	foreach f [glob sample/xy/arc.*] {file copy $f tmp/foo[file extension $f]}
+	set f [open tmp/foo.shx r+]
+	fconfigure $f -translation binary
+	set count [expr {([file size tmp/foo.shx] - 100) / 8}]
+	for {set i 0} {$i < $count} {incr i} {
+		seek $f [expr {100 + 8 * $i}]
+		binary scan [read $f 4] I offset
+		seek $f [expr {100 + 8 * $i}]
+		puts -nonewline $f [binary format I [expr {($offset + 0x7FFFFFFF) & 0xFFFFFFFF}]]
+	}
+	close $f
+}
+
+#
+# -largeFile open option
+#
+
+test largeFile-1.0 {
+# attempt to combine -largeFile and -lazy
+} -body {
+	shapefile sample/xy/point readonly -largeFile -lazy
+} -returnCodes {
+	error
+} -result {-largeFile option cannot be combined with -lazy or -shared}
+
+test largeFile-1.1 {
+# offsets of a shapefile are unchanged when recovered from record headers
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+	set large [shapefile sample/xy/arc readonly -largeFile]
+} -body {
+	list [expr {[$large coord read] eq [$shp coord read]}] \
+			[expr {[$large info count] == [$shp info count]}]
+} -cleanup {
+	$shp close
+	$large close
+} -result {1 1}
+
+test largeFile-1.2 {
+# wrapped index offsets are recovered from record headers
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+	wrapOffsets
+	set large [shapefile tmp/foo readonly -largeFile]
+} -body {
+	list [expr {[$large coord read] eq [$shp coord read]}] \
+			[expr {[$large coord read 7] eq [$shp coord read 7]}]
+} -cleanup {
+	$shp close
+	$large close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1}
+
+test largeFile-1.3 {
+# wrapped index offsets cannot be read without -largeFile
+} -setup {
+	wrapOffsets
+	set shp [shapefile tmp/foo readonly]
+} -body {
+	$shp coord read 1
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -returnCodes {
+	error
+} -result {failed to read feature 1}
+
+test largeFile-1.4 {
+# attempt to open a shapefile with fewer records than its index
+} -setup {
+	foreach f [glob sample/xy/arc.*] {file copy $f tmp/foo[file extension $f]}
+	set size [expr {[file size tmp/foo.shp] - 8}]
+	set f [open tmp/foo.shp r+]
+	chan truncate $f $size
+	close $f
+} -body {
+	shapefile tmp/foo readonly -largeFile
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+	unset f size
+} -returnCodes {
+	error
+} -match glob -result {failed to recover offset of feature * of "tmp/foo"}
+
+test largeFile-1.5 {
+# write and compact a shapefile opened with -largeFile
+} -setup {
+	wrapOffsets
+	set shp [shapefile tmp/foo readwrite -largeFile]
+	set expected [$shp coord read 2]
+} -body {
+	set id [$shp coord write {{1 2 3 4}}]
+	$shp delete 0
+	$shp compact
+	list [expr {[$shp coord read 1] eq $expected}] [$shp coord read [expr {$id - 1}]]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset expected id
+} -result {1 {{1.0 2.0 3.0 4.0}}}
+
+::tcltest::cleanupTests
@@ -0,0 +1,360 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+# Create point shapefiles tmp/shard0, tmp/shard1, ... with the given number
+# of features each. Feature k of shard i is located at (10i+k+10 10i+k+10),
+# and its id attribute is 10i+k.
+proc makeShards {counts} {
+	set paths {}
+	for {set i 0} {$i < [llength $counts]} {incr i} {
+		set shp [shapefile tmp/shard$i point {integer id 10 0 string name 10 0}]
+		for {set k 0} {$k < [lindex $counts $i]} {incr k} {
+			set v [expr {10 * $i + $k}]
+			$shp write [list [list [expr {$v + 10}] [expr {$v + 10}]]] [list $v shard$i]
+		}
+		$shp close
+		lappend paths tmp/shard$i
+	}
+	return $paths
+}
+
+proc removeShards {} {
+	file delete {*}[glob -nocomplain tmp/shard*]
+}
+
+#
+# layer open
+#
+
+test layer-1.0 {
+# invoke layer with too few arguments
+} -body {
+	shapetcl::layer open
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test layer-1.1 {
+# invoke layer with an invalid action
+} -body {
+	shapetcl::layer foo {}
+} -returnCodes {
+	error
+} -match glob -result {bad action "foo": *}
+
+test layer-1.2 {
+# open a layer with no shapefiles
+} -body {
+	shapetcl::layer open {}
+} -returnCodes {
+	error
+} -result {no shapefiles given}
+
+test layer-1.3 {
+# open a layer with an invalid open shapefile limit
+} -setup {
+	set paths [makeShards {1 1}]
+} -body {
+	shapetcl::layer open $paths -maxOpen 0
+} -cleanup {
+	removeShards
+	unset paths
+} -returnCodes {
+	error
+} -result {invalid open shapefile limit 0}
+
+test layer-1.4 {
+# open a layer with an invalid option
+} -setup {
+	set paths [makeShards {1 1}]
+} -body {
+	shapetcl::layer open $paths -foo 1
+} -cleanup {
+	removeShards
+	unset paths
+} -returnCodes {
+	error
+} -match glob -result {bad option "-foo": *}
+
+test layer-1.5 {
+# open a layer including a missing shapefile
+} -setup {
+	set paths [makeShards {1 1}]
+} -body {
+	shapetcl::layer open [linsert $paths 1 tmp/nonexistent]
+} -cleanup {
+	removeShards
+	unset paths
+} -returnCodes {
+	error
+} -result {failed to open attribute table for "tmp/nonexistent"}
+
+test layer-1.6 {
+# open a layer of shapefiles with different shape types
+} -setup {
+	set paths [makeShards {1}]
+	set shp [shapefile tmp/shardarc arc {integer id 10 0 string name 10 0}]
+	$shp close
+} -body {
+	shapetcl::layer open [lappend paths tmp/shardarc]
+} -cleanup {
+	removeShards
+	unset paths shp
+} -returnCodes {
+	error
+} -result {shape type of "tmp/shardarc" does not match "tmp/shard0"}
+
+test layer-1.7 {
+# open a layer of shapefiles with different attribute fields
+} -setup {
+	set paths [makeShards {1}]
+	set shp [shapefile tmp/shardother point {integer id 10 0}]
+	$shp close
+} -body {
+	shapetcl::layer open [lappend paths tmp/shardother]
+} -cleanup {
+	removeShards
+	unset paths shp
+} -returnCodes {
+	error
+} -result {attribute fields of "tmp/shardother" do not match}
+
+test layer-1.8 {
+# shapefiles are not opened until accessed
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 3}]]
+} -body {
+	list [$layer info count] [$layer info open] [$layer info shards]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {5 0 {tmp/shard0 tmp/shard1 tmp/shard2}}
+
+test layer-1.9 {
+# close a layer
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2}]]
+	$layer coord read 0
+} -body {
+	$layer close
+	info commands $layer
+} -cleanup {
+	removeShards
+	unset layer
+} -result {}
+
+#
+# global feature indices
+#
+
+test layer-2.0 {
+# locate features; empty shapefiles hold no indices
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 3}]]
+} -body {
+	list [$layer locate 0] [$layer locate 1] [$layer locate 2] [$layer locate 4]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{tmp/shard0 0} {tmp/shard0 1} {tmp/shard2 0} {tmp/shard2 2}}
+
+test layer-2.1 {
+# locate an invalid feature index
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 3}]]
+} -body {
+	$layer locate 5
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -returnCodes {
+	error
+} -result {invalid feature index 5}
+
+test layer-2.2 {
+# read coordinates of a feature by global index
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 3}]]
+} -body {
+	list [$layer coord read 1] [$layer coord read 3]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{{11.0 11.0}} {{31.0 31.0}}}
+
+test layer-2.3 {
+# read coordinates of all features
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 2}]]
+} -body {
+	$layer coord read
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{{10.0 10.0}} {{11.0 11.0}} {{30.0 30.0}} {{31.0 31.0}}}
+
+test layer-2.4 {
+# read coordinates of an invalid feature index
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2}]]
+} -body {
+	$layer coord read -1
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -returnCodes {
+	error
+} -result {invalid feature index -1}
+
+test layer-2.5 {
+# read attributes of a record, a field, and all records
+} -setup {
+	set layer [shapetcl::layer open [makeShards {1 2}]]
+} -body {
+	list [$layer attr read 2] [$layer attr read 1 1] [$layer attr read]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{11 shard1} shard1 {{0 shard0} {10 shard1} {11 shard1}}}
+
+test layer-2.6 {
+# search attributes; matches are reported by global index
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 2 2}]]
+} -body {
+	list [$layer attr search 1 shard1] [$layer attr search 0 21]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{2 3} 5}
+
+test layer-2.7 {
+# search an invalid field
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 2}]]
+} -body {
+	$layer attr search 2 foo
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -returnCodes {
+	error
+} -result {invalid field index 2}
+
+test layer-2.8 {
+# layer fields, type, and bounds
+} -setup {
+	set layer [shapetcl::layer open [makeShards {2 0 2}]]
+} -body {
+	list [$layer fields list] [$layer info type] [$layer info bounds] [$layer info bounds 3]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{integer id 10 0 string name 10 0} point {10.0 10.0 31.0 31.0} {31.0 31.0 31.0 31.0}}
+
+#
+# bounding box queries
+#
+
+test layer-3.0 {
+# query features by bounds; non-intersecting shapefiles are not opened
+} -setup {
+	set layer [shapetcl::layer open [makeShards {3 3 3}]]
+} -body {
+	list [$layer query {20.5 0 35 35}] [$layer info open]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{4 5 6 7 8} 2}
+
+test layer-3.1 {
+# query bounds that intersect no shapefile
+} -setup {
+	set layer [shapetcl::layer open [makeShards {3 3}]]
+} -body {
+	list [$layer query {100 100 200 200}] [$layer info open]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -result {{} 0}
+
+test layer-3.2 {
+# query with malformed bounds
+} -setup {
+	set layer [shapetcl::layer open [makeShards {3}]]
+} -body {
+	$layer query {0 0 1}
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer
+} -returnCodes {
+	error
+} -result {bounds must be a list of 4 values (xmin ymin xmax ymax)}
+
+#
+# open shapefile limit
+#
+
+test layer-4.0 {
+# no more than -maxOpen shapefiles are held open
+} -setup {
+	set layer [shapetcl::layer open [makeShards {1 1 1 1}] -maxOpen 2]
+} -body {
+	set counts {}
+	foreach id {0 1 2 3 0} {
+		$layer coord read $id
+		lappend counts [$layer info open]
+	}
+	list $counts [$layer attr read]
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer counts id
+} -result {{1 2 2 2 2} {{0 shard0} {10 shard1} {20 shard2} {30 shard3}}}
+
+test layer-4.1 {
+# shapefiles changed after the layer is opened are detected when opened
+} -setup {
+	set layer [shapetcl::layer open [makeShards {1 1}]]
+	set shp [shapefile tmp/shard1 readwrite]
+	$shp write {{5 5}} {5 foo}
+	$shp close
+} -body {
+	$layer coord read 1
+} -cleanup {
+	$layer close
+	removeShards
+	unset layer shp
+} -returnCodes {
+	error
+} -result {shapefile "tmp/shard1" has changed since layer was opened}
+
+::tcltest::cleanupTests
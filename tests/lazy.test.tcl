@@ -0,0 +1,140 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+#
+# -lazy open option
+#
+
+test lazy-1.0 {
+# attempt to combine -lazy and -shared
+} -body {
+	shapefile sample/xy/point readonly -lazy -shared
+} -returnCodes {
+	error
+} -result {-lazy and -shared options cannot be combined}
+
+test lazy-1.1 {
+# attempt to open a shapefile with a missing index
+} -setup {
+	foreach ext {shp dbf} {file copy sample/xy/point.$ext tmp/foo.$ext}
+} -body {
+	shapefile tmp/foo readonly -lazy
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+	unset ext
+} -returnCodes {
+	error
+} -result {failed to open shapefile for "tmp/foo"}
+
+test lazy-1.2 {
+# a missing index is rebuilt if requested
+} -setup {
+	foreach ext {shp dbf} {file copy sample/xy/point.$ext tmp/foo.$ext}
+} -body {
+	set shp [shapefile tmp/foo readonly -lazy -rebuildIndex auto]
+	list [$shp info count] [$shp file indexed]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset ext
+} -result {243 0}
+
+test lazy-2.0 {
+# metadata of a lazily opened shapefile matches a normally opened one
+} -setup {
+	set shp [shapefile sample/xyzm/polygonz readonly]
+	set lazy [shapefile sample/xyzm/polygonz readonly -lazy]
+} -body {
+	list [expr {[$lazy info count] == [$shp info count]}] \
+			[expr {[$lazy info bounds] eq [$shp info bounds]}] \
+			[expr {[$lazy info type] eq [$shp info type]}] \
+			[expr {[$lazy fields list] eq [$shp fields list]}] \
+			[$lazy file indexed]
+} -cleanup {
+	$shp close
+	$lazy close
+} -result {1 1 1 1 0}
+
+test lazy-2.1 {
+# attribute records are read without loading the index
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set lazy [shapefile sample/xy/point readonly -lazy]
+} -body {
+	list [expr {[$lazy attr read 5] eq [$shp attr read 5]}] \
+			[expr {[$lazy attr search 0 [$shp attr read 5 0]] eq [$shp attr search 0 [$shp attr read 5 0]]}] \
+			[$lazy file indexed]
+} -cleanup {
+	$shp close
+	$lazy close
+} -result {1 1 0}
+
+test lazy-2.2 {
+# features are read once the index is loaded on first access
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+	set lazy [shapefile sample/xy/arc readonly -lazy]
+} -body {
+	list [expr {[$lazy coord read 3] eq [$shp coord read 3]}] \
+			[$lazy file indexed] \
+			[expr {[$lazy coord read] eq [$shp coord read]}] \
+			[expr {[$lazy info bounds 3] eq [$shp info bounds 3]}]
+} -cleanup {
+	$shp close
+	$lazy close
+} -result {1 1 1 1}
+
+test lazy-2.3 {
+# write to a lazily opened readwrite shapefile
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite -lazy]
+} -body {
+	set id [$shp write {{1 2}} [$shp attr read 0]]
+	$shp close
+	set shp [shapefile tmp/foo readonly]
+	list $id [$shp info count] [$shp coord read $id]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset f id
+} -result {243 244 {{1.0 2.0}}}
+
+test lazy-2.4 {
+# abbreviated subcommands, attribute changes, and deletion flags do not
+# load the index; the bounds of one feature do
+} -setup {
+	foreach f [glob sample/xy/point.*] {file copy $f tmp/foo[file extension $f]}
+	set shp [shapefile tmp/foo readwrite -lazy]
+} -body {
+	$shp conf skipDeleted
+	$shp info type base
+	$shp info deleted 0
+	$shp attr write 1 [$shp attr read 0]
+	$shp del 0
+	$shp undel 0
+	set before [$shp file indexed]
+	$shp info bounds 0
+	list $before [$shp file indexed]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset f before
+} -result {0 1}
+
+::tcltest::cleanupTests
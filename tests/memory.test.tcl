@@ -0,0 +1,175 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+#
+# mem:// shapefiles
+#
+
+test memory-1.0 {
+# attempt to open a memory shapefile that does not exist
+} -body {
+	shapefile mem://missing readonly
+} -returnCodes {
+	error
+} -result {failed to open attribute table for "mem://missing"}
+
+test memory-1.1 {
+# attempt to open a memory shapefile with -lazy
+} -body {
+	shapefile mem://missing readonly -lazy
+} -returnCodes {
+	error
+} -result {-lazy and -shared options are not supported for memory shapefiles}
+
+test memory-1.2 {
+# create, write, and read a memory shapefile
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+} -body {
+	$shp write {{10 20}} 1
+	$shp write {{30 40}} 2
+	list [$shp info count] [$shp coord read 1] [$shp attr read 1] [$shp info bounds] [$shp file path]
+} -cleanup {
+	$shp close
+	unset shp
+} -result {2 {{30.0 40.0}} 2 {10.0 20.0 30.0 40.0} mem://foo}
+
+test memory-1.3 {
+# a memory shapefile can be reopened while a command still uses it
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+	$shp write {{10 20}} 1
+	$shp save
+} -body {
+	set shp2 [shapefile mem://foo readonly]
+	$shp close
+	list [$shp2 info count] [$shp2 attr read 0]
+} -cleanup {
+	$shp2 close
+	unset shp shp2
+} -result {1 1}
+
+test memory-1.4 {
+# a memory shapefile is discarded when the last command using it closes
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+	$shp close
+} -body {
+	shapefile mem://foo readonly
+} -cleanup {
+	unset shp
+} -returnCodes {
+	error
+} -result {failed to open attribute table for "mem://foo"}
+
+test memory-1.5 {
+# memory shapefiles can be compacted in place
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+	foreach i {1 2 3 4} {$shp write [list [list [expr {$i * 10}] 20]] $i}
+	$shp delete {0 2}
+} -body {
+	$shp compact
+	list [$shp info count] [$shp attr read] [$shp coord read 1]
+} -cleanup {
+	$shp close
+	unset shp i
+} -result {2 {2 4} {{40.0 20.0}}}
+
+#
+# save subcommand
+#
+
+test memory-2.0 {
+# save a memory shapefile to disk
+} -setup {
+	set shp [shapefile mem://foo polygon {string name 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} alpha
+} -body {
+	$shp save tmp/foo
+	$shp close
+	set shp [shapefile tmp/foo readonly]
+	list [$shp info type] [$shp info count] [$shp attr read 0] [$shp coord read 0]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {polygon 1 alpha {{10.0 10.0 10.0 20.0 20.0 20.0 20.0 10.0 10.0 10.0}}}
+
+test memory-2.1 {
+# save a disk shapefile to memory; the files are identical
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp save mem://bar
+	set copy [shapefile mem://bar readonly]
+	set result [list [$copy info count] [$copy attr read 42]]
+	foreach {ext data} [$copy save] {
+		set f [open sample/xy/point.$ext rb]
+		lappend result $ext [string equal $data [read $f]]
+		close $f
+	}
+	set result
+} -cleanup {
+	$copy close
+	$shp close
+	unset shp copy result ext data f
+} -match glob -result {243 * shp 1 shx 1 dbf 1}
+
+test memory-2.2 {
+# saved contents include unsaved changes to a readwrite shapefile
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+	$shp write {{10 20}} 7
+} -body {
+	set contents [$shp save]
+	binary scan [dict get $contents dbf] x4i count
+	list [dict keys $contents] [string length [dict get $contents shp]] \
+			[string length [dict get $contents shx]] $count
+} -cleanup {
+	$shp close
+	unset shp contents count
+} -result {{shp shx dbf} 128 108 1}
+
+test memory-2.3 {
+# attempt to save a shapefile over itself
+} -setup {
+	set shp [shapefile mem://foo point {integer id 10 0}]
+} -body {
+	$shp save mem://foo.shp
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {output path "mem://foo.shp" is the shapefile itself}
+
+test memory-2.4 {
+# save with too many arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp save tmp/foo tmp/bar
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {wrong # args: should be "* save ?path?"} -match glob
+
+::tcltest::cleanupTests
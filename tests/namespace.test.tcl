@@ -69,5 +69,21 @@ test ns-1.3 {
 	}
 	namespace delete foo
 } -result {243}
+
+test ns-1.4 {
+# import all exported commands; none replaces a builtin command
+} -setup {
+	set child [interp create]
+	$child eval [list lappend auto_path [file normalize ..]]
+} -body {
+	$child eval {
+		package require shapetcl
+		namespace import shapetcl::*
+		list [lsort [namespace import]] [namespace origin concat]
+	}
+} -cleanup {
+	interp delete $child
+	unset child
+} -result {{concatShapefiles import layer rebuildIndex shapefile spatialjoin} ::concat}
 	
 ::tcltest::cleanupTests
@@ -0,0 +1,156 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+namespace import shapetcl::rebuildIndex
+
+# Copy a sample shapefile to tmp/foo.
+proc copySample {sample} {
+	foreach f [glob sample/$sample.*] {
+		file copy -force $f tmp/foo[file extension $f]
+	}
+}
+
+# Return the contents of a file as binary data.
+proc readBinary {path} {
+	set f [open $path rb]
+	set data [read $f]
+	close $f
+	return $data
+}
+
+test rebuildIndex-1.0 {
+# invoke rebuildIndex with too few arguments
+} -body {
+	rebuildIndex
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test rebuildIndex-1.1 {
+# invoke rebuildIndex with too many arguments
+} -body {
+	rebuildIndex tmp/foo bar
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test rebuildIndex-1.2 {
+# invoke rebuildIndex on a nonexistent shapefile
+} -body {
+	rebuildIndex tmp/nonexistent
+} -returnCodes {
+	error
+} -match glob -result {failed to open shapefile for *}
+
+test rebuildIndex-1.3 {
+# open a shapefile with an invalid -rebuildIndex value
+} -body {
+	shapefile sample/xy/point readonly -rebuildIndex sometimes
+} -returnCodes {
+	error
+} -match glob -result {bad -rebuildIndex value "sometimes"*}
+
+test rebuildIndex-1.4 {
+# attempt to use an open option when creating a shapefile
+} -body {
+	shapefile tmp/foo point {integer id 10 0} -rebuildIndex auto
+} -returnCodes {
+	error
+} -match glob -result {options are only valid when opening *}
+
+test rebuildIndex-2.0 {
+# rebuilt indexes are identical to the sample indexes
+} -body {
+	set result {}
+	foreach sample {xy/point xy/arc xym/polygonm xyzm/multipointz} {
+		copySample $sample
+		file delete tmp/foo.shx
+		set count [rebuildIndex tmp/foo]
+		lappend result [expr {[readBinary tmp/foo.shx] eq [readBinary sample/$sample.shx]}]
+	}
+	set result
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1 1}
+
+test rebuildIndex-2.1 {
+# rebuildIndex returns the number of records indexed
+} -setup {
+	copySample xy/polygon
+	set shp [shapefile tmp/foo readonly]
+	set expected [$shp info count]
+	$shp close
+} -body {
+	expr {[rebuildIndex tmp/foo] == $expected}
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+} -result {1}
+
+test rebuildIndex-2.2 {
+# a truncated index prevents opening unless -rebuildIndex auto is given
+} -setup {
+	copySample xy/arc
+	set shp [shapefile tmp/foo readonly]
+	set expected [$shp coord read]
+	$shp close
+	set f [open tmp/foo.shx r+b]
+	chan truncate $f 116
+	close $f
+} -body {
+	set result [catch {shapefile tmp/foo readonly}]
+	set shp [shapefile tmp/foo readonly -rebuildIndex auto]
+	lappend result [expr {[$shp coord read] eq $expected}]
+	$shp close
+	set result
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1}
+
+test rebuildIndex-2.3 {
+# a missing index is rebuilt on open with -rebuildIndex auto
+} -setup {
+	copySample xy/point
+	file delete tmp/foo.shx
+} -body {
+	set shp [shapefile tmp/foo readwrite -rebuildIndex auto]
+	set result [list [file exists tmp/foo.shx] [$shp file mode]]
+	$shp close
+	set result
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+} -result {1 readwrite}
+
+test rebuildIndex-2.4 {
+# a truncated final record is dropped from the rebuilt index
+} -setup {
+	copySample xy/arc
+	set shp [shapefile tmp/foo readonly]
+	set expected [expr {[$shp info count] - 1}]
+	$shp close
+	set f [open tmp/foo.shp r+b]
+	chan truncate $f [expr {[file size tmp/foo.shp] - 4}]
+	close $f
+} -body {
+	expr {[rebuildIndex tmp/foo] == $expected}
+} -cleanup {
+	file delete {*}[glob tmp/foo.*]
+} -result {1}
+
+rename copySample {}
+rename readBinary {}
+
+::tcltest::cleanupTests
@@ -0,0 +1,174 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+::tcltest::testConstraint threadAvailable [expr {![catch {package require Thread}]}]
+
+test shared-1.0 {
+# attempt to open a shared shapefile in readwrite mode
+} -body {
+	shapefile sample/xy/point readwrite -shared
+} -returnCodes {
+	error
+} -result {shared shapefiles must be readonly}
+
+test shared-1.1 {
+# attempt to open a nonexistent shared shapefile
+} -body {
+	shapefile tmp/nonexistent readonly -shared
+} -returnCodes {
+	error
+} -match glob -result {failed to open *}
+
+test shared-1.2 {
+# attempt to open a shapefile with an unknown option
+} -body {
+	shapefile sample/xy/point readonly -foo
+} -returnCodes {
+	error
+} -match glob -result {bad option "-foo"*}
+
+test shared-2.0 {
+# shared handles read the same features as an unshared handle
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+	set a [shapefile sample/xy/arc -shared]
+	set b [shapefile sample/xy/arc.shp readonly -shared]
+} -body {
+	set expected [$shp coord read]
+	list [expr {[$a coord read] eq $expected}] \
+			[expr {[$b coord read] eq $expected}] \
+			[expr {[$a info count] == [$shp info count]}] \
+			[expr {[$b info bounds] eq [$shp info bounds]}] \
+			[expr {[$b attr read] eq [$shp attr read]}]
+} -cleanup {
+	$shp close
+	$a close
+	$b close
+} -result {1 1 1 1 1}
+
+test shared-2.1 {
+# a shared handle remains valid after the handle that loaded the index closes
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+	set expected [$shp coord read]
+	$shp close
+} -body {
+	set a [shapefile sample/xy/polygon -shared]
+	set b [shapefile sample/xy/polygon -shared]
+	$a close
+	set result [expr {[$b coord read] eq $expected}]
+	$b close
+	set c [shapefile sample/xy/polygon -shared]
+	lappend result [expr {[$c coord read] eq $expected}]
+	$c close
+	set result
+} -result {1 1}
+
+test shared-2.2 {
+# a shapefile modified after its index was shared gets a new index
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+	$shp write {{0 0}} 0
+	$shp close
+	set a [shapefile tmp/foo -shared]
+	set shp [shapefile tmp/foo readwrite]
+	$shp write {{1 1}} 1
+	$shp close
+	# ensure the modification time or size differs
+	file mtime tmp/foo.shp [expr {[file mtime tmp/foo.shp] + 1}]
+} -body {
+	set b [shapefile tmp/foo -shared]
+	list [$a info count] [$b info count] [$b coord read 1]
+} -cleanup {
+	$a close
+	$b close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 2 {{1.0 1.0}}}
+
+test shared-2.3 {
+# an index rebuilt while its shapefile is shared gets a new index, even if
+# the .shx size and modification time are unchanged
+} -setup {
+	foreach f [glob sample/xy/point.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readonly]
+	set expected [$shp coord read 0]
+	$shp close
+	# swap the index entries of the first two records
+	set f [open tmp/foo.shx r+]
+	fconfigure $f -translation binary
+	seek $f 100
+	set entries [read $f 16]
+	seek $f 100
+	puts -nonewline $f [string range $entries 8 15][string range $entries 0 7]
+	close $f
+	set a [shapefile tmp/foo readonly -shared]
+} -body {
+	set before [expr {[$a coord read 0] eq $expected}]
+	shapetcl::rebuildIndex tmp/foo
+	set b [shapefile tmp/foo readonly -shared]
+	list $before [expr {[$b coord read 0] eq $expected}]
+} -cleanup {
+	$a close
+	$b close
+	file delete {*}[glob tmp/foo.*]
+	unset shp expected f entries a b before
+} -result {0 1}
+
+test shared-3.0 {
+# shared handles opened in several threads read concurrently
+} -constraints {
+	threadAvailable
+} -body {
+	set script [format {
+		lappend auto_path %s
+		package require shapetcl
+		set shp [shapetcl::shapefile %s readonly -shared]
+		set coords [$shp coord read]
+		$shp close
+		set coords
+	} [list [file normalize ..]] [list [file normalize sample/xy/arc]]]
+	set threads {}
+	for {set i 0} {$i < 4} {incr i} {
+		lappend threads [thread::create]
+	}
+	foreach t $threads {
+		thread::send -async $t $script ::sharedResult($t)
+	}
+	set results {}
+	foreach t $threads {
+		if {![info exists ::sharedResult($t)]} {
+			vwait ::sharedResult($t)
+		}
+		lappend results $::sharedResult($t)
+		thread::release $t
+	}
+	set shp [shapefile sample/xy/arc readonly]
+	set expected [$shp coord read]
+	$shp close
+	set matches {}
+	foreach result $results {
+		lappend matches [expr {$result eq $expected}]
+	}
+	lsort -unique $matches
+} -cleanup {
+	array unset ::sharedResult
+} -result {1}
+
+::tcltest::cleanupTests
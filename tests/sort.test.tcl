@@ -0,0 +1,203 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+test sort-1.0 {
+# invoke sort cmd with too few arguments
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test sort-1.1 {
+# invoke sort cmd with invalid option
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort -foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {bad option "-foo"*}
+
+test sort-1.2 {
+# invoke sort cmd with more than one sort order
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort -hilbert -morton -output tmp/foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {only one of *}
+
+test sort-1.3 {
+# invoke sort cmd with no sort order
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort -output tmp/foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {missing sort order *}
+
+test sort-1.4 {
+# invoke sort cmd with an unknown field name
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort -field NoSuchField -output tmp/foo
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {field named "NoSuchField" not found}
+
+test sort-1.5 {
+# attempt to sort a readonly shapefile in place
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp sort -hilbert
+} -cleanup {
+	$shp close
+} -returnCodes {
+	error
+} -match glob -result {cannot sort readonly shapefile in place*}
+
+test sort-2.0 {
+# sort by a numeric field; coordinates and attributes remain paired
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	set fieldId [$shp fields index pop_max]
+	set expected {}
+	for {set i 0} {$i < [$shp info count]} {incr i} {
+		lappend expected [list [$shp attr read $i] [$shp coord read $i]]
+	}
+	set expected [lsort -integer -index [list 0 $fieldId] $expected]
+	$shp sort -field pop_max -output tmp/foo
+	set out [shapefile tmp/foo readonly]
+	set actual {}
+	for {set i 0} {$i < [$out info count]} {incr i} {
+		lappend actual [list [$out attr read $i] [$out coord read $i]]
+	}
+	$out close
+	expr {$actual eq $expected}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1}
+
+test sort-2.1 {
+# sort in place along a Hilbert curve; records are a permutation of original
+} -setup {
+	foreach f [glob sample/xy/polygon.*] {
+		file copy $f tmp/foo[file extension $f]
+	}
+	set shp [shapefile tmp/foo readwrite]
+} -body {
+	set expected {}
+	for {set i 0} {$i < [$shp info count]} {incr i} {
+		lappend expected [list [$shp attr read $i] [$shp coord read $i]]
+	}
+	set bounds [$shp info bounds]
+	$shp sort -hilbert
+	set actual {}
+	for {set i 0} {$i < [$shp info count]} {incr i} {
+		lappend actual [list [$shp attr read $i] [$shp coord read $i]]
+	}
+	list [expr {$actual ne $expected}] \
+			[expr {[lsort $actual] eq [lsort $expected]}] \
+			[expr {[$shp info bounds] eq $bounds}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1 1 1}
+
+test sort-2.2 {
+# Morton order places the four quadrant points in Z order
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+	$shp write {{10 10}} 3
+	$shp write {{0 10}} 2
+	$shp write {{10 0}} 1
+	$shp write {{0 0}} 0
+} -body {
+	$shp sort -morton -output tmp/bar
+	set out [shapefile tmp/bar readonly]
+	set result [$out attr read]
+	$out close
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+} -result {0 1 2 3}
+
+test sort-2.3 {
+# Hilbert order visits the four quadrant points along the curve
+} -setup {
+	set shp [shapefile tmp/foo point {integer id 10 0}]
+	$shp write {{10 10}} 2
+	$shp write {{0 10}} 1
+	$shp write {{10 0}} 3
+	$shp write {{0 0}} 0
+} -body {
+	$shp sort -hilbert -output tmp/bar
+	set out [shapefile tmp/bar readonly]
+	set result [$out attr read]
+	$out close
+	set result
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+} -result {0 1 2 3}
+
+test sort-2.4 {
+# sort by a string field; coordinates and attributes remain paired
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	set fieldId [$shp fields index name]
+	set expected {}
+	for {set i 0} {$i < [$shp info count]} {incr i} {
+		lappend expected [list [$shp attr read $i] [$shp coord read $i]]
+	}
+	set expected [lsort -ascii -index [list 0 $fieldId] $expected]
+	$shp sort -field name -output tmp/foo
+	set out [shapefile tmp/foo readonly]
+	set actual {}
+	for {set i 0} {$i < [$out info count]} {incr i} {
+		lappend actual [list [$out attr read $i] [$out coord read $i]]
+	}
+	$out close
+	expr {$actual eq $expected}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+} -result {1}
+
+::tcltest::cleanupTests
@@ -0,0 +1,266 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+#
+# spatial subcommand
+#
+
+test spatial-1.0 {
+# attempt an unknown spatial query
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp spatial within 0 0
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {bad action "within": must be contains, locate, or nearest}
+
+test spatial-1.1 {
+# attempt a containment query on a non-polygon shapefile
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+} -body {
+	$shp spatial contains 0 0
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {contains queries require a polygon shapefile}
+
+test spatial-1.2 {
+# attempt to locate an odd number of coordinates
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp spatial locate {1 2 3}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {2 coordinate values are expected for each point}
+
+test spatial-1.3 {
+# attempt to test an invalid candidate feature
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+} -body {
+	$shp spatial contains 0 0 -candidates {0 999}
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid feature index 999}
+
+test spatial-1.4 {
+# attempt a nearest query with an invalid neighbor count
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp spatial nearest 0 0 -k 0
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -result {invalid neighbor count 0}
+
+test spatial-1.5 {
+# attempt a nearest query with a missing option value
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+} -body {
+	$shp spatial nearest 0 0 -k
+} -cleanup {
+	$shp close
+	unset shp
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: should be "* spatial nearest x y ?-k count? ?-maxdist distance?"}
+
+test spatial-2.0 {
+# points in overlapping polygons, holes, and empty space
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 0
+	$shp write {{15 15 15 30 30 30 30 15 15 15}} 1
+	$shp write {} 2
+} -body {
+	list [$shp spatial contains 11 11] [$shp spatial contains 13 13] \
+			[$shp spatial contains 17 17] [$shp spatial contains 25 25] \
+			[$shp spatial contains 40 40]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {0 {} {0 1} 1 {}}
+
+test spatial-2.1 {
+# contains restricted to candidate features
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 0
+	$shp write {{15 15 15 30 30 30 30 15 15 15}} 1
+} -body {
+	list [$shp spatial contains 17 17 -candidates {1 0}] \
+			[$shp spatial contains 17 17 -candidates {1}] \
+			[$shp spatial contains 17 17 -candidates {}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{1 0} 1 {}}
+
+test spatial-2.2 {
+# locate a batch of points; overlaps resolve to the lowest index
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 0
+	$shp write {{15 15 15 30 30 30 30 15 15 15}} 1
+} -body {
+	$shp spatial locate {11 11 13 13 17 17 25 25 40 40}
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {0 -1 0 1 -1}
+
+test spatial-2.3 {
+# features written after a query are found by the next query
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 0
+} -body {
+	set before [$shp spatial locate {25 25}]
+	$shp write {{15 15 15 30 30 30 30 15 15 15}} 1
+	$shp coordinates write 0 {{40 40 40 50 50 50 50 40 40 40}}
+	list $before [$shp spatial locate {11 11 25 25 45 45}]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp before
+} -result {-1 {-1 1 0}}
+
+test spatial-2.4 {
+# deleted features are skipped if skipDeleted is set
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 0
+	$shp write {{15 15 15 30 30 30 30 15 15 15}} 1
+	$shp delete 0
+} -body {
+	set result [list [$shp spatial locate {17 17}]]
+	$shp configure skipDeleted 1
+	lappend result [$shp spatial locate {17 17}] [$shp spatial contains 17 17]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp result
+} -result {0 1 1}
+
+test spatial-3.0 {
+# indexed queries agree with exhaustive tests of sample polygons
+} -setup {
+	set shp [shapefile sample/xy/polygon readonly]
+	set pts [shapefile sample/xy/point readonly]
+	set all {}
+	for {set i 0} {$i < [$shp info count]} {incr i} {
+		lappend all $i
+	}
+	set points {}
+	foreach point [$pts coordinates read] {
+		lappend points {*}[lindex $point 0]
+	}
+} -body {
+	set expected {}
+	foreach {x y} $points {
+		set found [$shp spatial contains $x $y -candidates $all]
+		lappend expected [expr {[llength $found] ? [lindex [lsort -integer $found] 0] : -1}]
+	}
+	expr {[$shp spatial locate $points] eq $expected}
+} -cleanup {
+	$shp close
+	$pts close
+	unset shp pts all points expected x y found
+} -result 1
+
+test spatial-4.0 {
+# nearest arcs are measured to their segments, not their vertices
+} -setup {
+	set shp [shapefile tmp/foo arc {integer id 10 0}]
+	$shp write {{10 10 30 10}} 0
+	$shp write {{12 14 13 14}} 1
+	$shp write {{50 50 60 60}} 2
+} -body {
+	list [$shp spatial nearest 20 11] [$shp spatial nearest 20 11 -k 3] \
+			[$shp spatial nearest 20 11 -k 3 -maxdist 8] [$shp spatial nearest 80 80 -maxdist 1]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {0 {0 1 2} {0 1} {}}
+
+test spatial-4.1 {
+# points inside polygons are at distance 0; ties are in index order
+} -setup {
+	set shp [shapefile tmp/foo polygon {integer id 10 0}]
+	$shp write {{30 10 30 20 40 20 40 10 30 10}} 0
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 1
+	$shp write {{10 10 10 20 20 20 20 10 10 10}} 2
+} -body {
+	list [$shp spatial nearest 15 15 -k 3] [$shp spatial nearest 25 15 -k 3]
+} -cleanup {
+	$shp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp
+} -result {{1 2 0} {0 1 2}}
+
+test spatial-4.2 {
+# nearest sample points agree with an exhaustive search
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set points [$shp coordinates read]
+} -body {
+	set mismatches 0
+	foreach {x y} {-75 40 -100 35 -120 45 -90 30 0 0} {
+		set distances {}
+		set id 0
+		foreach point $points {
+			lassign [lindex $point 0] px py
+			lappend distances [list $id [expr {hypot($px - $x, $py - $y)}]]
+			incr id
+		}
+		set expected {}
+		foreach pair [lrange [lsort -real -index 1 $distances] 0 4] {
+			lappend expected [lindex $pair 0]
+		}
+		if {[$shp spatial nearest $x $y -k 5] ne $expected} {
+			incr mismatches
+		}
+	}
+	set mismatches
+} -cleanup {
+	$shp close
+	unset shp points mismatches x y distances id point px py expected pair
+} -result 0
+
+::tcltest::cleanupTests
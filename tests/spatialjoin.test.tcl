@@ -0,0 +1,177 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+#
+# spatialjoin command
+#
+
+test spatialjoin-1.0 {
+# invoke spatialjoin with too few arguments
+} -body {
+	shapetcl::spatialjoin foo
+} -returnCodes {
+	error
+} -match glob -result {wrong # args: *}
+
+test spatialjoin-1.1 {
+# attempt to join a command that is not a shapefile
+} -setup {
+	set polys [shapefile sample/xy/polygon readonly]
+} -body {
+	shapetcl::spatialjoin set $polys
+} -cleanup {
+	$polys close
+	unset polys
+} -returnCodes {
+	error
+} -result {"set" is not an open shapefile}
+
+test spatialjoin-1.2 {
+# attempt to join points to a non-polygon shapefile
+} -setup {
+	set pts [shapefile sample/xy/point readonly]
+	set arcs [shapefile sample/xy/arc readonly]
+} -body {
+	shapetcl::spatialjoin $pts $arcs
+} -cleanup {
+	$pts close
+	$arcs close
+	unset pts arcs
+} -returnCodes {
+	error
+} -match glob -result {"*" is not a polygon shapefile}
+
+test spatialjoin-1.3 {
+# attempt to join with an unknown predicate
+} -setup {
+	set pts [shapefile sample/xy/point readonly]
+	set polys [shapefile sample/xy/polygon readonly]
+} -body {
+	shapetcl::spatialjoin $pts $polys -predicate touches
+} -cleanup {
+	$pts close
+	$polys close
+	unset pts polys
+} -returnCodes {
+	error
+} -result {bad predicate "touches": must be intersects or within}
+
+test spatialjoin-1.4 {
+# attempt to join with an invalid thread count
+} -setup {
+	set pts [shapefile sample/xy/point readonly]
+	set polys [shapefile sample/xy/polygon readonly]
+} -body {
+	shapetcl::spatialjoin $pts $polys -threads 0
+} -cleanup {
+	$pts close
+	$polys close
+	unset pts polys
+} -returnCodes {
+	error
+} -result {invalid thread count 0}
+
+test spatialjoin-2.0 {
+# points within overlapping polygons; boundary points only intersect
+} -setup {
+	set pts [shapefile tmp/foo point {integer id 10 0}]
+	set polys [shapefile tmp/bar polygon {integer id 10 0}]
+	$polys write {{10 10 10 20 20 20 20 10 10 10} {12 12 14 12 14 14 12 14 12 12}} 0
+	$polys write {{15 15 15 30 30 30 30 15 15 15}} 1
+	foreach {x y} {11 11 13 13 17 17 25 25 40 40 10 15} {
+		$pts write [list [list $x $y]] 0
+	}
+} -body {
+	list [shapetcl::spatialjoin $pts $polys] \
+			[shapetcl::spatialjoin $pts $polys -predicate intersects]
+} -cleanup {
+	$pts close
+	$polys close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset pts polys x y
+} -result {{{0 0} {2 0} {2 1} {3 1}} {{0 0} {2 0} {2 1} {3 1} {5 0}}}
+
+test spatialjoin-2.1 {
+# multipoints are within a polygon only if all of their points are
+} -setup {
+	set pts [shapefile tmp/foo multipoint {integer id 10 0}]
+	set polys [shapefile tmp/bar polygon {integer id 10 0}]
+	$polys write {{10 10 10 20 20 20 20 10 10 10}} 0
+	$pts write {{11 11 19 19}} 0
+	$pts write {{11 11 25 25}} 1
+	$pts write {{30 30 40 40}} 2
+} -body {
+	list [shapetcl::spatialjoin $pts $polys] \
+			[shapetcl::spatialjoin $pts $polys -predicate intersects]
+} -cleanup {
+	$pts close
+	$polys close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset pts polys
+} -result {{{0 0}} {{0 0} {1 0}}}
+
+test spatialjoin-2.2 {
+# deleted features are not joined if skipDeleted is set
+} -setup {
+	set pts [shapefile tmp/foo point {integer id 10 0}]
+	set polys [shapefile tmp/bar polygon {integer id 10 0}]
+	$polys write {{10 10 10 20 20 20 20 10 10 10}} 0
+	$polys write {{15 15 15 30 30 30 30 15 15 15}} 1
+	$pts write {{17 17}} 0
+	$pts write {{11 11}} 1
+	$pts delete 1
+	$polys delete 0
+} -body {
+	set result [list [shapetcl::spatialjoin $pts $polys]]
+	$pts configure skipDeleted 1
+	$polys configure skipDeleted 1
+	lappend result [shapetcl::spatialjoin $pts $polys]
+} -cleanup {
+	$pts close
+	$polys close
+	file delete {*}[glob tmp/foo.* tmp/bar.*]
+	unset pts polys result
+} -result {{{0 0} {0 1} {1 0}} {{0 1}}}
+
+test spatialjoin-3.0 {
+# threaded joins of sample shapefiles agree with spatial locate
+} -setup {
+	set pts [shapefile sample/xy/point readonly]
+	set polys [shapefile sample/xy/polygon readonly]
+	set points {}
+	foreach point [$pts coordinates read] {
+		lappend points {*}[lindex $point 0]
+	}
+} -body {
+	set expected {}
+	set id 0
+	foreach polygon [$polys spatial locate $points] {
+		if {$polygon != -1} {
+			lappend expected [list $id $polygon]
+		}
+		incr id
+	}
+	list [expr {[shapetcl::spatialjoin $pts $polys -predicate intersects] eq $expected}] \
+			[expr {[shapetcl::spatialjoin $pts $polys -predicate intersects -threads 4] eq $expected}] \
+			[llength $expected]
+} -cleanup {
+	$pts close
+	$polys close
+	unset pts polys points point expected id polygon
+} -result {1 1 210}
+
+::tcltest::cleanupTests
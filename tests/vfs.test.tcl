@@ -0,0 +1,183 @@
+package require Tcl 8.5
+package require tcltest 2
+namespace import ::tcltest::test ::tcltest::makeFile ::tcltest::removeFile
+
+# Use the tests directory as the working directory for all tests.
+::tcltest::workingDirectory [file dirname [info script]]
+
+# Stow any temporary test files in the tmp subdirectory.
+::tcltest::configure -tmpdir tmp
+
+# Apply any additional configuration arguments.
+eval ::tcltest::configure $argv
+
+# Load the extension to test.
+lappend auto_path ..
+package require shapetcl
+namespace import shapetcl::shapefile
+
+::tcltest::testConstraint vfsAvailable [expr {![catch {package require vfs}]}]
+
+#
+# A minimal read-only virtual filesystem that mirrors a real directory, used
+# to read shapefiles through Tcl channels as from a starkit or zip archive.
+#
+
+proc mirror {target subcommand root relative actualpath args} {
+	set path [file join $target $relative]
+	switch -- $subcommand {
+		access {
+			if {![file exists $path] || [lindex $args 0] & 2} {
+				vfs::filesystem posixerror $::vfs::posix(EACCES)
+			}
+		}
+		stat {
+			if {![file exists $path]} {
+				vfs::filesystem posixerror $::vfs::posix(ENOENT)
+			}
+			file stat $path info
+			return [array get info]
+		}
+		matchindirectory {
+			set result {}
+			foreach name [glob -nocomplain -tails -directory $path [lindex $args 0]] {
+				lappend result [file join $actualpath $name]
+			}
+			return $result
+		}
+		open {
+			if {[string match {*[wa+]*} [lindex $args 0]]} {
+				vfs::filesystem posixerror $::vfs::posix(EROFS)
+			}
+			if {![file exists $path]} {
+				vfs::filesystem posixerror $::vfs::posix(ENOENT)
+			}
+			return [list [open $path r]]
+		}
+		default {
+			vfs::filesystem posixerror $::vfs::posix(EROFS)
+		}
+	}
+}
+
+if {[::tcltest::testConstraint vfsAvailable]} {
+	set mount [file normalize tmp/vfs]
+	vfs::filesystem mount $mount [list mirror [file normalize sample/xy]]
+}
+
+#
+# Shapefiles in virtual filesystems
+#
+
+test vfs-1.0 {
+# a shapefile in a virtual filesystem reads the same as on disk
+} -constraints {
+	vfsAvailable
+} -setup {
+	set shp [shapefile sample/xy/arc readonly]
+	set vshp [shapefile $mount/arc readonly]
+} -body {
+	list [expr {[$vshp info count] == [$shp info count]}] \
+			[expr {[$vshp info bounds] eq [$shp info bounds]}] \
+			[expr {[$vshp coord read] eq [$shp coord read]}] \
+			[expr {[$vshp attr read] eq [$shp attr read]}]
+} -cleanup {
+	$vshp close
+	$shp close
+	unset shp vshp
+} -result {1 1 1 1}
+
+test vfs-1.1 {
+# random access to features in a virtual filesystem
+} -constraints {
+	vfsAvailable
+} -setup {
+	set shp [shapefile sample/xy/point readonly]
+	set vshp [shapefile $mount/point readonly]
+} -body {
+	set result {}
+	foreach i {200 3 117 3 242 0} {
+		lappend result [expr {[$vshp coord read $i] eq [$shp coord read $i]}]
+	}
+	set result
+} -cleanup {
+	$vshp close
+	$shp close
+	unset shp vshp result i
+} -result {1 1 1 1 1 1}
+
+test vfs-1.2 {
+# -lazy and -shared open options
+} -constraints {
+	vfsAvailable
+} -body {
+	set lazy [shapefile $mount/polygon readonly -lazy]
+	set shared [shapefile $mount/polygon readonly -shared]
+	list [$lazy file indexed] [expr {[$lazy coord read 5] eq [$shared coord read 5]}] [$lazy file indexed]
+} -cleanup {
+	$lazy close
+	$shared close
+	unset lazy shared
+} -result {0 1 1}
+
+test vfs-1.3 {
+# threaded reads decode in the calling thread
+} -constraints {
+	vfsAvailable
+} -setup {
+	set vshp [shapefile $mount/multipoint readonly]
+} -body {
+	expr {[$vshp coord read -threads 4] eq [$vshp coord read]}
+} -cleanup {
+	$vshp close
+	unset vshp
+} -result 1
+
+test vfs-1.4 {
+# attempt an asynchronous read
+} -constraints {
+	vfsAvailable
+} -setup {
+	set vshp [shapefile $mount/point readonly]
+} -body {
+	$vshp coord read -async -command list
+} -cleanup {
+	$vshp close
+	unset vshp
+} -returnCodes {
+	error
+} -result {asynchronous reads are not supported for shapefiles in virtual filesystems}
+
+test vfs-1.5 {
+# attempt to open a shapefile in a read-only virtual filesystem for writing
+} -constraints {
+	vfsAvailable
+} -body {
+	shapefile $mount/point readwrite
+} -returnCodes {
+	error
+} -match glob -result {failed to open attribute table for "*/point"}
+
+test vfs-1.6 {
+# copy a shapefile out of a virtual filesystem
+} -constraints {
+	vfsAvailable
+} -setup {
+	set vshp [shapefile $mount/point readonly]
+} -body {
+	$vshp save tmp/foo
+	set shp [shapefile tmp/foo readonly]
+	expr {[$shp coord read] eq [$vshp coord read]}
+} -cleanup {
+	$shp close
+	$vshp close
+	file delete {*}[glob tmp/foo.*]
+	unset shp vshp
+} -result 1
+
+if {[::tcltest::testConstraint vfsAvailable]} {
+	vfs::filesystem unmount $mount
+	unset mount
+}
+
+::tcltest::cleanupTests